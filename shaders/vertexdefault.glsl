@@ -15,6 +15,20 @@ uniform mat4 projectionMatrix;
 uniform mat4 MVP;
 uniform mat4 normalMatrix;
 
+// FR
+// Dessin instancié (voir Renderer::addInstance()): chaque instance a sa
+// matrice modèle, sa matrice des normales (calculée par le CPU) et une
+// couleur, lues dans une texture buffer (8 texels par instance, voir
+// InstanceTexels). instanceBase vaut -1 quand l'objet n'est pas instancié.
+
+// EN
+// Instanced drawing (see Renderer::addInstance()): each instance has its
+// own model matrix, normal matrix (computed by the CPU) and color, read from
+// a buffer texture (8 texels per instance, see InstanceTexels). instanceBase
+// is -1 when the object is not instanced.
+uniform samplerBuffer instanceBuffer;
+uniform int instanceBase = -1;
+
 // FR
 // Données en entré (attributs/valeurs par sommet)
 // Le vertex shader est appelé en parallèle par sommet 
@@ -50,8 +64,25 @@ out vec4 varTexCoord;
 // EN: Procedure called for EACH vertex in parallel and processed by the GPU
 void main(void) 
 {
-    varColor = inPosition;
-    varNormal = (normalMatrix * vec4(inNormal,0.0)).xyz;
+    vec3 position = inPosition;
+    vec3 normal = inNormal;
+    vec3 color = vec3(1.0);
+    if (instanceBase >= 0) {
+        int texel = (instanceBase + gl_InstanceID) * 8;
+        mat4 model = mat4(texelFetch(instanceBuffer, texel),
+                          texelFetch(instanceBuffer, texel + 1),
+                          texelFetch(instanceBuffer, texel + 2),
+                          texelFetch(instanceBuffer, texel + 3));
+        mat3 instanceNormalMatrix = mat3(texelFetch(instanceBuffer, texel + 4).xyz,
+                                         texelFetch(instanceBuffer, texel + 5).xyz,
+                                         texelFetch(instanceBuffer, texel + 6).xyz);
+        color = texelFetch(instanceBuffer, texel + 7).rgb;
+        position = (model * vec4(inPosition, 1.0)).xyz;
+        normal = instanceNormalMatrix * inNormal;
+    }
+
+    varColor = inPosition * color;
+    varNormal = (normalMatrix * vec4(normal,0.0)).xyz;
     varTexCoord = inTexCoord;
 
     // FR: gl_Position est une variable "built-in" c-a-d toujours
@@ -59,7 +90,7 @@ void main(void)
 	
 	// EN: gl_Positionis is a "build-in" variable which means 
 	// it is always defined for you by OpenGl.
-    gl_Position = MVP*vec4(inPosition.xyz, 1.0);
+    gl_Position = MVP*vec4(position, 1.0);
     
     // FR: Mieux comprendre le pipeline:
     // Tentez de décommenter les lignes suivantes une à une
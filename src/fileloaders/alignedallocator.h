@@ -0,0 +1,94 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef ALIGNEDALLOCATOR_H
+#define ALIGNEDALLOCATOR_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+// =============================================================================
+namespace Loaders {
+// =============================================================================
+
+/** @ingroup FileLoaders
+ *  Standard allocator returning memory aligned on "Alignment" bytes,
+ *  so that SIMD loops can use aligned loads on std::vector storage.
+ */
+template<class T, std::size_t Alignment>
+class AlignedAllocator {
+public:
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+
+    template<class U>
+    struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() {}
+    template<class U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(std::size_t n)
+    {
+        if (n == 0)
+            return 0;
+        // Room for the alignment and the pointer returned by malloc()
+        void* raw = std::malloc(n * sizeof(T) + Alignment + sizeof(void*));
+        if (!raw)
+            throw std::bad_alloc();
+        std::size_t addr = (std::size_t)raw + sizeof(void*);
+        addr = (addr + Alignment - 1) & ~(Alignment - 1);
+        ((void**)addr)[-1] = raw;
+        return (T*)addr;
+    }
+
+    void deallocate(T* p, std::size_t)
+    {
+        if (p)
+            std::free(((void**)p)[-1]);
+    }
+
+    template<class U>
+    void construct(U* p, const U& value) { new ((void*)p) U(value); }
+    template<class U>
+    void construct(U* p) { new ((void*)p) U(); }
+    template<class U>
+    void destroy(U* p) { p->~U(); }
+
+    std::size_t max_size() const { return std::size_t(-1) / sizeof(T); }
+
+    template<class U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template<class U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+/// std::vector with its storage aligned on "Alignment" bytes
+template<class T, std::size_t Alignment = 32>
+struct AlignedVector {
+    typedef std::vector<T, AlignedAllocator<T, Alignment> > type;
+};
+
+} // end namespace loaders =====================================================
+
+#endif // ALIGNEDALLOCATOR_H
@@ -0,0 +1,122 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "mappedfile.h"
+
+#include <fstream>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define MAPPEDFILE_USE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Loaders {
+
+MappedFile::MappedFile()
+    : mData(0)
+    , mSize(0)
+    , mOpen(false)
+    , mMapped(false)
+{
+}
+
+// -----------------------------------------------------------------------------
+
+MappedFile::MappedFile(const std::string& filename)
+    : mData(0)
+    , mSize(0)
+    , mOpen(false)
+    , mMapped(false)
+{
+    open(filename);
+}
+
+// -----------------------------------------------------------------------------
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+// -----------------------------------------------------------------------------
+
+bool MappedFile::open(const std::string& filename)
+{
+    close();
+#ifdef MAPPEDFILE_USE_MMAP
+    int fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    mSize = (std::size_t)st.st_size;
+    if (mSize > 0) {
+        void* ptr = mmap(0, mSize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (ptr == MAP_FAILED) {
+            ::close(fd);
+            mSize = 0;
+            return false;
+        }
+        // We scan the file once from front to back:
+        madvise(ptr, mSize, MADV_SEQUENTIAL);
+        mData = (const char*)ptr;
+        mMapped = true;
+    }
+    // The mapping stays valid once the descriptor is closed
+    ::close(fd);
+#else
+    std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
+    if (!file)
+        return false;
+    file.seekg(0, std::ios::end);
+    mSize = (std::size_t)file.tellg();
+    file.seekg(0, std::ios::beg);
+    mCopy.resize(mSize);
+    if (mSize > 0 && !file.read(&mCopy[0], mSize)) {
+        mCopy.clear();
+        mSize = 0;
+        return false;
+    }
+    mData = mSize > 0 ? &mCopy[0] : 0;
+#endif
+    mOpen = true;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+void MappedFile::close()
+{
+#ifdef MAPPEDFILE_USE_MMAP
+    if (mMapped)
+        munmap((void*)mData, mSize);
+#endif
+    std::vector<char>().swap(mCopy);
+    mData = 0;
+    mSize = 0;
+    mOpen = false;
+    mMapped = false;
+}
+
+} // end namespace loaders
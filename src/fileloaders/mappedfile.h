@@ -0,0 +1,66 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// =============================================================================
+namespace Loaders {
+// =============================================================================
+
+/** @ingroup FileLoaders
+ *  Read-only view of a whole file mapped in memory.
+ *  On POSIX systems the file is mmap'ed so that parsers can scan it in place
+ *  without copying it line by line. Elsewhere the file is read once into a
+ *  private buffer. The mapping lives until #close() or destruction.
+ */
+class MappedFile {
+public:
+    MappedFile();
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+
+    /// Map "filename", closing any previously mapped file.
+    /// @return false if the file can't be opened or mapped.
+    bool open(const std::string& filename);
+    void close();
+
+    bool isOpen() const { return mOpen; }
+    /// First byte of the file (not null terminated, may be null if empty)
+    const char* data() const { return mData; }
+    std::size_t size() const { return mSize; }
+    const char* begin() const { return mData; }
+    const char* end() const { return mData + mSize; }
+
+private:
+    // non copyable
+    MappedFile(const MappedFile&);
+    MappedFile& operator=(const MappedFile&);
+
+    const char* mData;
+    std::size_t mSize;
+    bool mOpen;
+    bool mMapped;            ///< true if mData comes from mmap()
+    std::vector<char> mCopy; ///< fallback storage when mmap() is unavailable
+};
+
+} // end namespace loaders =====================================================
+
+#endif // MAPPEDFILE_H
@@ -19,82 +19,205 @@
  ***************************************************************************/
 #include "mesh.h"
 #include "utils.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <iostream>
+#include <thread>
+#include <utility>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define MESH_USE_SSE
+#include <xmmintrin.h>
+#endif
 
 namespace Loaders {
 using namespace Utils;
-Mesh::Mesh (): mNbVertices(0), mNbTriangles(0), mHasTextureCoords (true), mHasNormal (true) {
-
-}
-
-Mesh::Mesh (const std::vector<float> &vertexBuffer, const std::vector<int> &triangleBuffer, const std::vector<int> &quadBuffer, bool hasNormal, bool hasTextureCoords) : mHasTextureCoords (hasTextureCoords), mHasNormal (hasNormal) {
-    // Construction de la liste des sommets et BBox
-    mNbVertices = 0;
-    std::vector<float>::const_iterator it = vertexBuffer.begin();
-    while (it != vertexBuffer.end()) {
-        float x = *it; ++it;
-        float y = *it; ++it;
-        float z = *it; ++it;
-                Vertex v (glm::vec3(x, y, z));
-        if (hasNormal) {
-            float nx = *it; ++it;
-            float ny = *it; ++it;
-            float nz = *it; ++it;
-                        v.normal = glm::vec3 (nx, ny, nz);
-                        glm::normalize(v.normal);
-        }
-        if (hasTextureCoords) {
-            v.texcoord[0] = *it; ++it;
-                        v.texcoord[1] = *it; ++it;
-        }
-        mVertices.push_back (v);
-        ++mNbVertices;
-    }
-
-    // construction liste des faces triangulaires
-    std::vector<int>::const_iterator fit = triangleBuffer.begin();
-    mNbTriangles = 0;
-    while (fit != triangleBuffer.end()) {
-        int index1 = *fit; ++fit;
-        assert (index1 < mNbVertices);
-        int index2 = *fit; ++fit;
-        assert (index2 < mNbVertices);
-        int index3 = *fit; ++fit;
-        assert (index3 < mNbVertices);
-        ++mNbTriangles;
-        TriangleIndex f (index1, index2, index3);
-        mTriangles.push_back (f);
-    }
-
-        //   construction liste des faces quads
-    std::vector<int>::const_iterator fiq = quadBuffer.begin();
-    while (fiq != quadBuffer.end()) {
-        int index1 = *fiq; ++fiq;
-        assert (index1 < mNbVertices);
-        int index2 = *fiq; ++fiq;
-        assert (index2 < mNbVertices);
-        int index3 = *fiq; ++fiq;
-        assert (index3 < mNbVertices);
-        int index4 = *fiq; ++fiq;
-        assert (index4 < mNbVertices);
-
-                ++mNbTriangles;
-                TriangleIndex f1 (index1, index2, index3);
-                mTriangles.push_back (f1);
-
-                ++mNbTriangles;
-                TriangleIndex f2 (index1, index3, index4);
-                mTriangles.push_back (f2);
 
+namespace {
+
+/// Below this number of elements a pass is not worth a thread
+const std::size_t PARALLEL_GRAIN = 1 << 14;
+
+/// Call f(begin, end) on contiguous slices of [0, n), one per core
+template<class F>
+void parallelFor (std::size_t n, F f) {
+    std::size_t nbThreads = std::max (1u, std::thread::hardware_concurrency());
+    nbThreads = std::min (nbThreads, (n + PARALLEL_GRAIN - 1) / PARALLEL_GRAIN);
+    if (nbThreads <= 1) {
+        f (std::size_t(0), n);
+        return;
+    }
+    std::vector<std::thread> threads;
+    const std::size_t slice = (n + nbThreads - 1) / nbThreads;
+    for (std::size_t t = 1; t < nbThreads; ++t) {
+        std::size_t begin = std::min (n, t * slice);
+        std::size_t end = std::min (n, begin + slice);
+        threads.push_back (std::thread (f, begin, end));
+    }
+    f (std::size_t(0), std::min (n, slice));
+    for (std::size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+}
+
+#ifdef MESH_USE_SSE
+inline __m128 load3 (const glm::vec3& v) {
+    return _mm_setr_ps (v.x, v.y, v.z, 0.f);
+}
+
+inline __m128 cross (__m128 a, __m128 b) {
+    __m128 a_yzx = _mm_shuffle_ps (a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_yzx = _mm_shuffle_ps (b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps (_mm_mul_ps (a, b_yzx), _mm_mul_ps (a_yzx, b));
+    return _mm_shuffle_ps (c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+/// Dot product of the 3 first components broadcasted in every component
+inline __m128 dot3 (__m128 a, __m128 b) {
+    __m128 m = _mm_mul_ps (a, b);
+    __m128 y = _mm_shuffle_ps (m, m, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 z = _mm_shuffle_ps (m, m, _MM_SHUFFLE(2, 2, 2, 2));
+    __m128 d = _mm_add_ss (_mm_add_ss (m, y), z);
+    return _mm_shuffle_ps (d, d, _MM_SHUFFLE(0, 0, 0, 0));
+}
+#endif
+
+/// Write the unit normal of (p0, p1, p2) in n[0..3] (n[3] = 0)
+/// @return twice the area of the triangle
+inline float faceNormal (const glm::vec3& p0, const glm::vec3& p1, const glm::vec3& p2, float* n) {
+#ifdef MESH_USE_SSE
+    __m128 a = load3 (p0);
+    __m128 c = cross (_mm_sub_ps (load3 (p1), a), _mm_sub_ps (load3 (p2), a));
+    __m128 len = _mm_sqrt_ps (dot3 (c, c));
+    __m128 valid = _mm_cmpgt_ps (len, _mm_setzero_ps());
+    _mm_storeu_ps (n, _mm_and_ps (_mm_div_ps (c, len), valid));
+    return _mm_cvtss_f32 (len);
+#else
+    glm::vec3 c = glm::cross (p1 - p0, p2 - p0);
+    float len = glm::length (c);
+    glm::vec3 u = len > 0.f ? c / len : glm::vec3 (0.f);
+    n[0] = u.x; n[1] = u.y; n[2] = u.z; n[3] = 0.f;
+    return len;
+#endif
+}
+
+/// Weighted sum of the normals of the faces owning [first, last) corners, normalized
+inline void gatherNormal (const float* faceNormals, const float* cornerWeights,
+                          const unsigned int* first, const unsigned int* last,
+                          glm::vec3& normal) {
+#ifdef MESH_USE_SSE
+    __m128 sum = _mm_setzero_ps();
+    for (const unsigned int* c = first; c != last; ++c) {
+        __m128 n = _mm_loadu_ps (faceNormals + 4 * (*c / 3));
+        sum = _mm_add_ps (sum, _mm_mul_ps (n, _mm_set1_ps (cornerWeights[*c])));
+    }
+    __m128 len = _mm_sqrt_ps (dot3 (sum, sum));
+    __m128 valid = _mm_cmpgt_ps (len, _mm_setzero_ps());
+    float out[4];
+    _mm_storeu_ps (out, _mm_and_ps (_mm_div_ps (sum, len), valid));
+    normal = glm::vec3 (out[0], out[1], out[2]);
+#else
+    glm::vec3 sum (0.f);
+    for (const unsigned int* c = first; c != last; ++c) {
+        const float* n = faceNormals + 4 * (*c / 3);
+        sum += cornerWeights[*c] * glm::vec3 (n[0], n[1], n[2]);
     }
+    float len = glm::length (sum);
+    normal = len > 0.f ? sum / len : glm::vec3 (0.f);
+#endif
+}
+
+} // end anonymous namespace
+
+Mesh::Mesh (): mNbVertices(0), mNbTriangles(0), mHasTextureCoords (true), mHasNormal (true), mLayout (INTERLEAVED) {
+
+}
+
+Mesh::Mesh (const std::vector<float> &vertexBuffer, const std::vector<int> &triangleBuffer, const std::vector<int> &quadBuffer, bool hasNormal, bool hasTextureCoords) : mHasTextureCoords (hasTextureCoords), mHasNormal (hasNormal), mLayout (INTERLEAVED) {
+    setVertices (vertexBuffer);
+    setFaces (triangleBuffer, quadBuffer);
 
     if (!hasNormal){
                 computeNormals();
-                hasNormal = true;
+                mHasNormal = true;
         }
 
 }
 
+Mesh::Mesh (std::vector<float> &&vertexBuffer, std::vector<int> &&triangleBuffer, std::vector<int> &&quadBuffer, bool hasNormal, bool hasTextureCoords) : mHasTextureCoords (hasTextureCoords), mHasNormal (hasNormal), mLayout (INTERLEAVED) {
+    // Les buffers sont liberes des qu'ils ne servent plus
+    {
+        std::vector<float> vertices (std::move(vertexBuffer));
+        setVertices (vertices);
+    }
+    {
+        std::vector<int> triangles (std::move(triangleBuffer));
+        std::vector<int> quads (std::move(quadBuffer));
+        setFaces (triangles, quads);
+    }
+
+    if (!hasNormal){
+                computeNormals();
+                mHasNormal = true;
+        }
+
+}
+
+void Mesh::setVertices (const std::vector<float> &vertexBuffer) {
+    // Construction de la liste des sommets
+    const std::size_t stride = 3 + (mHasNormal ? 3 : 0) + (mHasTextureCoords ? 2 : 0);
+    const std::size_t nbVertices = vertexBuffer.size() / stride;
+    mVertices.clear();
+    mVertices.resize (nbVertices);
+    mNbVertices = (int)nbVertices;
+    if (nbVertices == 0)
+        return;
+
+    if (stride == 8) {
+        // meme disposition que Vertex : copie directe
+        static_assert(sizeof(Vertex) == 8 * sizeof(float), "Vertex must be 8 packed floats");
+        std::memcpy ((void*)&mVertices[0], &vertexBuffer[0], nbVertices * sizeof(Vertex));
+        return;
+    }
+
+    const float* it = &vertexBuffer[0];
+    for (std::size_t i = 0; i < nbVertices; ++i) {
+        Vertex& v = mVertices[i];
+        v.position = glm::vec3 (it[0], it[1], it[2]);
+        it += 3;
+        if (mHasNormal) {
+            v.normal = glm::vec3 (it[0], it[1], it[2]);
+            it += 3;
+        }
+        if (mHasTextureCoords) {
+            v.texcoord = glm::vec2 (it[0], it[1]);
+            it += 2;
+        }
+    }
+}
+
+void Mesh::setFaces (const std::vector<int> &triangleBuffer, const std::vector<int> &quadBuffer) {
+    // construction liste des faces triangulaires puis des quads
+    const std::size_t nbTriangles = triangleBuffer.size() / 3;
+    const std::size_t nbQuads = quadBuffer.size() / 4;
+    mTriangles.clear();
+    mTriangles.reserve (nbTriangles + 2 * nbQuads);
+
+    for (std::size_t i = 0; i < nbTriangles; ++i) {
+        const int* ids = &triangleBuffer[3 * i];
+        assert (ids[0] < mNbVertices && ids[1] < mNbVertices && ids[2] < mNbVertices);
+        mTriangles.push_back (TriangleIndex (ids));
+    }
+
+    for (std::size_t i = 0; i < nbQuads; ++i) {
+        const int* ids = &quadBuffer[4 * i];
+        assert (ids[0] < mNbVertices && ids[1] < mNbVertices && ids[2] < mNbVertices && ids[3] < mNbVertices);
+        mTriangles.push_back (TriangleIndex (ids[0], ids[1], ids[2]));
+        mTriangles.push_back (TriangleIndex (ids[0], ids[2], ids[3]));
+    }
+    mNbTriangles = (int)mTriangles.size();
+}
+
 Mesh::Mesh(const Mesh &mesh)
 {
     mVertices = mesh.mVertices;
@@ -103,6 +226,62 @@ Mesh::Mesh(const Mesh &mesh)
     mNbTriangles = mesh.mNbTriangles;
     mHasTextureCoords = mesh.mHasTextureCoords;
     mHasNormal = mesh.mHasNormal;
+    mStreams = mesh.mStreams;
+    mLayout = mesh.mLayout;
+    mBvh = mesh.mBvh;
+}
+
+Mesh::Mesh(Mesh &&mesh) :
+    mVertices (std::move(mesh.mVertices)),
+    mNbVertices (mesh.mNbVertices),
+    mTriangles (std::move(mesh.mTriangles)),
+    mNbTriangles (mesh.mNbTriangles),
+    mHasTextureCoords (mesh.mHasTextureCoords),
+    mHasNormal (mesh.mHasNormal),
+    mStreams (std::move(mesh.mStreams)),
+    mLayout (mesh.mLayout),
+    mBvh (std::move(mesh.mBvh))
+{
+    mesh.mVertices.clear();
+    mesh.mStreams.clear();
+    mesh.mTriangles.clear();
+    mesh.mNbVertices = 0;
+    mesh.mNbTriangles = 0;
+}
+
+Mesh & Mesh::operator=(const Mesh &mesh)
+{
+    mVertices = mesh.mVertices;
+    mTriangles = mesh.mTriangles;
+    mNbVertices = mesh.mNbVertices;
+    mNbTriangles = mesh.mNbTriangles;
+    mHasTextureCoords = mesh.mHasTextureCoords;
+    mHasNormal = mesh.mHasNormal;
+    mStreams = mesh.mStreams;
+    mLayout = mesh.mLayout;
+    mBvh = mesh.mBvh;
+    return *this;
+}
+
+Mesh & Mesh::operator=(Mesh &&mesh)
+{
+    if (this != &mesh) {
+        mVertices = std::move(mesh.mVertices);
+        mTriangles = std::move(mesh.mTriangles);
+        mNbVertices = mesh.mNbVertices;
+        mNbTriangles = mesh.mNbTriangles;
+        mHasTextureCoords = mesh.mHasTextureCoords;
+        mHasNormal = mesh.mHasNormal;
+        mStreams = std::move(mesh.mStreams);
+        mLayout = mesh.mLayout;
+        mBvh = std::move(mesh.mBvh);
+        mesh.mVertices.clear();
+        mesh.mStreams.clear();
+        mesh.mTriangles.clear();
+        mesh.mNbVertices = 0;
+        mesh.mNbTriangles = 0;
+    }
+    return *this;
 }
 
 Mesh::~Mesh() {
@@ -117,67 +296,472 @@ void Mesh::printfInfo() const {
                   << std::endl;
 }
 
-void Mesh::computeNormals (void) {
-    for (TriangleIndexArray::iterator f_iter = mTriangles.begin() ; f_iter != mTriangles.end() ; ++f_iter) {
-        Vertex& v0 = mVertices[f_iter->indexes[0]];
-        Vertex& v1 = mVertices[f_iter->indexes[1]];
-        Vertex& v2 = mVertices[f_iter->indexes[2]];
-                glm::vec3 p0, p1, p2;
-        p0 = v0.position;
-        p1 = v1.position;
-        p2 = v2.position;
+void Mesh::computeNormals (NormalWeighting weighting) {
+    const std::size_t nbVertices = mNbVertices;
+    const std::size_t nbFaces = mTriangles.size();
 
-                // compute normals
-                glm::vec3 f_normal;
-                f_normal = glm::cross((p1 - p0), (p2 - p0));
-                glm::normalize(f_normal);
-        v0.normal += f_normal;
-        v1.normal += f_normal;
-        v2.normal += f_normal;
-    }
-    for (VertexArray::iterator v_iter = mVertices.begin() ; v_iter != mVertices.end() ; ++v_iter) {
-                glm::normalize(v_iter->normal);
+    // Adjacence sommet -> coins de faces (coin = 3 * face + k), format CSR
+    std::vector<unsigned int> firstCorner (nbVertices + 1, 0);
+    for (std::size_t f = 0; f < nbFaces; ++f)
+        for (int k = 0; k < 3; ++k)
+            ++firstCorner[mTriangles[f].indexes[k] + 1];
+    for (std::size_t v = 0; v < nbVertices; ++v)
+        firstCorner[v + 1] += firstCorner[v];
+    std::vector<unsigned int> corners (3 * nbFaces);
+    {
+        std::vector<unsigned int> fill (firstCorner.begin(), firstCorner.end() - 1);
+        for (std::size_t f = 0; f < nbFaces; ++f)
+            for (int k = 0; k < 3; ++k)
+                corners[fill[mTriangles[f].indexes[k]]++] = (unsigned int)(3 * f + k);
     }
+
+    // Normales unitaires des faces (x,y,z,0) et poids de chaque coin
+    std::vector<float> faceNormals (4 * nbFaces);
+    std::vector<float> cornerWeights (3 * nbFaces);
+    parallelFor (nbFaces, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t f = begin; f < end; ++f) {
+            const TriangleIndex& t = mTriangles[f];
+            float area2 = faceNormal (position (t.indexes[0]),
+                                      position (t.indexes[1]),
+                                      position (t.indexes[2]),
+                                      &faceNormals[4 * f]);
+            float* w = &cornerWeights[3 * f];
+            switch (weighting) {
+            case UNIFORM_WEIGHTS:
+                w[0] = w[1] = w[2] = area2 > 0.f ? 1.f : 0.f;
+                break;
+            case AREA_WEIGHTS:
+                w[0] = w[1] = w[2] = area2;
+                break;
+            case ANGLE_WEIGHTS:
+                for (int k = 0; k < 3; ++k) {
+                    glm::vec3 p = position (t.indexes[k]);
+                    glm::vec3 e1 = position (t.indexes[(k + 1) % 3]) - p;
+                    glm::vec3 e2 = position (t.indexes[(k + 2) % 3]) - p;
+                    float l = glm::length (e1) * glm::length (e2);
+                    w[k] = (l > 0.f && area2 > 0.f) ? std::acos (glm::clamp (glm::dot (e1, e2) / l, -1.f, 1.f)) : 0.f;
+                }
+                break;
+            }
+        }
+    });
+
+    // Chaque sommet rassemble les normales de ses faces
+    parallelFor (nbVertices, [&](std::size_t begin, std::size_t end) {
+        for (std::size_t v = begin; v < end; ++v) {
+            glm::vec3 n;
+            gatherNormal (&faceNormals[0], &cornerWeights[0],
+                          &corners[0] + firstCorner[v], &corners[0] + firstCorner[v + 1],
+                          n);
+            setNormal (v, n);
+        }
+    });
 }
 
 void Mesh::getData ( std::vector<float> &vertexBuffer, std::vector<int> &triangleBuffer, bool &parametrized ){
     parametrized = true;
 
-    for (VertexArray::iterator v_iter = mVertices.begin() ; v_iter != mVertices.end() ; ++v_iter) {
-        vertexBuffer.push_back(v_iter->position[0]);
-        vertexBuffer.push_back(v_iter->position[1]);
-        vertexBuffer.push_back(v_iter->position[2]);
-        vertexBuffer.push_back(v_iter->normal[0]);
-        vertexBuffer.push_back(v_iter->normal[1]);
-        vertexBuffer.push_back(v_iter->normal[2]);
-        if (mHasTextureCoords){
-            vertexBuffer.push_back(v_iter->texcoord[0]);
-            vertexBuffer.push_back(v_iter->texcoord[1]);
+    const std::size_t firstFloat = vertexBuffer.size();
+    vertexBuffer.resize (firstFloat + 8 * (std::size_t)mNbVertices);
+    if (mLayout == SEPARATE_STREAMS) {
+        // entrelacement des flux pour le GPU
+        const VertexStreams& s = mStreams;
+        const VertexStreams::Stream& u = mHasTextureCoords ? s.u : s.x;
+        const VertexStreams::Stream& v = mHasTextureCoords ? s.v : s.y;
+        float* out = vertexBuffer.data() + firstFloat;
+        for (std::size_t i = 0; i < s.size(); ++i, out += 8) {
+            out[0] = s.x[i];
+            out[1] = s.y[i];
+            out[2] = s.z[i];
+            out[3] = s.nx[i];
+            out[4] = s.ny[i];
+            out[5] = s.nz[i];
+            out[6] = u[i];
+            out[7] = v[i];
+        }
+    } else if (!mVertices.empty()) {
+        float* out = vertexBuffer.data() + firstFloat;
+        if (mHasTextureCoords) {
+            std::memcpy (out, &mVertices[0], mVertices.size() * sizeof(Vertex));
         } else {
-            vertexBuffer.push_back(v_iter->position[0]);
-            vertexBuffer.push_back(v_iter->position[1]);
+            // pas de coordonnees de texture : on met (x, y) a la place
+            for (VertexArray::const_iterator v_iter = mVertices.begin() ; v_iter != mVertices.end() ; ++v_iter, out += 8) {
+                out[0] = v_iter->position[0];
+                out[1] = v_iter->position[1];
+                out[2] = v_iter->position[2];
+                out[3] = v_iter->normal[0];
+                out[4] = v_iter->normal[1];
+                out[5] = v_iter->normal[2];
+                out[6] = v_iter->position[0];
+                out[7] = v_iter->position[1];
+            }
         }
     }
-    for (TriangleIndexArray::iterator f_iter = mTriangles.begin() ; f_iter != mTriangles.end() ; ++f_iter) {
-        triangleBuffer.push_back(f_iter->indexes[0]);
-        triangleBuffer.push_back(f_iter->indexes[1]);
-        triangleBuffer.push_back(f_iter->indexes[2]);
+
+    const std::size_t firstIndex = triangleBuffer.size();
+    triangleBuffer.resize (firstIndex + 3 * mTriangles.size());
+    if (!mTriangles.empty()) {
+        static_assert(sizeof(TriangleIndex) == 3 * sizeof(int), "TriangleIndex must be 3 packed indices");
+        std::memcpy (&triangleBuffer[firstIndex], &mTriangles[0], mTriangles.size() * sizeof(TriangleIndex));
     }
 }
 
 Mesh & Mesh::operator+=(const Mesh &m){
-    for (VertexArray::const_iterator v_iter = m.mVertices.begin() ; v_iter != m.mVertices.end() ; ++v_iter) {
-        mVertices.push_back(*v_iter);
+    mBvh.reset();
+    if (mLayout == INTERLEAVED) {
+        if (m.mLayout == INTERLEAVED) {
+            mVertices.insert (mVertices.end(), m.mVertices.begin(), m.mVertices.end());
+        } else {
+            for (std::size_t i = 0; i < m.mStreams.size(); ++i)
+                mVertices.push_back (m.mStreams.get (i));
+        }
+    } else {
+        if (m.mLayout == SEPARATE_STREAMS) {
+            mStreams.append (m.mStreams);
+        } else {
+            for (VertexArray::const_iterator v_iter = m.mVertices.begin() ; v_iter != m.mVertices.end() ; ++v_iter)
+                mStreams.push_back (*v_iter);
+        }
     }
-    for (TriangleIndexArray::const_iterator f_iter = m.mTriangles.begin() ; f_iter != m.mTriangles.end() ; ++f_iter) {
-        TriangleIndex f (f_iter->indexes[0]+mNbVertices,
-                         f_iter->indexes[1]+mNbVertices,
-                         f_iter->indexes[2]+mNbVertices);
-        mTriangles.push_back(f);
+    const std::size_t first = mTriangles.size();
+    mTriangles.insert (mTriangles.end(), m.mTriangles.begin(), m.mTriangles.end());
+    for (TriangleIndexArray::iterator f_iter = mTriangles.begin() + first ; f_iter != mTriangles.end() ; ++f_iter) {
+        f_iter->indexes[0] += mNbVertices;
+        f_iter->indexes[1] += mNbVertices;
+        f_iter->indexes[2] += mNbVertices;
     }
     mNbVertices+=m.mNbVertices;
     mNbTriangles+=m.mNbTriangles;
     return *this;
 }
 
+Mesh & Mesh::operator+=(Mesh &&m){
+    mBvh.reset();
+    if (mLayout == m.mLayout && mVertices.capacity() == 0 && mStreams.x.capacity() == 0 && mTriangles.capacity() == 0) {
+        mVertices = std::move(m.mVertices);
+        mStreams = std::move(m.mStreams);
+        mTriangles = std::move(m.mTriangles);
+        mNbVertices = m.mNbVertices;
+        mNbTriangles = m.mNbTriangles;
+    } else {
+        *this += m;
+        VertexArray().swap(m.mVertices);
+        m.mStreams.clear();
+        TriangleIndexArray().swap(m.mTriangles);
+    }
+    m.mVertices.clear();
+    m.mStreams.clear();
+    m.mTriangles.clear();
+    m.mNbVertices = 0;
+    m.mNbTriangles = 0;
+    return *this;
+}
+
+void Mesh::reserve (int nbVertices, int nbTriangles) {
+    if (mLayout == INTERLEAVED)
+        mVertices.reserve (nbVertices);
+    else
+        mStreams.reserve (nbVertices);
+    mTriangles.reserve (nbTriangles);
+}
+
+void Mesh::setNormal (std::size_t i, const glm::vec3& n) {
+    if (mLayout == INTERLEAVED) {
+        mVertices[i].normal = n;
+    } else {
+        mStreams.nx[i] = n.x;
+        mStreams.ny[i] = n.y;
+        mStreams.nz[i] = n.z;
+    }
+}
+
+void Mesh::setVertexLayout (VertexLayout layout) {
+    if (layout == mLayout)
+        return;
+    if (layout == SEPARATE_STREAMS) {
+        mStreams.resize (mVertices.size());
+        for (std::size_t i = 0; i < mVertices.size(); ++i) {
+            const Vertex& v = mVertices[i];
+            mStreams.x[i] = v.position.x;
+            mStreams.y[i] = v.position.y;
+            mStreams.z[i] = v.position.z;
+            mStreams.nx[i] = v.normal.x;
+            mStreams.ny[i] = v.normal.y;
+            mStreams.nz[i] = v.normal.z;
+            mStreams.u[i] = v.texcoord.x;
+            mStreams.v[i] = v.texcoord.y;
+        }
+        VertexArray().swap (mVertices);
+    } else {
+        mVertices.resize (mStreams.size());
+        for (std::size_t i = 0; i < mVertices.size(); ++i)
+            mVertices[i] = mStreams.get (i);
+        mStreams.clear();
+    }
+    mLayout = layout;
+}
+
+void Mesh::boundingBox (glm::vec3& bmin, glm::vec3& bmax) const {
+    bmin = bmax = glm::vec3 (0.f);
+    if (mNbVertices == 0)
+        return;
+
+    if (mLayout == INTERLEAVED) {
+        bmin = bmax = mVertices[0].position;
+        for (VertexArray::const_iterator v_iter = mVertices.begin() ; v_iter != mVertices.end() ; ++v_iter) {
+            bmin = glm::min (bmin, v_iter->position);
+            bmax = glm::max (bmax, v_iter->position);
+        }
+        return;
+    }
+
+    // un min/max par flux, 4 sommets a la fois
+    const std::size_t n = mStreams.size();
+    const float* comp[3] = { &mStreams.x[0], &mStreams.y[0], &mStreams.z[0] };
+    for (int c = 0; c < 3; ++c) {
+        const float* p = comp[c];
+        float lo = p[0], hi = p[0];
+        std::size_t i = 0;
+#ifdef MESH_USE_SSE
+        if (n >= 4) {
+            __m128 vlo = _mm_load_ps (p), vhi = vlo;
+            for (i = 4; i + 4 <= n; i += 4) {
+                __m128 x = _mm_load_ps (p + i);
+                vlo = _mm_min_ps (vlo, x);
+                vhi = _mm_max_ps (vhi, x);
+            }
+            float l[4], h[4];
+            _mm_storeu_ps (l, vlo);
+            _mm_storeu_ps (h, vhi);
+            for (int k = 0; k < 4; ++k) {
+                lo = std::min (lo, l[k]);
+                hi = std::max (hi, h[k]);
+            }
+        }
+#endif
+        for (; i < n; ++i) {
+            lo = std::min (lo, p[i]);
+            hi = std::max (hi, p[i]);
+        }
+        bmin[c] = lo;
+        bmax[c] = hi;
+    }
+}
+
+void Mesh::boundingSphere (glm::vec3& center, float& radius) const {
+    glm::vec3 bmin, bmax;
+    boundingBox (bmin, bmax);
+    center = (bmin + bmax) * 0.5f;
+    float radius2 = 0.f;
+    for (int i = 0; i < mNbVertices; ++i) {
+        glm::vec3 d = position (i) - center;
+        radius2 = std::max (radius2, glm::dot (d, d));
+    }
+    radius = std::sqrt (radius2);
+}
+
+void Mesh::transform (const glm::mat4& m) {
+    mBvh.reset();
+    const glm::mat3 nm = glm::transpose (glm::inverse (glm::mat3 (m)));
+
+    if (mLayout == INTERLEAVED) {
+        for (VertexArray::iterator v_iter = mVertices.begin() ; v_iter != mVertices.end() ; ++v_iter) {
+            v_iter->position = glm::vec3 (m * glm::vec4 (v_iter->position, 1.f));
+            glm::vec3 n = nm * v_iter->normal;
+            float l = glm::length (n);
+            v_iter->normal = l > 0.f ? n / l : n;
+        }
+        return;
+    }
+
+    // Flux separes : boucles sans dependance, sur 4 sommets a la fois
+    const std::size_t n = mStreams.size();
+    float* x = n ? &mStreams.x[0] : 0;
+    float* y = n ? &mStreams.y[0] : 0;
+    float* z = n ? &mStreams.z[0] : 0;
+    float* nx = n ? &mStreams.nx[0] : 0;
+    float* ny = n ? &mStreams.ny[0] : 0;
+    float* nz = n ? &mStreams.nz[0] : 0;
+    std::size_t i = 0;
+#ifdef MESH_USE_SSE
+    __m128 mc[4][3], nc[3][3];
+    for (int c = 0; c < 4; ++c)
+        for (int r = 0; r < 3; ++r)
+            mc[c][r] = _mm_set1_ps (m[c][r]);
+    for (int c = 0; c < 3; ++c)
+        for (int r = 0; r < 3; ++r)
+            nc[c][r] = _mm_set1_ps (nm[c][r]);
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4) {
+        __m128 px = _mm_load_ps (x + i), py = _mm_load_ps (y + i), pz = _mm_load_ps (z + i);
+        __m128 r[3];
+        for (int k = 0; k < 3; ++k)
+            r[k] = _mm_add_ps (_mm_add_ps (_mm_mul_ps (mc[0][k], px), _mm_mul_ps (mc[1][k], py)),
+                               _mm_add_ps (_mm_mul_ps (mc[2][k], pz), mc[3][k]));
+        _mm_store_ps (x + i, r[0]);
+        _mm_store_ps (y + i, r[1]);
+        _mm_store_ps (z + i, r[2]);
+
+        __m128 qx = _mm_load_ps (nx + i), qy = _mm_load_ps (ny + i), qz = _mm_load_ps (nz + i);
+        for (int k = 0; k < 3; ++k)
+            r[k] = _mm_add_ps (_mm_add_ps (_mm_mul_ps (nc[0][k], qx), _mm_mul_ps (nc[1][k], qy)),
+                               _mm_mul_ps (nc[2][k], qz));
+        __m128 len = _mm_sqrt_ps (_mm_add_ps (_mm_add_ps (_mm_mul_ps (r[0], r[0]), _mm_mul_ps (r[1], r[1])),
+                                              _mm_mul_ps (r[2], r[2])));
+        __m128 valid = _mm_cmpgt_ps (len, zero);
+        // longueur nulle : on garde la normale nulle
+        __m128 inv = _mm_and_ps (_mm_div_ps (_mm_set1_ps (1.f), len), valid);
+        __m128 keep = _mm_andnot_ps (valid, _mm_set1_ps (1.f));
+        inv = _mm_or_ps (inv, keep);
+        _mm_store_ps (nx + i, _mm_mul_ps (r[0], inv));
+        _mm_store_ps (ny + i, _mm_mul_ps (r[1], inv));
+        _mm_store_ps (nz + i, _mm_mul_ps (r[2], inv));
+    }
+#endif
+    for (; i < n; ++i) {
+        glm::vec3 p = glm::vec3 (m * glm::vec4 (x[i], y[i], z[i], 1.f));
+        x[i] = p.x; y[i] = p.y; z[i] = p.z;
+        glm::vec3 q = nm * glm::vec3 (nx[i], ny[i], nz[i]);
+        float l = glm::length (q);
+        if (l > 0.f)
+            q /= l;
+        nx[i] = q.x; ny[i] = q.y; nz[i] = q.z;
+    }
+}
+
+void Mesh::buildBvh () {
+    mBvh = std::make_shared<TriangleBvh> (*this);
+}
+
+bool Mesh::intersect (const Ray& ray, RayHit& hit) const {
+    if (mBvh)
+        return mBvh->intersect (ray, hit);
+
+    // pas de hierarchie : tous les triangles sont testes
+    hit = RayHit();
+    for (std::size_t t = 0; t < mTriangles.size(); ++t) {
+        const unsigned int* tri = mTriangles[t].indexes;
+        const glm::vec3 p0 = position (tri[0]);
+        const glm::vec3 e1 = position (tri[1]) - p0;
+        const glm::vec3 e2 = position (tri[2]) - p0;
+        const glm::vec3 p = glm::cross (ray.direction, e2);
+        const float det = glm::dot (e1, p);
+        if (std::fabs (det) < 1e-20f)
+            continue;
+        const glm::vec3 s = ray.origin - p0;
+        const float u = glm::dot (s, p) / det;
+        const glm::vec3 q = glm::cross (s, e1);
+        const float v = glm::dot (ray.direction, q) / det;
+        const float d = glm::dot (e2, q) / det;
+        if (u < 0.f || u > 1.f || v < 0.f || u + v > 1.f || d < 0.f || (hit.triangle >= 0 && d >= hit.distance))
+            continue;
+        hit.triangle = (int)t;
+        hit.distance = d;
+        hit.u = u;
+        hit.v = v;
+        const float w = 1.f - u - v;
+        hit.vertex = (int)(w >= u && w >= v ? tri[0] : (u >= v ? tri[1] : tri[2]));
+    }
+    return hit.triangle >= 0;
+}
+
+void Mesh::intersect (const std::vector<Ray>& rays, std::vector<RayHit>& hits) const {
+    hits.resize (rays.size());
+    if (rays.empty())
+        return;
+    if (mBvh) {
+        mBvh->intersect (&rays[0], (int)rays.size(), &hits[0]);
+        return;
+    }
+    for (std::size_t i = 0; i < rays.size(); ++i)
+        intersect (rays[i], hits[i]);
+}
+
+void Mesh::optimizeVertexCache (VertexCache::Stats* before, VertexCache::Stats* after) {
+    static_assert(sizeof(TriangleIndex) == 3 * sizeof(unsigned int), "TriangleIndex must be 3 packed indices");
+    if (mTriangles.empty())
+        return;
+    mBvh.reset();
+    unsigned int* indices = mTriangles[0].indexes;
+    const std::size_t nbIndices = 3 * mTriangles.size();
+
+    if (before)
+        *before = VertexCache::analyze (indices, nbIndices, mNbVertices);
+
+    VertexCache::optimizeTriangles (indices, nbIndices, mNbVertices);
+    std::vector<unsigned int> remap;
+    VertexCache::optimizeVertexFetch (indices, nbIndices, mNbVertices, remap);
+
+    // les sommets suivent la nouvelle numerotation
+    if (mLayout == INTERLEAVED) {
+        VertexArray reordered (mVertices.size());
+        for (std::size_t v = 0; v < mVertices.size(); ++v)
+            reordered[remap[v]] = mVertices[v];
+        mVertices.swap (reordered);
+    } else {
+        VertexStreams::Stream* streams[8] = { &mStreams.x, &mStreams.y, &mStreams.z,
+                                              &mStreams.nx, &mStreams.ny, &mStreams.nz,
+                                              &mStreams.u, &mStreams.v };
+        VertexStreams::Stream reordered (mStreams.size());
+        for (int s = 0; s < 8; ++s) {
+            const VertexStreams::Stream& stream = *streams[s];
+            for (std::size_t v = 0; v < stream.size(); ++v)
+                reordered[remap[v]] = stream[v];
+            streams[s]->swap (reordered);
+        }
+    }
+
+    if (after)
+        *after = VertexCache::analyze (indices, nbIndices, mNbVertices);
+}
+
+// -----------------------------------------------------------------------------
+
+void Mesh::VertexStreams::resize (std::size_t n) {
+    x.resize (n); y.resize (n); z.resize (n);
+    nx.resize (n); ny.resize (n); nz.resize (n);
+    u.resize (n); v.resize (n);
+}
+
+void Mesh::VertexStreams::reserve (std::size_t n) {
+    x.reserve (n); y.reserve (n); z.reserve (n);
+    nx.reserve (n); ny.reserve (n); nz.reserve (n);
+    u.reserve (n); v.reserve (n);
+}
+
+void Mesh::VertexStreams::clear () {
+    Stream().swap (x); Stream().swap (y); Stream().swap (z);
+    Stream().swap (nx); Stream().swap (ny); Stream().swap (nz);
+    Stream().swap (u); Stream().swap (v);
+}
+
+void Mesh::VertexStreams::push_back (const Vertex& vertex) {
+    x.push_back (vertex.position.x);
+    y.push_back (vertex.position.y);
+    z.push_back (vertex.position.z);
+    nx.push_back (vertex.normal.x);
+    ny.push_back (vertex.normal.y);
+    nz.push_back (vertex.normal.z);
+    u.push_back (vertex.texcoord.x);
+    v.push_back (vertex.texcoord.y);
+}
+
+void Mesh::VertexStreams::append (const VertexStreams& s) {
+    x.insert (x.end(), s.x.begin(), s.x.end());
+    y.insert (y.end(), s.y.begin(), s.y.end());
+    z.insert (z.end(), s.z.begin(), s.z.end());
+    nx.insert (nx.end(), s.nx.begin(), s.nx.end());
+    ny.insert (ny.end(), s.ny.begin(), s.ny.end());
+    nz.insert (nz.end(), s.nz.begin(), s.nz.end());
+    u.insert (u.end(), s.u.begin(), s.u.end());
+    v.insert (v.end(), s.v.begin(), s.v.end());
+}
+
+Mesh::Vertex Mesh::VertexStreams::get (std::size_t i) const {
+    Vertex vertex (glm::vec3 (x[i], y[i], z[i]));
+    vertex.normal = glm::vec3 (nx[i], ny[i], nz[i]);
+    vertex.texcoord = glm::vec2 (u[i], v[i]);
+    return vertex;
+}
+
 } // namespace loaders
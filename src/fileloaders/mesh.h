@@ -21,8 +21,12 @@
 #define MESH_H
 
 
+#include <memory>
 #include <vector>
 #include "glm/glm.hpp"
+#include "alignedallocator.h"
+#include "trianglebvh.h"
+#include "vertexcache.h"
 
 // =============================================================================
 namespace Loaders {
@@ -34,6 +38,11 @@ namespace Loaders {
   * Represents a triangular mesh as an array of vertex and an array of triangluar faces.
   * In the vertex buffer, datas are interleaved (x,y,z, nx,ny,nz, u,v)
   * when auxiliary data are present ((nx,ny,nz) or (u,v))
+  *
+  * Vertices are stored interleaved by default. #setVertexLayout() switches
+  * to one stream per component so that position only passes
+  * (#boundingBox(), #transform(), #computeNormals()) stream through
+  * contiguous memory. #getData() interleaves them again for the GPU.
   */
 class Mesh {
 public:
@@ -54,13 +63,32 @@ public:
           bool hasNormals, bool hasTextureCoords
           );
 
+    /**
+      * Same as above but takes ownership of the buffers: each of them is
+      * released as soon as it has been converted, which lowers the memory
+      * peak when building big meshes.
+      */
+    Mesh (std::vector<float> &&vertexBuffer,
+          std::vector<int> &&triangleBuffer,
+          std::vector<int> &&quadBuffer,
+          bool hasNormals, bool hasTextureCoords
+          );
+
     /// Copy contructor.
     Mesh(const Mesh &mesh);
 
+    /// Move constructor, "mesh" is left empty.
+    Mesh(Mesh &&mesh);
+
+    Mesh & operator=(const Mesh &mesh);
+    Mesh & operator=(Mesh &&mesh);
+
     /// Destructor.
     virtual ~Mesh();
 
     /// Gets the mesh data in raw format.
+    /// Data are appended to the buffers with 8 floats per vertex
+    /// (x,y,z, nx,ny,nz, u,v) and 3 indices per triangle.
     void getData( std::vector<float>& vertexBuffer,
                   std::vector<int>& triangleBuffer,
                   bool& parametrized );
@@ -68,13 +96,84 @@ public:
     /// Concatenates 2 meshes.
     Mesh & operator+=(const Mesh &m);
 
+    /// Concatenates 2 meshes, "m" is left empty.
+    /// The arrays of "m" are moved instead of copied when this mesh is empty
+    /// and has not reserved memory.
+    Mesh & operator+=(Mesh &&m);
+
+    /// Allocate memory for at least "nbVertices" and "nbTriangles"
+    /// so that concatenations don't reallocate.
+    void reserve(int nbVertices, int nbTriangles);
+
     int nbVertices () const { return mNbVertices;  }
     int nbTriangles() const { return mNbTriangles; }
 
     /// Prints basic information about the mesh on stderr.
     void printfInfo() const;
 
+    /// Contribution of each adjacent face to a vertex normal
+    enum NormalWeighting {
+        UNIFORM_WEIGHTS = 0, ///< every face counts the same
+        AREA_WEIGHTS,        ///< proportional to the face area
+        ANGLE_WEIGHTS        ///< proportional to the face angle at the vertex
+    };
+
+    /// Reorder the triangles for the post-transform vertex cache, then the
+    /// vertices in the order the triangles first use them.
+    /// @see VertexCache
+    /// @param before, after : if not null, cache statistics of the index
+    /// buffer before and after the optimization
+    void optimizeVertexCache (VertexCache::Stats* before = 0, VertexCache::Stats* after = 0);
+
+    /// Storage of the vertex attributes
+    enum VertexLayout {
+        INTERLEAVED = 0, ///< array of #Vertex (x,y,z, nx,ny,nz, u,v)
+        SEPARATE_STREAMS ///< one aligned array per component (#VertexStreams)
+    };
+
+    VertexLayout vertexLayout() const { return mLayout; }
+
+    /// Convert the storage of the vertices to "layout"
+    void setVertexLayout (VertexLayout layout);
+
+    /// Axis aligned bounding box of the vertex positions.
+    /// Both corners are (0,0,0) when the mesh is empty.
+    void boundingBox (glm::vec3& bmin, glm::vec3& bmax) const;
+
+    /// Sphere centered on the bounding box containing every vertex.
+    /// Tighter than the sphere around the box for most meshes.
+    void boundingSphere (glm::vec3& center, float& radius) const;
+
+    /// Transform positions by "m" and normals by its inverse transpose.
+    void transform (const glm::mat4& m);
+
+    /// Compute smoothed unit normals at each vertex.
+    /// Face normals are computed first, then each vertex gathers the normals
+    /// of its adjacent faces. Both passes are spread over the CPU cores.
+    /// Vertices without any non degenerated face get a null normal.
+    void computeNormals (NormalWeighting weighting = AREA_WEIGHTS);
+
+    /// Build the triangle hierarchy used by #intersect().
+    /// It is shared by the copies of the mesh and dropped when the positions
+    /// or the triangles change.
+    void buildBvh ();
+
+    bool hasBvh () const { return mBvh != 0; }
+
+    /// Closest triangle hit by "ray". Without #buildBvh() every triangle
+    /// is tested.
+    /// @return false when the ray misses the mesh
+    bool intersect (const Ray& ray, RayHit& hit) const;
+
+    /// Closest hits of a batch of rays (area selection).
+    /// hits[i].triangle is -1 when rays[i] misses the mesh.
+    void intersect (const std::vector<Ray>& rays, std::vector<RayHit>& hits) const;
+
 protected:
+    friend class MeshCache; // reads and fills the arrays in bulk
+    friend class MeshSimplifier;
+    friend struct Meshlet;
+    friend class TriangleBvh;
 
     /// Internal vertex representation, there is 3 attributes:
     /// position (vec3), normal (vec3) and texture coordinates (vec2)
@@ -88,12 +187,32 @@ protected:
         glm::vec2 texcoord;
     };
 
+    /// Structure of arrays storage of the vertices :
+    /// one stream per component, aligned on 32 bytes.
+    struct VertexStreams {
+        typedef AlignedVector<float>::type Stream;
+        Stream x, y, z;
+        Stream nx, ny, nz;
+        Stream u, v;
+
+        std::size_t size() const { return x.size(); }
+        void resize (std::size_t n);
+        void reserve (std::size_t n);
+        /// Release the memory
+        void clear ();
+        void push_back (const Vertex& vertex);
+        void append (const VertexStreams& streams);
+        Vertex get (std::size_t i) const;
+    };
+
     /// Internal triangle representation : three integer indices
     class TriangleIndex {
     public:
 
         unsigned int indexes[3]; ///<  index of vertices in the array of positions
 
+        TriangleIndex () {}
+
         TriangleIndex (int i0, int i1, int i2) {
             indexes[0] = i0; indexes[1] = i1; indexes[2] = i2;
         }
@@ -124,8 +243,21 @@ protected:
     bool mHasTextureCoords;
     bool mHasNormal;
 
-    /// Compute smothed normals at each vertex.
-    void computeNormals (void);
+    VertexStreams mStreams; ///< vertices when #mLayout is SEPARATE_STREAMS
+    VertexLayout mLayout;   ///< #mVertices or #mStreams is empty depending on it
+
+    std::shared_ptr<const TriangleBvh> mBvh; ///< null until #buildBvh()
+
+private:
+    /// Fill #mVertices from a (x,y,z[,nx,ny,nz][,u,v]) buffer
+    void setVertices (const std::vector<float> &vertexBuffer);
+    /// Fill #mTriangles, quads are split in two triangles
+    void setFaces (const std::vector<int> &triangleBuffer, const std::vector<int> &quadBuffer);
+
+    glm::vec3 position (std::size_t i) const {
+        return mLayout == INTERLEAVED ? mVertices[i].position : glm::vec3 (mStreams.x[i], mStreams.y[i], mStreams.z[i]);
+    }
+    void setNormal (std::size_t i, const glm::vec3& n);
 
 };
 
@@ -0,0 +1,362 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "meshcache.h"
+#include "mesh.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+namespace Loaders {
+
+namespace {
+
+const char MESHCACHE_MAGIC[8] = { 'M', 'E', 'S', 'H', 'C', 'A', 'C', 'H' };
+const uint32_t MESHCACHE_VERSION = 2;
+const uint32_t MESHCACHE_BYTE_ORDER = 0x01020304;
+
+/// Sources bigger than this are hashed on evenly spaced samples
+const std::size_t HASH_FULL_LIMIT = 1 << 20;
+const std::size_t HASH_NB_SAMPLES = 256;
+const std::size_t HASH_SAMPLE_SIZE = 4096;
+
+enum {
+    HAS_NORMALS = 1 << 0,
+    HAS_TEXCOORDS = 1 << 1
+};
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    uint64_t sourceHash;
+    uint32_t nbMeshes;
+    uint32_t options;
+};
+
+inline uint64_t align16(uint64_t offset)
+{
+    return (offset + 15) & ~uint64_t(15);
+}
+
+// FNV-1a
+uint64_t hashBytes(uint64_t h, const char* data, std::size_t size)
+{
+    for (std::size_t i = 0; i < size; ++i) {
+        h ^= (unsigned char)data[i];
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+/// Size, modification time and hash of a file.
+/// Big files are only hashed on HASH_NB_SAMPLES blocks (first and last
+/// blocks included) so that validating the cache stays cheap.
+bool sourceSignature(const std::string& sourceFile, Header& header)
+{
+    struct stat st;
+    if (stat(sourceFile.c_str(), &st) != 0)
+        return false;
+
+    MappedFile source;
+    if (!source.open(sourceFile))
+        return false;
+
+    uint64_t h = 14695981039346656037ull;
+    std::size_t size = source.size();
+    if (size <= HASH_FULL_LIMIT) {
+        h = hashBytes(h, source.data(), size);
+    }
+    else {
+        std::size_t step = (size - HASH_SAMPLE_SIZE) / (HASH_NB_SAMPLES - 1);
+        for (std::size_t i = 0; i < HASH_NB_SAMPLES; ++i)
+            h = hashBytes(h, source.data() + i * step, HASH_SAMPLE_SIZE);
+    }
+
+    header.sourceSize = size;
+    header.sourceMtime = (int64_t)st.st_mtime;
+    header.sourceHash = h;
+    return true;
+}
+
+} // end anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+/// Per mesh description, offsets are from the beginning of the file
+struct MeshCache::Record {
+    uint32_t flags;
+    uint32_t nbVertices;
+    uint32_t nbTriangles;
+    uint32_t nameLength;
+    uint32_t materialLength;
+    float bboxMin[3];
+    float bboxMax[3];
+    uint32_t reserved;
+    uint64_t nameOffset;
+    uint64_t materialOffset;
+    uint64_t vertexOffset;
+    uint64_t indexOffset;
+};
+
+// -----------------------------------------------------------------------------
+
+MeshCache::MeshCache()
+{
+}
+
+// -----------------------------------------------------------------------------
+
+std::string MeshCache::cachePath(const std::string& sourceFile, const std::string& cacheDirectory)
+{
+    if (cacheDirectory.empty())
+        return sourceFile + ".meshcache";
+    const std::size_t slash = sourceFile.find_last_of("/\\");
+    const std::string name = slash == std::string::npos ? sourceFile : sourceFile.substr(slash + 1);
+    char hash[20];
+    sprintf(hash, "-%016llx", (unsigned long long)hashBytes(14695981039346656037ull, sourceFile.data(), sourceFile.size()));
+    return cacheDirectory + "/" + name + hash + ".meshcache";
+}
+
+// -----------------------------------------------------------------------------
+
+bool MeshCache::open(const std::string& sourceFile, unsigned int options, const std::string& cacheDirectory)
+{
+    close();
+    if (!mFile.open(cachePath(sourceFile, cacheDirectory)))
+        return false;
+
+    const uint64_t fileSize = mFile.size();
+    Header expected;
+    if (fileSize < sizeof(Header) || !sourceSignature(sourceFile, expected)) {
+        close();
+        return false;
+    }
+
+    const Header* header = (const Header*)mFile.data();
+    if (std::memcmp(header->magic, MESHCACHE_MAGIC, sizeof(MESHCACHE_MAGIC)) != 0
+        || header->version != MESHCACHE_VERSION
+        || header->byteOrder != MESHCACHE_BYTE_ORDER
+        || header->sourceSize != expected.sourceSize
+        || header->sourceMtime != expected.sourceMtime
+        || header->sourceHash != expected.sourceHash
+        || header->options != options
+        || sizeof(Header) + uint64_t(header->nbMeshes) * sizeof(Record) > fileSize) {
+        close();
+        return false;
+    }
+
+    // Check every blob lies inside the file
+    const Record* records = (const Record*)(mFile.data() + sizeof(Header));
+    for (uint32_t i = 0; i < header->nbMeshes; ++i) {
+        const Record& r = records[i];
+        if (r.nameOffset + r.nameLength > fileSize
+            || r.materialOffset + r.materialLength > fileSize
+            || r.vertexOffset + uint64_t(r.nbVertices) * 8 * sizeof(float) > fileSize
+            || r.indexOffset + uint64_t(r.nbTriangles) * 3 * sizeof(uint32_t) > fileSize
+            || r.vertexOffset % 16 != 0 || r.indexOffset % 16 != 0) {
+            close();
+            return false;
+        }
+        mRecords.push_back(&r);
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+void MeshCache::close()
+{
+    mRecords.clear();
+    mFile.close();
+}
+
+// -----------------------------------------------------------------------------
+
+std::string MeshCache::name(int i) const
+{
+    return std::string(mFile.data() + mRecords[i]->nameOffset, mRecords[i]->nameLength);
+}
+
+// -----------------------------------------------------------------------------
+
+std::string MeshCache::material(int i) const
+{
+    return std::string(mFile.data() + mRecords[i]->materialOffset, mRecords[i]->materialLength);
+}
+
+// -----------------------------------------------------------------------------
+
+glm::vec3 MeshCache::bboxMin(int i) const
+{
+    const float* b = mRecords[i]->bboxMin;
+    return glm::vec3(b[0], b[1], b[2]);
+}
+
+// -----------------------------------------------------------------------------
+
+glm::vec3 MeshCache::bboxMax(int i) const
+{
+    const float* b = mRecords[i]->bboxMax;
+    return glm::vec3(b[0], b[1], b[2]);
+}
+
+// -----------------------------------------------------------------------------
+
+int MeshCache::nbVertices(int i) const
+{
+    return (int)mRecords[i]->nbVertices;
+}
+
+// -----------------------------------------------------------------------------
+
+int MeshCache::nbTriangles(int i) const
+{
+    return (int)mRecords[i]->nbTriangles;
+}
+
+
+// -----------------------------------------------------------------------------
+
+Mesh* MeshCache::createMesh(int i) const
+{
+    const Record& r = *mRecords[i];
+    Mesh* mesh = new Mesh();
+    mesh->mHasNormal = (r.flags & HAS_NORMALS) != 0;
+    mesh->mHasTextureCoords = (r.flags & HAS_TEXCOORDS) != 0;
+    mesh->mNbVertices = (int)r.nbVertices;
+    mesh->mNbTriangles = (int)r.nbTriangles;
+    mesh->mVertices.resize(r.nbVertices);
+    mesh->mTriangles.resize(r.nbTriangles);
+    if (r.nbVertices > 0)
+        std::memcpy((void*)&mesh->mVertices[0], mFile.data() + r.vertexOffset, r.nbVertices * sizeof(Mesh::Vertex));
+    if (r.nbTriangles > 0)
+        std::memcpy((void*)&mesh->mTriangles[0], mFile.data() + r.indexOffset, r.nbTriangles * sizeof(Mesh::TriangleIndex));
+    return mesh;
+}
+
+// -----------------------------------------------------------------------------
+
+bool MeshCache::write(const std::string& sourceFile,
+                      const std::vector<Mesh*>& meshes,
+                      const std::vector<std::string>& names,
+                      const std::vector<std::string>& materials,
+                      unsigned int options,
+                      const std::string& cacheDirectory)
+{
+    static_assert(sizeof(Mesh::Vertex) == 8 * sizeof(float), "Mesh::Vertex must be 8 packed floats");
+    static_assert(sizeof(Mesh::TriangleIndex) == 3 * sizeof(uint32_t), "Mesh::TriangleIndex must be 3 packed uint32");
+
+    Header header;
+    if (!sourceSignature(sourceFile, header))
+        return false;
+    std::memcpy(header.magic, MESHCACHE_MAGIC, sizeof(MESHCACHE_MAGIC));
+    header.version = MESHCACHE_VERSION;
+    header.byteOrder = MESHCACHE_BYTE_ORDER;
+    header.nbMeshes = (uint32_t)meshes.size();
+    header.options = (uint32_t)options;
+
+    // Place the blobs
+    std::vector<Record> records(meshes.size());
+    uint64_t offset = sizeof(Header) + records.size() * sizeof(Record);
+    for (std::size_t i = 0; i < meshes.size(); ++i) {
+        const Mesh& m = *meshes[i];
+        Record& r = records[i];
+        std::memset(&r, 0, sizeof(Record));
+        r.flags = (m.mHasNormal ? HAS_NORMALS : 0) | (m.mHasTextureCoords ? HAS_TEXCOORDS : 0);
+        r.nbVertices = (uint32_t)m.mNbVertices;
+        r.nbTriangles = (uint32_t)m.mTriangles.size();
+        r.nameLength = (uint32_t)names[i].size();
+        r.materialLength = (uint32_t)materials[i].size();
+
+        glm::vec3 bmin, bmax;
+        m.boundingBox(bmin, bmax);
+        for (int k = 0; k < 3; ++k) {
+            r.bboxMin[k] = bmin[k];
+            r.bboxMax[k] = bmax[k];
+        }
+
+        r.nameOffset = offset;
+        offset += r.nameLength;
+        r.materialOffset = offset;
+        offset += r.materialLength;
+        r.vertexOffset = offset = align16(offset);
+        offset += uint64_t(r.nbVertices) * sizeof(Mesh::Vertex);
+        r.indexOffset = offset = align16(offset);
+        offset += uint64_t(r.nbTriangles) * sizeof(Mesh::TriangleIndex);
+    }
+
+    const std::string path = cachePath(sourceFile, cacheDirectory);
+    const std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file)
+            return false;
+
+        static const char padding[16] = { 0 };
+        uint64_t written = 0;
+        file.write((const char*)&header, sizeof(Header));
+        if (!records.empty())
+            file.write((const char*)&records[0], records.size() * sizeof(Record));
+        written = sizeof(Header) + records.size() * sizeof(Record);
+
+        for (std::size_t i = 0; i < meshes.size(); ++i) {
+            const Mesh& m = *meshes[i];
+            const Record& r = records[i];
+            file.write(names[i].data(), r.nameLength);
+            file.write(materials[i].data(), r.materialLength);
+            written += r.nameLength + r.materialLength;
+
+            file.write(padding, r.vertexOffset - written);
+            if (r.nbVertices > 0 && m.mLayout == Mesh::INTERLEAVED) {
+                file.write((const char*)&m.mVertices[0], r.nbVertices * sizeof(Mesh::Vertex));
+            }
+            else if (r.nbVertices > 0) {
+                for (uint32_t v = 0; v < r.nbVertices; ++v) {
+                    Mesh::Vertex vertex = m.mStreams.get(v);
+                    file.write((const char*)&vertex, sizeof(Mesh::Vertex));
+                }
+            }
+            written = r.vertexOffset + uint64_t(r.nbVertices) * sizeof(Mesh::Vertex);
+
+            file.write(padding, r.indexOffset - written);
+            if (r.nbTriangles > 0)
+                file.write((const char*)&m.mTriangles[0], r.nbTriangles * sizeof(Mesh::TriangleIndex));
+            written = r.indexOffset + uint64_t(r.nbTriangles) * sizeof(Mesh::TriangleIndex);
+        }
+        if (!file) {
+            file.close();
+            std::remove(tmpPath.c_str());
+            return false;
+        }
+    }
+
+    // rename() does not replace an existing file on every platform
+    std::remove(path.c_str());
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        std::remove(tmpPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // end namespace loaders
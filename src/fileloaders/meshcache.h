@@ -0,0 +1,114 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <string>
+#include <vector>
+#include "glm/glm.hpp"
+#include "mappedfile.h"
+
+// =============================================================================
+namespace Loaders {
+// =============================================================================
+
+class Mesh;
+
+/** @ingroup FileLoaders
+ *  Binary cache of the meshes built from a geometry file.
+ *
+ *  The cache is written beside the source ("model.obj" -> "model.obj.meshcache")
+ *  or in a cache directory (see #cachePath()) and stores, for each mesh, its name, material name, bounding box and the
+ *  mesh data ready to be sent to the GPU: interleaved vertices
+ *  (x,y,z, nx,ny,nz, u,v) followed by the triangles indices (3 x uint32).
+ *  The file is memory mapped when read back so meshes are filled with a plain
+ *  copy of the blobs, no parsing involved.
+ *
+ *  The header records the size, modification time and a hash of the
+ *  source file and the loader options: the cache is ignored as soon as one
+ *  of them differs.
+ *
+ *  Layout (native endianness, blobs aligned on 16 bytes):
+ *  @code
+ *  Header | Record[nbMeshes] | { name, material, vertices, indices } per mesh
+ *  @endcode
+ */
+class MeshCache {
+public:
+    MeshCache();
+
+    /// Path of the cache of "sourceFile": beside it when "cacheDirectory" is
+    /// empty, otherwise in "cacheDirectory", named after the file and a hash
+    /// of "sourceFile" (pass absolute paths so that two "model.obj" of
+    /// different folders do not share a cache)
+    static std::string cachePath(const std::string& sourceFile,
+                                 const std::string& cacheDirectory = std::string());
+
+    // -------------------------------------------------------------------------
+    /// @name Reading
+    // -------------------------------------------------------------------------
+
+    /// Map the cache of "sourceFile" and check it is up to date.
+    /// @param options : loader options the meshes must have been built with
+    /// (see #write())
+    /// @param cacheDirectory : see #cachePath()
+    /// @return false if there is no cache, if it is corrupted, outdated or
+    /// written with other options.
+    bool open(const std::string& sourceFile, unsigned int options = 0,
+              const std::string& cacheDirectory = std::string());
+    void close();
+    bool isOpen() const { return mFile.isOpen(); }
+
+    int nbMeshes() const { return (int)mRecords.size(); }
+    std::string name(int i) const;
+    std::string material(int i) const;
+    glm::vec3 bboxMin(int i) const;
+    glm::vec3 bboxMax(int i) const;
+    int nbVertices(int i) const;
+    int nbTriangles(int i) const;
+
+    /// Build the i-th mesh from the mapped blobs. Caller owns the result.
+    Mesh* createMesh(int i) const;
+
+    // -------------------------------------------------------------------------
+    /// @name Writing
+    // -------------------------------------------------------------------------
+
+    /// Write the cache of "sourceFile" with the given meshes.
+    /// The file is written under a temporary name then renamed so that a
+    /// concurrent reader never sees a partial cache.
+    /// @param names, materials : one entry per mesh
+    /// @param options : bit set of the loader options changing the meshes
+    /// built from the same file, part of the cache key
+    /// @param cacheDirectory : see #cachePath(), must exist
+    static bool write(const std::string& sourceFile,
+                      const std::vector<Mesh*>& meshes,
+                      const std::vector<std::string>& names,
+                      const std::vector<std::string>& materials,
+                      unsigned int options = 0,
+                      const std::string& cacheDirectory = std::string());
+
+private:
+    struct Record;
+
+    MappedFile mFile;
+    std::vector<const Record*> mRecords;
+};
+
+} // end namespace loaders =====================================================
+
+#endif // MESHCACHE_H
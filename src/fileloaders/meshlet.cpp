@@ -0,0 +1,223 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "meshlet.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Loaders {
+
+namespace {
+
+const float HALF_PI = 1.57079632679f;
+
+/// Bounding sphere and normal cone of the triangles [first, first + nbTriangles)
+void computeBounds(const std::vector<glm::vec3>& positions,
+                   const std::vector<unsigned int>& indices,
+                   Meshlet& m)
+{
+    const unsigned int* tri = &indices[m.firstIndex];
+
+    glm::vec3 bmin(positions[tri[0]]), bmax(positions[tri[0]]);
+    for (int i = 0; i < 3 * m.nbTriangles; ++i) {
+        bmin = glm::min(bmin, positions[tri[i]]);
+        bmax = glm::max(bmax, positions[tri[i]]);
+    }
+    m.center = (bmin + bmax) * 0.5f;
+    float radius2 = 0.f;
+    for (int i = 0; i < 3 * m.nbTriangles; ++i) {
+        glm::vec3 d = positions[tri[i]] - m.center;
+        radius2 = std::max(radius2, glm::dot(d, d));
+    }
+    m.radius = std::sqrt(radius2);
+
+    // Cone: mean axis of the normals, opened up to the farthest one
+    std::vector<glm::vec3> normals;
+    normals.reserve(m.nbTriangles);
+    glm::vec3 sum(0.f);
+    for (int t = 0; t < m.nbTriangles; ++t) {
+        const glm::vec3& p0 = positions[tri[3 * t]];
+        glm::vec3 n = glm::cross(positions[tri[3 * t + 1]] - p0, positions[tri[3 * t + 2]] - p0);
+        float len = glm::length(n);
+        if (len <= 0.f)
+            continue; // degenerated triangle: can't be seen
+        n /= len;
+        normals.push_back(n);
+        sum += n;
+    }
+    m.coneAxis = glm::vec3(0.f, 0.f, 1.f);
+    m.coneCutoff = -1.f;
+    float len = glm::length(sum);
+    if (normals.empty() || len <= 1e-6f)
+        return;
+    m.coneAxis = sum / len;
+    float cutoff = 1.f;
+    for (unsigned i = 0; i < normals.size(); ++i)
+        cutoff = std::min(cutoff, glm::dot(m.coneAxis, normals[i]));
+    // Opening of at least 90 degrees: a face is always visible
+    m.coneCutoff = cutoff > 0.f ? cutoff : -1.f;
+}
+
+} // end anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+void Meshlet::build(const Mesh& mesh,
+                    std::vector<Meshlet>& meshlets,
+                    std::vector<unsigned int>& indices,
+                    int maxVertices,
+                    int maxTriangles)
+{
+    meshlets.clear();
+    indices.clear();
+
+    const unsigned int nbVertices = mesh.nbVertices();
+    const unsigned int nbTriangles = (unsigned int)mesh.mTriangles.size();
+    if (nbTriangles == 0)
+        return;
+    maxVertices = std::max(maxVertices, 3);
+    maxTriangles = std::max(maxTriangles, 1);
+
+    std::vector<glm::vec3> positions(nbVertices);
+    for (unsigned int v = 0; v < nbVertices; ++v)
+        positions[v] = mesh.position(v);
+
+    // Vertices welded by position, so that UV or normal seams don't cut
+    // the neighbourhood of the triangles
+    std::vector<unsigned int> welded(nbVertices);
+    {
+        std::vector<unsigned int> order(nbVertices);
+        for (unsigned int v = 0; v < nbVertices; ++v)
+            order[v] = v;
+        const std::vector<glm::vec3>& p = positions;
+        std::sort(order.begin(), order.end(), [&p](unsigned int a, unsigned int b) {
+            if (p[a].x != p[b].x) return p[a].x < p[b].x;
+            if (p[a].y != p[b].y) return p[a].y < p[b].y;
+            if (p[a].z != p[b].z) return p[a].z < p[b].z;
+            return a < b;
+        });
+        for (unsigned int i = 0; i < nbVertices; ++i)
+            welded[order[i]] = (i > 0 && p[order[i]] == p[order[i - 1]]) ? welded[order[i - 1]] : order[i];
+    }
+
+    // Triangles adjacent to each welded vertex
+    std::vector<unsigned int> firstTriangle(nbVertices + 1, 0);
+    for (unsigned int t = 0; t < nbTriangles; ++t)
+        for (int k = 0; k < 3; ++k)
+            ++firstTriangle[welded[mesh.mTriangles[t].indexes[k]] + 1];
+    for (unsigned int v = 0; v < nbVertices; ++v)
+        firstTriangle[v + 1] += firstTriangle[v];
+    std::vector<unsigned int> adjacency(firstTriangle[nbVertices]);
+    {
+        std::vector<unsigned int> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+        for (unsigned int t = 0; t < nbTriangles; ++t)
+            for (int k = 0; k < 3; ++k)
+                adjacency[fill[welded[mesh.mTriangles[t].indexes[k]]]++] = t;
+    }
+
+    std::vector<bool> emitted(nbTriangles, false);
+    std::vector<unsigned int> vertexTag(nbVertices, 0);      // current meshlet + 1
+    std::vector<unsigned int> candidateTag(nbTriangles, 0);
+    std::vector<unsigned int> candidates;
+    indices.reserve(3 * nbTriangles);
+
+    unsigned int seed = 0;
+    while (true) {
+        while (seed < nbTriangles && emitted[seed])
+            ++seed;
+        if (seed == nbTriangles)
+            break;
+
+        const unsigned int tag = (unsigned int)meshlets.size() + 1;
+        Meshlet m;
+        m.firstIndex = (int)indices.size();
+        m.nbTriangles = 0;
+        m.nbVertices = 0;
+        candidates.clear();
+
+        unsigned int next = seed;
+        while (true) {
+            // Add the triangle, and its neighbours to the candidates
+            const unsigned int* tri = mesh.mTriangles[next].indexes;
+            emitted[next] = true;
+            ++m.nbTriangles;
+            for (int k = 0; k < 3; ++k) {
+                indices.push_back(tri[k]);
+                if (vertexTag[tri[k]] != tag) {
+                    vertexTag[tri[k]] = tag;
+                    ++m.nbVertices;
+                }
+                unsigned int w = welded[tri[k]];
+                for (unsigned int i = firstTriangle[w]; i < firstTriangle[w + 1]; ++i) {
+                    unsigned int t = adjacency[i];
+                    if (!emitted[t] && candidateTag[t] != tag) {
+                        candidateTag[t] = tag;
+                        candidates.push_back(t);
+                    }
+                }
+            }
+            if (m.nbTriangles >= maxTriangles)
+                break;
+
+            // Candidate bringing the fewest new vertices
+            int best = -1;
+            int bestExtra = 4;
+            std::size_t kept = 0;
+            for (std::size_t i = 0; i < candidates.size(); ++i) {
+                unsigned int t = candidates[i];
+                if (emitted[t])
+                    continue;
+                candidates[kept++] = t;
+                const unsigned int* c = mesh.mTriangles[t].indexes;
+                int extra = (vertexTag[c[0]] != tag) + (vertexTag[c[1]] != tag) + (vertexTag[c[2]] != tag);
+                if (extra < bestExtra) {
+                    best = (int)t;
+                    bestExtra = extra;
+                }
+            }
+            candidates.resize(kept);
+            if (best < 0 || m.nbVertices + bestExtra > maxVertices)
+                break;
+            next = (unsigned int)best;
+        }
+
+        computeBounds(positions, indices, m);
+        meshlets.push_back(m);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+bool Meshlet::isBackFacing(const glm::vec3& eye) const
+{
+    if (coneCutoff <= 0.f)
+        return false;
+    glm::vec3 d = center - eye;
+    float distance = glm::length(d);
+    if (distance <= radius)
+        return false;
+    // Every triangle is seen from the back if the angle between its normal
+    // and the view direction from "eye" stays under 90 degrees:
+    // cone opening + axis/center angle + angular radius of the sphere
+    float axisAngle = std::acos(glm::clamp(glm::dot(coneAxis, d) / distance, -1.f, 1.f));
+    float sphereAngle = std::asin(radius / distance);
+    float coneAngle = std::acos(coneCutoff);
+    return coneAngle + axisAngle + sphereAngle < HALF_PI;
+}
+
+} // end namespace loaders
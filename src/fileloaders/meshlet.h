@@ -0,0 +1,69 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef MESHLET_H
+#define MESHLET_H
+
+#include <vector>
+#include "glm/glm.hpp"
+
+// =============================================================================
+namespace Loaders {
+// =============================================================================
+
+class Mesh;
+
+/** @ingroup FileLoaders
+ *  Cluster of neighbouring triangles of a mesh with the bounds needed to
+ *  cull it as a whole : a bounding sphere and a cone containing the normals
+ *  of all its triangles.
+ *
+ *  The triangles of a meshlet are a contiguous range of the index buffer
+ *  filled by #build(), so a set of visible meshlets draws with one
+ *  glMultiDrawElements().
+ */
+struct Meshlet {
+    int firstIndex;    ///< first index in the meshlet index buffer
+    int nbTriangles;
+    int nbVertices;    ///< distinct vertices used by the triangles
+
+    glm::vec3 center;  ///< bounding sphere of the triangles
+    float radius;
+
+    glm::vec3 coneAxis; ///< mean direction of the triangle normals
+    /// cosine of the half angle of the normal cone, -1 when the normals are
+    /// too spread for the meshlet to ever be back-facing
+    float coneCutoff;
+
+    /// Split "mesh" into meshlets of at most "maxVertices" vertices and
+    /// "maxTriangles" triangles. Each meshlet grows from a seed triangle by
+    /// adding the neighbour triangle that brings the fewest new vertices.
+    /// The result only depends on the mesh.
+    /// @param indices : triangles of the mesh in meshlet order, 3 per triangle
+    static void build(const Mesh& mesh,
+                      std::vector<Meshlet>& meshlets,
+                      std::vector<unsigned int>& indices,
+                      int maxVertices = 64,
+                      int maxTriangles = 124);
+
+    /// True when no triangle of the meshlet can be front-facing from "eye"
+    /// (counter clockwise front faces, "eye" in the frame of the mesh).
+    bool isBackFacing(const glm::vec3& eye) const;
+};
+
+} // end namespace loaders =====================================================
+
+#endif // MESHLET_H
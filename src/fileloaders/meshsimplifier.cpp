@@ -0,0 +1,365 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "meshsimplifier.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <thread>
+
+namespace Loaders {
+
+namespace {
+
+/// Maximum number of collapse passes per call to simplify()
+const int MAX_PASSES = 64;
+/// A collapse is rejected if a triangle normal turns by more than ~75 degrees
+const double FLIP_COS = 0.25;
+/// Wedges of a vertex whose normals differ by more than 45 degrees make a
+/// seam: hard edges are kept while flat shaded surfaces are simplified
+const float CREASE_COS = 0.7071f;
+
+/// Symmetric 4x4 matrix of the quadric error (a2 ab ac ad b2 bc bd c2 cd d2)
+struct Quadric {
+    double m[10];
+
+    Quadric() { std::fill(m, m + 10, 0.0); }
+
+    /// Squared distance to the plane a x + b y + c z + d = 0 (unit normal)
+    Quadric(double a, double b, double c, double d)
+    {
+        m[0] = a * a; m[1] = a * b; m[2] = a * c; m[3] = a * d;
+        m[4] = b * b; m[5] = b * c; m[6] = b * d;
+        m[7] = c * c; m[8] = c * d;
+        m[9] = d * d;
+    }
+
+    Quadric& operator+=(const Quadric& q)
+    {
+        for (int i = 0; i < 10; ++i)
+            m[i] += q.m[i];
+        return *this;
+    }
+
+    double eval(const glm::vec3& p) const
+    {
+        double x = p.x, y = p.y, z = p.z;
+        double e = m[0] * x * x + 2 * m[1] * x * y + 2 * m[2] * x * z + 2 * m[3] * x
+                 + m[4] * y * y + 2 * m[5] * y * z + 2 * m[6] * y
+                 + m[7] * z * z + 2 * m[8] * z
+                 + m[9];
+        return e > 0.0 ? e : 0.0;
+    }
+};
+
+struct Collapse {
+    double cost;
+    unsigned int from; ///< vertex removed
+    unsigned int to;   ///< vertex kept
+    bool operator<(const Collapse& c) const { return cost < c.cost; }
+};
+
+inline bool contains(const unsigned int* tri, unsigned int v)
+{
+    return tri[0] == v || tri[1] == v || tri[2] == v;
+}
+
+} // end anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+MeshSimplifier::MeshSimplifier(const Mesh& mesh)
+{
+    const std::size_t nbVertices = mesh.nbVertices();
+    mPositions.resize(nbVertices);
+    mNormals.resize(nbVertices);
+    mTexcoords.resize(nbVertices);
+    for (std::size_t v = 0; v < nbVertices; ++v) {
+        Mesh::Vertex vertex = mesh.mLayout == Mesh::INTERLEAVED ? mesh.mVertices[v] : mesh.mStreams.get(v);
+        mPositions[v] = vertex.position;
+        mNormals[v] = vertex.normal;
+        mTexcoords[v] = mesh.mHasTextureCoords ? vertex.texcoord : glm::vec2(0.f);
+    }
+
+    mIndices.reserve(3 * mesh.mTriangles.size());
+    for (std::size_t t = 0; t < mesh.mTriangles.size(); ++t)
+        mIndices.insert(mIndices.end(), mesh.mTriangles[t].indexes, mesh.mTriangles[t].indexes + 3);
+
+    // Weld the vertices sharing a position: unwelded or flat shaded meshes
+    // then get a connected topology
+    std::vector<unsigned int> order(nbVertices);
+    for (std::size_t v = 0; v < nbVertices; ++v)
+        order[v] = (unsigned int)v;
+    const std::vector<glm::vec3>& p = mPositions;
+    std::sort(order.begin(), order.end(), [&p](unsigned int a, unsigned int b) {
+        if (p[a].x != p[b].x) return p[a].x < p[b].x;
+        if (p[a].y != p[b].y) return p[a].y < p[b].y;
+        if (p[a].z != p[b].z) return p[a].z < p[b].z;
+        return a < b;
+    });
+    mWeld.resize(nbVertices);
+    mNextWedge.resize(nbVertices);
+    mOnSeam.assign(nbVertices, false);
+    for (std::size_t first = 0, last = 0; first < nbVertices; first = last) {
+        while (last < nbVertices && p[order[last]] == p[order[first]])
+            ++last;
+        // a seam only where the attributes of the wedges disagree
+        bool seam = false;
+        for (std::size_t i = first; i < last; ++i) {
+            mWeld[order[i]] = order[first];
+            mNextWedge[order[i]] = order[i + 1 < last ? i + 1 : first];
+            for (std::size_t j = first; j < i && !seam; ++j)
+                seam = !sameAttributes(order[i], order[j]);
+        }
+        for (std::size_t i = first; i < last; ++i)
+            mOnSeam[order[i]] = seam;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+bool MeshSimplifier::sameAttributes(unsigned int a, unsigned int b) const
+{
+    return mTexcoords[a] == mTexcoords[b]
+        && glm::dot(mNormals[a], mNormals[b]) >= CREASE_COS * glm::length(mNormals[a]) * glm::length(mNormals[b]);
+}
+
+// -----------------------------------------------------------------------------
+
+unsigned int MeshSimplifier::closestWedge(unsigned int v, unsigned int corner) const
+{
+    unsigned int best = v;
+    float bestDistance = -1.f;
+    unsigned int w = v;
+    do {
+        glm::vec2 dt = mTexcoords[w] - mTexcoords[corner];
+        float distance = glm::dot(dt, dt) + (1.f - glm::dot(mNormals[w], mNormals[corner]));
+        if (bestDistance < 0.f || distance < bestDistance) {
+            bestDistance = distance;
+            best = w;
+        }
+        w = mNextWedge[w];
+    } while (w != v);
+    return best;
+}
+
+// -----------------------------------------------------------------------------
+
+float MeshSimplifier::simplify(std::vector<unsigned int>& indices, std::size_t targetTriangles) const
+{
+    const std::size_t nbVertices = mPositions.size();
+    const std::vector<glm::vec3>& p = mPositions;
+
+    // The topology works on the welded vertices, "indices" keeps the
+    // wedges (vertices with their own normal and texture coordinates)
+    std::vector<unsigned int> welded(indices.size());
+    for (std::size_t i = 0; i < indices.size(); ++i)
+        welded[i] = mWeld[indices[i]];
+
+    // Quadrics of the triangle planes
+    std::vector<Quadric> quadrics(nbVertices);
+    for (std::size_t i = 0; i + 2 < welded.size(); i += 3) {
+        glm::vec3 n = glm::cross(p[welded[i + 1]] - p[welded[i]], p[welded[i + 2]] - p[welded[i]]);
+        float len = glm::length(n);
+        if (len <= 0.f)
+            continue;
+        n /= len;
+        Quadric q(n.x, n.y, n.z, -glm::dot(n, p[welded[i]]));
+        for (int k = 0; k < 3; ++k)
+            quadrics[welded[i + k]] += q;
+    }
+
+    double maxCost = 0.0;
+    std::vector<unsigned int> firstTriangle(nbVertices + 1);
+    std::vector<unsigned int> triangles;
+    std::vector<bool> locked(nbVertices);
+    std::vector<bool> touched(nbVertices);
+    std::vector<unsigned int> remap(nbVertices);
+    std::vector<Collapse> collapses;
+
+    for (int pass = 0; pass < MAX_PASSES; ++pass) {
+        const std::size_t nbTriangles = welded.size() / 3;
+        if (nbTriangles <= targetTriangles)
+            break;
+
+        // Triangles of each vertex
+        std::fill(firstTriangle.begin(), firstTriangle.end(), 0);
+        for (std::size_t i = 0; i < welded.size(); ++i)
+            ++firstTriangle[welded[i] + 1];
+        for (std::size_t v = 0; v < nbVertices; ++v)
+            firstTriangle[v + 1] += firstTriangle[v];
+        triangles.resize(welded.size());
+        {
+            std::vector<unsigned int> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+            for (std::size_t i = 0; i < welded.size(); ++i)
+                triangles[fill[welded[i]]++] = (unsigned int)(i / 3);
+        }
+
+        // Locked vertices: seams and borders (edge of a single triangle)
+        for (std::size_t v = 0; v < nbVertices; ++v) {
+            bool border = false;
+            for (unsigned int i = firstTriangle[v]; i < firstTriangle[v + 1] && !border; ++i) {
+                const unsigned int* tri = &welded[3 * triangles[i]];
+                for (int k = 0; k < 3 && !border; ++k) {
+                    unsigned int w = tri[k];
+                    if (w == v)
+                        continue;
+                    int shared = 0;
+                    for (unsigned int j = firstTriangle[v]; j < firstTriangle[v + 1]; ++j)
+                        shared += contains(&welded[3 * triangles[j]], w) ? 1 : 0;
+                    border = (shared == 1);
+                }
+            }
+            locked[v] = mOnSeam[v] || border;
+        }
+
+        // Candidate collapses, cheapest first
+        collapses.clear();
+        for (std::size_t i = 0; i < welded.size(); i += 3) {
+            for (int k = 0; k < 3; ++k) {
+                unsigned int a = welded[i + k];
+                unsigned int b = welded[i + (k + 1) % 3];
+                for (int dir = 0; dir < 2; ++dir, std::swap(a, b)) {
+                    if (locked[a])
+                        continue;
+                    Quadric q = quadrics[a];
+                    q += quadrics[b];
+                    Collapse c = { q.eval(p[b]), a, b };
+                    collapses.push_back(c);
+                }
+            }
+        }
+        std::sort(collapses.begin(), collapses.end());
+
+        std::fill(touched.begin(), touched.end(), false);
+        for (std::size_t v = 0; v < nbVertices; ++v)
+            remap[v] = (unsigned int)v;
+
+        std::size_t removed = 0;
+        for (std::size_t c = 0; c < collapses.size() && nbTriangles - removed > targetTriangles; ++c) {
+            const unsigned int a = collapses[c].from;
+            const unsigned int b = collapses[c].to;
+            if (touched[a] || touched[b])
+                continue;
+
+            // reject the collapses flipping a triangle
+            bool valid = true;
+            std::size_t collapsed = 0;
+            for (unsigned int i = firstTriangle[a]; i < firstTriangle[a + 1] && valid; ++i) {
+                const unsigned int* tri = &welded[3 * triangles[i]];
+                if (contains(tri, b)) {
+                    ++collapsed;
+                    continue;
+                }
+                glm::vec3 q[3] = { p[tri[0]], p[tri[1]], p[tri[2]] };
+                glm::dvec3 before = glm::dvec3(glm::cross(q[1] - q[0], q[2] - q[0]));
+                for (int k = 0; k < 3; ++k)
+                    if (tri[k] == a)
+                        q[k] = p[b];
+                glm::dvec3 after = glm::dvec3(glm::cross(q[1] - q[0], q[2] - q[0]));
+                double lb = glm::length(before), la = glm::length(after);
+                if (lb > 0.0)
+                    valid = glm::dot(before, after) > FLIP_COS * lb * la;
+            }
+            if (!valid || collapsed == 0)
+                continue;
+
+            remap[a] = b;
+            quadrics[b] += quadrics[a];
+            maxCost = std::max(maxCost, collapses[c].cost);
+            removed += collapsed;
+            for (unsigned int i = firstTriangle[a]; i < firstTriangle[a + 1]; ++i) {
+                const unsigned int* tri = &welded[3 * triangles[i]];
+                touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = true;
+            }
+        }
+        if (removed == 0)
+            break;
+
+        // New list without the degenerated triangles. A moved corner takes
+        // the wedge of its new vertex closest to its own attributes
+        std::size_t out = 0;
+        for (std::size_t i = 0; i < welded.size(); i += 3) {
+            unsigned int a = remap[welded[i]], b = remap[welded[i + 1]], c = remap[welded[i + 2]];
+            if (a == b || b == c || a == c)
+                continue;
+            unsigned int moved[3] = { a, b, c };
+            for (int k = 0; k < 3; ++k) {
+                unsigned int corner = indices[i + k];
+                indices[out + k] = moved[k] == welded[i + k] ? corner : closestWedge(moved[k], corner);
+                welded[out + k] = moved[k];
+            }
+            out += 3;
+        }
+        indices.resize(out);
+        welded.resize(out);
+    }
+    return (float)std::sqrt(maxCost);
+}
+
+// -----------------------------------------------------------------------------
+
+void MeshSimplifier::buildLodChain(std::vector<MeshLod>& lods, int maxLevels, float ratio, std::size_t minTriangles) const
+{
+    lods.clear();
+    lods.push_back(MeshLod());
+    lods[0].indices = mIndices;
+
+    for (int level = 1; level < maxLevels; ++level) {
+        const MeshLod& previous = lods.back();
+        const std::size_t nbTriangles = previous.indices.size() / 3;
+        const std::size_t target = (std::size_t)(nbTriangles * ratio);
+        if (target < minTriangles)
+            break;
+
+        MeshLod lod;
+        lod.indices = previous.indices;
+        float error = simplify(lod.indices, target);
+        // not enough progress: the mesh is locked
+        if (lod.indices.size() / 3 > nbTriangles - (nbTriangles - target) / 4)
+            break;
+        lod.error = previous.error + error;
+        lods.push_back(lod);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void MeshSimplifier::buildLodChains(const std::vector<const Mesh*>& meshes,
+                                    std::vector<std::vector<MeshLod> >& chains,
+                                    int maxLevels, float ratio, std::size_t minTriangles)
+{
+    chains.clear();
+    chains.resize(meshes.size());
+    std::atomic<std::size_t> next(0);
+    auto worker = [&]() {
+        for (std::size_t i = next++; i < meshes.size(); i = next++)
+            MeshSimplifier(*meshes[i]).buildLodChain(chains[i], maxLevels, ratio, minTriangles);
+    };
+
+    std::size_t nbThreads = std::max(1u, std::thread::hardware_concurrency());
+    nbThreads = std::min(nbThreads, meshes.size());
+    std::vector<std::thread> threads;
+    for (std::size_t t = 1; t < nbThreads; ++t)
+        threads.push_back(std::thread(worker));
+    worker();
+    for (std::size_t t = 0; t < threads.size(); ++t)
+        threads[t].join();
+}
+
+} // end namespace loaders
@@ -0,0 +1,97 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef MESHSIMPLIFIER_H
+#define MESHSIMPLIFIER_H
+
+#include <cstddef>
+#include <vector>
+#include "glm/glm.hpp"
+
+// =============================================================================
+namespace Loaders {
+// =============================================================================
+
+class Mesh;
+
+/** @ingroup FileLoaders
+ *  One level of detail of a mesh.
+ *  The triangles index the vertices of the original mesh so that every level
+ *  shares the same vertex buffer.
+ */
+struct MeshLod {
+    std::vector<unsigned int> indices; ///< 3 per triangle
+    float error;                       ///< geometric deviation from the original mesh (object space)
+    MeshLod() : error(0.f) {}
+};
+
+/** @ingroup FileLoaders
+ *  Quadric error metric simplification (Garland & Heckbert) by vertex
+ *  collapses : a vertex is merged onto one of its neighbours so that no new
+ *  vertex is created.
+ *
+ *  The vertices sharing a position are welded so that unwelded and flat
+ *  shaded meshes are simplified like smooth ones. Vertices on a UV seam or
+ *  on a hard edge (the vertices sharing the position disagree on their
+ *  texture coordinates or normals) and on open borders are locked, and
+ *  collapses flipping a triangle are rejected, so texture coordinates and
+ *  normals stay valid at every level.
+ */
+class MeshSimplifier {
+public:
+    explicit MeshSimplifier(const Mesh& mesh);
+
+    /// Simplify the triangle list "indices" (of the mesh) down to at most
+    /// "targetTriangles" when possible.
+    /// @return the error introduced
+    float simplify(std::vector<unsigned int>& indices, std::size_t targetTriangles) const;
+
+    /// Build the levels of detail of the mesh: level 0 is the mesh itself,
+    /// each level has about "ratio" times the triangles of the previous one.
+    /// Stops when a level has less than "minTriangles" triangles or can't
+    /// be simplified any further.
+    void buildLodChain(std::vector<MeshLod>& lods,
+                       int maxLevels = 6,
+                       float ratio = 0.5f,
+                       std::size_t minTriangles = 256) const;
+
+    /// #buildLodChain() for several meshes at once, one mesh per thread.
+    static void buildLodChains(const std::vector<const Mesh*>& meshes,
+                               std::vector<std::vector<MeshLod> >& chains,
+                               int maxLevels = 6,
+                               float ratio = 0.5f,
+                               std::size_t minTriangles = 256);
+
+private:
+    /// Same texture coordinates and normals close enough to be smooth
+    bool sameAttributes(unsigned int a, unsigned int b) const;
+
+    /// Vertex sharing the position of "v" with the attributes closest to
+    /// the ones of "corner"
+    unsigned int closestWedge(unsigned int v, unsigned int corner) const;
+
+    std::vector<glm::vec3> mPositions;
+    std::vector<glm::vec3> mNormals;
+    std::vector<glm::vec2> mTexcoords;    ///< (0, 0) when the mesh has none
+    std::vector<unsigned int> mIndices;   ///< triangles of the original mesh
+    std::vector<unsigned int> mWeld;      ///< first vertex sharing the position of each vertex
+    std::vector<unsigned int> mNextWedge; ///< circular list of the vertices sharing a position
+    std::vector<bool> mOnSeam;            ///< vertices sharing the position disagree on their attributes
+};
+
+} // end namespace loaders =====================================================
+
+#endif // MESHSIMPLIFIER_H
@@ -19,6 +19,7 @@
  ***************************************************************************/
 #ifndef OBJFILEPARSER_H
 #define OBJFILEPARSER_H
+#include <algorithm>
 #include <cstddef>
 #include <tuple>
 #include <fstream>
@@ -196,7 +197,10 @@ public:
     typedef enum {
         parse_blank_lines_as_comment = 1 << 0,
         triangulate_faces = 1 << 1,
-        translate_negative_indices = 1 << 2
+        translate_negative_indices = 1 << 2,
+        /// parse_mapped()/parse_buffer() tokenize chunks of the file on
+        /// several threads, callbacks are still called in file order
+        parse_multithreaded = 1 << 3
     } ParseOptions;
     obj_parser(flags_type flags = 0);
     void info_callback(const info_callback_type& info_callback);
@@ -216,8 +220,26 @@ public:
     bool parse(std::istream& istream);
     bool parse(const std::string& filename);
 
+    /// Same as parse(filename) but the file is mapped in memory and scanned
+    /// in place with a pointer based tokenizer (no per line string streams).
+    /// Callbacks, index checks and messages are identical to #parse().
+    bool parse_mapped(const std::string& filename);
+    /// Parse the OBJ text stored in [first, last) with the in place tokenizer.
+    bool parse_buffer(const char* first, const char* last);
+
+    /// Threads used by #parse_multithreaded (0: one per core, the default)
+    /// and smallest chunk they tokenize (1 MB by default). Texts smaller
+    /// than two chunks are tokenized by the calling thread.
+    void set_threading(unsigned nb_threads, std::size_t min_chunk_size);
+
 private:
+    /// Checks faces and forwards tokenized lines to the callbacks
+    /// (defined in objmappedparser.cpp)
+    class Callback_sink;
+
     flags_type flags_;
+    unsigned nb_threads_;
+    std::size_t min_chunk_size_;
     info_callback_type info_callback_;
     warning_callback_type warning_callback_;
     error_callback_type error_callback_;
@@ -256,7 +278,15 @@ private:
 
 inline Obj_mtl::obj_parser::obj_parser(flags_type flags)
     : flags_(flags)
+    , nb_threads_(0)
+    , min_chunk_size_(std::size_t(1) << 20)
+{
+}
+
+inline void Obj_mtl::obj_parser::set_threading(unsigned nb_threads, std::size_t min_chunk_size)
 {
+    nb_threads_ = nb_threads;
+    min_chunk_size_ = std::max(std::size_t(1), min_chunk_size);
 }
 
 inline bool Obj_mtl::obj_parser::parse(const std::string& filename)
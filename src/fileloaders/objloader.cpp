@@ -18,6 +18,7 @@
  *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
  ***************************************************************************/
 #include "objloader.h"
+#include "vertexwelder.h"
 
 
 #include <cstdlib>
@@ -26,15 +27,25 @@
 #include <iostream>
 #include <sstream>
 #include <utility>
+#include <QDir>
 #include <QFileInfo>
 
 
 namespace Loaders {
 namespace Obj_mtl {
 
+/// Options changing the meshes built from a file, part of the cache key
+enum {
+    CACHE_OPTIMIZED_MESHES = 1 << 0
+};
+
 
 ObjLoader::ObjLoader()
 {
+    mUseMappedParser = true;
+    mUseMeshCache = false;
+    mOptimizeMeshes = false;
+    mWriteCache = false;
     vertices = 0;
     normals = 0;
     textures = 0;
@@ -79,9 +90,25 @@ void ObjLoader::error_callback(const std::string& /*filename*/, std::size_t line
 
 bool ObjLoader::load(const QString& filename, QString& reason)
 {
-    Obj_mtl::obj_parser* parser = new Obj_mtl::obj_parser(Obj_mtl::obj_parser::translate_negative_indices /*obj_mtl::obj_parser::triangulate_faces*/);
+    mObjDir = QFileInfo(filename).absolutePath() + "/";
+    mWriteCache = false;
+    // Absolute in a shared cache directory: the cache is named after it
+    mFileName = mCacheDirectory.isEmpty() ? filename.toStdString() : QFileInfo(filename).absoluteFilePath().toStdString();
+    if (mUseMeshCache && !mCacheDirectory.isEmpty() && !QDir().mkpath(mCacheDirectory))
+        std::cerr << "warning: unable to create " << mCacheDirectory.toStdString() << std::endl;
+
+    // Pas besoin de parser si le cache est a jour
+    if (mUseMeshCache && mCache.open(mFileName, cacheOptions(), mCacheDirectory.toStdString())) {
+        lastParseMessage = filename.toStdString() + "\nloaded from " + MeshCache::cachePath(mFileName, mCacheDirectory.toStdString()) + "\n";
+        std::cerr << lastParseMessage;
+        reason = QString(lastParseMessage.c_str());
+        return true;
+    }
 
-    std::ifstream file(filename.toStdString().c_str());
+    Obj_mtl::obj_parser::flags_type flags = Obj_mtl::obj_parser::translate_negative_indices /*obj_mtl::obj_parser::triangulate_faces*/;
+    if (mUseMappedParser)
+        flags |= Obj_mtl::obj_parser::parse_multithreaded;
+    Obj_mtl::obj_parser* parser = new Obj_mtl::obj_parser(flags);
 
     /* Association des callbacks */
     parser->info_callback(std::bind(&ObjLoader::info_callback, this, filename.toStdString(), std::placeholders::_1, std::placeholders::_2));
@@ -116,15 +143,21 @@ bool ObjLoader::load(const QString& filename, QString& reason)
     parser->object_name_callback(std::bind(&ObjLoader::set_group, this, std::placeholders::_1));
     parser->material_name_callback(std::bind(&ObjLoader::set_material, this, std::placeholders::_1));
 
-    QString dirname = QFileInfo(filename).absolutePath() + "/";
-
-    mObjDir = dirname;
+    QString dirname = mObjDir;
     parser->material_library_callback(std::bind(&ObjLoader::parse_material_library, this, dirname.toStdString(), std::placeholders::_1));
 
     /* Parse */
-    bool result = parser->parse(file);
+    bool result;
+    if (mUseMappedParser) {
+        result = parser->parse_mapped(filename.toStdString());
+    }
+    else {
+        std::ifstream file(filename.toStdString().c_str());
+        result = parser->parse(file);
+    }
     std::cerr << lastParseMessage;
     reason = QString(lastParseMessage.c_str());
+    mWriteCache = mUseMeshCache && result;
 
     delete parser;
     return result;
@@ -170,627 +203,160 @@ void ObjLoader::parse_material_library(const std::string& dirname, const std::st
     delete mtlparser;
 }
 
-int ObjLoader::faceType(Face* f)
+int ObjLoader::faceType(const FaceList& faces)
 {
     int type = 4; // 0 -> full, 1 -> normales, 2 -> textures, 3 ->vertex uniquement
-    if (f->have[NORMALS] && f->have[TEXTURES])
+    bool haveNormals = faces.have(0, NORMALS);
+    bool haveTextures = faces.have(0, TEXTURES);
+    if (haveNormals && haveTextures)
         type = 0;
-    else if (f->have[NORMALS])
+    else if (haveNormals)
         type = 1;
-    else if (f->have[TEXTURES])
+    else if (haveTextures)
         type = 2;
     else
         type = 3;
     return type;
 }
 
-void ObjLoader::addVerticeNormalTexturePart(ObjMesh* mesh, FaceList& faces, int num)
+// Smoothing and welding follow the file (already in the cache signature),
+// both parsers build the same meshes and the vertex layout is changed after
+// loading: only the vertex cache optimization changes the meshes.
+unsigned int ObjLoader::cacheOptions() const
 {
-    std::vector<Face*>::iterator it = faces.begin();
-    std::map<VertexObj, int> vertexBuffer;
-    // Etape 1 : construire la liste des sommets (vert.norm.tex) uniques
-    int addedVerticesNumber = 0;
-    do {
-        VertexObj v1(*this, (*it)->vertices[0], (*it)->textures[0], (*it)->normals[0]);
-        vertexBuffer[v1] = ++addedVerticesNumber;
-        VertexObj v2(*this, (*it)->vertices[1], (*it)->textures[1], (*it)->normals[1]);
-        vertexBuffer[v2] = ++addedVerticesNumber;
-        VertexObj v3(*this, (*it)->vertices[2], (*it)->textures[2], (*it)->normals[2]);
-        vertexBuffer[v3] = ++addedVerticesNumber;
-        if ((*it)->type == QUAD) {
-            VertexObj v4(*this, (*it)->vertices[3], (*it)->textures[3], (*it)->normals[3]);
-            vertexBuffer[v4] = ++addedVerticesNumber;
-        }
-    } while (++it != faces.end());
-
-    // Etape 2 : numeroter les sommets
-    int newnumber = 0;
-    for (std::map<VertexObj, int>::iterator vm = vertexBuffer.begin(); vm != vertexBuffer.end(); ++vm)
-        vm->second = newnumber++;
-
-    // Etape 3 : construire la liste des faces
-    std::vector<int> triangleBuffer;
-    std::vector<int> quadBuffer;
-
-    int reservedSize = faces.size();
-    triangleBuffer.reserve(reservedSize);
-    quadBuffer.reserve(reservedSize);
-
-    it = faces.begin();
-    do {
-        VertexObj v1(*this, (*it)->vertices[0], (*it)->textures[0], (*it)->normals[0]);
-        VertexObj v2(*this, (*it)->vertices[1], (*it)->textures[1], (*it)->normals[1]);
-        VertexObj v3(*this, (*it)->vertices[2], (*it)->textures[2], (*it)->normals[2]);
-        int index1 = vertexBuffer.find(v1)->second;
-        int index2 = vertexBuffer.find(v2)->second;
-        int index3 = vertexBuffer.find(v3)->second;
-
-        if ((*it)->type == TRIANGLE) {
-            triangleBuffer.push_back(index1);
-            triangleBuffer.push_back(index2);
-            triangleBuffer.push_back(index3);
-        }
-        else {
-            VertexObj v4(*this, (*it)->vertices[3], (*it)->textures[3], (*it)->normals[3]);
-            int index4 = vertexBuffer.find(v4)->second;
-            quadBuffer.push_back(index1);
-            quadBuffer.push_back(index2);
-            quadBuffer.push_back(index3);
-            quadBuffer.push_back(index4);
-        }
-        delete (*it);
-    } while (++it != faces.end());
-
-    // etape4 : construire le tableau de sommet final
-    std::vector<float> glVertexBuffer;
-    for (std::map<VertexObj, int>::iterator vm = vertexBuffer.begin(); vm != vertexBuffer.end(); ++vm) {
-        glVertexBuffer.push_back(vm->first.vertex.x);
-        glVertexBuffer.push_back(vm->first.vertex.y);
-        glVertexBuffer.push_back(vm->first.vertex.z);
-        glVertexBuffer.push_back(vm->first.normal.x);
-        glVertexBuffer.push_back(vm->first.normal.y);
-        glVertexBuffer.push_back(vm->first.normal.z);
-        glVertexBuffer.push_back(vm->first.texcoord[0]);
-        glVertexBuffer.push_back(vm->first.texcoord[1]);
-    }
-    // etape 5 : construire le Mesh pour le renderer
-    SmoothGroup* theSmoothGroup = new SmoothGroup(glVertexBuffer, triangleBuffer, quadBuffer, true, true);
-    mesh->addSmoothGroup(theSmoothGroup);
-
-    // On nettoie tout !
-    glVertexBuffer.erase(glVertexBuffer.begin(), glVertexBuffer.end());
-    triangleBuffer.erase(triangleBuffer.begin(), triangleBuffer.end());
-    quadBuffer.erase(quadBuffer.begin(), quadBuffer.end());
-    vertexBuffer.erase(vertexBuffer.begin(), vertexBuffer.end());
+    return mOptimizeMeshes ? CACHE_OPTIMIZED_MESHES : 0;
 }
 
-void ObjLoader::addVerticeNormalPart(ObjMesh* mesh, FaceList& faces, int num)
+// Ajoute les attributs du coin c de la face f (0 si la face n'en a pas)
+void ObjLoader::pushCorner(std::vector<float>& glVertexBuffer, const FaceRef& f, int c, bool hasNormals, bool hasTextures) const
 {
-    std::vector<Face*>::iterator it = faces.begin();
-    std::map<VertexObj, int> vertexBuffer;
-    // Etape 1 : construire la liste des sommets (vert.norm.tex) uniques
-    int addedVerticesNumber = 0;
-    do {
-        VertexObj v1(*this, (*it)->vertices[0], (*it)->normals[0]);
-        vertexBuffer[v1] = ++addedVerticesNumber;
-        VertexObj v2(*this, (*it)->vertices[1], (*it)->normals[1]);
-        vertexBuffer[v2] = ++addedVerticesNumber;
-        VertexObj v3(*this, (*it)->vertices[2], (*it)->normals[2]);
-        vertexBuffer[v3] = ++addedVerticesNumber;
-        if ((*it)->type == QUAD) {
-            VertexObj v4(*this, (*it)->vertices[3], (*it)->normals[3]);
-            vertexBuffer[v4] = ++addedVerticesNumber;
-        }
-    } while (++it != faces.end());
-
-    // Etape 2 : numeroter les sommets
-    int newnumber = 0;
-    for (std::map<VertexObj, int>::iterator vm = vertexBuffer.begin(); vm != vertexBuffer.end(); ++vm)
-        vm->second = newnumber++;
-
-    // Etape 3 : construire la liste des faces
-    std::vector<int> triangleBuffer;
-    std::vector<int> quadBuffer;
-
-    int reservedSize = faces.size();
-    triangleBuffer.reserve(reservedSize);
-    quadBuffer.reserve(reservedSize);
-
-    it = faces.begin();
-    do {
-        VertexObj v1(*this, (*it)->vertices[0], (*it)->normals[0]);
-        VertexObj v2(*this, (*it)->vertices[1], (*it)->normals[1]);
-        VertexObj v3(*this, (*it)->vertices[2], (*it)->normals[2]);
-        int index1 = vertexBuffer.find(v1)->second;
-        int index2 = vertexBuffer.find(v2)->second;
-        int index3 = vertexBuffer.find(v3)->second;
-
-        if ((*it)->type == TRIANGLE) {
-            triangleBuffer.push_back(index1);
-            triangleBuffer.push_back(index2);
-            triangleBuffer.push_back(index3);
-        }
-        else {
-            VertexObj v4(*this, (*it)->vertices[3], (*it)->normals[3]);
-            int index4 = vertexBuffer.find(v4)->second;
-            quadBuffer.push_back(index1);
-            quadBuffer.push_back(index2);
-            quadBuffer.push_back(index3);
-            quadBuffer.push_back(index4);
-        }
-        delete (*it);
-    } while (++it != faces.end());
-
-    // etape4 : construire le tableau de sommet final
-    std::vector<float> glVertexBuffer;
-    for (std::map<VertexObj, int>::iterator vm = vertexBuffer.begin(); vm != vertexBuffer.end(); ++vm) {
-        glVertexBuffer.push_back(vm->first.vertex.x);
-        glVertexBuffer.push_back(vm->first.vertex.y);
-        glVertexBuffer.push_back(vm->first.vertex.z);
-        glVertexBuffer.push_back(vm->first.normal.x);
-        glVertexBuffer.push_back(vm->first.normal.y);
-        glVertexBuffer.push_back(vm->first.normal.z);
+    const glm::vec3& pos = verticesTable[f.vertices[c]];
+    glVertexBuffer.push_back(pos.x);
+    glVertexBuffer.push_back(pos.y);
+    glVertexBuffer.push_back(pos.z);
+    if (hasNormals) {
+        glm::vec3 nor = f.normals ? normalsTable[f.normals[c]] : glm::vec3(0.f);
+        glVertexBuffer.push_back(nor.x);
+        glVertexBuffer.push_back(nor.y);
+        glVertexBuffer.push_back(nor.z);
+    }
+    if (hasTextures) {
+        glm::vec3 tex = f.textures ? texturesTable[f.textures[c]] : glm::vec3(0.f);
+        glVertexBuffer.push_back(tex.x);
+        glVertexBuffer.push_back(tex.y);
     }
-    // etape 5 : construire le Mesh pour le renderer
-    SmoothGroup* theSmoothGroup = new SmoothGroup(glVertexBuffer, triangleBuffer, quadBuffer, true, false);
-    mesh->addSmoothGroup(theSmoothGroup);
-
-    // On nettoie tout !
-    glVertexBuffer.erase(glVertexBuffer.begin(), glVertexBuffer.end());
-    triangleBuffer.erase(triangleBuffer.begin(), triangleBuffer.end());
-    quadBuffer.erase(quadBuffer.begin(), quadBuffer.end());
-    vertexBuffer.erase(vertexBuffer.begin(), vertexBuffer.end());
 }
 
-void ObjLoader::addVerticeTexturePart(ObjMesh* mesh, FaceList& faces, int num)
+void ObjLoader::addWeldedPart(ObjMesh* mesh, FaceList& faces, bool hasNormals, bool hasTextures)
 {
-    std::vector<Face*>::iterator it = faces.begin();
-    std::map<VertexObj, int> vertexBuffer;
-    // Etape 1 : construire la liste des sommets (vert.tex) uniques
-    int addedVerticesNumber = 0;
-    do {
-        VertexObj v1(*this, (*it)->vertices[0], (*it)->textures[0], true);
-        vertexBuffer[v1] = ++addedVerticesNumber;
-        VertexObj v2(*this, (*it)->vertices[1], (*it)->textures[1], true);
-        vertexBuffer[v2] = ++addedVerticesNumber;
-        VertexObj v3(*this, (*it)->vertices[2], (*it)->textures[2], true);
-        vertexBuffer[v3] = ++addedVerticesNumber;
-        if ((*it)->type == QUAD) {
-            VertexObj v4(*this, (*it)->vertices[3], (*it)->textures[3], true);
-            vertexBuffer[v4] = ++addedVerticesNumber;
-        }
-    } while (++it != faces.end());
-
-    // Etape 2 : numeroter les sommets
-    int newnumber = 0;
-    for (std::map<VertexObj, int>::iterator vm = vertexBuffer.begin(); vm != vertexBuffer.end(); ++vm)
-        vm->second = newnumber++;
+    // Une seule passe : chaque coin (v, vt, vn) est numerote dans l'ordre
+    // de premiere apparition, les attributs sont ajoutes a ce moment la.
+    const int nbFloats = 3 + (hasNormals ? 3 : 0) + (hasTextures ? 2 : 0);
 
-    // Etape 3 : construire la liste des faces
     std::vector<int> triangleBuffer;
     std::vector<int> quadBuffer;
+    std::vector<float> glVertexBuffer;
 
     int reservedSize = faces.size();
-    triangleBuffer.reserve(reservedSize);
+    triangleBuffer.reserve(3 * reservedSize);
     quadBuffer.reserve(reservedSize);
-
-    it = faces.begin();
-    do {
-        VertexObj v1(*this, (*it)->vertices[0], (*it)->textures[0], true);
-        VertexObj v2(*this, (*it)->vertices[1], (*it)->textures[1], true);
-        VertexObj v3(*this, (*it)->vertices[2], (*it)->textures[2], true);
-        int index1 = vertexBuffer.find(v1)->second;
-        int index2 = vertexBuffer.find(v2)->second;
-        int index3 = vertexBuffer.find(v3)->second;
-
-        if ((*it)->type == TRIANGLE) {
-            triangleBuffer.push_back(index1);
-            triangleBuffer.push_back(index2);
-            triangleBuffer.push_back(index3);
-        }
-        else {
-            VertexObj v4(*this, (*it)->vertices[3], (*it)->textures[3], true);
-            int index4 = vertexBuffer.find(v4)->second;
-            quadBuffer.push_back(index1);
-            quadBuffer.push_back(index2);
-            quadBuffer.push_back(index3);
-            quadBuffer.push_back(index4);
+    glVertexBuffer.reserve(nbFloats * reservedSize);
+
+    VertexWelder welder(reservedSize);
+    FaceList::Reader reader(faces);
+    FaceRef f;
+    while (reader.next(f)) {
+        int index[4];
+        for (int c = 0; c < f.nbCorners; ++c) {
+            int t = !hasTextures ? 0 : (f.textures ? f.textures[c] : -1);
+            int n = !hasNormals ? 0 : (f.normals ? f.normals[c] : -1);
+            bool inserted;
+            index[c] = welder.weld(f.vertices[c], t, n, inserted);
+            if (inserted)
+                pushCorner(glVertexBuffer, f, c, hasNormals, hasTextures);
         }
-        delete (*it);
-    } while (++it != faces.end());
 
-    // etape4 : construire le tableau de sommet final
-    std::vector<float> glVertexBuffer;
-    for (std::map<VertexObj, int>::iterator vm = vertexBuffer.begin(); vm != vertexBuffer.end(); ++vm) {
-        glVertexBuffer.push_back(vm->first.vertex.x);
-        glVertexBuffer.push_back(vm->first.vertex.y);
-        glVertexBuffer.push_back(vm->first.vertex.z);
-        glVertexBuffer.push_back(vm->first.texcoord[0]);
-        glVertexBuffer.push_back(vm->first.texcoord[1]);
+        if (f.type == TRIANGLE)
+            triangleBuffer.insert(triangleBuffer.end(), index, index + 3);
+        else
+            quadBuffer.insert(quadBuffer.end(), index, index + 4);
     }
-    // etape 5 : construire le Mesh pour le renderer
-    SmoothGroup* theSmoothGroup = new SmoothGroup(glVertexBuffer, triangleBuffer, quadBuffer, false, true);
-    mesh->addSmoothGroup(theSmoothGroup);
 
-    // On nettoie tout !
-    glVertexBuffer.erase(glVertexBuffer.begin(), glVertexBuffer.end());
-    triangleBuffer.erase(triangleBuffer.begin(), triangleBuffer.end());
-    quadBuffer.erase(quadBuffer.begin(), quadBuffer.end());
-    vertexBuffer.erase(vertexBuffer.begin(), vertexBuffer.end());
+    // construire le Mesh pour le renderer
+    SmoothGroup* theSmoothGroup = new SmoothGroup(std::move(glVertexBuffer), std::move(triangleBuffer), std::move(quadBuffer), hasNormals, hasTextures);
+    mesh->addSmoothGroup(theSmoothGroup);
 }
 
-void ObjLoader::addVerticePart(ObjMesh* mesh, FaceList& faces, int num)
+void ObjLoader::addRawPart(ObjMesh* mesh, FaceList& faces, bool hasNormals, bool hasTextures)
 {
-    std::vector<Face*>::iterator it = faces.begin();
-    std::map<VertexObj, int> vertexBuffer;
-    // Etape 1 : construire la liste des sommets (vert) uniques
-    int addedVerticesNumber = 0;
-    do {
-        VertexObj v1(*this, (*it)->vertices[0]);
-        vertexBuffer[v1] = ++addedVerticesNumber;
-        VertexObj v2(*this, (*it)->vertices[1]);
-        vertexBuffer[v2] = ++addedVerticesNumber;
-        VertexObj v3(*this, (*it)->vertices[2]);
-        vertexBuffer[v3] = ++addedVerticesNumber;
-
-        if ((*it)->type == QUAD) {
-            VertexObj v4(*this, (*it)->vertices[3]);
-            vertexBuffer[v4] = ++addedVerticesNumber;
-        }
-    } while (++it != faces.end());
+    // Les sommets sont ajoutes sans reorganisation : un par coin de face
+    const int nbFloats = 3 + (hasNormals ? 3 : 0) + (hasTextures ? 2 : 0);
 
-    // Etape 2 : numeroter les sommets
-    int newnumber = 0;
-    for (std::map<VertexObj, int>::iterator vm = vertexBuffer.begin(); vm != vertexBuffer.end(); ++vm)
-        vm->second = newnumber++;
-
-    // Etape 3 : construire la liste des faces
     std::vector<int> triangleBuffer;
     std::vector<int> quadBuffer;
+    std::vector<float> glVertexBuffer;
 
     int reservedSize = faces.size();
-    triangleBuffer.reserve(reservedSize);
+    triangleBuffer.reserve(3 * reservedSize);
     quadBuffer.reserve(reservedSize);
+    glVertexBuffer.reserve(3 * nbFloats * reservedSize);
 
-    it = faces.begin();
-    do {
-        VertexObj v1(*this, (*it)->vertices[0]);
-        VertexObj v2(*this, (*it)->vertices[1]);
-        VertexObj v3(*this, (*it)->vertices[2]);
-        int index1 = vertexBuffer.find(v1)->second;
-        int index2 = vertexBuffer.find(v2)->second;
-        int index3 = vertexBuffer.find(v3)->second;
-
-        if ((*it)->type == TRIANGLE) {
-            triangleBuffer.push_back(index1);
-            triangleBuffer.push_back(index2);
-            triangleBuffer.push_back(index3);
-        }
-        else {
-            VertexObj v4(*this, (*it)->vertices[3]);
-            int index4 = vertexBuffer.find(v4)->second;
-            quadBuffer.push_back(index1);
-            quadBuffer.push_back(index2);
-            quadBuffer.push_back(index3);
-            quadBuffer.push_back(index4);
+    int indexVertex = 0;
+    FaceList::Reader reader(faces);
+    FaceRef f;
+    while (reader.next(f)) {
+        for (int c = 0; c < f.nbCorners; ++c) {
+            pushCorner(glVertexBuffer, f, c, hasNormals, hasTextures);
+            if (f.type == TRIANGLE)
+                triangleBuffer.push_back(indexVertex++);
+            else
+                quadBuffer.push_back(indexVertex++);
         }
-        delete (*it);
-    } while (++it != faces.end());
-
-    // etape4 : construire le tableau de sommet final
-    std::vector<float> glVertexBuffer;
-    for (std::map<VertexObj, int>::iterator vm = vertexBuffer.begin(); vm != vertexBuffer.end(); ++vm) {
-        glVertexBuffer.push_back(vm->first.vertex.x);
-        glVertexBuffer.push_back(vm->first.vertex.y);
-        glVertexBuffer.push_back(vm->first.vertex.z);
     }
-    // etape 5 : construire le Mesh pour le renderer
-    SmoothGroup* theSmoothGroup = new SmoothGroup(glVertexBuffer, triangleBuffer, quadBuffer, false, false);
-    mesh->addSmoothGroup(theSmoothGroup);
 
-    // On nettoie tout !
-    glVertexBuffer.erase(glVertexBuffer.begin(), glVertexBuffer.end());
-    triangleBuffer.erase(triangleBuffer.begin(), triangleBuffer.end());
-    quadBuffer.erase(quadBuffer.begin(), quadBuffer.end());
-    vertexBuffer.erase(vertexBuffer.begin(), vertexBuffer.end());
+    // construire le Mesh pour le renderer
+    SmoothGroup* theSmoothGroup = new SmoothGroup(std::move(glVertexBuffer), std::move(triangleBuffer), std::move(quadBuffer), hasNormals, hasTextures);
+    mesh->addSmoothGroup(theSmoothGroup);
 }
 
-void ObjLoader::addRawVerticeNormalTexturePart(ObjMesh* mesh, FaceList& faces, int num)
+void ObjLoader::addVerticeNormalTexturePart(ObjMesh* mesh, FaceList& faces, int /*num*/)
 {
-    std::vector<Face*>::iterator it = faces.begin();
-    // Etape 1 : construire la liste des faces
-    std::vector<int> triangleBuffer;
-    std::vector<int> quadBuffer;
-    std::vector<float> glVertexBuffer;
-
-    int reservedSize = faces.size();
-    triangleBuffer.reserve(reservedSize);
-    quadBuffer.reserve(reservedSize);
-    glVertexBuffer.reserve(3. * reservedSize);
-
-    int indexVertex = 0;
-    it = faces.begin();
-    do {
-        VertexObj v1(*this, (*it)->vertices[0], (*it)->textures[0], (*it)->normals[0]);
-        VertexObj v2(*this, (*it)->vertices[1], (*it)->textures[1], (*it)->normals[1]);
-        VertexObj v3(*this, (*it)->vertices[2], (*it)->textures[2], (*it)->normals[2]);
-
-        glVertexBuffer.push_back(v1.vertex.x);
-        glVertexBuffer.push_back(v1.vertex.y);
-        glVertexBuffer.push_back(v1.vertex.z);
-        glVertexBuffer.push_back(v1.normal.x);
-        glVertexBuffer.push_back(v1.normal.y);
-        glVertexBuffer.push_back(v1.normal.z);
-        glVertexBuffer.push_back(v1.texcoord[0]);
-        glVertexBuffer.push_back(v1.texcoord[1]);
-
-        glVertexBuffer.push_back(v2.vertex.x);
-        glVertexBuffer.push_back(v2.vertex.y);
-        glVertexBuffer.push_back(v2.vertex.z);
-        glVertexBuffer.push_back(v2.normal.x);
-        glVertexBuffer.push_back(v2.normal.y);
-        glVertexBuffer.push_back(v2.normal.z);
-        glVertexBuffer.push_back(v2.texcoord[0]);
-        glVertexBuffer.push_back(v2.texcoord[1]);
-
-        glVertexBuffer.push_back(v3.vertex.x);
-        glVertexBuffer.push_back(v3.vertex.y);
-        glVertexBuffer.push_back(v3.vertex.z);
-        glVertexBuffer.push_back(v3.normal.x);
-        glVertexBuffer.push_back(v3.normal.y);
-        glVertexBuffer.push_back(v3.normal.z);
-        glVertexBuffer.push_back(v3.texcoord[0]);
-        glVertexBuffer.push_back(v3.texcoord[1]);
-
-        int index1 = indexVertex++;
-        int index2 = indexVertex++;
-        int index3 = indexVertex++;
-
-        if ((*it)->type == TRIANGLE) {
-            triangleBuffer.push_back(index1);
-            triangleBuffer.push_back(index2);
-            triangleBuffer.push_back(index3);
-        }
-        else {
-            VertexObj v4(*this, (*it)->vertices[3], (*it)->textures[3], (*it)->normals[3]);
-            glVertexBuffer.push_back(v4.vertex.x);
-            glVertexBuffer.push_back(v4.vertex.y);
-            glVertexBuffer.push_back(v4.vertex.z);
-            glVertexBuffer.push_back(v4.normal.x);
-            glVertexBuffer.push_back(v4.normal.y);
-            glVertexBuffer.push_back(v4.normal.z);
-            glVertexBuffer.push_back(v4.texcoord[0]);
-            glVertexBuffer.push_back(v4.texcoord[1]);
-
-            int index4 = indexVertex++;
-
-            quadBuffer.push_back(index1);
-            quadBuffer.push_back(index2);
-            quadBuffer.push_back(index3);
-            quadBuffer.push_back(index4);
-        }
-        delete (*it);
-    } while (++it != faces.end());
-    // etape 2 : construire le Mesh pour le renderer
-    SmoothGroup* theSmoothGroup = new SmoothGroup(glVertexBuffer, triangleBuffer, quadBuffer, true, true);
-    mesh->addSmoothGroup(theSmoothGroup);
-    // On nettoie tout !
-    glVertexBuffer.erase(glVertexBuffer.begin(), glVertexBuffer.end());
-    triangleBuffer.erase(triangleBuffer.begin(), triangleBuffer.end());
-    quadBuffer.erase(quadBuffer.begin(), quadBuffer.end());
+    addWeldedPart(mesh, faces, true, true);
 }
 
-void ObjLoader::addRawVerticeNormalPart(ObjMesh* mesh, FaceList& faces, int num)
+void ObjLoader::addVerticeNormalPart(ObjMesh* mesh, FaceList& faces, int /*num*/)
 {
-    std::vector<Face*>::iterator it = faces.begin();
-    // Etape 1 : construire la liste des faces
-    std::vector<int> triangleBuffer;
-    std::vector<int> quadBuffer;
-    std::vector<float> glVertexBuffer;
-
-    int reservedSize = faces.size();
-    triangleBuffer.reserve(reservedSize);
-    quadBuffer.reserve(reservedSize);
-    glVertexBuffer.reserve(3. * reservedSize);
-
-    int indexVertex = 0;
-    it = faces.begin();
-    do {
-        VertexObj v1(*this, (*it)->vertices[0], (*it)->normals[0]);
-        VertexObj v2(*this, (*it)->vertices[1], (*it)->normals[1]);
-        VertexObj v3(*this, (*it)->vertices[2], (*it)->normals[2]);
-
-        glVertexBuffer.push_back(v1.vertex.x);
-        glVertexBuffer.push_back(v1.vertex.y);
-        glVertexBuffer.push_back(v1.vertex.z);
-        glVertexBuffer.push_back(v1.normal.x);
-        glVertexBuffer.push_back(v1.normal.y);
-        glVertexBuffer.push_back(v1.normal.z);
-
-        glVertexBuffer.push_back(v2.vertex.x);
-        glVertexBuffer.push_back(v2.vertex.y);
-        glVertexBuffer.push_back(v2.vertex.z);
-        glVertexBuffer.push_back(v2.normal.x);
-        glVertexBuffer.push_back(v2.normal.y);
-        glVertexBuffer.push_back(v2.normal.z);
-
-        glVertexBuffer.push_back(v3.vertex.x);
-        glVertexBuffer.push_back(v3.vertex.y);
-        glVertexBuffer.push_back(v3.vertex.z);
-        glVertexBuffer.push_back(v3.normal.x);
-        glVertexBuffer.push_back(v3.normal.y);
-        glVertexBuffer.push_back(v3.normal.z);
-
-        int index1 = indexVertex++;
-        int index2 = indexVertex++;
-        int index3 = indexVertex++;
-
-        if ((*it)->type == TRIANGLE) {
-            triangleBuffer.push_back(index1);
-            triangleBuffer.push_back(index2);
-            triangleBuffer.push_back(index3);
-        }
-        else {
-            VertexObj v4(*this, (*it)->vertices[3], (*it)->normals[3]);
-            glVertexBuffer.push_back(v4.vertex.x);
-            glVertexBuffer.push_back(v4.vertex.y);
-            glVertexBuffer.push_back(v4.vertex.z);
-            glVertexBuffer.push_back(v4.normal.x);
-            glVertexBuffer.push_back(v4.normal.y);
-            glVertexBuffer.push_back(v4.normal.z);
-
-            int index4 = indexVertex++;
-
-            quadBuffer.push_back(index1);
-            quadBuffer.push_back(index2);
-            quadBuffer.push_back(index3);
-            quadBuffer.push_back(index4);
-        }
-        delete (*it);
-    } while (++it != faces.end());
-    // etape 2 : construire le Mesh pour le renderer
-    SmoothGroup* theSmoothGroup = new SmoothGroup(glVertexBuffer, triangleBuffer, quadBuffer, true, false);
-    mesh->addSmoothGroup(theSmoothGroup);
-    // On nettoie tout !
-    glVertexBuffer.erase(glVertexBuffer.begin(), glVertexBuffer.end());
-    triangleBuffer.erase(triangleBuffer.begin(), triangleBuffer.end());
-    quadBuffer.erase(quadBuffer.begin(), quadBuffer.end());
+    addWeldedPart(mesh, faces, true, false);
 }
 
-void ObjLoader::addRawVerticeTexturePart(ObjMesh* mesh, FaceList& faces, int num)
+void ObjLoader::addVerticeTexturePart(ObjMesh* mesh, FaceList& faces, int /*num*/)
 {
-    std::vector<Face*>::iterator it = faces.begin();
-    // Etape 1 : construire la liste des faces
-    std::vector<int> triangleBuffer;
-    std::vector<int> quadBuffer;
-    std::vector<float> glVertexBuffer;
-
-    int reservedSize = faces.size();
-    triangleBuffer.reserve(reservedSize);
-    quadBuffer.reserve(reservedSize);
-    glVertexBuffer.reserve(3. * reservedSize);
-
-    int indexVertex = 0;
-    it = faces.begin();
-    do {
-        VertexObj v1(*this, (*it)->vertices[0], (*it)->textures[0], true);
-        VertexObj v2(*this, (*it)->vertices[1], (*it)->textures[1], true);
-        VertexObj v3(*this, (*it)->vertices[2], (*it)->textures[2], true);
-
-        glVertexBuffer.push_back(v1.vertex.x);
-        glVertexBuffer.push_back(v1.vertex.y);
-        glVertexBuffer.push_back(v1.vertex.z);
-        glVertexBuffer.push_back(v1.texcoord[0]);
-        glVertexBuffer.push_back(v1.texcoord[1]);
-
-        glVertexBuffer.push_back(v2.vertex.x);
-        glVertexBuffer.push_back(v2.vertex.y);
-        glVertexBuffer.push_back(v2.vertex.z);
-        glVertexBuffer.push_back(v2.texcoord[0]);
-        glVertexBuffer.push_back(v2.texcoord[1]);
-
-        glVertexBuffer.push_back(v3.vertex.x);
-        glVertexBuffer.push_back(v3.vertex.y);
-        glVertexBuffer.push_back(v3.vertex.z);
-        glVertexBuffer.push_back(v3.texcoord[0]);
-        glVertexBuffer.push_back(v3.texcoord[1]);
-
-        int index1 = indexVertex++;
-        int index2 = indexVertex++;
-        int index3 = indexVertex++;
-
-        if ((*it)->type == TRIANGLE) {
-            triangleBuffer.push_back(index1);
-            triangleBuffer.push_back(index2);
-            triangleBuffer.push_back(index3);
-        }
-        else {
-            VertexObj v4(*this, (*it)->vertices[3], (*it)->textures[3], true);
-            glVertexBuffer.push_back(v4.vertex.x);
-            glVertexBuffer.push_back(v4.vertex.y);
-            glVertexBuffer.push_back(v4.vertex.z);
-            glVertexBuffer.push_back(v4.texcoord[0]);
-            glVertexBuffer.push_back(v4.texcoord[1]);
-
-            int index4 = indexVertex++;
-
-            quadBuffer.push_back(index1);
-            quadBuffer.push_back(index2);
-            quadBuffer.push_back(index3);
-            quadBuffer.push_back(index4);
-        }
-        delete (*it);
-    } while (++it != faces.end());
-    // etape 2 : construire le Mesh pour le renderer
-    SmoothGroup* theSmoothGroup = new SmoothGroup(glVertexBuffer, triangleBuffer, quadBuffer, false, true);
-    mesh->addSmoothGroup(theSmoothGroup);
-    // On nettoie tout !
-    glVertexBuffer.erase(glVertexBuffer.begin(), glVertexBuffer.end());
-    triangleBuffer.erase(triangleBuffer.begin(), triangleBuffer.end());
-    quadBuffer.erase(quadBuffer.begin(), quadBuffer.end());
+    addWeldedPart(mesh, faces, false, true);
 }
 
-void ObjLoader::addRawVerticePart(ObjMesh* mesh, FaceList& faces, int num)
+void ObjLoader::addVerticePart(ObjMesh* mesh, FaceList& faces, int /*num*/)
 {
-    std::vector<Face*>::iterator it = faces.begin();
-    // Etape 1 : construire la liste des faces
-    std::vector<int> triangleBuffer;
-    std::vector<int> quadBuffer;
-    std::vector<float> glVertexBuffer;
-
-    int reservedSize = faces.size();
-    triangleBuffer.reserve(reservedSize);
-    quadBuffer.reserve(reservedSize);
-    glVertexBuffer.reserve(3. * reservedSize);
+    addWeldedPart(mesh, faces, false, false);
+}
 
-    int indexVertex = 0;
-    it = faces.begin();
-    do {
-        VertexObj v1(*this, (*it)->vertices[0]);
-        VertexObj v2(*this, (*it)->vertices[1]);
-        VertexObj v3(*this, (*it)->vertices[2]);
-
-        glVertexBuffer.push_back(v1.vertex.x);
-        glVertexBuffer.push_back(v1.vertex.y);
-        glVertexBuffer.push_back(v1.vertex.z);
-        glVertexBuffer.push_back(v2.vertex.x);
-        glVertexBuffer.push_back(v2.vertex.y);
-        glVertexBuffer.push_back(v2.vertex.z);
-        glVertexBuffer.push_back(v3.vertex.x);
-        glVertexBuffer.push_back(v3.vertex.y);
-        glVertexBuffer.push_back(v3.vertex.z);
-
-        int index1 = indexVertex++;
-        int index2 = indexVertex++;
-        int index3 = indexVertex++;
-        if ((*it)->type == TRIANGLE) {
-            triangleBuffer.push_back(index1);
-            triangleBuffer.push_back(index2);
-            triangleBuffer.push_back(index3);
-        }
-        else {
-            VertexObj v4(*this, (*it)->vertices[3]);
+void ObjLoader::addRawVerticeNormalTexturePart(ObjMesh* mesh, FaceList& faces, int /*num*/)
+{
+    addRawPart(mesh, faces, true, true);
+}
 
-            glVertexBuffer.push_back(v4.vertex.x);
-            glVertexBuffer.push_back(v4.vertex.y);
-            glVertexBuffer.push_back(v4.vertex.z);
+void ObjLoader::addRawVerticeNormalPart(ObjMesh* mesh, FaceList& faces, int /*num*/)
+{
+    addRawPart(mesh, faces, true, false);
+}
 
-            int index4 = indexVertex++;
+void ObjLoader::addRawVerticeTexturePart(ObjMesh* mesh, FaceList& faces, int /*num*/)
+{
+    addRawPart(mesh, faces, false, true);
+}
 
-            quadBuffer.push_back(index1);
-            quadBuffer.push_back(index2);
-            quadBuffer.push_back(index3);
-            quadBuffer.push_back(index4);
-        }
-        delete (*it);
-    } while (++it != faces.end());
-    // etape 2 : construire le Mesh pour le renderer
-    SmoothGroup* theSmoothGroup = new SmoothGroup(glVertexBuffer, triangleBuffer, quadBuffer, false, false);
-    mesh->addSmoothGroup(theSmoothGroup);
-    // On nettoie tout !
-    glVertexBuffer.erase(glVertexBuffer.begin(), glVertexBuffer.end());
-    triangleBuffer.erase(triangleBuffer.begin(), triangleBuffer.end());
-    quadBuffer.erase(quadBuffer.begin(), quadBuffer.end());
+void ObjLoader::addRawVerticePart(ObjMesh* mesh, FaceList& faces, int /*num*/)
+{
+    addRawPart(mesh, faces, false, false);
 }
 
 
@@ -800,6 +366,21 @@ void ObjLoader::addRawVerticePart(ObjMesh* mesh, FaceList& faces, int num)
  */
 void ObjLoader::getObjects(std::vector<Loaders::Mesh*>& meshes)
 {
+    if (mCache.isOpen()) {
+        for (int i = 0; i < mCache.nbMeshes(); ++i) {
+            if (mProgress && !mProgress(i, mCache.nbMeshes()))
+                break;
+            meshes.push_back(mCache.createMesh(i));
+        }
+        mCache.close();
+        return;
+    }
+
+    // nom et materiau de chaque mesh pour le cache
+    std::size_t firstMesh = meshes.size();
+    std::vector<std::string> names;
+    std::vector<std::string> materials;
+
     /*
 void ObjLoader::addEntities (Scene * theScene, const Transform& transform) {
 // add materials to the scene
@@ -809,20 +390,23 @@ void ObjLoader::addEntities (Scene * theScene, const Transform& transform) {
 	}
 */
     //add geometries to the scene
+    bool canceled = false;
     {
         // add geometries
+        int done = 0;
         for (std::map<std::string, Group*>::iterator group = allgroups.begin(); group != allgroups.end(); ++group) {
             Group* theGroup = group->second;
-            if (!theGroup->empty) {
+            if (!canceled && mProgress)
+                canceled = !mProgress(done++, (int)allgroups.size());
+            if (!theGroup->empty && !canceled) {
                 ObjMesh* theMesh;
                 // 				std::cerr << "Material name : " << theGroup->getMaterial() << std::endl;
                 theMesh = new ObjMesh(theGroup->name /*, theScene->getMaterialByName (theGroup->getMaterial())*/);
                 for (std::map<int, FaceList>::iterator sg = theGroup->faces.begin(); sg != theGroup->faces.end(); ++sg) {
                     //                 std::cerr << "Traitement de " << theGroup->name << " smooth group " << sg->first << std::endl;
-                    std::vector<Face*>::iterator it = sg->second.begin();
-                    if (it != sg->second.end()) {
+                    if (!sg->second.empty()) {
                         // le groupe n'est pas vide !
-                        int type = faceType(*it);
+                        int type = faceType(sg->second);
                         switch (type) {
                         case 0: // group with complete faces
                             if (sg->first == 0) {
@@ -867,15 +451,32 @@ void ObjLoader::addEntities (Scene * theScene, const Transform& transform) {
                         default:
                             std::cerr << "Cas normalement impossible !" << std::endl;
                         }
+                        // les faces ne servent plus
+                        sg->second.clear();
                     }
                 }
 
                 meshes.push_back(theMesh->compile());
+                if (mOptimizeMeshes) {
+                    VertexCache::Stats before, after;
+                    meshes.back()->optimizeVertexCache(&before, &after);
+                    std::cerr << theGroup->name << " : ACMR " << before.acmr << " -> " << after.acmr
+                              << ", ATVR " << before.atvr << " -> " << after.atvr << std::endl;
+                }
+                names.push_back(theGroup->name);
+                materials.push_back(theGroup->getMaterial());
                 delete theMesh;
             }
             delete theGroup;
         }
     }
+
+    if (mWriteCache && !canceled) {
+        std::vector<Loaders::Mesh*> newMeshes(meshes.begin() + firstMesh, meshes.end());
+        if (!MeshCache::write(mFileName, newMeshes, names, materials, cacheOptions(), mCacheDirectory.toStdString()))
+            std::cerr << "warning: unable to write " << MeshCache::cachePath(mFileName, mCacheDirectory.toStdString()) << std::endl;
+        mWriteCache = false;
+    }
 }
 
 } // end namespace obj
@@ -21,6 +21,7 @@
 #define OBJLOADER_H
 
 #include <QString>
+#include <functional>
 #include <vector>
 #include <map>
 #include <iostream>
@@ -30,6 +31,7 @@
 #include "glm/gtx/string_cast.hpp"
 #include "objfileparser.h"
 #include "objmesh.h"
+#include "meshcache.h"
 
 #include "utils.h"
 using namespace Utils;
@@ -81,6 +83,34 @@ public:
     /// @return if loaded correctly or not
     bool load(const QString& filename, QString& reason);
 
+    /// Parse with the memory mapped, multithreaded tokenizer (default) or with the
+    /// historical std::istream based parser.
+    /// @see Obj_mtl::obj_parser::parse_mapped()
+    void setUseMappedParser(bool on) { mUseMappedParser = on; }
+
+    /// Read the meshes from the binary cache when it is up to date, otherwise
+    /// parse the file and (re)write the cache in #getObjects(). Off by
+    /// default: the cache is written beside the file ("model.obj.meshcache")
+    /// unless #setCacheDirectory() is called.
+    /// @see Loaders::MeshCache
+    void setUseMeshCache(bool on) { mUseMeshCache = on; }
+
+    /// Write the mesh caches in "directory", created when missing, e.g. under
+    /// $XDG_CACHE_HOME. Empty (default): beside the files loaded.
+    void setCacheDirectory(const QString& directory) { mCacheDirectory = directory; }
+
+    /// Reorder the triangles and vertices of each mesh for the GPU vertex
+    /// cache in #getObjects(), and print the cache statistics. Off by default.
+    /// When the mesh cache is on, the meshes are cached after the optimization.
+    /// @see Loaders::Mesh::optimizeVertexCache()
+    void setOptimizeMeshes(bool on) { mOptimizeMeshes = on; }
+
+    /// Called by #getObjects() before building each mesh with the number of
+    /// meshes built so far and the total. Returning false cancels: the
+    /// meshes not built yet are dropped and the cache is not written.
+    typedef std::function<bool(int, int)> ProgressCallback;
+    void setProgressCallback(const ProgressCallback& callback) { mProgress = callback; }
+
     /// Get the loaded meshes after calling #load().
     ///  An OBJ defines one or several meshes therefore we return a vector
     ///  "meshes"
@@ -93,6 +123,17 @@ private:
 
     std::string lastParseMessage;
 
+    bool mUseMappedParser;
+
+    bool mOptimizeMeshes;
+
+    bool mUseMeshCache;
+    QString mCacheDirectory;
+    ProgressCallback mProgress;
+    MeshCache mCache;       ///< opened by #load() when the cache is valid
+    std::string mFileName;
+    bool mWriteCache;       ///< file parsed successfully, cache to be written
+
     // table des sommets, normales et coordtextures
     std::vector<glm::vec3> verticesTable;
     int vertices;
@@ -107,225 +148,115 @@ private:
     // triangular faces definition
     enum FaceVertexElement { NORMALS = 0,
                              TEXTURES };
+    enum FaceType { TRIANGLE = 0,
+                    QUAD };
+
     /** @ingroup OBJ-MTL
-                   OBJ vertex.
+                   Read only view of a face stored in a #FaceList.
+                   Indices are 0 based, normals/textures are null when the
+                   face does not reference them.
                 */
-    class VertexObj {
-        friend class ObjLoader;
-        glm::vec3 vertex;
-        glm::vec3 normal;
-        float texcoord[2];
-        bool have[2];
-
-    public:
-        VertexObj(const ObjLoader& loader, int v)
-        {
-            vertex = loader.verticesTable[v];
-            texcoord[0] = texcoord[1] = 0.0f;
-            have[NORMALS] = have[TEXTURES] = false;
-        }
-        VertexObj(const ObjLoader& loader, int v, int t, bool)
-        {
-            vertex = loader.verticesTable[v];
-            texcoord[0] = loader.texturesTable[t].x;
-            texcoord[1] = loader.texturesTable[t].y;
-            have[NORMALS] = false;
-            have[TEXTURES] = true;
-        }
-        VertexObj(const ObjLoader& loader, int v, int n)
-        {
-            vertex = loader.verticesTable[v];
-            normal = loader.normalsTable[n];
-            texcoord[0] = texcoord[1] = 0.0f;
-            have[NORMALS] = true;
-            have[TEXTURES] = false;
-        }
-        VertexObj(const ObjLoader& loader, int v, int t, int n)
-        {
-            vertex = loader.verticesTable[v];
-            normal = loader.normalsTable[n];
-            texcoord[0] = loader.texturesTable[t].x;
-            texcoord[1] = loader.texturesTable[t].y;
-            have[NORMALS] = true;
-            have[TEXTURES] = true;
-        }
-        friend bool operator<(const VertexObj& a, const VertexObj& b)
-        {
-            if (a == b)
-                return false;
-            else if (a.vertex == b.vertex) {
-                // comparer la normale
-                if (a.normal == b.normal) {
-                    // comparer les text coord
-                    if (a.texcoord[0] < b.texcoord[0])
-                        return true;
-                    else if (a.texcoord[0] > b.texcoord[0])
-                        return false;
-                    else
-                        return (a.texcoord[1] < b.texcoord[1]);
-                }
-                else {
-                    // comparer les normales
-                    if (a.normal.x < b.normal.x)
-                        return true;
-                    else if (a.normal.x > b.normal.x)
-                        return false;
-                    else if (a.normal.y < b.normal.y)
-                        return true;
-                    else if (a.normal.y > b.normal.y)
-                        return false;
-                    else
-                        return (a.normal.z < b.normal.z);
-                }
-            }
-            else {
-                if (a.vertex.x < b.vertex.x)
-                    return true;
-                else if (a.vertex.x > b.vertex.x)
-                    return false;
-                else if (a.vertex.y < b.vertex.y)
-                    return true;
-                else if (a.vertex.y > b.vertex.y)
-                    return false;
-                else
-                    return (a.vertex.z < b.vertex.z);
-            }
-        }
-
-        friend bool operator==(const VertexObj& a, const VertexObj& b)
-        {
-            return ((a.vertex == b.vertex) && (a.normal == b.normal) && (a.texcoord[0] == b.texcoord[0]) && (a.texcoord[1] == b.texcoord[1]));
-        }
-
-        friend std::ostream& operator<<(std::ostream& os, const VertexObj& a)
-        {
-            os << "Pos : " << glm::to_string(a.vertex) << " -- Norm : " << glm::to_string(a.normal) << " -- Tex : " << a.texcoord[0] << " " << a.texcoord[1] << " ";
-            return os;
-        }
+    struct FaceRef {
+        FaceType type;
+        int nbCorners;
+        const int* vertices;
+        const int* normals;
+        const int* textures;
     };
 
-    enum FaceType { TRIANGLE = 0,
-                    QUAD };
     /** @ingroup OBJ-MTL
-                   OBJ face.
+                   OBJ faces of a smoothing group.
+                   Corner indices are appended to contiguous arrays (3 or 4
+                   per face, normals/textures only for the faces having them)
+                   with one mask byte per face, instead of a heap allocated
+                   object per face. Faces are read back in order with a
+                   #Reader.
                 */
-    class Face {
+    class FaceList {
         friend class ObjLoader;
-        int vertices[4];
-        int normals[4];
-        int textures[4];
-        bool have[2];
-        FaceType type;
+        enum { HAVE_NORMALS = 1 << NORMALS,
+               HAVE_TEXTURES = 1 << TEXTURES,
+               IS_QUAD = 1 << 2 };
 
-    public:
-        Face(int s0, int s1, int s2)
-        {
-            vertices[0] = s0;
-            vertices[1] = s1;
-            vertices[2] = s2;
-            have[NORMALS] = have[TEXTURES] = false;
-            type = TRIANGLE;
-        }
-        Face(int s0, int s1, int s2, int s3)
-        {
-            vertices[0] = s0;
-            vertices[1] = s1;
-            vertices[2] = s2;
-            vertices[3] = s3;
-            have[NORMALS] = have[TEXTURES] = false;
-            type = QUAD;
-        }
+        std::vector<int> mVertices;
+        std::vector<int> mNormals;
+        std::vector<int> mTextures;
+        std::vector<unsigned char> mMasks;
 
-        Face(int s0, int s1, int s2, int n0, int n1, int n2)
-        {
-            vertices[0] = s0;
-            vertices[1] = s1;
-            vertices[2] = s2;
-            normals[0] = n0;
-            normals[1] = n1;
-            normals[2] = n2;
-            have[NORMALS] = true;
-            have[TEXTURES] = false;
-            type = TRIANGLE;
-        }
+    public:
+        std::size_t size() const { return mMasks.size(); }
+        bool empty() const { return mMasks.empty(); }
 
-        Face(int s0, int s1, int s2, int s3, int n0, int n1, int n2, int n3)
+        /// @param normals, textures : may be null
+        void add(int nbCorners, const int* vertices, const int* normals, const int* textures)
         {
-            vertices[0] = s0;
-            vertices[1] = s1;
-            vertices[2] = s2;
-            vertices[3] = s3;
-            normals[0] = n0;
-            normals[1] = n1;
-            normals[2] = n2;
-            normals[3] = n3;
-            have[NORMALS] = true;
-            have[TEXTURES] = false;
-            type = QUAD;
+            unsigned char mask = (nbCorners == 4) ? IS_QUAD : 0;
+            mVertices.insert(mVertices.end(), vertices, vertices + nbCorners);
+            if (normals) {
+                mNormals.insert(mNormals.end(), normals, normals + nbCorners);
+                mask |= HAVE_NORMALS;
+            }
+            if (textures) {
+                mTextures.insert(mTextures.end(), textures, textures + nbCorners);
+                mask |= HAVE_TEXTURES;
+            }
+            mMasks.push_back(mask);
         }
 
-        Face(int s0, int s1, int s2, int t0, int t1, int t2, bool)
+        bool have(std::size_t face, FaceVertexElement e) const
         {
-            vertices[0] = s0;
-            vertices[1] = s1;
-            vertices[2] = s2;
-            textures[0] = t0;
-            textures[1] = t1;
-            textures[2] = t2;
-            have[NORMALS] = false;
-            have[TEXTURES] = true;
-            type = TRIANGLE;
+            return (mMasks[face] & (1 << e)) != 0;
         }
 
-        Face(int s0, int s1, int s2, int s3, int t0, int t1, int t2, int t3, bool)
+        /// Release the memory
+        void clear()
         {
-            vertices[0] = s0;
-            vertices[1] = s1;
-            vertices[2] = s2;
-            vertices[3] = s3;
-            textures[0] = t0;
-            textures[1] = t1;
-            textures[2] = t2;
-            textures[3] = t3;
-            have[NORMALS] = false;
-            have[TEXTURES] = true;
-            type = QUAD;
-        }
+            std::vector<int>().swap(mVertices);
+            std::vector<int>().swap(mNormals);
+            std::vector<int>().swap(mTextures);
+            std::vector<unsigned char>().swap(mMasks);
+        }
+
+        /// Sequential access to the faces of a #FaceList
+        class Reader {
+        public:
+            Reader(const FaceList& list)
+                : mList(list)
+                , mFace(0)
+                , mVertex(0)
+                , mNormal(0)
+                , mTexture(0)
+            {
+            }
 
-        Face(int s0, int s1, int s2, int n0, int n1, int n2, int t0, int t1, int t2)
-        {
-            vertices[0] = s0;
-            vertices[1] = s1;
-            vertices[2] = s2;
-            normals[0] = n0;
-            normals[1] = n1;
-            normals[2] = n2;
-            textures[0] = t0;
-            textures[1] = t1;
-            textures[2] = t2;
-            have[NORMALS] = have[TEXTURES] = true;
-            type = TRIANGLE;
-        }
+            /// @return false when all faces have been read
+            bool next(FaceRef& f)
+            {
+                if (mFace >= mList.mMasks.size())
+                    return false;
+                unsigned char mask = mList.mMasks[mFace++];
+                f.type = (mask & IS_QUAD) ? QUAD : TRIANGLE;
+                f.nbCorners = (mask & IS_QUAD) ? 4 : 3;
+                f.vertices = &mList.mVertices[mVertex];
+                mVertex += f.nbCorners;
+                f.normals = 0;
+                if (mask & HAVE_NORMALS) {
+                    f.normals = &mList.mNormals[mNormal];
+                    mNormal += f.nbCorners;
+                }
+                f.textures = 0;
+                if (mask & HAVE_TEXTURES) {
+                    f.textures = &mList.mTextures[mTexture];
+                    mTexture += f.nbCorners;
+                }
+                return true;
+            }
 
-        Face(int s0, int s1, int s2, int s3, int n0, int n1, int n2, int n3, int t0, int t1, int t2, int t3)
-        {
-            vertices[0] = s0;
-            vertices[1] = s1;
-            vertices[2] = s2;
-            vertices[3] = s3;
-            normals[0] = n0;
-            normals[1] = n1;
-            normals[2] = n2;
-            normals[3] = n3;
-            textures[0] = t0;
-            textures[1] = t1;
-            textures[2] = t2;
-            textures[3] = t3;
-            have[NORMALS] = have[TEXTURES] = true;
-            type = QUAD;
-        }
+        private:
+            const FaceList& mList;
+            std::size_t mFace, mVertex, mNormal, mTexture;
+        };
     };
-    typedef std::vector<Face*> FaceList;
 
     /** @ingroup OBJ-MTL
                    OBJ group.
@@ -358,10 +289,10 @@ private:
         {
             return material;
         }
-        void addFace(Face* f)
+        void addFace(int nbCorners, const int* vertices, const int* normals, const int* textures)
         {
             empty = false;
-            faces[smoothGroup].push_back(f);
+            faces[smoothGroup].add(nbCorners, vertices, normals, textures);
         }
         FaceList& getFaces(int s = 0)
         {
@@ -433,11 +364,22 @@ private:
     std::map<std::string, mtlMaterial*> mtllib;
     int materialNumber;
 
-    int faceType(Face* f);
+    int faceType(const FaceList& faces);
+
+    /// Options the cached meshes must have been built with
+    unsigned int cacheOptions() const;
 
     // -------------------------
 
 private:
+    /// Weld the corners of 'faces' on their (v, vt, vn) indices
+    /// (see #VertexWelder) and add the resulting smooth group to 'mesh'
+    void addWeldedPart(ObjMesh* mesh, FaceList& faces, bool hasNormals, bool hasTextures);
+    /// Add the corners of 'faces' as is (no welding) to 'mesh'
+    void addRawPart(ObjMesh* mesh, FaceList& faces, bool hasNormals, bool hasTextures);
+    /// Append position (normal) (texcoord) of the corner 'c' of 'f'
+    void pushCorner(std::vector<float>& glVertexBuffer, const FaceRef& f, int c, bool hasNormals, bool hasTextures) const;
+
     void addVerticeNormalTexturePart(ObjMesh* mesh, FaceList& faces, int num);
     void addVerticeNormalPart(ObjMesh* mesh, FaceList& faces, int num);
     void addVerticeTexturePart(ObjMesh* mesh, FaceList& faces, int num);
@@ -474,91 +416,57 @@ protected:
     // Callbacks de faces
     void add_face_T_vertices(int i0, int i1, int i2)
     {
-        currentGroup->addFace(new Face(i0 - 1, i1 - 1, i2 - 1));
+        int v[3] = { i0 - 1, i1 - 1, i2 - 1 };
+        currentGroup->addFace(3, v, 0, 0);
     }
     void add_face_Q_vertices(int i0, int i1, int i2, int i3)
     {
-        currentGroup->addFace(new Face(i0 - 1, i1 - 1, i2 - 1, i3 - 1));
+        int v[4] = { i0 - 1, i1 - 1, i2 - 1, i3 - 1 };
+        currentGroup->addFace(4, v, 0, 0);
     }
 
     void add_face_T_vertices_textures(const Obj_mtl::index_2_tuple_type& v1_vt1, const Obj_mtl::index_2_tuple_type& v2_vt2, const Obj_mtl::index_2_tuple_type& v3_vt3)
     {
-        currentGroup->addFace(new Face(
-            std::get<0>(v1_vt1) - 1,
-            std::get<0>(v2_vt2) - 1,
-            std::get<0>(v3_vt3) - 1,
-            std::get<1>(v1_vt1) - 1,
-            std::get<1>(v2_vt2) - 1,
-            std::get<1>(v3_vt3) - 1,
-            true));
+        int v[3] = { std::get<0>(v1_vt1) - 1, std::get<0>(v2_vt2) - 1, std::get<0>(v3_vt3) - 1 };
+        int t[3] = { std::get<1>(v1_vt1) - 1, std::get<1>(v2_vt2) - 1, std::get<1>(v3_vt3) - 1 };
+        currentGroup->addFace(3, v, 0, t);
     }
 
     void add_face_Q_vertices_textures(const Obj_mtl::index_2_tuple_type& v1_vt1, const Obj_mtl::index_2_tuple_type& v2_vt2, const Obj_mtl::index_2_tuple_type& v3_vt3, const Obj_mtl::index_2_tuple_type& v4_vt4)
     {
-        currentGroup->addFace(new Face(
-            std::get<0>(v1_vt1) - 1,
-            std::get<0>(v2_vt2) - 1,
-            std::get<0>(v3_vt3) - 1,
-            std::get<0>(v4_vt4) - 1,
-            std::get<1>(v1_vt1) - 1,
-            std::get<1>(v2_vt2) - 1,
-            std::get<1>(v3_vt3) - 1,
-            std::get<1>(v4_vt4) - 1, true));
+        int v[4] = { std::get<0>(v1_vt1) - 1, std::get<0>(v2_vt2) - 1, std::get<0>(v3_vt3) - 1, std::get<0>(v4_vt4) - 1 };
+        int t[4] = { std::get<1>(v1_vt1) - 1, std::get<1>(v2_vt2) - 1, std::get<1>(v3_vt3) - 1, std::get<1>(v4_vt4) - 1 };
+        currentGroup->addFace(4, v, 0, t);
     }
 
     void add_face_T_vertices_normals(const Obj_mtl::index_2_tuple_type& v1_vn1, const Obj_mtl::index_2_tuple_type& v2_vn2, const Obj_mtl::index_2_tuple_type& v3_vn3)
     {
-        currentGroup->addFace(new Face(
-            std::get<0>(v1_vn1) - 1,
-            std::get<0>(v2_vn2) - 1,
-            std::get<0>(v3_vn3) - 1,
-            std::get<1>(v1_vn1) - 1,
-            std::get<1>(v2_vn2) - 1,
-            std::get<1>(v3_vn3) - 1));
+        int v[3] = { std::get<0>(v1_vn1) - 1, std::get<0>(v2_vn2) - 1, std::get<0>(v3_vn3) - 1 };
+        int n[3] = { std::get<1>(v1_vn1) - 1, std::get<1>(v2_vn2) - 1, std::get<1>(v3_vn3) - 1 };
+        currentGroup->addFace(3, v, n, 0);
     }
 
     void add_face_Q_vertices_normals(const Obj_mtl::index_2_tuple_type& v1_vn1, const Obj_mtl::index_2_tuple_type& v2_vn2, const Obj_mtl::index_2_tuple_type& v3_vn3, const Obj_mtl::index_2_tuple_type& v4_vn4)
     {
-        currentGroup->addFace(new Face(
-            std::get<0>(v1_vn1) - 1,
-            std::get<0>(v2_vn2) - 1,
-            std::get<0>(v3_vn3) - 1,
-            std::get<0>(v4_vn4) - 1,
-            std::get<1>(v1_vn1) - 1,
-            std::get<1>(v2_vn2) - 1,
-            std::get<1>(v3_vn3) - 1,
-            std::get<1>(v4_vn4) - 1));
+        int v[4] = { std::get<0>(v1_vn1) - 1, std::get<0>(v2_vn2) - 1, std::get<0>(v3_vn3) - 1, std::get<0>(v4_vn4) - 1 };
+        int n[4] = { std::get<1>(v1_vn1) - 1, std::get<1>(v2_vn2) - 1, std::get<1>(v3_vn3) - 1, std::get<1>(v4_vn4) - 1 };
+        currentGroup->addFace(4, v, n, 0);
     }
 
     void add_face_T_vertices_textures_normals(const Obj_mtl::index_3_tuple_type& v1_vtn1, const Obj_mtl::index_3_tuple_type& v2_vtn2, const Obj_mtl::index_3_tuple_type& v3_vtn3)
     {
-        currentGroup->addFace(new Face(
-            std::get<0>(v1_vtn1) - 1,
-            std::get<0>(v2_vtn2) - 1,
-            std::get<0>(v3_vtn3) - 1,
-            std::get<2>(v1_vtn1) - 1,
-            std::get<2>(v2_vtn2) - 1,
-            std::get<2>(v3_vtn3) - 1,
-            std::get<1>(v1_vtn1) - 1,
-            std::get<1>(v2_vtn2) - 1,
-            std::get<1>(v3_vtn3) - 1));
+        int v[3] = { std::get<0>(v1_vtn1) - 1, std::get<0>(v2_vtn2) - 1, std::get<0>(v3_vtn3) - 1 };
+        int t[3] = { std::get<1>(v1_vtn1) - 1, std::get<1>(v2_vtn2) - 1, std::get<1>(v3_vtn3) - 1 };
+        int n[3] = { std::get<2>(v1_vtn1) - 1, std::get<2>(v2_vtn2) - 1, std::get<2>(v3_vtn3) - 1 };
+        currentGroup->addFace(3, v, n, t);
     }
 
     void add_face_Q_vertices_textures_normals(const Obj_mtl::index_3_tuple_type& v1_vtn1, const Obj_mtl::index_3_tuple_type& v2_vtn2, const Obj_mtl::index_3_tuple_type& v3_vtn3, const Obj_mtl::index_3_tuple_type& v4_vtn4)
     {
-        currentGroup->addFace(new Face(
-            std::get<0>(v1_vtn1) - 1,
-            std::get<0>(v2_vtn2) - 1,
-            std::get<0>(v3_vtn3) - 1,
-            std::get<0>(v4_vtn4) - 1,
-            std::get<2>(v1_vtn1) - 1,
-            std::get<2>(v2_vtn2) - 1,
-            std::get<2>(v3_vtn3) - 1,
-            std::get<2>(v4_vtn4) - 1,
-            std::get<1>(v1_vtn1) - 1,
-            std::get<1>(v2_vtn2) - 1,
-            std::get<1>(v3_vtn3) - 1,
-            std::get<1>(v4_vtn4) - 1));
+        int v[4] = { std::get<0>(v1_vtn1) - 1, std::get<0>(v2_vtn2) - 1, std::get<0>(v3_vtn3) - 1, std::get<0>(v4_vtn4) - 1 };
+        int t[4] = { std::get<1>(v1_vtn1) - 1, std::get<1>(v2_vtn2) - 1, std::get<1>(v3_vtn3) - 1, std::get<1>(v4_vtn4) - 1 };
+        int n[4] = { std::get<2>(v1_vtn1) - 1, std::get<2>(v2_vtn2) - 1, std::get<2>(v3_vtn3) - 1, std::get<2>(v4_vtn4) - 1 };
+        currentGroup->addFace(4, v, n, t);
     }
 
     // Callback de groupes
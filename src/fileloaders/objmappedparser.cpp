@@ -0,0 +1,1088 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "objfileparser.h"
+#include "mappedfile.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace Loaders {
+
+// =============================================================================
+namespace {
+// =============================================================================
+
+/*
+  Pointer based tokenizer used by obj_parser::parse_buffer().
+  Every helper works on a [p, end) range which is a single line of the file
+  (end excluded, no '\n' inside) and advances 'p' past what it consumed.
+*/
+
+using Obj_mtl::index_type;
+using Obj_mtl::float_type;
+using Obj_mtl::index_2_tuple_type;
+using Obj_mtl::index_3_tuple_type;
+
+enum Face_format { FACE_V = 0,
+                   FACE_V_VT,
+                   FACE_V_VN,
+                   FACE_V_VT_VN };
+
+/// Exactly representable powers of ten in double precision
+const double pow10_table[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// -----------------------------------------------------------------------------
+
+/// Blank characters inside a line ('\n' is handled by the line splitter)
+inline bool is_blank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline bool is_digit(char c)
+{
+    return (unsigned)(c - '0') < 10u;
+}
+
+inline void skip_blanks(const char*& p, const char* end)
+{
+    while (p < end && is_blank(*p))
+        ++p;
+}
+
+/// @return true if 'p' ends a token (blank or end of line)
+inline bool token_end(const char* p, const char* end)
+{
+    return p == end || is_blank(*p);
+}
+
+inline const char* find_token_end(const char* p, const char* end)
+{
+    while (p < end && !is_blank(*p))
+        ++p;
+    return p;
+}
+
+inline bool same_keyword(const char* keyword, std::size_t length, const char* ref)
+{
+    return length == std::strlen(ref) && std::memcmp(keyword, ref, length) == 0;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Read a signed integer. Fails on overflow like stream extraction does.
+inline bool parse_index(const char*& p, const char* end, index_type& out)
+{
+    const char* s = p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) {
+        negative = (*s == '-');
+        ++s;
+    }
+    if (s == end || !is_digit(*s))
+        return false;
+
+    // one more magnitude on the negative side: "-2147483648" is valid
+    const long long limit = negative ? 0x80000000LL : 0x7fffffffLL;
+    long long value = 0;
+    for (; s < end && is_digit(*s); ++s) {
+        value = value * 10 + (*s - '0');
+        if (value > limit)
+            return false;
+    }
+    out = index_type(negative ? -value : value);
+    p = s;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Slow path for what the fast float parser doesn't handle exactly
+/// (more than 2^53 in the mantissa, huge exponents, hexadecimal, etc.)
+bool parse_float_fallback(const char*& p, const char* end, float_type& out)
+{
+    const char* last = find_token_end(p, end);
+    char buffer[64];
+    std::size_t length = std::size_t(last - p);
+    if (length == 0 || length >= sizeof(buffer))
+        return false;
+
+    std::memcpy(buffer, p, length);
+    buffer[length] = 0;
+    char* stop = 0;
+    out = std::strtof(buffer, &stop);
+    if (stop == buffer)
+        return false;
+    p += stop - buffer;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Read a decimal float: [+-]digits[.digits][(e|E)[+-]digits]
+/// The mantissa is accumulated in an integer and scaled once by an exact
+/// power of ten, so the result is the correctly rounded double converted
+/// to float.
+inline bool parse_float(const char*& p, const char* end, float_type& out)
+{
+    const char* s = p;
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) {
+        negative = (*s == '-');
+        ++s;
+    }
+
+    unsigned long long mantissa = 0;
+    int nb_digits = 0; // significant digits in 'mantissa'
+    int exponent = 0;
+    bool any_digit = false;
+    for (; s < end && is_digit(*s); ++s) {
+        any_digit = true;
+        if (nb_digits < 19) {
+            mantissa = mantissa * 10 + (*s - '0');
+            nb_digits += (mantissa != 0);
+        }
+        else {
+            ++exponent;
+        }
+    }
+    if (s < end && *s == '.') {
+        ++s;
+        for (; s < end && is_digit(*s); ++s) {
+            any_digit = true;
+            if (nb_digits < 19) {
+                mantissa = mantissa * 10 + (*s - '0');
+                nb_digits += (mantissa != 0);
+                --exponent;
+            }
+        }
+    }
+    if (!any_digit)
+        return parse_float_fallback(p, end, out);
+
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        ++s;
+        bool negative_exponent = false;
+        if (s < end && (*s == '-' || *s == '+')) {
+            negative_exponent = (*s == '-');
+            ++s;
+        }
+        if (s == end || !is_digit(*s))
+            return parse_float_fallback(p, end, out);
+        int e = 0;
+        for (; s < end && is_digit(*s); ++s)
+            if (e < 10000)
+                e = e * 10 + (*s - '0');
+        exponent += negative_exponent ? -e : e;
+    }
+
+    if (mantissa == 0) {
+        out = negative ? -float_type(0) : float_type(0);
+        p = s;
+        return true;
+    }
+    // Outside these bounds the double computation is no longer exact
+    if (mantissa > (1ull << 53) || exponent < -22 || exponent > 22)
+        return parse_float_fallback(p, end, out);
+
+    double value = double(mantissa);
+    if (exponent < 0)
+        value /= pow10_table[-exponent];
+    else
+        value *= pow10_table[exponent];
+    out = float_type(negative ? -value : value);
+    p = s;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Read " <float>": at least one blank then a float ending the token.
+inline bool next_float(const char*& p, const char* end, float_type& out)
+{
+    if (p == end || !is_blank(*p))
+        return false;
+    skip_blanks(p, end);
+    return parse_float(p, end, out) && token_end(p, end);
+}
+
+/// Read " <token>" and return its bounds in [first, last)
+inline bool next_token(const char*& p, const char* end, const char*& first, const char*& last)
+{
+    if (p == end || !is_blank(*p))
+        return false;
+    skip_blanks(p, end);
+    if (p == end)
+        return false;
+    first = p;
+    last = p = find_token_end(p, end);
+    return true;
+}
+
+/// @return true if only blanks remain on the line
+inline bool line_end(const char*& p, const char* end)
+{
+    skip_blanks(p, end);
+    return p == end;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Read one face corner: "v", "v/vt", "v//vn" or "v/vt/vn".
+/// idx[] is filled with (v, vt, vn) and 'format' tells which are set.
+inline bool parse_face_vertex(const char*& p, const char* end, index_type idx[3], int& format)
+{
+    if (!parse_index(p, end, idx[0]))
+        return false;
+    format = FACE_V;
+    if (p < end && *p == '/') {
+        ++p;
+        if (p < end && *p == '/') {
+            ++p;
+            if (!parse_index(p, end, idx[2]))
+                return false;
+            format = FACE_V_VN;
+        }
+        else {
+            if (!parse_index(p, end, idx[1]))
+                return false;
+            format = FACE_V_VT;
+            if (p < end && *p == '/') {
+                ++p;
+                if (!parse_index(p, end, idx[2]))
+                    return false;
+                format = FACE_V_VT_VN;
+            }
+        }
+    }
+    return token_end(p, end);
+}
+
+/// Same bounds check as the stream parser: -count <= i <= -1 or 1 <= i <= count
+inline bool index_in_range(index_type i, std::size_t count)
+{
+    return (-index_type(count) <= i && i <= -1) || (1 <= i && i <= index_type(count));
+}
+
+// -----------------------------------------------------------------------------
+
+/// Tokenize every line of [first, last) and hand them to 'sink'.
+/// 'nb_lines' receives the number of lines read.
+/// @return false on the first parse error (already reported to the sink)
+template <class Sink>
+bool scan_lines(const char* first, const char* last, bool blank_lines_as_comment, Sink& sink, std::size_t& nb_lines)
+{
+    std::size_t line_number = 0;
+
+    // Corners of the current face, 3 indices (v, vt, vn) per corner
+    std::vector<index_type> face;
+    face.reserve(3 * 16);
+
+    const char* cursor = first;
+    while (cursor < last) {
+        const char* line_begin = cursor;
+        const char* line_stop = static_cast<const char*>(std::memchr(cursor, '\n', last - cursor));
+        if (!line_stop) {
+            line_stop = last;
+        }
+        cursor = (line_stop < last) ? line_stop + 1 : last;
+        ++line_number;
+
+        const char* p = line_begin;
+        skip_blanks(p, line_stop);
+        if (p == line_stop) {
+            if (blank_lines_as_comment) {
+                sink.comment(line_begin, line_stop);
+            }
+            continue;
+        }
+        if (*p == '#') {
+            sink.comment(line_begin, line_stop);
+            continue;
+        }
+
+        const char* keyword = p;
+        p = find_token_end(p, line_stop);
+        const std::size_t keyword_length = std::size_t(p - keyword);
+
+        // geometric vertex (v)
+        if (same_keyword(keyword, keyword_length, "v")) {
+            float_type x, y, z;
+            if (!next_float(p, line_stop, x) || !next_float(p, line_stop, y) || !next_float(p, line_stop, z) || !line_end(p, line_stop)) {
+                sink.error(line_number, "parse error");
+                return false;
+            }
+            sink.vertex(x, y, z);
+        }
+
+        // texture vertex (vt), the optional w is read and dropped
+        else if (same_keyword(keyword, keyword_length, "vt")) {
+            float_type u, v, w;
+            if (!next_float(p, line_stop, u) || !next_float(p, line_stop, v) || !(line_end(p, line_stop) || (parse_float(p, line_stop, w) && line_end(p, line_stop)))) {
+                sink.error(line_number, "parse error");
+                return false;
+            }
+            sink.texture_vertex(u, v);
+        }
+
+        // vertex normal (vn)
+        else if (same_keyword(keyword, keyword_length, "vn")) {
+            float_type x, y, z;
+            if (!next_float(p, line_stop, x) || !next_float(p, line_stop, y) || !next_float(p, line_stop, z) || !line_end(p, line_stop)) {
+                sink.error(line_number, "parse error");
+                return false;
+            }
+            sink.vertex_normal(x, y, z);
+        }
+
+        // face (f)
+        else if (same_keyword(keyword, keyword_length, "f") || same_keyword(keyword, keyword_length, "fo")) {
+            face.clear();
+            int format = FACE_V;
+            bool ok = true;
+            while (!line_end(p, line_stop)) {
+                index_type idx[3] = { 0, 0, 0 };
+                int corner_format;
+                if (!parse_face_vertex(p, line_stop, idx, corner_format) || (!face.empty() && corner_format != format)) {
+                    ok = false;
+                    break;
+                }
+                format = corner_format;
+                face.push_back(idx[0]);
+                face.push_back(idx[1]);
+                face.push_back(idx[2]);
+            }
+            if (!ok || face.size() < 3 * 3) {
+                sink.error(line_number, "parse error");
+                return false;
+            }
+            if (!sink.face(line_number, format, &face[0], face.size() / 3)) {
+                return false;
+            }
+        }
+
+        // group name (g)
+        else if (same_keyword(keyword, keyword_length, "g")) {
+            const char *name_first, *name_last;
+            const char* rest = p;
+            if (line_end(rest, line_stop)) {
+                sink.default_group();
+            }
+            else {
+                if (!next_token(p, line_stop, name_first, name_last) || !line_end(p, line_stop)) {
+                    sink.error(line_number, "parse error");
+                    return false;
+                }
+                sink.group(name_first, name_last);
+            }
+        }
+
+        // smoothing group (s)
+        else if (same_keyword(keyword, keyword_length, "s")) {
+            const char *number_first, *number_last;
+            if (!next_token(p, line_stop, number_first, number_last) || !line_end(p, line_stop)) {
+                sink.error(line_number, "parse error");
+                return false;
+            }
+            Obj_mtl::size_type group_number = 0;
+            if (!same_keyword(number_first, std::size_t(number_last - number_first), "off")) {
+                const char* n = number_first;
+                if (*n == '+') {
+                    ++n;
+                }
+                if (n == number_last) {
+                    sink.error(line_number, "parse error");
+                    return false;
+                }
+                for (; n < number_last; ++n) {
+                    if (!is_digit(*n)) {
+                        sink.error(line_number, "parse error");
+                        return false;
+                    }
+                    group_number = group_number * 10 + Obj_mtl::size_type(*n - '0');
+                }
+            }
+            sink.smoothing_group(group_number);
+        }
+
+        // object name (o), material library (mtllib), material name (usemtl)
+        else if (same_keyword(keyword, keyword_length, "o") || same_keyword(keyword, keyword_length, "mtllib") || same_keyword(keyword, keyword_length, "usemtl")) {
+            const char *name_first, *name_last;
+            if (!next_token(p, line_stop, name_first, name_last) || !line_end(p, line_stop)) {
+                sink.error(line_number, "parse error");
+                return false;
+            }
+            if (keyword[0] == 'o') {
+                sink.object_name(name_first, name_last);
+            }
+            else if (keyword[0] == 'm') {
+                sink.material_library(name_first, name_last);
+            }
+            else {
+                sink.material_name(name_first, name_last);
+            }
+        }
+
+        // unknown keyword
+        else {
+            sink.unknown(line_number, line_begin, line_stop);
+        }
+    }
+    nb_lines = line_number;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+/*
+  Multithreaded parsing: the buffer is cut in chunks of whole lines. Each
+  chunk is tokenized by a worker into a Chunk (a flat list of events plus the
+  numbers they carry). The calling thread then replays the chunks in file
+  order into the callback sink, so index checks, negative index translation
+  and the g/o/s/usemtl state see exactly the same sequence as a serial parse.
+  Names and comments are kept as ranges inside the parsed buffer.
+*/
+
+enum Event_type { EV_COMMENT = 0,
+                  EV_VERTEX,
+                  EV_TEXTURE_VERTEX,
+                  EV_VERTEX_NORMAL,
+                  EV_FACE,
+                  EV_DEFAULT_GROUP,
+                  EV_GROUP,
+                  EV_SMOOTHING_GROUP,
+                  EV_OBJECT_NAME,
+                  EV_MATERIAL_LIBRARY,
+                  EV_MATERIAL_NAME,
+                  EV_UNKNOWN,
+                  EV_ERROR };
+
+struct Event {
+    unsigned char type;   ///< an Event_type
+    unsigned char format; ///< Face_format for EV_FACE
+    unsigned nb_corners;  ///< for EV_FACE
+    std::size_t line;     ///< line number inside the chunk
+};
+
+struct Chunk {
+    const char* first;
+    const char* last;
+    std::size_t nb_lines;
+    std::vector<Event> events;
+    std::vector<float_type> floats;
+    std::vector<index_type> indices;
+    std::vector<Obj_mtl::size_type> numbers;
+    std::vector<const char*> ranges; ///< [first, last) pairs
+    std::vector<const char*> errors; ///< static error messages
+
+    void release()
+    {
+        std::vector<Event>().swap(events);
+        std::vector<float_type>().swap(floats);
+        std::vector<index_type>().swap(indices);
+        std::vector<Obj_mtl::size_type>().swap(numbers);
+        std::vector<const char*>().swap(ranges);
+    }
+};
+
+/// Sink of scan_lines() recording everything in a Chunk
+class Record_sink {
+public:
+    Record_sink(Chunk& chunk)
+        : _chunk(chunk)
+    {
+        // rough guess: one event every 32 bytes of text
+        std::size_t guess = std::size_t(chunk.last - chunk.first) / 32;
+        _chunk.events.reserve(guess);
+        _chunk.floats.reserve(guess * 3);
+    }
+
+    void comment(const char* first, const char* last) { add_range(EV_COMMENT, first, last); }
+    void vertex(float_type x, float_type y, float_type z) { add_floats(EV_VERTEX, x, y, z); }
+    void texture_vertex(float_type u, float_type v) { add_floats(EV_TEXTURE_VERTEX, u, v, 0); }
+    void vertex_normal(float_type x, float_type y, float_type z) { add_floats(EV_VERTEX_NORMAL, x, y, z); }
+
+    bool face(std::size_t line_number, int format, const index_type* corners, std::size_t nb_corners)
+    {
+        add(EV_FACE, line_number, format, nb_corners);
+        _chunk.indices.insert(_chunk.indices.end(), corners, corners + 3 * nb_corners);
+        return true;
+    }
+
+    void default_group() { add(EV_DEFAULT_GROUP); }
+    void group(const char* first, const char* last) { add_range(EV_GROUP, first, last); }
+    void smoothing_group(Obj_mtl::size_type number)
+    {
+        add(EV_SMOOTHING_GROUP);
+        _chunk.numbers.push_back(number);
+    }
+    void object_name(const char* first, const char* last) { add_range(EV_OBJECT_NAME, first, last); }
+    void material_library(const char* first, const char* last) { add_range(EV_MATERIAL_LIBRARY, first, last); }
+    void material_name(const char* first, const char* last) { add_range(EV_MATERIAL_NAME, first, last); }
+
+    void unknown(std::size_t line_number, const char* first, const char* last)
+    {
+        add(EV_UNKNOWN, line_number);
+        _chunk.ranges.push_back(first);
+        _chunk.ranges.push_back(last);
+    }
+
+    void error(std::size_t line_number, const char* message)
+    {
+        add(EV_ERROR, line_number);
+        _chunk.errors.push_back(message);
+    }
+
+private:
+    void add(Event_type type, std::size_t line = 0, int format = 0, std::size_t nb_corners = 0)
+    {
+        Event e;
+        e.type = (unsigned char)type;
+        e.format = (unsigned char)format;
+        e.nb_corners = (unsigned)nb_corners;
+        e.line = line;
+        _chunk.events.push_back(e);
+    }
+
+    void add_floats(Event_type type, float_type a, float_type b, float_type c)
+    {
+        add(type);
+        _chunk.floats.push_back(a);
+        _chunk.floats.push_back(b);
+        _chunk.floats.push_back(c);
+    }
+
+    void add_range(Event_type type, const char* first, const char* last)
+    {
+        add(type);
+        _chunk.ranges.push_back(first);
+        _chunk.ranges.push_back(last);
+    }
+
+    Chunk& _chunk;
+};
+
+// -----------------------------------------------------------------------------
+
+/// Feed the events of 'chunk' to 'sink', 'line_base' being the number of
+/// lines before the chunk.
+template <class Sink>
+bool replay(const Chunk& chunk, std::size_t line_base, Sink& sink)
+{
+    const float_type* f = chunk.floats.empty() ? 0 : &chunk.floats[0];
+    const index_type* idx = chunk.indices.empty() ? 0 : &chunk.indices[0];
+    const char* const* r = chunk.ranges.empty() ? 0 : &chunk.ranges[0];
+    std::size_t number = 0, error = 0;
+    std::vector<index_type> corners;
+
+    for (std::size_t i = 0; i < chunk.events.size(); ++i) {
+        const Event& e = chunk.events[i];
+        switch (e.type) {
+        case EV_COMMENT:
+            sink.comment(r[0], r[1]);
+            r += 2;
+            break;
+        case EV_VERTEX:
+            sink.vertex(f[0], f[1], f[2]);
+            f += 3;
+            break;
+        case EV_TEXTURE_VERTEX:
+            sink.texture_vertex(f[0], f[1]);
+            f += 3;
+            break;
+        case EV_VERTEX_NORMAL:
+            sink.vertex_normal(f[0], f[1], f[2]);
+            f += 3;
+            break;
+        case EV_FACE:
+            // the sink translates negative indices in place: work on a copy
+            corners.assign(idx, idx + 3 * e.nb_corners);
+            idx += 3 * e.nb_corners;
+            if (!sink.face(line_base + e.line, e.format, &corners[0], e.nb_corners)) {
+                return false;
+            }
+            break;
+        case EV_DEFAULT_GROUP:
+            sink.default_group();
+            break;
+        case EV_GROUP:
+            sink.group(r[0], r[1]);
+            r += 2;
+            break;
+        case EV_SMOOTHING_GROUP:
+            sink.smoothing_group(chunk.numbers[number++]);
+            break;
+        case EV_OBJECT_NAME:
+            sink.object_name(r[0], r[1]);
+            r += 2;
+            break;
+        case EV_MATERIAL_LIBRARY:
+            sink.material_library(r[0], r[1]);
+            r += 2;
+            break;
+        case EV_MATERIAL_NAME:
+            sink.material_name(r[0], r[1]);
+            r += 2;
+            break;
+        case EV_UNKNOWN:
+            sink.unknown(line_base + e.line, r[0], r[1]);
+            r += 2;
+            break;
+        case EV_ERROR:
+            sink.error(line_base + e.line, chunk.errors[error++]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Tokenize [first, last) on 'nb_threads' threads, in chunks of at least
+/// 'min_chunk_size' bytes, and replay it in order into 'sink'. Workers never run more than a few chunks ahead of the replay
+/// to bound the memory used by the recorded events.
+template <class Sink>
+bool scan_chunks(const char* first, const char* last, bool blank_lines_as_comment, unsigned nb_threads, std::size_t min_chunk_size, Sink& sink, std::size_t& nb_lines)
+{
+    const std::size_t size = std::size_t(last - first);
+    const std::size_t chunk_size = std::max(min_chunk_size, size / (4 * nb_threads));
+
+    // Cut at line boundaries
+    std::vector<Chunk> chunks;
+    for (const char* begin = first; begin < last;) {
+        const char* end = begin + std::min(chunk_size, std::size_t(last - begin));
+        if (end < last) {
+            const char* newline = static_cast<const char*>(std::memchr(end, '\n', last - end));
+            end = newline ? newline + 1 : last;
+        }
+        Chunk c;
+        c.first = begin;
+        c.last = end;
+        c.nb_lines = 0;
+        chunks.push_back(c);
+        begin = end;
+    }
+
+    const std::size_t nb_chunks = chunks.size();
+    const std::size_t window = 2 * nb_threads;
+    std::vector<char> ready(nb_chunks, 0);
+    std::size_t next = 0;     // next chunk to tokenize
+    std::size_t replayed = 0; // chunks already replayed
+    bool cancel = false;
+    std::mutex mutex;
+    std::condition_variable cond;
+
+    auto worker = [&]() {
+        for (;;) {
+            std::size_t i;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cond.wait(lock, [&] { return cancel || next >= nb_chunks || next < replayed + window; });
+                if (cancel || next >= nb_chunks) {
+                    return;
+                }
+                i = next++;
+            }
+            Record_sink recorder(chunks[i]);
+            scan_lines(chunks[i].first, chunks[i].last, blank_lines_as_comment, recorder, chunks[i].nb_lines);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ready[i] = 1;
+            }
+            cond.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < nb_threads; ++t) {
+        threads.push_back(std::thread(worker));
+    }
+
+    bool ok = true;
+    std::size_t line_base = 0;
+    for (std::size_t i = 0; i < nb_chunks && ok; ++i) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [&] { return ready[i] != 0; });
+        }
+        ok = replay(chunks[i], line_base, sink);
+        line_base += chunks[i].nb_lines;
+        chunks[i].release();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            replayed = i + 1;
+            cancel = !ok;
+        }
+        cond.notify_all();
+    }
+
+    for (unsigned t = 0; t < nb_threads; ++t) {
+        threads[t].join();
+    }
+    nb_lines = line_base;
+    return ok;
+}
+
+} // END anonymous namespace ===================================================
+
+/// Sink of scan_lines() checking faces and calling the obj_parser callbacks
+class Obj_mtl::obj_parser::Callback_sink {
+public:
+    Callback_sink(const obj_parser& parser)
+        : _parser(parser)
+        , number_of_geometric_vertices(0)
+        , number_of_texture_vertices(0)
+        , number_of_vertex_normals(0)
+        , number_of_faces(0)
+        , number_of_group_names(0)
+        , number_of_smoothing_groups(0)
+        , number_of_object_names(0)
+        , number_of_material_libraries(0)
+        , number_of_material_names(0)
+    {
+    }
+
+    void comment(const char* first, const char* last)
+    {
+        if (_parser.comment_callback_) {
+            _parser.comment_callback_(std::string(first, last));
+        }
+    }
+
+    void vertex(float_type x, float_type y, float_type z)
+    {
+        ++number_of_geometric_vertices;
+        if (_parser.geometric_vertex_callback_) {
+            _parser.geometric_vertex_callback_(x, y, z);
+        }
+    }
+
+    void texture_vertex(float_type u, float_type v)
+    {
+        ++number_of_texture_vertices;
+        if (_parser.texture_vertex_callback_) {
+            _parser.texture_vertex_callback_(u, v);
+        }
+    }
+
+    void vertex_normal(float_type x, float_type y, float_type z)
+    {
+        ++number_of_vertex_normals;
+        if (_parser.vertex_normal_callback_) {
+            _parser.vertex_normal_callback_(x, y, z);
+        }
+    }
+
+    /// Check the indices against what has been read so far, translate the
+    /// negative ones if asked, then emit triangles/quad/polygon.
+    bool face(std::size_t line_number, int format, index_type* corners, std::size_t nb_corners)
+    {
+        const bool has_vt = (format == FACE_V_VT) || (format == FACE_V_VT_VN);
+        const bool has_vn = (format == FACE_V_VN) || (format == FACE_V_VT_VN);
+        for (std::size_t c = 0; c < nb_corners; ++c) {
+            index_type* idx = corners + 3 * c;
+            if (!index_in_range(idx[0], number_of_geometric_vertices)
+                || (has_vt && !index_in_range(idx[1], number_of_texture_vertices))
+                || (has_vn && !index_in_range(idx[2], number_of_vertex_normals))) {
+                error(line_number, "index out of bounds");
+                return false;
+            }
+            if (_parser.flags_ & translate_negative_indices) {
+                if (idx[0] < 0) {
+                    idx[0] += number_of_geometric_vertices + 1;
+                }
+                if (has_vt && idx[1] < 0) {
+                    idx[1] += number_of_texture_vertices + 1;
+                }
+                if (has_vn && idx[2] < 0) {
+                    idx[2] += number_of_vertex_normals + 1;
+                }
+            }
+        }
+
+        _face = corners;
+        _format = format;
+        ++number_of_faces;
+        if (nb_corners == 3) {
+            triangle(0, 1, 2);
+        }
+        else if (_parser.flags_ & triangulate_faces) {
+            for (std::size_t c = 1; c + 1 < nb_corners; ++c) {
+                triangle(0, c, c + 1);
+            }
+        }
+        else if (nb_corners == 4) {
+            quad();
+        }
+        else {
+            polygon(nb_corners);
+        }
+        return true;
+    }
+
+    void default_group()
+    {
+        ++number_of_group_names;
+        if (_parser.group_name_callback_) {
+            _parser.group_name_callback_("default");
+        }
+    }
+
+    void group(const char* first, const char* last)
+    {
+        ++number_of_group_names;
+        if (_parser.group_name_callback_) {
+            _parser.group_name_callback_(std::string(first, last));
+        }
+    }
+
+    void smoothing_group(size_type number)
+    {
+        ++number_of_smoothing_groups;
+        if (_parser.smoothing_group_callback_) {
+            _parser.smoothing_group_callback_(number);
+        }
+    }
+
+    void object_name(const char* first, const char* last)
+    {
+        ++number_of_object_names;
+        if (_parser.object_name_callback_) {
+            _parser.object_name_callback_(std::string(first, last));
+        }
+    }
+
+    void material_library(const char* first, const char* last)
+    {
+        ++number_of_material_libraries;
+        if (_parser.material_library_callback_) {
+            _parser.material_library_callback_(std::string(first, last));
+        }
+    }
+
+    void material_name(const char* first, const char* last)
+    {
+        ++number_of_material_names;
+        if (_parser.material_name_callback_) {
+            _parser.material_name_callback_(std::string(first, last));
+        }
+    }
+
+    void unknown(std::size_t line_number, const char* first, const char* last)
+    {
+        std::string message = "ignoring line " + std::string(first, last);
+        if (_parser.warning_callback_) {
+            _parser.warning_callback_(line_number, message);
+        }
+    }
+
+    void error(std::size_t line_number, const char* message)
+    {
+        if (_parser.error_callback_) {
+            _parser.error_callback_(line_number, message);
+        }
+    }
+
+    void info(std::size_t line_number)
+    {
+        std::ostringstream info_message;
+        info_message << "Vertices : " << number_of_geometric_vertices << std::endl;
+        info_message << "Texture coordinates : " << number_of_texture_vertices << std::endl;
+        info_message << "Normals : " << number_of_vertex_normals << std::endl;
+        info_message << "Faces : " << number_of_faces << std::endl;
+        info_message << "Groups name : " << number_of_group_names << std::endl;
+        info_message << "Smoothing groups : " << number_of_smoothing_groups << std::endl;
+        info_message << "Object names : " << number_of_object_names << std::endl;
+        info_message << "Material Library : " << number_of_material_libraries << std::endl;
+        info_message << "Material names : " << number_of_material_names;
+        if (_parser.info_callback_) {
+            _parser.info_callback_(line_number, info_message.str());
+        }
+    }
+
+private:
+    index_2_tuple_type t2(std::size_t c, int k) const { return index_2_tuple_type(_face[3 * c], _face[3 * c + k]); }
+    index_3_tuple_type t3(std::size_t c) const { return index_3_tuple_type(_face[3 * c], _face[3 * c + 1], _face[3 * c + 2]); }
+
+    void triangle(std::size_t a, std::size_t b, std::size_t c)
+    {
+        switch (_format) {
+        case FACE_V:
+            if (_parser.triangular_face_geometric_vertices_callback_) {
+                _parser.triangular_face_geometric_vertices_callback_(_face[3 * a], _face[3 * b], _face[3 * c]);
+            }
+            break;
+        case FACE_V_VT:
+            if (_parser.triangular_face_geometric_vertices_texture_vertices_callback_) {
+                _parser.triangular_face_geometric_vertices_texture_vertices_callback_(t2(a, 1), t2(b, 1), t2(c, 1));
+            }
+            break;
+        case FACE_V_VN:
+            if (_parser.triangular_face_geometric_vertices_vertex_normals_callback_) {
+                _parser.triangular_face_geometric_vertices_vertex_normals_callback_(t2(a, 2), t2(b, 2), t2(c, 2));
+            }
+            break;
+        case FACE_V_VT_VN:
+            if (_parser.triangular_face_geometric_vertices_texture_vertices_vertex_normals_callback_) {
+                _parser.triangular_face_geometric_vertices_texture_vertices_vertex_normals_callback_(t3(a), t3(b), t3(c));
+            }
+            break;
+        }
+    }
+
+    void quad()
+    {
+        switch (_format) {
+        case FACE_V:
+            if (_parser.quadrilateral_face_geometric_vertices_callback_) {
+                _parser.quadrilateral_face_geometric_vertices_callback_(_face[0], _face[3], _face[6], _face[9]);
+            }
+            break;
+        case FACE_V_VT:
+            if (_parser.quadrilateral_face_geometric_vertices_texture_vertices_callback_) {
+                _parser.quadrilateral_face_geometric_vertices_texture_vertices_callback_(t2(0, 1), t2(1, 1), t2(2, 1), t2(3, 1));
+            }
+            break;
+        case FACE_V_VN:
+            if (_parser.quadrilateral_face_geometric_vertices_vertex_normals_callback_) {
+                _parser.quadrilateral_face_geometric_vertices_vertex_normals_callback_(t2(0, 2), t2(1, 2), t2(2, 2), t2(3, 2));
+            }
+            break;
+        case FACE_V_VT_VN:
+            if (_parser.quadrilateral_face_geometric_vertices_texture_vertices_vertex_normals_callback_) {
+                _parser.quadrilateral_face_geometric_vertices_texture_vertices_vertex_normals_callback_(t3(0), t3(1), t3(2), t3(3));
+            }
+            break;
+        }
+    }
+
+    void polygon(std::size_t nb_corners)
+    {
+        switch (_format) {
+        case FACE_V:
+            if (_parser.polygonal_face_geometric_vertices_begin_callback_) {
+                _parser.polygonal_face_geometric_vertices_begin_callback_(_face[0], _face[3], _face[6]);
+            }
+            for (std::size_t c = 3; c < nb_corners; ++c) {
+                if (_parser.polygonal_face_geometric_vertices_vertex_callback_) {
+                    _parser.polygonal_face_geometric_vertices_vertex_callback_(_face[3 * c]);
+                }
+            }
+            if (_parser.polygonal_face_geometric_vertices_end_callback_) {
+                _parser.polygonal_face_geometric_vertices_end_callback_();
+            }
+            break;
+        case FACE_V_VT:
+            if (_parser.polygonal_face_geometric_vertices_texture_vertices_begin_callback_) {
+                _parser.polygonal_face_geometric_vertices_texture_vertices_begin_callback_(t2(0, 1), t2(1, 1), t2(2, 1));
+            }
+            for (std::size_t c = 3; c < nb_corners; ++c) {
+                if (_parser.polygonal_face_geometric_vertices_texture_vertices_vertex_callback_) {
+                    _parser.polygonal_face_geometric_vertices_texture_vertices_vertex_callback_(t2(c, 1));
+                }
+            }
+            if (_parser.polygonal_face_geometric_vertices_texture_vertices_end_callback_) {
+                _parser.polygonal_face_geometric_vertices_texture_vertices_end_callback_();
+            }
+            break;
+        case FACE_V_VN:
+            if (_parser.polygonal_face_geometric_vertices_vertex_normals_begin_callback_) {
+                _parser.polygonal_face_geometric_vertices_vertex_normals_begin_callback_(t2(0, 2), t2(1, 2), t2(2, 2));
+            }
+            for (std::size_t c = 3; c < nb_corners; ++c) {
+                if (_parser.polygonal_face_geometric_vertices_vertex_normals_vertex_callback_) {
+                    _parser.polygonal_face_geometric_vertices_vertex_normals_vertex_callback_(t2(c, 2));
+                }
+            }
+            if (_parser.polygonal_face_geometric_vertices_vertex_normals_end_callback_) {
+                _parser.polygonal_face_geometric_vertices_vertex_normals_end_callback_();
+            }
+            break;
+        case FACE_V_VT_VN:
+            if (_parser.polygonal_face_geometric_vertices_texture_vertices_vertex_normals_begin_callback_) {
+                _parser.polygonal_face_geometric_vertices_texture_vertices_vertex_normals_begin_callback_(t3(0), t3(1), t3(2));
+            }
+            for (std::size_t c = 3; c < nb_corners; ++c) {
+                if (_parser.polygonal_face_geometric_vertices_texture_vertices_vertex_normals_vertex_callback_) {
+                    _parser.polygonal_face_geometric_vertices_texture_vertices_vertex_normals_vertex_callback_(t3(c));
+                }
+            }
+            if (_parser.polygonal_face_geometric_vertices_texture_vertices_vertex_normals_end_callback_) {
+                _parser.polygonal_face_geometric_vertices_texture_vertices_vertex_normals_end_callback_();
+            }
+            break;
+        }
+    }
+
+    const obj_parser& _parser;
+    const index_type* _face; ///< corners of the face being emitted
+    int _format;
+
+    std::size_t number_of_geometric_vertices, number_of_texture_vertices, number_of_vertex_normals, number_of_faces, number_of_group_names, number_of_smoothing_groups, number_of_object_names, number_of_material_libraries, number_of_material_names;
+};
+
+// -----------------------------------------------------------------------------
+
+bool Obj_mtl::obj_parser::parse_mapped(const std::string& filename)
+{
+    MappedFile file;
+    if (!file.open(filename)) {
+        if (error_callback_) {
+            error_callback_(0, "unable to open file");
+        }
+        return false;
+    }
+    return parse_buffer(file.begin(), file.end());
+}
+
+// -----------------------------------------------------------------------------
+
+bool Obj_mtl::obj_parser::parse_buffer(const char* first, const char* last)
+{
+    const bool blank_lines_as_comment = (flags_ & parse_blank_lines_as_comment) != 0;
+    unsigned nb_threads = 1;
+    if (flags_ & parse_multithreaded) {
+        nb_threads = nb_threads_ != 0 ? nb_threads_ : std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    Callback_sink sink(*this);
+    std::size_t nb_lines = 0;
+    bool ok;
+    // Not worth spawning threads for less than a couple of chunks
+    if (nb_threads > 1 && std::size_t(last - first) > 2 * min_chunk_size_) {
+        ok = scan_chunks(first, last, blank_lines_as_comment, nb_threads, min_chunk_size_, sink, nb_lines);
+    }
+    else {
+        ok = scan_lines(first, last, blank_lines_as_comment, sink, nb_lines);
+    }
+    if (!ok) {
+        return false;
+    }
+    sink.info(nb_lines);
+    return true;
+}
+
+} // END namespace loaders
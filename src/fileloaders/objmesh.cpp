@@ -20,6 +20,7 @@
 #include "objmesh.h"
 
 #include <iostream>
+#include <utility>
 
 namespace Loaders {
 namespace Obj_mtl {
@@ -57,8 +58,16 @@ void ObjMesh::printfInfo() const {
 Mesh *ObjMesh::compile(){
     int nbParts = parts.size();
     Mesh * result = new Mesh();
-    for (int i = 0; i < nbParts; i++)
-        *result += *parts[i];
+    if (nbParts > 1)
+        result->reserve (mNbVert, mNbTri);
+    for (int i = 0; i < nbParts; i++) {
+        // chaque partie est liberee des qu'elle a ete ajoutee
+        *result += std::move(*parts[i]);
+        delete parts[i];
+    }
+    parts.clear();
+    mNbVert = 0;
+    mNbTri = 0;
     return result;
 }
 
@@ -71,6 +80,12 @@ SmoothGroup::SmoothGroup (const std::vector<float> &vertexBuffer,
                 : Mesh (vertexBuffer, triangleBuffer, quadBuffer, hasNormals, hasTextureCoords) {
 }
 
+SmoothGroup::SmoothGroup (std::vector<float> &&vertexBuffer,
+                          std::vector<int> &&triangleBuffer,
+                          std::vector<int> &&quadBuffer, bool hasNormals, bool hasTextureCoords)
+                : Mesh (std::move(vertexBuffer), std::move(triangleBuffer), std::move(quadBuffer), hasNormals, hasTextureCoords) {
+}
+
 } // end namespace obj
 
 } // end namespace loaders
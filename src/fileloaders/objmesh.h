@@ -41,6 +41,14 @@ public:
             bool hasNormals, bool hasTextureCoords
             );
 
+    /// Takes ownership of the buffers (see Loaders::Mesh)
+    SmoothGroup (
+            std::vector<float> &&vertexBuffer,
+            std::vector<int> &&triangleBuffer,
+            std::vector<int> &&quadBuffer,
+            bool hasNormals, bool hasTextureCoords
+            );
+
 };
 
 
@@ -65,6 +73,9 @@ public:
         nbTriangles = mNbTri;
     }
 
+    /// Concatenate the smooth groups into a single Mesh.
+    /// The parts are released while they are concatenated,
+    /// the ObjMesh is left empty.
     Mesh * compile();
 
     std::string getName(){ return mName; }
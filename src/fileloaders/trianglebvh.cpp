@@ -0,0 +1,401 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "trianglebvh.h"
+#include "mesh.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <thread>
+
+namespace Loaders {
+
+namespace {
+
+const int MAX_LEAF_SIZE = 4;
+const int NB_BINS = 16;
+/// Cost of visiting a node relatively to testing a triangle
+const float TRAVERSAL_COST = 1.f;
+/// Deeper nodes become leaves, bounds the traversal stacks
+const int MAX_DEPTH = 100;
+const int STACK_SIZE = MAX_DEPTH + 2;
+/// Under this number of triangles a subtree is built by a single thread
+const int PARALLEL_MIN_TRIANGLES = 1 << 15;
+
+inline float halfArea(const glm::vec3& bmin, const glm::vec3& bmax)
+{
+    glm::vec3 d = glm::max(bmax - bmin, glm::vec3(0.f));
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+/// Slab test, @return the entry distance or a negative value on miss
+inline float intersectBox(const glm::vec3& origin, const glm::vec3& invDir,
+                          const glm::vec3& bmin, const glm::vec3& bmax, float tMax)
+{
+    glm::vec3 t0 = (bmin - origin) * invDir;
+    glm::vec3 t1 = (bmax - origin) * invDir;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+    float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return enter <= exit ? enter : -1.f;
+}
+
+inline glm::vec3 inverse(const glm::vec3& d)
+{
+    return glm::vec3(1.f / d.x, 1.f / d.y, 1.f / d.z);
+}
+
+/// Copy the nodes of a subtree built apart, its inner nodes referenced
+/// their right child relatively to the subtree root
+void appendNodes(std::vector<TriangleBvh::Node>& nodes, const std::vector<TriangleBvh::Node>& subtree)
+{
+    const int base = (int)nodes.size();
+    nodes.insert(nodes.end(), subtree.begin(), subtree.end());
+    for (std::size_t i = base; i < nodes.size(); ++i) {
+        if (!nodes[i].isLeaf())
+            nodes[i].offset += base;
+    }
+}
+
+} // end anonymous namespace
+
+// passed by reference to std::min()
+const int TriangleBvh::PACKET_SIZE;
+
+// -----------------------------------------------------------------------------
+
+TriangleBvh::TriangleBvh(const Mesh& mesh)
+{
+    const int nbVertices = mesh.nbVertices();
+    const int nbTriangles = (int)mesh.mTriangles.size();
+    mPositions.resize(nbVertices);
+    for (int v = 0; v < nbVertices; ++v)
+        mPositions[v] = mesh.position(v);
+
+    mTriangleIds.resize(nbTriangles);
+    mTriangleMin.resize(nbTriangles);
+    mTriangleMax.resize(nbTriangles);
+    mCentroids.resize(nbTriangles);
+    for (int t = 0; t < nbTriangles; ++t) {
+        const unsigned int* tri = mesh.mTriangles[t].indexes;
+        const glm::vec3& p0 = mPositions[tri[0]];
+        const glm::vec3& p1 = mPositions[tri[1]];
+        const glm::vec3& p2 = mPositions[tri[2]];
+        mTriangleIds[t] = t;
+        mTriangleMin[t] = glm::min(p0, glm::min(p1, p2));
+        mTriangleMax[t] = glm::max(p0, glm::max(p1, p2));
+        mCentroids[t] = (mTriangleMin[t] + mTriangleMax[t]) * 0.5f;
+    }
+    if (nbTriangles == 0)
+        return;
+
+    // The first levels launch one thread per left subtree
+    const unsigned int nbThreads = std::max(1u, std::thread::hardware_concurrency());
+    mParallelDepth = 0;
+    while ((1u << mParallelDepth) < nbThreads)
+        ++mParallelDepth;
+
+    // buildNode() reads the triangles of the mesh through mTriangles
+    mTriangles.resize(3 * nbTriangles);
+    for (int t = 0; t < nbTriangles; ++t)
+        std::copy(mesh.mTriangles[t].indexes, mesh.mTriangles[t].indexes + 3, &mTriangles[3 * t]);
+
+    mNodes.reserve(nbTriangles / 2 + 1);
+    buildNode(0, nbTriangles, mNodes, 0);
+    std::vector<glm::vec3>().swap(mTriangleMin);
+    std::vector<glm::vec3>().swap(mTriangleMax);
+    std::vector<glm::vec3>().swap(mCentroids);
+
+    // Triangles in the order of the leaves
+    std::vector<unsigned int> ordered(3 * nbTriangles);
+    for (int i = 0; i < nbTriangles; ++i)
+        std::copy(&mTriangles[3 * mTriangleIds[i]], &mTriangles[3 * mTriangleIds[i]] + 3, &ordered[3 * i]);
+    mTriangles.swap(ordered);
+}
+
+// -----------------------------------------------------------------------------
+
+void TriangleBvh::buildNode(int begin, int end, std::vector<Node>& nodes, int depth)
+{
+    const int index = (int)nodes.size();
+    nodes.push_back(Node());
+
+    glm::vec3 bmin(std::numeric_limits<float>::max()), bmax(-std::numeric_limits<float>::max());
+    glm::vec3 cmin = bmin, cmax = bmax;
+    for (int i = begin; i < end; ++i) {
+        const unsigned int t = mTriangleIds[i];
+        bmin = glm::min(bmin, mTriangleMin[t]);
+        bmax = glm::max(bmax, mTriangleMax[t]);
+        cmin = glm::min(cmin, mCentroids[t]);
+        cmax = glm::max(cmax, mCentroids[t]);
+    }
+    nodes[index].bmin = bmin;
+    nodes[index].bmax = bmax;
+
+    const int count = end - begin;
+    int axis = 0;
+    glm::vec3 extent = cmax - cmin;
+    if (extent.y > extent[axis]) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+
+    int mid = begin;
+    if (count > MAX_LEAF_SIZE && depth < MAX_DEPTH) {
+        if (extent[axis] > 0.f) {
+            // Binned SAH along the largest axis of the centroids
+            glm::vec3 binMin[NB_BINS], binMax[NB_BINS];
+            int binCount[NB_BINS];
+            for (int b = 0; b < NB_BINS; ++b) {
+                binMin[b] = glm::vec3(std::numeric_limits<float>::max());
+                binMax[b] = glm::vec3(-std::numeric_limits<float>::max());
+                binCount[b] = 0;
+            }
+            const float scale = NB_BINS / extent[axis];
+            const float origin = cmin[axis];
+            for (int i = begin; i < end; ++i) {
+                const unsigned int t = mTriangleIds[i];
+                int b = std::min(NB_BINS - 1, (int)((mCentroids[t][axis] - origin) * scale));
+                binMin[b] = glm::min(binMin[b], mTriangleMin[t]);
+                binMax[b] = glm::max(binMax[b], mTriangleMax[t]);
+                ++binCount[b];
+            }
+
+            float rightArea[NB_BINS];
+            int rightCount[NB_BINS];
+            glm::vec3 rmin = binMin[NB_BINS - 1], rmax = binMax[NB_BINS - 1];
+            int rcount = 0;
+            for (int b = NB_BINS - 1; b > 0; --b) {
+                rmin = glm::min(rmin, binMin[b]);
+                rmax = glm::max(rmax, binMax[b]);
+                rcount += binCount[b];
+                rightArea[b] = halfArea(rmin, rmax);
+                rightCount[b] = rcount;
+            }
+            float bestCost = std::numeric_limits<float>::max();
+            int bestSplit = -1;
+            glm::vec3 lmin = binMin[0], lmax = binMax[0];
+            int lcount = 0;
+            for (int b = 1; b < NB_BINS; ++b) {
+                lmin = glm::min(lmin, binMin[b - 1]);
+                lmax = glm::max(lmax, binMax[b - 1]);
+                lcount += binCount[b - 1];
+                if (lcount == 0 || rightCount[b] == 0)
+                    continue;
+                float cost = halfArea(lmin, lmax) * lcount + rightArea[b] * rightCount[b];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestSplit = b;
+                }
+            }
+
+            const float splitCost = TRAVERSAL_COST + bestCost / std::max(halfArea(bmin, bmax), 1e-30f);
+            if (bestSplit > 0 && (splitCost < (float)count || count > 4 * MAX_LEAF_SIZE)) {
+                const std::vector<glm::vec3>& centroids = mCentroids;
+                unsigned int* first = &mTriangleIds[0];
+                mid = (int)(std::partition(first + begin, first + end, [&](unsigned int t) {
+                    return std::min(NB_BINS - 1, (int)((centroids[t][axis] - origin) * scale)) < bestSplit;
+                }) - first);
+            }
+        }
+        if (mid == begin && count > 4 * MAX_LEAF_SIZE) {
+            // Coincident centroids: split in the middle
+            mid = begin + count / 2;
+        }
+    }
+
+    if (mid == begin) {
+        nodes[index].offset = begin;
+        nodes[index].nbTriangles = count;
+        return;
+    }
+
+    nodes[index].nbTriangles = 0;
+    if (count >= PARALLEL_MIN_TRIANGLES && depth < mParallelDepth) {
+        // Subtrees built in parallel then copied one after the other
+        std::vector<Node> left, right;
+        std::thread worker([&]() { buildNode(begin, mid, left, depth + 1); });
+        buildNode(mid, end, right, depth + 1);
+        worker.join();
+        appendNodes(nodes, left);
+        nodes[index].offset = (int)nodes.size();
+        appendNodes(nodes, right);
+    }
+    else {
+        buildNode(begin, mid, nodes, depth + 1);
+        nodes[index].offset = (int)nodes.size();
+        buildNode(mid, end, nodes, depth + 1);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+bool TriangleBvh::intersectTriangle(int i, const Ray& ray, RayHit& hit) const
+{
+    // Moller-Trumbore, both faces count
+    const unsigned int* tri = &mTriangles[3 * i];
+    const glm::vec3& p0 = mPositions[tri[0]];
+    const glm::vec3 e1 = mPositions[tri[1]] - p0;
+    const glm::vec3 e2 = mPositions[tri[2]] - p0;
+    const glm::vec3 p = glm::cross(ray.direction, e2);
+    const float det = glm::dot(e1, p);
+    if (std::fabs(det) < 1e-20f)
+        return false;
+    const float invDet = 1.f / det;
+    const glm::vec3 s = ray.origin - p0;
+    const float u = glm::dot(s, p) * invDet;
+    if (u < 0.f || u > 1.f)
+        return false;
+    const glm::vec3 q = glm::cross(s, e1);
+    const float v = glm::dot(ray.direction, q) * invDet;
+    if (v < 0.f || u + v > 1.f)
+        return false;
+    const float t = glm::dot(e2, q) * invDet;
+    if (t < 0.f || (hit.triangle >= 0 && t >= hit.distance))
+        return false;
+
+    hit.triangle = (int)mTriangleIds[i];
+    hit.distance = t;
+    hit.u = u;
+    hit.v = v;
+    const float w = 1.f - u - v;
+    hit.vertex = (int)(w >= u && w >= v ? tri[0] : (u >= v ? tri[1] : tri[2]));
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+bool TriangleBvh::intersect(const Ray& ray, RayHit& hit) const
+{
+    hit = RayHit();
+    if (mNodes.empty())
+        return false;
+
+    const glm::vec3 invDir = inverse(ray.direction);
+    int stack[STACK_SIZE];
+    int top = 0;
+    if (intersectBox(ray.origin, invDir, mNodes[0].bmin, mNodes[0].bmax, std::numeric_limits<float>::max()) >= 0.f)
+        stack[top++] = 0;
+
+    while (top > 0) {
+        const int node = stack[--top];
+        const Node& n = mNodes[node];
+        const float tMax = hit.triangle >= 0 ? hit.distance : std::numeric_limits<float>::max();
+        if (n.isLeaf()) {
+            for (int i = n.offset; i < n.offset + n.nbTriangles; ++i)
+                intersectTriangle(i, ray, hit);
+            continue;
+        }
+        // The closest child is visited first
+        const Node& left = mNodes[node + 1];
+        const Node& right = mNodes[n.offset];
+        float dl = intersectBox(ray.origin, invDir, left.bmin, left.bmax, tMax);
+        float dr = intersectBox(ray.origin, invDir, right.bmin, right.bmax, tMax);
+        if (dl >= 0.f && dr >= 0.f) {
+            if (dl <= dr) {
+                stack[top++] = n.offset;
+                stack[top++] = node + 1;
+            }
+            else {
+                stack[top++] = node + 1;
+                stack[top++] = n.offset;
+            }
+        }
+        else if (dl >= 0.f)
+            stack[top++] = node + 1;
+        else if (dr >= 0.f)
+            stack[top++] = n.offset;
+    }
+    return hit.triangle >= 0;
+}
+
+// -----------------------------------------------------------------------------
+
+void TriangleBvh::intersectPacket(const Ray* rays, int nbRays, RayHit* hits) const
+{
+    glm::vec3 invDir[PACKET_SIZE];
+    float tMax[PACKET_SIZE];
+    for (int r = 0; r < nbRays; ++r) {
+        hits[r] = RayHit();
+        invDir[r] = inverse(rays[r].direction);
+        tMax[r] = std::numeric_limits<float>::max();
+    }
+    if (mNodes.empty())
+        return;
+
+    // A node is visited from the first ray of the packet hitting its box:
+    // the previous rays missed it in an ancestor
+    int stack[STACK_SIZE];
+    int firstRay[STACK_SIZE];
+    int top = 0;
+    stack[top] = 0;
+    firstRay[top++] = 0;
+    while (top > 0) {
+        --top;
+        const int node = stack[top];
+        const Node& n = mNodes[node];
+        int first = firstRay[top];
+        while (first < nbRays && intersectBox(rays[first].origin, invDir[first], n.bmin, n.bmax, tMax[first]) < 0.f)
+            ++first;
+        if (first == nbRays)
+            continue;
+
+        if (!n.isLeaf()) {
+            // Closest child first, according to the direction of the first ray
+            const Node& left = mNodes[node + 1];
+            const Node& right = mNodes[n.offset];
+            const glm::vec3 delta = (right.bmin + right.bmax) - (left.bmin + left.bmax);
+            const bool leftFirst = glm::dot(delta, rays[first].direction) >= 0.f;
+            stack[top] = leftFirst ? n.offset : node + 1;
+            firstRay[top++] = first;
+            stack[top] = leftFirst ? node + 1 : n.offset;
+            firstRay[top++] = first;
+            continue;
+        }
+        for (int r = first; r < nbRays; ++r) {
+            if (r != first && intersectBox(rays[r].origin, invDir[r], n.bmin, n.bmax, tMax[r]) < 0.f)
+                continue;
+            for (int i = n.offset; i < n.offset + n.nbTriangles; ++i) {
+                if (intersectTriangle(i, rays[r], hits[r]))
+                    tMax[r] = hits[r].distance;
+            }
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void TriangleBvh::intersect(const Ray* rays, int nbRays, RayHit* hits) const
+{
+    const int nbPackets = (nbRays + PACKET_SIZE - 1) / PACKET_SIZE;
+    std::atomic<int> next(0);
+    auto worker = [&]() {
+        for (int p = next++; p < nbPackets; p = next++) {
+            const int first = p * PACKET_SIZE;
+            intersectPacket(rays + first, std::min(PACKET_SIZE, nbRays - first), hits + first);
+        }
+    };
+    const int nbThreads = std::min<int>(nbPackets, std::max(1u, std::thread::hardware_concurrency()));
+    std::vector<std::thread> threads;
+    for (int i = 1; i < nbThreads; ++i)
+        threads.push_back(std::thread(worker));
+    worker();
+    for (std::size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+}
+
+} // end namespace loaders
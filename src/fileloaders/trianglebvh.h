@@ -0,0 +1,108 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef TRIANGLEBVH_H
+#define TRIANGLEBVH_H
+
+#include <vector>
+#include "glm/glm.hpp"
+
+// =============================================================================
+namespace Loaders {
+// =============================================================================
+
+class Mesh;
+
+/** @ingroup FileLoaders
+ *  Half line origin + t direction, t >= 0
+ */
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;
+
+    Ray() {}
+    Ray(const glm::vec3& o, const glm::vec3& d) : origin(o), direction(d) {}
+};
+
+/** @ingroup FileLoaders
+ *  Closest intersection of a ray with the triangles of a mesh
+ */
+struct RayHit {
+    int triangle;   ///< index of the triangle, -1 when the ray misses the mesh
+    int vertex;     ///< vertex of the triangle closest to the hit point
+    float distance; ///< t of the hit point (a distance when the direction is unit)
+    float u, v;     ///< barycentric coordinates of the 2nd and 3rd vertices, 1-u-v for the 1st
+
+    RayHit() : triangle(-1), vertex(-1), distance(0.f), u(0.f), v(0.f) {}
+};
+
+/** @ingroup FileLoaders
+ *  Bounding volume hierarchy over the triangles of a mesh, built in
+ *  parallel with the binned surface area heuristic.
+ *
+ *  The tree keeps its own copy of the positions and of the triangles in leaf
+ *  order, so it stays valid as long as the positions of the mesh don't
+ *  change. Nodes are stored depth first: the left child of an inner node
+ *  follows it.
+ */
+class TriangleBvh {
+public:
+    /// 32 bytes node
+    struct Node {
+        glm::vec3 bmin;
+        int offset;       ///< right child (inner node) or first triangle (leaf)
+        glm::vec3 bmax;
+        int nbTriangles;  ///< 0 for inner nodes
+        bool isLeaf() const { return nbTriangles > 0; }
+    };
+
+    /// Rays traversing the tree together in #intersect(const Ray*, int, RayHit*)
+    static const int PACKET_SIZE = 64;
+
+    explicit TriangleBvh(const Mesh& mesh);
+
+    int nbNodes() const { return (int)mNodes.size(); }
+    const std::vector<Node>& nodes() const { return mNodes; }
+
+    /// Closest hit of "ray", both faces of the triangles count.
+    /// @return false when the ray misses the mesh
+    bool intersect(const Ray& ray, RayHit& hit) const;
+
+    /// Closest hits of many rays (area selection...): neighbouring rays are
+    /// grouped by packets sharing the box tests, packets are spread over the
+    /// CPU cores. hits[i].triangle is -1 when rays[i] misses.
+    void intersect(const Ray* rays, int nbRays, RayHit* hits) const;
+
+private:
+    void buildNode(int begin, int end, std::vector<Node>& nodes, int depth);
+    void intersectPacket(const Ray* rays, int nbRays, RayHit* hits) const;
+    /// Test the triangles of a leaf, update "hit" when one is closer
+    bool intersectTriangle(int i, const Ray& ray, RayHit& hit) const;
+
+    std::vector<Node> mNodes;
+    std::vector<glm::vec3> mPositions;
+    std::vector<unsigned int> mTriangles;   ///< 3 vertex indices per triangle, leaf order
+    std::vector<unsigned int> mTriangleIds; ///< index in the mesh of each triangle of #mTriangles
+    /// Bounds of each triangle, only used during the build
+    std::vector<glm::vec3> mTriangleMin;
+    std::vector<glm::vec3> mTriangleMax;
+    std::vector<glm::vec3> mCentroids;      ///< only used during the build
+    int mParallelDepth;                     ///< only used during the build
+};
+
+} // end namespace loaders =====================================================
+
+#endif // TRIANGLEBVH_H
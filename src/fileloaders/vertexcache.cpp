@@ -0,0 +1,241 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "vertexcache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace Loaders {
+namespace VertexCache {
+
+namespace {
+
+// Parameters of Forsyth's article
+const int LRU_SIZE = 32;
+const float CACHE_DECAY_POWER = 1.5f;
+const float LAST_TRIANGLE_SCORE = 0.75f;
+const float VALENCE_BOOST_SCALE = 2.0f;
+const float VALENCE_BOOST_POWER = 0.5f;
+const int MAX_VALENCE_TABLE = 64;
+
+/// Score tables, computed once
+struct ScoreTables {
+    float cache[LRU_SIZE];
+    float valence[MAX_VALENCE_TABLE];
+
+    ScoreTables()
+    {
+        for (int i = 0; i < LRU_SIZE; ++i) {
+            if (i < 3)
+                cache[i] = LAST_TRIANGLE_SCORE;
+            else
+                cache[i] = std::pow(1.f - float(i - 3) / float(LRU_SIZE - 3), CACHE_DECAY_POWER);
+        }
+        valence[0] = 0.f;
+        for (int i = 1; i < MAX_VALENCE_TABLE; ++i)
+            valence[i] = VALENCE_BOOST_SCALE * std::pow(float(i), -VALENCE_BOOST_POWER);
+    }
+
+    /// @param cachePos : -1 when the vertex is not in the cache
+    /// @param valence : number of triangles not yet emitted using the vertex
+    float score(int cachePos, int valence) const
+    {
+        if (valence == 0)
+            return -1.f;
+        float s = cachePos >= 0 ? cache[cachePos] : 0.f;
+        if (valence < MAX_VALENCE_TABLE)
+            s += this->valence[valence];
+        else
+            s += VALENCE_BOOST_SCALE * std::pow(float(valence), -VALENCE_BOOST_POWER);
+        return s;
+    }
+};
+
+} // end anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+Stats analyze(const unsigned int* indices, std::size_t nbIndices,
+              std::size_t nbVertices, int cacheSize)
+{
+    Stats stats;
+    const std::size_t nbTriangles = nbIndices / 3;
+    if (nbTriangles == 0)
+        return stats;
+
+    // FIFO: a vertex is in the cache if it was inserted less than
+    // "cacheSize" misses ago
+    const std::size_t NONE = std::size_t(-1);
+    std::vector<std::size_t> insertedAt(nbVertices, NONE);
+    std::size_t misses = 0;
+    std::size_t referenced = 0;
+    for (std::size_t i = 0; i < nbTriangles * 3; ++i) {
+        unsigned int v = indices[i];
+        assert(v < nbVertices);
+        if (insertedAt[v] == NONE)
+            ++referenced;
+        if (insertedAt[v] == NONE || misses - insertedAt[v] >= (std::size_t)cacheSize) {
+            insertedAt[v] = misses;
+            ++misses;
+        }
+    }
+    stats.acmr = float(misses) / float(nbTriangles);
+    stats.atvr = float(misses) / float(referenced);
+    return stats;
+}
+
+// -----------------------------------------------------------------------------
+
+void optimizeTriangles(unsigned int* indices, std::size_t nbIndices, std::size_t nbVertices)
+{
+    static const ScoreTables tables;
+    const std::size_t nbTriangles = nbIndices / 3;
+    if (nbTriangles == 0)
+        return;
+
+    // Triangles of each vertex (CSR), the triangles still to be emitted
+    // are kept at the front of the list of each vertex
+    std::vector<unsigned int> firstTriangle(nbVertices + 1, 0);
+    for (std::size_t i = 0; i < nbTriangles * 3; ++i)
+        ++firstTriangle[indices[i] + 1];
+    for (std::size_t v = 0; v < nbVertices; ++v)
+        firstTriangle[v + 1] += firstTriangle[v];
+    std::vector<unsigned int> triangles(nbTriangles * 3);
+    std::vector<unsigned int> valence(nbVertices, 0);
+    for (std::size_t i = 0; i < nbTriangles * 3; ++i) {
+        unsigned int v = indices[i];
+        triangles[firstTriangle[v] + valence[v]++] = (unsigned int)(i / 3);
+    }
+
+    std::vector<int> cachePos(nbVertices, -1);
+    std::vector<float> vertexScore(nbVertices);
+    for (std::size_t v = 0; v < nbVertices; ++v)
+        vertexScore[v] = tables.score(-1, valence[v]);
+
+    std::vector<float> triangleScore(nbTriangles);
+    std::vector<bool> emitted(nbTriangles, false);
+    for (std::size_t t = 0; t < nbTriangles; ++t) {
+        const unsigned int* tri = indices + 3 * t;
+        triangleScore[t] = vertexScore[tri[0]] + vertexScore[tri[1]] + vertexScore[tri[2]];
+    }
+
+    std::vector<unsigned int> output(nbTriangles * 3);
+    int cache[LRU_SIZE];
+    int cacheSize = 0;
+    std::size_t nextUnemitted = 0; // to restart when the cache proposes nothing
+
+    // first triangle: the best score
+    std::size_t best = 0;
+    for (std::size_t t = 1; t < nbTriangles; ++t)
+        if (triangleScore[t] > triangleScore[best])
+            best = t;
+
+    for (std::size_t n = 0; n < nbTriangles; ++n) {
+        const unsigned int* tri = indices + 3 * best;
+        emitted[best] = true;
+        output[3 * n + 0] = tri[0];
+        output[3 * n + 1] = tri[1];
+        output[3 * n + 2] = tri[2];
+
+        // remove the triangle from the lists of its vertices
+        for (int k = 0; k < 3; ++k) {
+            unsigned int v = tri[k];
+            unsigned int* list = &triangles[firstTriangle[v]];
+            unsigned int* last = list + valence[v] - 1;
+            for (unsigned int* it = list; it <= last; ++it) {
+                if (*it == best) {
+                    std::swap(*it, *last);
+                    break;
+                }
+            }
+            --valence[v];
+        }
+
+        // LRU: the vertices of the triangle move to the front
+        int newCache[LRU_SIZE + 3];
+        int newSize = 0;
+        for (int k = 0; k < 3; ++k)
+            newCache[newSize++] = (int)tri[k];
+        for (int i = 0; i < cacheSize; ++i) {
+            int v = cache[i];
+            if (v != (int)tri[0] && v != (int)tri[1] && v != (int)tri[2])
+                newCache[newSize++] = v;
+        }
+
+        // update the scores of the touched vertices and of their triangles
+        for (int i = 0; i < newSize; ++i) {
+            int v = newCache[i];
+            cachePos[v] = i < LRU_SIZE ? i : -1;
+            float score = tables.score(cachePos[v], valence[v]);
+            float delta = score - vertexScore[v];
+            vertexScore[v] = score;
+            const unsigned int* list = &triangles[firstTriangle[v]];
+            for (unsigned int j = 0; j < valence[v]; ++j)
+                triangleScore[list[j]] += delta;
+        }
+        // element wise: std::copy() of a size the compiler can't bound
+        // triggers -Wstringop-overflow at -O2
+        cacheSize = std::min(newSize, LRU_SIZE);
+        for (int i = 0; i < cacheSize; ++i)
+            cache[i] = newCache[i];
+
+        // next triangle: the best among those of the cached vertices
+        float bestScore = -1.f;
+        bool found = false;
+        for (int i = 0; i < cacheSize; ++i) {
+            int v = cache[i];
+            const unsigned int* list = &triangles[firstTriangle[v]];
+            for (unsigned int j = 0; j < valence[v]; ++j) {
+                if (triangleScore[list[j]] > bestScore) {
+                    bestScore = triangleScore[list[j]];
+                    best = list[j];
+                    found = true;
+                }
+            }
+        }
+        if (!found) {
+            while (nextUnemitted < nbTriangles && emitted[nextUnemitted])
+                ++nextUnemitted;
+            best = nextUnemitted;
+        }
+    }
+
+    std::copy(output.begin(), output.end(), indices);
+}
+
+// -----------------------------------------------------------------------------
+
+void optimizeVertexFetch(unsigned int* indices, std::size_t nbIndices,
+                         std::size_t nbVertices, std::vector<unsigned int>& remap)
+{
+    const unsigned int UNUSED = (unsigned int)-1;
+    remap.assign(nbVertices, UNUSED);
+    unsigned int next = 0;
+    for (std::size_t i = 0; i < nbIndices; ++i) {
+        unsigned int& v = indices[i];
+        if (remap[v] == UNUSED)
+            remap[v] = next++;
+        v = remap[v];
+    }
+    for (std::size_t v = 0; v < nbVertices; ++v)
+        if (remap[v] == UNUSED)
+            remap[v] = next++;
+}
+
+} // end namespace VertexCache
+} // end namespace loaders
@@ -0,0 +1,62 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef VERTEXCACHE_H
+#define VERTEXCACHE_H
+
+#include <cstddef>
+#include <vector>
+
+// =============================================================================
+namespace Loaders {
+// =============================================================================
+
+/** @ingroup FileLoaders
+ *  Post-transform vertex cache optimization of triangle lists.
+ *  Pure CPU functions working on index buffers (3 indices per triangle).
+ */
+namespace VertexCache {
+
+/// Statistics of an index buffer through a simulated FIFO vertex cache
+struct Stats {
+    float acmr; ///< average cache miss ratio : transformed vertices per triangle (0.5 .. 3)
+    float atvr; ///< average transformed vertex ratio : transformed / referenced vertices (>= 1)
+    Stats() : acmr(0.f), atvr(0.f) {}
+};
+
+/// Default size of the FIFO used by #analyze()
+const int FIFO_SIZE = 16;
+
+/// Simulate a FIFO post-transform cache of "cacheSize" entries
+Stats analyze(const unsigned int* indices, std::size_t nbIndices,
+              std::size_t nbVertices, int cacheSize = FIFO_SIZE);
+
+/// Reorder the triangles of "indices" in place so that consecutive
+/// triangles share vertices (Tom Forsyth, "Linear-Speed Vertex Cache
+/// Optimisation", with a 32 entries LRU cache model).
+void optimizeTriangles(unsigned int* indices, std::size_t nbIndices, std::size_t nbVertices);
+
+/// Compute a new vertex order following the first reference of each vertex
+/// in "indices", and rewrite "indices" accordingly.
+/// remap[old] = new; unreferenced vertices are moved at the end.
+void optimizeVertexFetch(unsigned int* indices, std::size_t nbIndices,
+                         std::size_t nbVertices, std::vector<unsigned int>& remap);
+
+} // end namespace VertexCache
+
+} // end namespace loaders =====================================================
+
+#endif // VERTEXCACHE_H
@@ -0,0 +1,117 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef VERTEXWELDER_H
+#define VERTEXWELDER_H
+
+#include <cstddef>
+#include <vector>
+
+namespace Loaders {
+namespace Obj_mtl {
+
+/** @ingroup OBJ-MTL
+ *  Open addressing hash table numbering OBJ face corners.
+ *  A corner is the (v, vt, vn) index triple found in the file: equal triples
+ *  reference equal attributes, so welding on the indices alone is enough and
+ *  avoids comparing positions/normals/texcoords.
+ *  New triples are numbered 0, 1, 2... in the order they are first seen.
+ */
+class VertexWelder {
+public:
+    /// @param expectedVertices : hint of the number of unique vertices
+    VertexWelder(std::size_t expectedVertices = 1024)
+        : mSize(0)
+    {
+        std::size_t capacity = 16;
+        while (capacity < 2 * expectedVertices)
+            capacity *= 2;
+        mSlots.resize(capacity);
+        mMask = capacity - 1;
+    }
+
+    /// @return the number of the corner (v, t, n).
+    /// 'inserted' is true if it was not seen before, the returned number
+    /// is then the previous #size().
+    int weld(int v, int t, int n, bool& inserted)
+    {
+        if (2 * std::size_t(mSize + 1) > mSlots.size())
+            grow();
+        std::size_t i = hash(v, t, n) & mMask;
+        while (true) {
+            Slot& s = mSlots[i];
+            if (s.index < 0) {
+                s.v = v;
+                s.t = t;
+                s.n = n;
+                s.index = mSize++;
+                inserted = true;
+                return s.index;
+            }
+            if (s.v == v && s.t == t && s.n == n) {
+                inserted = false;
+                return s.index;
+            }
+            i = (i + 1) & mMask;
+        }
+    }
+
+    /// Number of unique corners
+    int size() const { return mSize; }
+
+private:
+    struct Slot {
+        Slot()
+            : v(0), t(0), n(0), index(-1)
+        {
+        }
+        int v, t, n;
+        int index; ///< -1 for an empty slot
+    };
+
+    static std::size_t hash(int v, int t, int n)
+    {
+        unsigned long long h = (unsigned)v * 0x9E3779B97F4A7C15ull;
+        h ^= (unsigned)t * 0xC2B2AE3D27D4EB4Full;
+        h ^= (unsigned)n * 0x165667B19E3779F9ull;
+        h ^= h >> 29;
+        return std::size_t(h);
+    }
+
+    void grow()
+    {
+        std::vector<Slot> old(mSlots.size() * 2);
+        old.swap(mSlots);
+        mMask = mSlots.size() - 1;
+        for (std::size_t j = 0; j < old.size(); ++j) {
+            if (old[j].index < 0)
+                continue;
+            std::size_t i = hash(old[j].v, old[j].t, old[j].n) & mMask;
+            while (mSlots[i].index >= 0)
+                i = (i + 1) & mMask;
+            mSlots[i] = old[j];
+        }
+    }
+
+    std::vector<Slot> mSlots;
+    std::size_t mMask;
+    int mSize;
+};
+
+} // end namespace obj
+} // end namespace loaders
+
+#endif // VERTEXWELDER_H
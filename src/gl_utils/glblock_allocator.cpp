@@ -0,0 +1,160 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include "glblock_allocator.h"
+
+#include <cassert>
+
+// -----------------------------------------------------------------------------
+
+GlBlock_allocator::GlBlock_allocator(int capacity)
+    : _capacity(0)
+    , _used(0)
+{
+    grow(capacity);
+}
+
+// -----------------------------------------------------------------------------
+
+int GlBlock_allocator::alloc(int size)
+{
+    assert(size > 0);
+    // Smallest free range holding 'size' elements
+    std::multimap<int, int>::iterator it = _free_sizes.lower_bound(size);
+    if (it == _free_sizes.end())
+        return -1;
+
+    const int offset = it->second;
+    const int range = it->first;
+    erase_free(_free.find(offset));
+    if (range > size)
+        insert_free(offset + size, range - size);
+    _blocks[offset] = size;
+    _used += size;
+    return offset;
+}
+
+// -----------------------------------------------------------------------------
+
+void GlBlock_allocator::free(int offset)
+{
+    std::map<int, int>::iterator b = _blocks.find(offset);
+    assert(b != _blocks.end());
+    int start = offset;
+    int size = b->second;
+    _used -= size;
+    _blocks.erase(b);
+
+    // Merge with the free ranges around
+    std::map<int, int>::iterator next = _free.find(start + size);
+    if (next != _free.end()) {
+        size += next->second;
+        erase_free(next);
+    }
+    std::map<int, int>::iterator prev = _free.lower_bound(start);
+    if (prev != _free.begin()) {
+        --prev;
+        if (prev->first + prev->second == start) {
+            start = prev->first;
+            size += prev->second;
+            erase_free(prev);
+        }
+    }
+    insert_free(start, size);
+}
+
+// -----------------------------------------------------------------------------
+
+void GlBlock_allocator::grow(int capacity)
+{
+    if (capacity <= _capacity)
+        return;
+
+    int start = _capacity;
+    int size = capacity - _capacity;
+    if (!_free.empty()) {
+        std::map<int, int>::iterator last = --_free.end();
+        if (last->first + last->second == _capacity) {
+            start = last->first;
+            size += last->second;
+            erase_free(last);
+        }
+    }
+    insert_free(start, size);
+    _capacity = capacity;
+}
+
+// -----------------------------------------------------------------------------
+
+void GlBlock_allocator::defragment(std::vector<Move>& moves)
+{
+    moves.clear();
+    std::map<int, int> packed;
+    int head = 0;
+    for (std::map<int, int>::const_iterator it = _blocks.begin(); it != _blocks.end(); ++it) {
+        if (it->first != head) {
+            Move m = { it->first, head, it->second };
+            moves.push_back(m);
+        }
+        packed.insert(packed.end(), std::make_pair(head, it->second));
+        head += it->second;
+    }
+    _blocks.swap(packed);
+
+    _free.clear();
+    _free_sizes.clear();
+    if (head < _capacity)
+        insert_free(head, _capacity - head);
+}
+
+// -----------------------------------------------------------------------------
+
+int GlBlock_allocator::largest_free() const
+{
+    return _free_sizes.empty() ? 0 : (--_free_sizes.end())->first;
+}
+
+// -----------------------------------------------------------------------------
+
+int GlBlock_allocator::size(int offset) const
+{
+    std::map<int, int>::const_iterator it = _blocks.find(offset);
+    return it == _blocks.end() ? 0 : it->second;
+}
+
+// -----------------------------------------------------------------------------
+
+void GlBlock_allocator::insert_free(int offset, int size)
+{
+    _free[offset] = size;
+    _free_sizes.insert(std::make_pair(size, offset));
+}
+
+// -----------------------------------------------------------------------------
+
+void GlBlock_allocator::erase_free(std::map<int, int>::iterator it)
+{
+    typedef std::multimap<int, int>::iterator Iter;
+    std::pair<Iter, Iter> same_size = _free_sizes.equal_range(it->second);
+    for (Iter s = same_size.first; s != same_size.second; ++s) {
+        if (s->second == it->first) {
+            _free_sizes.erase(s);
+            break;
+        }
+    }
+    _free.erase(it);
+}
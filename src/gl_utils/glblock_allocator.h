@@ -0,0 +1,97 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef GL_BLOCK_ALLOCATOR_HPP__
+#define GL_BLOCK_ALLOCATOR_HPP__
+
+#include <map>
+#include <vector>
+
+/**
+ * @class GlBlock_allocator
+ * @brief Sub-allocates ranges of a buffer of fixed capacity
+ *
+ * Pure book keeping without any OpenGL call: offsets and sizes are in
+ * elements (vertices, indices...) of a buffer owned by someone else.
+ * Allocations take the smallest free range large enough (best fit) and
+ * freed ranges are merged with their free neighbours.
+ *
+ * @code
+ *      GlBlock_allocator a(1024);
+ *      int off = a.alloc(100); // -1 if no free range is large enough
+ *      a.free(off);
+ * @endcode
+ */
+class GlBlock_allocator {
+public:
+    /// A block moved by defragment(), in elements
+    struct Move {
+        int src;
+        int dst;
+        int size;
+    };
+
+    explicit GlBlock_allocator(int capacity = 0);
+
+    /// @return offset of 'size' consecutive elements or -1 when no free
+    /// range is large enough (see largest_free())
+    int alloc(int size);
+
+    /// Release the block starting at 'offset' returned by alloc()
+    void free(int offset);
+
+    /// Enlarge the capacity, the new elements are appended to the last
+    /// free range. Capacity never shrinks.
+    void grow(int capacity);
+
+    /// Pack every block at the beginning of the buffer keeping their order,
+    /// which leaves a single free range at the end.
+    /// @param moves : blocks whose offset changed, by increasing offsets.
+    /// Applied in this order a move never overwrites a block not moved yet.
+    void defragment(std::vector<Move>& moves);
+
+    // =========================================================================
+    /// @name Getter & Setters
+    // =========================================================================
+
+    int capacity() const { return _capacity; }
+
+    /// @return number of elements allocated
+    int used() const { return _used; }
+
+    /// @return size of the largest free range
+    int largest_free() const;
+
+    /// @return size of the block starting at 'offset', 0 if there is none
+    int size(int offset) const;
+
+    int nb_blocks() const { return (int)_blocks.size(); }
+
+    int nb_free_ranges() const { return (int)_free.size(); }
+
+private:
+    void insert_free(int offset, int size);
+    void erase_free(std::map<int, int>::iterator it);
+
+    std::map<int, int> _blocks;          ///< offset -> size of the blocks
+    std::map<int, int> _free;            ///< offset -> size of free ranges
+    std::multimap<int, int> _free_sizes; ///< size -> offset of free ranges
+    int _capacity;
+    int _used;
+};
+
+#endif // GL_BLOCK_ALLOCATOR_HPP__
@@ -18,9 +18,13 @@
  ***************************************************************************/
 
 #include "gldirect_draw.h"
+#include "glring_buffer.h"
+#include "glstate.h"
 
 #include <iostream>
 #include <cmath>
+#include <cstring>
+#include <glm/gtc/packing.hpp>
 
 #include <cassert>
 
@@ -136,6 +140,11 @@ struct GlBuffer_obj {
                   const GLvoid* data,
                   GLenum mode = GL_STREAM_DRAW);
 
+    /// Upload data to a part of the already allocated buffer object
+    void set_sub_data(int offset,
+                      int nb_elt,
+                      const GLvoid* data);
+
     /// Download data from the buffer object
     void get_data(int offset,
                   int nb_elt,
@@ -213,15 +222,16 @@ GlBuffer_obj::GlBuffer_obj(int nb_elt, int type, GLenum mode)
 {
     _data_ratio = guess_data_ratio(type);
     glAssert(glGenBuffers(1, &_buffer_id));
-    glAssert(glBindBuffer(_type, _buffer_id));
+    GlState::current().bind_buffer(_type, _buffer_id);
     glAssert(glBufferData(_type, nb_elt * _data_ratio, NULL, mode));
-    glAssert(glBindBuffer(_type, 0));
+    GlState::current().bind_buffer(_type, 0);
 }
 
 // -----------------------------------------------------------------------------
 
 GlBuffer_obj::~GlBuffer_obj()
 {
+    GlState::current().forget_buffer(_buffer_id);
     glAssert(glDeleteBuffers(1, &_buffer_id));
 }
 
@@ -229,14 +239,14 @@ GlBuffer_obj::~GlBuffer_obj()
 
 void GlBuffer_obj::bind() const
 {
-    glAssert(glBindBuffer(_type, _buffer_id));
+    GlState::current().bind_buffer(_type, _buffer_id);
 }
 
 // -----------------------------------------------------------------------------
 
 void GlBuffer_obj::unbind() const
 {
-    glAssert(glBindBuffer(_type, 0));
+    GlState::current().bind_buffer(_type, 0);
 }
 
 // -----------------------------------------------------------------------------
@@ -253,6 +263,18 @@ void GlBuffer_obj::set_data(int nb_elt,
 
 // -----------------------------------------------------------------------------
 
+void GlBuffer_obj::set_sub_data(int offset,
+                                int nb_elt,
+                                const GLvoid* data)
+{
+    assert(offset + nb_elt <= _size_buffer);
+    bind();
+    glAssert(glBufferSubData(_type, offset * _data_ratio, nb_elt * _data_ratio, data));
+    unbind();
+}
+
+// -----------------------------------------------------------------------------
+
 void GlBuffer_obj::get_data(int offset,
                             int nb_elt,
                             GLvoid* data) const
@@ -278,6 +300,7 @@ bool GlBuffer_obj::unmap() const
 
 #include <string>
 #include <map>
+#include <unordered_map>
 
 #ifndef GL_GEOMETRY_SHADER
 #define GL_GEOMETRY_SHADER (GL_GEOMETRY_SHADER_EXT)
@@ -353,8 +376,8 @@ public:
     /// get linkage status
     int get_status() const;
 
-    /// link the 2 shaders
-    int link() const;
+    /// link the 2 shaders and look up the locations of active uniforms
+    int link();
 
     /// use the program
     int use() const;
@@ -391,6 +414,15 @@ public:
         return set_uniform(name, idx);
     }
 
+    /// @return location of the uniform 'name' or -1 if not active.
+    /// Locations are cached by link(): no opengl call is done.
+    int get_uniform_location(const char* name) const;
+
+    /// Associate the uniform block 'name' to a uniform buffer binding point
+    /// (see glBindBufferBase()).
+    /// @return false if the block is not used by the program
+    bool bind_uniform_block(const char* name, GLuint binding) const;
+
     /// Sets a uniform Matrix4x4
     /// @param is_row_major : does the matrices are row major. (by default
     /// opengl matrices are column major)
@@ -415,10 +447,17 @@ public:
     }
 
 private:
+    /// Fill '_uniforms' with the active uniforms of the linked program
+    void cache_uniforms();
+
     GLuint _id;
     GLuint _vs_id;
     GLuint _gs_id;
     GLuint _fs_id;
+    bool _is_linked; ///< cached link status
+
+    /// Uniforms name to location (uniform blocks members excluded)
+    std::unordered_map<std::string, GLint> _uniforms;
 };
 // =============================================================================
 
@@ -569,6 +608,7 @@ Shader_prog::Shader_prog()
     , _vs_id(0)
     , _gs_id(0)
     , _fs_id(0)
+    , _is_linked(false)
 {
 }
 
@@ -577,6 +617,7 @@ Shader_prog::Shader_prog()
 Shader_prog::Shader_prog(const Shader& vs, const Shader& fs)
     : _id(glCreateProgram())
     , _gs_id(0)
+    , _is_linked(false)
 {
     if (vs.get_type() != GL_VERTEX_SHADER) {
         std::cerr << "Expected a vertex shader !" << std::endl;
@@ -645,8 +686,10 @@ int Shader_prog::get_status() const
 
 // -----------------------------------------------------------------------------
 
-int Shader_prog::link() const
+int Shader_prog::link()
 {
+    _is_linked = false;
+    _uniforms.clear();
     if (_vs_id != 0 || _fs_id != 0) {
         glAssert(glLinkProgram(_id));
         if (get_status() != GL_TRUE) {
@@ -659,6 +702,8 @@ int Shader_prog::link() const
             fflush(stderr);
             return 0;
         }
+        _is_linked = true;
+        cache_uniforms();
         return 1;
     }
     return 0;
@@ -666,10 +711,60 @@ int Shader_prog::link() const
 
 // -----------------------------------------------------------------------------
 
+void Shader_prog::cache_uniforms()
+{
+    GLint nb_uniforms = 0;
+    GLint max_length = 0;
+    glAssert(glGetProgramiv(_id, GL_ACTIVE_UNIFORMS, &nb_uniforms));
+    glAssert(glGetProgramiv(_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length));
+
+    std::vector<char> buff(max_length + 1);
+    for (GLint i = 0; i < nb_uniforms; ++i) {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        glAssert(glGetActiveUniform(_id, i, (GLsizei)buff.size(), &length, &size, &type, &(buff[0])));
+
+        std::string name(&(buff[0]), length);
+        GLint loc = glGetUniformLocation(_id, name.c_str());
+        GL_CHECK_ERRORS();
+        if (loc == -1)
+            continue; // Member of a uniform block
+
+        _uniforms[name] = loc;
+        // Arrays are listed as "name[0]" but can be set through "name"
+        std::string::size_type bracket = name.find('[');
+        if (bracket != std::string::npos)
+            _uniforms[name.substr(0, bracket)] = loc;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+int Shader_prog::get_uniform_location(const char* name) const
+{
+    std::unordered_map<std::string, GLint>::const_iterator it = _uniforms.find(name);
+    return it == _uniforms.end() ? -1 : it->second;
+}
+
+// -----------------------------------------------------------------------------
+
+bool Shader_prog::bind_uniform_block(const char* name, GLuint binding) const
+{
+    GLuint idx = glGetUniformBlockIndex(_id, name);
+    GL_CHECK_ERRORS();
+    if (idx == GL_INVALID_INDEX)
+        return false;
+    glAssert(glUniformBlockBinding(_id, idx, binding));
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
 int Shader_prog::use() const
 {
-    if (get_status() == GL_TRUE) {
-        glAssert(glUseProgram(_id));
+    if (_is_linked) {
+        GlState::current().use_program(_id);
         return 1;
     }
     return 0;
@@ -679,7 +774,7 @@ int Shader_prog::use() const
 
 int Shader_prog::unuse()
 {
-    glAssert(glUseProgram(0));
+    GlState::current().use_program(0);
     return 1;
 }
 
@@ -721,8 +816,7 @@ int Shader_prog::set_uniform(const char* name, unsigned v0) const
 int Shader_prog::set_uniform(const char* name, int v0) const
 {
     assert(Shader_prog::currently_used() == (int)_id);
-    int res = glGetUniformLocation(_id, name);
-    GL_CHECK_ERRORS();
+    int res = get_uniform_location(name);
     if (res != -1) {
         glAssert(glUniform1i(res, v0));
         return 1;
@@ -735,8 +829,7 @@ int Shader_prog::set_uniform(const char* name, int v0) const
 int Shader_prog::set_uniform(const char* name, int v0, int v1) const
 {
     assert(Shader_prog::currently_used() == (int)_id);
-    int res = glGetUniformLocation(_id, name);
-    GL_CHECK_ERRORS();
+    int res = get_uniform_location(name);
     if (res != -1) {
         glAssert(glUniform2i(res, v0, v1));
         return 1;
@@ -749,8 +842,7 @@ int Shader_prog::set_uniform(const char* name, int v0, int v1) const
 int Shader_prog::set_uniform(const char* name, int v0, int v1, int v2) const
 {
     assert(Shader_prog::currently_used() == (int)_id);
-    int res = glGetUniformLocation(_id, name);
-    GL_CHECK_ERRORS();
+    int res = get_uniform_location(name);
     if (res != -1) {
         glAssert(glUniform3i(res, v0, v1, v2));
         return 1;
@@ -763,8 +855,7 @@ int Shader_prog::set_uniform(const char* name, int v0, int v1, int v2) const
 int Shader_prog::set_uniform(const char* name, int v0, int v1, int v2, int v3) const
 {
     assert(Shader_prog::currently_used() == (int)_id);
-    int res = glGetUniformLocation(_id, name);
-    GL_CHECK_ERRORS();
+    int res = get_uniform_location(name);
     if (res != -1) {
         glAssert(glUniform4i(res, v0, v1, v2, v3));
         return 1;
@@ -777,8 +868,7 @@ int Shader_prog::set_uniform(const char* name, int v0, int v1, int v2, int v3) c
 int Shader_prog::set_uniform(const char* name, GLsizei count, int* values) const
 {
     assert(Shader_prog::currently_used() == (int)_id);
-    int res = glGetUniformLocation(_id, name);
-    GL_CHECK_ERRORS();
+    int res = get_uniform_location(name);
     if (res != -1) {
         glAssert(glUniform1iv(res, count, values));
         return 1;
@@ -791,8 +881,7 @@ int Shader_prog::set_uniform(const char* name, GLsizei count, int* values) const
 int Shader_prog::set_uniform(const char* name, float v0) const
 {
     assert(Shader_prog::currently_used() == (int)_id);
-    int res = glGetUniformLocation(_id, name);
-    GL_CHECK_ERRORS();
+    int res = get_uniform_location(name);
     if (res != -1) {
         glAssert(glUniform1f(res, v0));
         return 1;
@@ -805,8 +894,7 @@ int Shader_prog::set_uniform(const char* name, float v0) const
 int Shader_prog::set_uniform(const char* name, float v0, float v1) const
 {
     assert(Shader_prog::currently_used() == (int)_id);
-    int res = glGetUniformLocation(_id, name);
-    GL_CHECK_ERRORS();
+    int res = get_uniform_location(name);
     if (res != -1) {
         glAssert(glUniform2f(res, v0, v1));
         return 1;
@@ -819,8 +907,7 @@ int Shader_prog::set_uniform(const char* name, float v0, float v1) const
 int Shader_prog::set_uniform(const char* name, float v0, float v1, float v2) const
 {
     assert(Shader_prog::currently_used() == (int)_id);
-    int res = glGetUniformLocation(_id, name);
-    GL_CHECK_ERRORS();
+    int res = get_uniform_location(name);
     if (res != -1) {
         glAssert(glUniform3f(res, v0, v1, v2));
         return 1;
@@ -833,8 +920,7 @@ int Shader_prog::set_uniform(const char* name, float v0, float v1, float v2) con
 int Shader_prog::set_uniform(const char* name, float v0, float v1, float v2, float v3) const
 {
     assert(Shader_prog::currently_used() == (int)_id);
-    int res = glGetUniformLocation(_id, name);
-    GL_CHECK_ERRORS();
+    int res = get_uniform_location(name);
     if (res != -1) {
         glAssert(glUniform4f(res, v0, v1, v2, v3));
         return 1;
@@ -847,8 +933,7 @@ int Shader_prog::set_uniform(const char* name, float v0, float v1, float v2, flo
 int Shader_prog::set_uniform(const char* name, GLsizei count, float* values) const
 {
     assert(Shader_prog::currently_used() == (int)_id);
-    int res = glGetUniformLocation(_id, name);
-    GL_CHECK_ERRORS();
+    int res = get_uniform_location(name);
     if (res != -1) {
         glAssert(glUniform1fv(res, count, values));
         return 1;
@@ -861,8 +946,7 @@ int Shader_prog::set_uniform(const char* name, GLsizei count, float* values) con
 int Shader_prog::set_mat4x4(const char* name, const float* values, GLsizei count, bool is_row_major) const
 {
     assert(Shader_prog::currently_used() == (int)_id);
-    int res = glGetUniformLocation(_id, name);
-    GL_CHECK_ERRORS();
+    int res = get_uniform_location(name);
     if (res != -1) {
         glAssert(glUniformMatrix4fv(res, count, is_row_major, values));
         return 1;
@@ -896,6 +980,7 @@ Shader_prog::~Shader_prog()
     if (_fs_id != 0)
         glAssert(glDetachShader(_id, _fs_id));
 
+    GlState::current().forget_program(_id);
     glAssert(glDeleteProgram(_id));
 }
 
@@ -915,35 +1000,47 @@ public:
 
     ~GlVao()
     {
+        GlState::current().forget_vertex_array(_id);
         glDeleteVertexArrays(1, &_id);
     }
 
     void bind()
     {
-        glAssert(glBindVertexArray(_id));
+        GlState::current().bind_vertex_array(_id);
     }
 
     static void unbind()
     {
-        glBindVertexArray(0);
+        GlState::current().bind_vertex_array(0);
     }
 
     /// @param vbo_id : opengl identifier of the vertex object buffer to
     /// be recorded by the VAO
     /// @param attr_idx : index of the attribute
     /// @param nb_components : number of components (x, y, z ...) of the attribute
+    /// @param type : type of the components, integer types are normalized
+    /// @param stride, offset : byte size of a vertex and byte offset of the
+    /// attribute in the buffer
     /// @warning you must bind the vao buffer using this method
-    void record_attr(GLuint vbo_id, int attr_idx, int nb_components)
+    void record_attr(GLuint vbo_id, int attr_idx, int nb_components,
+                     GLenum type = GL_FLOAT, int stride = 0, int offset = 0)
     {
-        glAssert(glBindBuffer(GL_ARRAY_BUFFER, vbo_id));
-        glAssert(glVertexAttribPointer(attr_idx, nb_components, GL_FLOAT, GL_FALSE, 0, 0));
+        GLboolean normalized = (type == GL_FLOAT || type == GL_HALF_FLOAT) ? GL_FALSE : GL_TRUE;
+        GlState::current().bind_buffer(GL_ARRAY_BUFFER, vbo_id);
+        glAssert(glVertexAttribPointer(attr_idx, nb_components, type, normalized, stride, (const GLvoid*)(size_t)offset));
         glAssert(glEnableVertexAttribArray(attr_idx));
     }
 
+    /// @warning you must bind the vao buffer using this method
+    void disable_attr(int attr_idx)
+    {
+        glAssert(glDisableVertexAttribArray(attr_idx));
+    }
+
     /// @warning you must bind the vao buffer using this method
     void record_elt(GLuint vbo_elts_id)
     {
-        glAssert(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, vbo_elts_id));
+        GlState::current().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, vbo_elts_id);
     }
 
 private:
@@ -1187,16 +1284,30 @@ namespace Shader_dd {
 Shader_prog* phong_shader = 0;
 int acc = 0;
 
+/// CPU image of the 'Matrices' uniform block (std140: mat4 are 4 vec4
+/// columns, no padding)
+struct Matrices_std140 {
+    float model_view[16];
+    float projection[16];
+    float mvp[16];
+    float normal[16];
+};
+
+/// Uniform buffer holding a Matrices_std140
+GlBuffer_obj* matrices_ubo = 0;
+
 // -----------------------------------------------------------------------------
 
 // Hard coded phong vertex shader
 const char* src_vert = "#version 150\n"
                        "#extension GL_EXT_gpu_shader4 : enable\n"
-                       "// Matrices\n"
-                       "uniform mat4 modelViewMatrix;\n"
-                       "uniform mat4 projectionMatrix;\n"
-                       "uniform mat4 MVP;\n"
-                       "uniform mat4 normalMatrix;\n"
+                       "// Matrices (written once by set_matrix() in a uniform buffer)\n"
+                       "layout(std140) uniform Matrices {\n"
+                       "   mat4 modelViewMatrix;\n"
+                       "   mat4 projectionMatrix;\n"
+                       "   mat4 MVP;\n"
+                       "   mat4 normalMatrix;\n"
+                       "};\n"
                        "in vec3 inPosition;\n"
                        "in vec3 inNormal;\n"
                        "in vec4 inTexCoord;\n"
@@ -1287,6 +1398,9 @@ void init()
 
     if (!phong_shader->get_status())
         assert(false);
+
+    phong_shader->bind_uniform_block("Matrices", GlDirectDraw::MATRICES_BINDING);
+    matrices_ubo = new GlBuffer_obj(sizeof(Matrices_std140), GL_UNIFORM_BUFFER, GL_DYNAMIC_DRAW);
 }
 
 // -----------------------------------------------------------------------------
@@ -1298,6 +1412,8 @@ void clear()
         return;
     delete phong_shader;
     phong_shader = 0;
+    delete matrices_ubo;
+    matrices_ubo = 0;
 }
 
 } // END SHADER_DD ==============================================================
@@ -1314,10 +1430,17 @@ GlDirectDraw::GlDirectDraw(bool use_internal_shader, GLenum buffer_mode)
     , _auto_normals(false)
     , _auto_normalize(false)
     , _enable_lighting(false)
+    , _compact_formats(false)
     , _curr_mode(MODE_NONE)
+    , _is_streaming(false)
+    , _stream_capacity(0)
+    , _ring(0)
+    , _stream_vao(0)
 {
-    for (int i = 0; i < ATTR_SIZE; ++i)
+    for (int i = 0; i < ATTR_SIZE; ++i) {
         _attrs_index[i] = -1;
+        _attr_used[i] = false;
+    }
 
     // Init attributes component size
     _attributes[ATTR_POSITION].size = 3;  // x, y, z
@@ -1353,24 +1476,74 @@ void GlDirectDraw::clear()
     */
 
     for (int attr_t = 0; attr_t < ATTR_SIZE; ++attr_t) {
-        for (int mode_t = 0; mode_t < MODE_SIZE; ++mode_t) {
-            int size = (int)_gpu_buffers[attr_t][mode_t].size();
-            for (int ith_buffer = 0; ith_buffer < size; ++ith_buffer)
-                delete _gpu_buffers[attr_t][mode_t][ith_buffer];
-
-            _gpu_buffers[attr_t][mode_t].clear();
-            _gpu_maps[attr_t][mode_t].clear();
+        for (int mode_t = 0; mode_t < MODE_SIZE; ++mode_t)
             _cpu_buffers[attr_t][mode_t].clear();
-        }
     }
 
-    // Delete Vaos:
+    // Delete VBOs and Vaos:
     for (int mode_t = 0; mode_t < MODE_SIZE; ++mode_t) {
-        int size = (int)_vaos[mode_t].size();
+        int size = (int)_gpu_buffers[mode_t].size();
+        for (int ith_buffer = 0; ith_buffer < size; ++ith_buffer)
+            delete _gpu_buffers[mode_t][ith_buffer];
+        _gpu_buffers[mode_t].clear();
+        _gpu_maps[mode_t].clear();
+        _layouts[mode_t].clear();
+
+        size = (int)_vaos[mode_t].size();
         for (int ith_vao = 0; ith_vao < size; ++ith_vao)
             delete _vaos[mode_t][ith_vao];
         _vaos[mode_t].clear();
+        _stream_offsets[mode_t].clear();
+
+        release_merged((Mode_t)mode_t);
+        _merged[mode_t].first.clear();
     }
+
+    // Streamed ranges were drawn (or dropped): hand them back to the ring
+    // once the GPU is done with them
+    if (_ring != 0)
+        _ring->fence();
+}
+
+// -----------------------------------------------------------------------------
+
+void GlDirectDraw::set_streaming(bool state, int nb_verts)
+{
+    assert_msg(!_is_begin && !_is_update, "ERROR: can't be called inside begin() end() calls");
+#ifdef USE_GL_LEGACY
+    if (state)
+        std::cerr << "WARNING: streaming mode needs OpenGL 3.1 or higher" << std::endl;
+    state = false;
+#endif
+    clear();
+    if (state == _is_streaming && nb_verts == _stream_capacity)
+        return;
+
+    release_streaming();
+    _is_streaming = state;
+    if (!state)
+        return;
+
+    // Sized for vertices storing every attribute as floats
+    int nb_words = 0;
+    for (int attr_t = 0; attr_t < ATTR_SIZE; ++attr_t)
+        nb_words += nb_verts * _attributes[attr_t].size;
+
+    _stream_capacity = nb_verts;
+    GlRing_backend* backend = new GlRing_backend_gl(nb_words * (int)sizeof(float));
+    _ring = new GlRing_buffer(backend, nb_words, (int)sizeof(float));
+}
+
+// -----------------------------------------------------------------------------
+
+void GlDirectDraw::release_streaming()
+{
+    delete _ring;
+    _ring = 0;
+    delete _stream_vao;
+    _stream_vao = 0;
+    _stream_capacity = 0;
+    _is_streaming = false;
 }
 
 // -----------------------------------------------------------------------------
@@ -1390,6 +1563,7 @@ GlDirectDraw::~GlDirectDraw()
 {
     Shader_dd::clear();
     clear();
+    release_streaming();
 }
 
 // -----------------------------------------------------------------------------
@@ -1404,13 +1578,11 @@ void GlDirectDraw::begin(GLenum gl_mode)
     assert_msg(it != _gl_mode_to_our.end(), "ERROR: unsupported drawing mode");
     _curr_mode = it->second;
 
+    // GPU objects are created by end() once the layout is known
     for (int attr_t = 0; attr_t < ATTR_SIZE; ++attr_t) {
         _cpu_buffers[attr_t][_curr_mode].push_back(std::vector<float>());
         _cpu_buffers[attr_t][_curr_mode][_cpu_buffers[attr_t][_curr_mode].size() - 1].reserve(128 * 4); ////////////////////DEBUG
-        _gpu_buffers[attr_t][_curr_mode].push_back(new GlBuffer_obj(GL_ARRAY_BUFFER));
-        _gpu_maps[attr_t][_curr_mode].push_back(0);
     }
-    _vaos[_curr_mode].push_back(new GlVao());
 }
 
 // -----------------------------------------------------------------------------
@@ -1445,6 +1617,7 @@ GlDirectDraw::Attr_id GlDirectDraw::vertex3f(GLfloat x, GLfloat y, GLfloat z)
 
 void GlDirectDraw::color3f(GLfloat r, GLfloat g, GLfloat b)
 {
+    _attr_used[ATTR_COLOR] = true;
     _attributes[ATTR_COLOR].set(r, g, b, 1.f);
 }
 
@@ -1452,6 +1625,7 @@ void GlDirectDraw::color3f(GLfloat r, GLfloat g, GLfloat b)
 
 void GlDirectDraw::color4f(GLfloat r, GLfloat g, GLfloat b, GLfloat a)
 {
+    _attr_used[ATTR_COLOR] = true;
     _attributes[ATTR_COLOR].set(r, g, b, a);
 }
 
@@ -1465,6 +1639,7 @@ void GlDirectDraw::normal3f(GLfloat x, GLfloat y, GLfloat z)
         y /= n;
         z /= n;
     }
+    _attr_used[ATTR_NORMAL] = true;
     _attributes[ATTR_NORMAL].set(x, y, z, 0.f);
 }
 
@@ -1472,7 +1647,8 @@ void GlDirectDraw::normal3f(GLfloat x, GLfloat y, GLfloat z)
 
 void GlDirectDraw::texCoords2f(GLfloat u, GLfloat v)
 {
-    _attributes[ATTR_COLOR].set(u, v, 0.f, 0.f);
+    _attr_used[ATTR_TEX_COORD] = true;
+    _attributes[ATTR_TEX_COORD].set(u, v, 0.f, 0.f);
 }
 
 // -----------------------------------------------------------------------------
@@ -1722,6 +1898,7 @@ void GlDirectDraw::convert_prim(
     Mode_t new_mode,
     void (*conv_func)(int attr_size, const std::vector<float>& quad_attr, std::vector<float>& tri_attr))
 {
+    // Only CPU buffers exist at this point (see end())
     for (int attr_t = 0; attr_t < ATTR_SIZE; ++attr_t) {
         std::vector<float>& quad_attr = _cpu_buffers[attr_t][old_mode][buff_id];
         std::vector<float> tri_attr;
@@ -1734,23 +1911,9 @@ void GlDirectDraw::convert_prim(
         _cpu_buffers[attr_t][old_mode].erase(_cpu_buffers[attr_t][old_mode].begin() + buff_id);
         // Create tri cpu
         _cpu_buffers[attr_t][new_mode].push_back(tri_attr);
-        // Delete quad VBO and mapping
-        delete _gpu_buffers[attr_t][old_mode][buff_id];
-        _gpu_buffers[attr_t][old_mode].erase(_gpu_buffers[attr_t][old_mode].begin() + buff_id);
-        _gpu_maps[attr_t][old_mode].erase(_gpu_maps[attr_t][old_mode].begin() + buff_id);
-        // Create triangle VBO and mapping
-        _gpu_buffers[attr_t][new_mode].push_back(new GlBuffer_obj(GL_ARRAY_BUFFER));
-        _gpu_maps[attr_t][new_mode].push_back(0);
     }
-
-    // Delete quad VAO
-    delete _vaos[old_mode][buff_id];
-    _vaos[old_mode].erase(_vaos[old_mode].begin() + buff_id);
-    // Create triangle VAO
-    _vaos[new_mode].push_back(new GlVao());
 }
 
-
 // -----------------------------------------------------------------------------
 
 void GlDirectDraw::convert_to_triangles(int buff_id)
@@ -1774,8 +1937,7 @@ void GlDirectDraw::end(bool direct_draw)
     _is_begin = false;
 
 
-    int plast = (int)_cpu_buffers[ATTR_POSITION][_curr_mode].size() - 1;
-    int last = (int)_vaos[_curr_mode].size() - 1;
+    int last = (int)_cpu_buffers[ATTR_POSITION][_curr_mode].size() - 1;
 
     // In opengl 3.1 QUADS are not supported any more we have to convert them to
     // triangles
@@ -1790,6 +1952,9 @@ void GlDirectDraw::end(bool direct_draw)
     }
 #endif
 
+    // Converted buffers are appended to their new mode
+    last = (int)_cpu_buffers[ATTR_POSITION][_curr_mode].size() - 1;
+
     if (_auto_normals) {
         // Automatically compute normals for flat shading
         update_normals(_curr_mode,
@@ -1797,27 +1962,38 @@ void GlDirectDraw::end(bool direct_draw)
                        _cpu_buffers[ATTR_NORMAL][_curr_mode][last]);
     }
 
-    _vaos[_curr_mode][last]->bind();
-    assert(plast == last);
-    // Upload to GPU:
-    for (int attr_t = 0; attr_t < ATTR_SIZE; ++attr_t) {
-        int last = (int)_cpu_buffers[attr_t][_curr_mode].size() - 1;
-        assert(last >= 0);
-        assert(last >= plast); // <- why not equal
+    int nb_verts = (int)_cpu_buffers[ATTR_POSITION][_curr_mode][last].size() / _attributes[ATTR_POSITION].size;
+    Layout layout = make_layout(nb_verts);
+    _layouts[_curr_mode].push_back(layout);
+    assert((int)_layouts[_curr_mode].size() == last + 1);
 
-        std::vector<float>& in = _cpu_buffers[attr_t][_curr_mode][last];
-        GlBuffer_obj* out = _gpu_buffers[attr_t][_curr_mode][last];
-
-        out->set_data(in.size(), &(in[0]), GL_STATIC_DRAW);
-        int idx_attr = _use_int_shader ? attr_t : _attrs_index[attr_t];
-        if (idx_attr > -1)
-            _vaos[_curr_mode][last]->record_attr(out->get_id(), idx_attr, _attributes[attr_t].size);
+    if (_is_streaming) {
+        stream_buffer(last);
+    }
+    else {
+        // Upload to GPU:
+        std::vector<char> packed(layout.nb_verts * layout.stride);
+        if (!packed.empty())
+            pack_buffer(_curr_mode, last, layout, &(packed[0]));
+
+        GlBuffer_obj* out = new GlBuffer_obj(GL_ARRAY_BUFFER);
+        out->set_data((int)(packed.size() / sizeof(GLfloat)), packed.empty() ? 0 : &(packed[0]), GL_STATIC_DRAW);
+        _gpu_buffers[_curr_mode].push_back(out);
+        _gpu_maps[_curr_mode].push_back(0);
+
+        GlVao* vao = new GlVao();
+        _vaos[_curr_mode].push_back(vao);
+#ifndef USE_GL_LEGACY
+        vao->bind();
+        record_layout(vao, layout, out->get_id(), 0);
+        vao->unbind();
+        GlState::current().bind_buffer(GL_ARRAY_BUFFER, 0);
+#endif
     }
-    _vaos[_curr_mode][last]->unbind();
 
     if (direct_draw) {
         begin_shader();
-        draw_buffer(_curr_mode, plast);
+        draw_buffer(_curr_mode, last);
         end_shader();
     }
 
@@ -1826,10 +2002,163 @@ void GlDirectDraw::end(bool direct_draw)
 
 // -----------------------------------------------------------------------------
 
+/// @return wether GL_INT_2_10_10_10_REV can be used as a vertex attribute type
+static bool packed_normals_supported()
+{
+#ifdef __APPLE__
+    return false;
+#else
+    return GLEW_VERSION_3_3 || GLEW_ARB_vertex_type_2_10_10_10_rev;
+#endif
+}
+
+// -----------------------------------------------------------------------------
+
+GlDirectDraw::Layout GlDirectDraw::make_layout(int nb_verts) const
+{
+#ifndef USE_GL_LEGACY
+    const bool compact = _compact_formats;
+#else
+    const bool compact = false; // client states don't know every packed format
+#endif
+
+    Layout l;
+    l.nb_verts = nb_verts;
+    l.stride = 0;
+    for (int attr_t = 0; attr_t < ATTR_SIZE; ++attr_t) {
+        const Attr_data& attr = _attributes[attr_t];
+        l.index[attr_t] = _use_int_shader ? attr_t : _attrs_index[attr_t];
+        l.offset[attr_t] = -1;
+        l.size[attr_t] = attr.size;
+        l.type[attr_t] = GL_FLOAT;
+        for (int comp = 0; comp < 4; ++comp)
+            l.value[attr_t][comp] = attr.data[comp];
+
+        bool stored = attr_t == ATTR_POSITION || _attr_used[attr_t] ||
+                      (attr_t == ATTR_NORMAL && _auto_normals);
+#ifndef USE_GL_LEGACY
+        stored = stored && l.index[attr_t] > -1; // No shader input to feed
+#endif
+        if (!stored)
+            continue;
+
+        int nb_bytes = attr.size * (int)sizeof(GLfloat);
+        if (compact && attr_t == ATTR_NORMAL) {
+            l.type[attr_t] = packed_normals_supported() ? GL_INT_2_10_10_10_REV : GL_BYTE;
+            l.size[attr_t] = 4;
+            nb_bytes = 4;
+        }
+        else if (compact && attr_t == ATTR_COLOR) {
+            l.type[attr_t] = GL_UNSIGNED_BYTE;
+            l.size[attr_t] = 4;
+            nb_bytes = 4;
+        }
+        else if (compact && attr_t == ATTR_TEX_COORD && attr.size == 2) {
+            // (u, v) as two half floats, other sizes stay floats
+            l.type[attr_t] = GL_HALF_FLOAT;
+            l.size[attr_t] = 2;
+            nb_bytes = 4;
+        }
+        l.offset[attr_t] = l.stride;
+        l.stride += nb_bytes;
+    }
+    // Attributes are 4 bytes aligned
+    assert(l.stride % 4 == 0);
+    return l;
+}
+
+// -----------------------------------------------------------------------------
+
+void GlDirectDraw::encode_attr(GLenum type, int nb_components, const float* in, char* out)
+{
+    switch (type) {
+    case GL_INT_2_10_10_10_REV: {
+        glm::uint32 p = glm::packSnorm3x10_1x2(glm::vec4(in[0], in[1], in[2], 0.f));
+        std::memcpy(out, &p, 4);
+    } break;
+    case GL_BYTE: {
+        for (int i = 0; i < 3; ++i)
+            out[i] = (char)glm::packSnorm1x8(in[i]);
+        out[3] = 0;
+    } break;
+    case GL_UNSIGNED_BYTE: {
+        glm::uint32 p = glm::packUnorm4x8(glm::vec4(in[0], in[1], in[2], in[3]));
+        std::memcpy(out, &p, 4);
+    } break;
+    case GL_HALF_FLOAT: {
+        glm::uint32 p = glm::packHalf2x16(glm::vec2(in[0], in[1]));
+        std::memcpy(out, &p, 4);
+    } break;
+    default:
+        std::memcpy(out, in, nb_components * sizeof(float));
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void GlDirectDraw::pack_buffer(Mode_t mode, int buff_id, const Layout& l, char* out)
+{
+    for (int attr_t = 0; attr_t < ATTR_SIZE; ++attr_t) {
+        if (l.offset[attr_t] < 0)
+            continue;
+
+        const int attr_size = _attributes[attr_t].size;
+        const std::vector<float>& in = _cpu_buffers[attr_t][mode][buff_id];
+        assert((int)in.size() == l.nb_verts * attr_size);
+        for (int i = 0; i < l.nb_verts; ++i)
+            encode_attr(l.type[attr_t], l.size[attr_t], &(in[i * attr_size]), out + i * l.stride + l.offset[attr_t]);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void GlDirectDraw::record_layout(GlVao* vao, const Layout& l, GLuint vbo_id, int base_offset)
+{
+    for (int attr_t = 0; attr_t < ATTR_SIZE; ++attr_t) {
+        if (l.offset[attr_t] < 0 || l.index[attr_t] < 0)
+            continue;
+        vao->record_attr(vbo_id, l.index[attr_t], l.size[attr_t], l.type[attr_t],
+                         l.stride, base_offset + l.offset[attr_t]);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void GlDirectDraw::stream_buffer(int buff_id)
+{
+    // Keep the same indexing than the layouts
+    std::vector<int>& offsets = _stream_offsets[_curr_mode];
+    offsets.resize(buff_id + 1, -1);
+
+    const Layout& l = _layouts[_curr_mode][buff_id];
+    int nb_words = l.nb_verts * l.stride / (int)sizeof(float);
+    if (nb_words == 0)
+        return;
+
+    int first = _ring->alloc(nb_words);
+    if (first < 0) {
+        std::cerr << "WARNING: GlDirectDraw streaming buffer too small (";
+        std::cerr << _stream_capacity << " vertices), primitives dropped.";
+        std::cerr << " Call clear() each frame or increase set_streaming() size";
+        std::cerr << std::endl;
+        return;
+    }
+
+    pack_buffer(_curr_mode, buff_id, l, (char*)_ring->map(first, nb_words));
+    _ring->flush(first, nb_words);
+    offsets[buff_id] = first * (int)sizeof(float);
+
+    if (_stream_vao == 0)
+        _stream_vao = new GlVao();
+}
+
+// -----------------------------------------------------------------------------
+
 void GlDirectDraw::begin_update(GLenum gl_mode)
 {
     assert_msg(!_is_begin, "ERROR: can't be called inside begin() end() calls");
     assert_msg(!_is_update, "ERROR: imbricated begin_update() end_update() are forbidden");
+    assert_msg(!_is_streaming, "ERROR: begin_update() is not available in streaming mode");
     _is_update = true;
 
     int start_mode = 0;
@@ -1848,15 +2177,22 @@ void GlDirectDraw::begin_update(GLenum gl_mode)
         end_mode = start_mode + 1;
     }
 
-    for (int attr_t = 0; attr_t < ATTR_SIZE; ++attr_t) {
-        for (int mode_t = start_mode; mode_t < end_mode; ++mode_t) {
-            int size = (int)_gpu_buffers[attr_t][mode_t].size();
-            for (int ith_buffer = 0; ith_buffer < size; ++ith_buffer) {
-                float* m = 0;
-                _gpu_buffers[attr_t][mode_t][ith_buffer]->map_to(m, GL_WRITE_ONLY);
-                assert(m != 0); // Can't map the vbo apparently
-                _gpu_maps[attr_t][mode_t][ith_buffer] = m;
-            }
+    for (int mode_t = start_mode; mode_t < end_mode; ++mode_t) {
+        Merged& merged = _merged[mode_t];
+        if (merged.vbo != 0) {
+            merged.vbo->map_to(merged.map, GL_WRITE_ONLY);
+            assert(merged.map != 0);
+        }
+
+        int size = (int)_gpu_buffers[mode_t].size();
+        for (int ith_buffer = 0; ith_buffer < size; ++ith_buffer) {
+            // Nothing to map (empty or merged)
+            if (_gpu_buffers[mode_t][ith_buffer] == 0 || _gpu_buffers[mode_t][ith_buffer]->size() == 0)
+                continue;
+            char* m = 0;
+            _gpu_buffers[mode_t][ith_buffer]->map_to(m, GL_WRITE_ONLY);
+            assert(m != 0); // Can't map the vbo apparently
+            _gpu_maps[mode_t][ith_buffer] = m;
         }
     }
 }
@@ -1877,16 +2213,32 @@ void GlDirectDraw::set(const Attr_id& v, Attr_t type, GLfloat x, GLfloat y, GLfl
         attr_t = type;
         end_attr = type + 1;
         _attributes[type].set(x, y, z, w);
+        _attr_used[type] = true;
     }
     else
         _attributes[ATTR_POSITION].set(x, y, z, 1.f);
 
+    // Locate the vertex in its own VBO or in the VBO merged by compile()
+    const Merged& merged = _merged[v.mode_t];
+    const bool is_merged = v.buff_t < (int)merged.first.size();
+    const Layout& l = is_merged ? merged.layout : _layouts[v.mode_t][v.buff_t];
+    char* vert = is_merged ? merged.map : _gpu_maps[v.mode_t][v.buff_t];
+    assert(vert != 0); // The VBO is not mapped ?
+    vert += ((is_merged ? merged.first[v.buff_t] : 0) + v.idx) * l.stride;
+
     for (; attr_t < end_attr; ++attr_t) {
-        for (int i = 0; i < _attributes[attr_t].size; ++i) {
-            const int idx = v.idx * _attributes[attr_t].size + i;
-            assert(_gpu_maps[attr_t][v.mode_t][v.buff_t] != 0); // The VBO is not mapped ?
-            _gpu_maps[attr_t][v.mode_t][v.buff_t][idx] = _attributes[attr_t][i];
+        // Keep CPU data in sync so that compile() can repack it
+        const int attr_size = _attributes[attr_t].size;
+        float* cpu = &(_cpu_buffers[attr_t][v.mode_t][v.buff_t][v.idx * attr_size]);
+        for (int i = 0; i < attr_size; ++i)
+            cpu[i] = _attributes[attr_t][i];
+
+        if (l.offset[attr_t] < 0) {
+            assert_msg(type == ATTR_CURRENTS,
+                       "ERROR: attribute not stored, set its value once before begin() to update it");
+            continue;
         }
+        encode_attr(l.type[attr_t], l.size[attr_t], _attributes[attr_t].data, vert + l.offset[attr_t]);
     }
 }
 
@@ -1907,24 +2259,213 @@ void GlDirectDraw::end_update()
         end_mode = start_mode + 1;
     }
 
-    for (int attr_t = 0; attr_t < ATTR_SIZE; ++attr_t) {
-        for (int mode_t = start_mode; mode_t < end_mode; ++mode_t) {
-            int size = (int)_gpu_buffers[attr_t][mode_t].size();
-            for (int ith_buffer = 0; ith_buffer < size; ++ith_buffer) {
-                _gpu_buffers[attr_t][mode_t][ith_buffer]->unmap();
-                _gpu_maps[attr_t][mode_t][ith_buffer] = 0;
-            }
+    for (int mode_t = start_mode; mode_t < end_mode; ++mode_t) {
+        Merged& merged = _merged[mode_t];
+        if (merged.map != 0) {
+            merged.vbo->unmap();
+            merged.map = 0;
+        }
+
+        int size = (int)_gpu_buffers[mode_t].size();
+        for (int ith_buffer = 0; ith_buffer < size; ++ith_buffer) {
+            if (_gpu_maps[mode_t][ith_buffer] == 0)
+                continue;
+            _gpu_buffers[mode_t][ith_buffer]->unmap();
+            _gpu_maps[mode_t][ith_buffer] = 0;
         }
     }
 
     // unbind vbos
-    glAssert(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    GlState::current().bind_buffer(GL_ARRAY_BUFFER, 0);
 
     _curr_mode = MODE_NONE;
 }
 
 // -----------------------------------------------------------------------------
 
+/// @return wether primitives of 'mode' must be separated by a restart index
+/// when concatenated
+static bool needs_restart(GLenum gl_mode)
+{
+    return gl_mode == GL_LINE_STRIP || gl_mode == GL_LINE_LOOP ||
+           gl_mode == GL_TRIANGLE_STRIP || gl_mode == GL_TRIANGLE_FAN;
+}
+
+static const GLuint s_restart_index = 0xFFFFFFFF;
+
+// -----------------------------------------------------------------------------
+
+void GlDirectDraw::compile()
+{
+    assert_msg(!_is_begin, "ERROR: can't be called inside begin() end() calls");
+    assert_msg(!_is_update, "ERROR: can't be called inside begin_update() end_update() calls");
+    if (_is_streaming)
+        return;
+
+    for (int mode_t = 0; mode_t < MODE_SIZE; ++mode_t) {
+        Merged& merged = _merged[mode_t];
+        const int nb_buffers = (int)_layouts[mode_t].size();
+        if (nb_buffers == (int)merged.first.size())
+            continue; // Nothing new
+        if (nb_buffers == 1)
+            continue; // Already a single draw call
+
+        const bool restart = needs_restart(our_mode_to_gl_mode((Mode_t)mode_t));
+#ifdef USE_GL_LEGACY
+        if (restart)
+            continue;
+#endif
+
+        int nb_verts = 0;
+        for (int i = 0; i < nb_buffers; ++i)
+            nb_verts += _layouts[mode_t][i].nb_verts;
+
+        // Repack every batch (merged ones included) from CPU memory
+        Layout l = make_layout(nb_verts);
+        std::vector<char> packed(nb_verts * l.stride);
+        std::vector<GLuint> elts;
+        merged.first.resize(nb_buffers);
+        int first = 0;
+        for (int i = 0; i < nb_buffers; ++i) {
+            Layout batch = l;
+            batch.nb_verts = _layouts[mode_t][i].nb_verts;
+            merged.first[i] = first;
+            if (batch.nb_verts == 0)
+                continue;
+
+            pack_buffer((Mode_t)mode_t, i, batch, &(packed[first * l.stride]));
+            if (restart) {
+                if (!elts.empty())
+                    elts.push_back(s_restart_index);
+                for (int v = 0; v < batch.nb_verts; ++v)
+                    elts.push_back(first + v);
+            }
+            first += batch.nb_verts;
+        }
+
+        // Release separate batches and the previous merge
+        for (int i = 0; i < nb_buffers; ++i) {
+            delete _gpu_buffers[mode_t][i];
+            delete _vaos[mode_t][i];
+            _gpu_buffers[mode_t][i] = 0;
+            _vaos[mode_t][i] = 0;
+        }
+        release_merged((Mode_t)mode_t);
+
+        // Upload to GPU:
+        merged.layout = l;
+        merged.vbo = new GlBuffer_obj(GL_ARRAY_BUFFER);
+        merged.vbo->set_data((int)(packed.size() / sizeof(GLfloat)), packed.empty() ? 0 : &(packed[0]), GL_STATIC_DRAW);
+        merged.vao = new GlVao();
+        merged.vao->bind();
+        if (restart) {
+            merged.nb_elts = (int)elts.size();
+            merged.elts = new GlBuffer_obj(GL_ELEMENT_ARRAY_BUFFER);
+            merged.elts->set_data(merged.nb_elts, elts.empty() ? 0 : &(elts[0]), GL_STATIC_DRAW);
+            merged.vao->record_elt(merged.elts->get_id());
+        }
+#ifndef USE_GL_LEGACY
+        record_layout(merged.vao, l, merged.vbo->get_id(), 0);
+#endif
+        merged.vao->unbind();
+        GlState::current().bind_buffer(GL_ARRAY_BUFFER, 0);
+        GlState::current().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void GlDirectDraw::release_merged(Mode_t mode_t)
+{
+    Merged& merged = _merged[mode_t];
+    delete merged.vbo;
+    delete merged.elts;
+    delete merged.vao;
+    merged.vbo = 0;
+    merged.elts = 0;
+    merged.vao = 0;
+    merged.nb_elts = 0;
+    merged.map = 0;
+}
+
+// -----------------------------------------------------------------------------
+
+void GlDirectDraw::draw_merged(Mode_t mode_t)
+{
+    const Merged& merged = _merged[mode_t];
+    const Layout& l = merged.layout;
+    if (l.nb_verts == 0)
+        return;
+
+    GLenum gl_mode = our_mode_to_gl_mode(mode_t);
+
+#ifndef USE_GL_LEGACY
+    assert_msg(_is_mat_set || !_use_int_shader, "ERROR: you forgot to setup your transformation matrices with set_matrix().");
+    merged.vao->bind();
+
+    // Attributes not stored in the VBO are constant
+    for (int attr_t = 0; attr_t < ATTR_SIZE; ++attr_t) {
+        if (l.offset[attr_t] < 0 && l.index[attr_t] > -1) {
+            glAssert(glVertexAttrib4fv(l.index[attr_t], l.value[attr_t]));
+        }
+    }
+
+    ///////////////////
+    // OpenGl draw call
+    if (merged.elts != 0) {
+        GlState::current().enable(GL_PRIMITIVE_RESTART);
+        glAssert(glPrimitiveRestartIndex(s_restart_index));
+        glAssert(glDrawElements(gl_mode, merged.nb_elts, GL_UNSIGNED_INT, 0));
+        GlState::current().disable(GL_PRIMITIVE_RESTART);
+    }
+    else {
+        glAssert(glDrawArrays(gl_mode, 0, l.nb_verts));
+    }
+
+    GlVao::unbind();
+#else
+    // Strips, loops and fans are never merged without primitive restart
+    // (see compile()): the layout of the merged VBO is drawn like any
+    // other buffer.
+    const char* vbo = 0;
+    merged.vbo->bind();
+
+    glAssert(glEnableClientState(GL_VERTEX_ARRAY));
+    glAssert(glVertexPointer(l.size[ATTR_POSITION], l.type[ATTR_POSITION], l.stride, vbo + l.offset[ATTR_POSITION]));
+    if (l.offset[ATTR_NORMAL] > -1) {
+        glAssert(glEnableClientState(GL_NORMAL_ARRAY));
+        glAssert(glNormalPointer(l.type[ATTR_NORMAL], l.stride, vbo + l.offset[ATTR_NORMAL]));
+    }
+    else {
+        glAssert(glNormal3fv(l.value[ATTR_NORMAL]));
+    }
+    if (l.offset[ATTR_TEX_COORD] > -1) {
+        glAssert(glEnableClientState(GL_TEXTURE_COORD_ARRAY));
+        glAssert(glTexCoordPointer(l.size[ATTR_TEX_COORD], l.type[ATTR_TEX_COORD], l.stride, vbo + l.offset[ATTR_TEX_COORD]));
+    }
+    else {
+        glAssert(glTexCoord2fv(l.value[ATTR_TEX_COORD]));
+    }
+    if (l.offset[ATTR_COLOR] > -1) {
+        glAssert(glEnableClientState(GL_COLOR_ARRAY));
+        glAssert(glColorPointer(l.size[ATTR_COLOR], l.type[ATTR_COLOR], l.stride, vbo + l.offset[ATTR_COLOR]));
+    }
+    else {
+        glAssert(glColor4fv(l.value[ATTR_COLOR]));
+    }
+
+    glAssert(glDrawArrays(gl_mode, 0, l.nb_verts));
+
+    GlState::current().bind_buffer(GL_ARRAY_BUFFER, 0);
+    glAssert(glDisableClientState(GL_VERTEX_ARRAY));
+    glAssert(glDisableClientState(GL_NORMAL_ARRAY));
+    glAssert(glDisableClientState(GL_TEXTURE_COORD_ARRAY));
+    glAssert(glDisableClientState(GL_COLOR_ARRAY));
+#endif
+}
+
+// -----------------------------------------------------------------------------
+
 void GlDirectDraw::draw()
 {
     assert_msg(!_is_begin, "ERROR: can't draw inside begin() end() calls");
@@ -1934,8 +2475,11 @@ void GlDirectDraw::draw()
 
     // for each mode (GL_TRIANGLES, GL_LINE_STRIP etc.)
     for (int mode_t = 0; mode_t < MODE_SIZE; ++mode_t) { // Look up associated buffers
-        int s = (int)_gpu_buffers[ATTR_POSITION][mode_t].size();
-        for (int i = 0; i < s; ++i)
+        int s = (int)_layouts[mode_t].size();
+        int nb_merged = (int)_merged[mode_t].first.size();
+        if (nb_merged > 0)
+            draw_merged((Mode_t)mode_t);
+        for (int i = nb_merged; i < s; ++i)
             draw_buffer((Mode_t)mode_t, i);
     }
 
@@ -1947,24 +2491,17 @@ void GlDirectDraw::draw()
 void GlDirectDraw::set_matrix(const float model_view[16],
                               const float proj[16])
 {
-    float MVP[16];
-    float normal_mat[16];
-
-    multMatrices(model_view, proj, MVP);
-    invertMatrix(model_view, normal_mat);
-    transposeMatrix(normal_mat, normal_mat);
-
-    GLint sh_id = 0;
-    glAssert(glGetIntegerv(GL_CURRENT_PROGRAM, &sh_id));
-    Shader_dd::phong_shader->use();
-
-    Shader_dd::phong_shader->set_mat4x4("MVP", MVP);
-    Shader_dd::phong_shader->set_mat4x4("normalMatrix", normal_mat);
-    Shader_dd::phong_shader->set_mat4x4("modelViewMatrix", model_view);
-    Shader_dd::phong_shader->set_mat4x4("projectionMatrix", proj);
-
-    if (sh_id >= 0)
-        glAssert(glUseProgram(sh_id));
+    Shader_dd::Matrices_std140 m;
+    std::memcpy(m.model_view, model_view, sizeof(m.model_view));
+    std::memcpy(m.projection, proj, sizeof(m.projection));
+    multMatrices(model_view, proj, m.mvp);
+    invertMatrix(model_view, m.normal);
+    transposeMatrix(m.normal, m.normal);
+
+    // One upload shared by every program reading the block: no program
+    // switch nor uniform look up
+    Shader_dd::matrices_ubo->set_sub_data(0, sizeof(m), &m);
+    GlState::current().bind_buffer_base(GL_UNIFORM_BUFFER, MATRICES_BINDING, Shader_dd::matrices_ubo->get_id());
     _is_mat_set = true;
 }
 
@@ -1979,71 +2516,99 @@ void GlDirectDraw::enable_lighting(bool state)
 
 void GlDirectDraw::draw_buffer(Mode_t mode_t, int i)
 {
+    const Layout& l = _layouts[mode_t][i];
+
     // empty buffer skip it
-    if (_gpu_buffers[ATTR_POSITION][mode_t][i]->size() == 0) {
+    if (l.nb_verts == 0) {
         std::cerr << "WARNING: empty vbo, maybe you didn't put";
         std::cerr << " a vertex3f() between begin() end() calls";
         std::cerr << std::endl;
         return;
     }
 
+    GLenum gl_mode = our_mode_to_gl_mode((Mode_t)mode_t);
+
 #ifndef USE_GL_LEGACY
     assert_msg(_is_mat_set || !_use_int_shader, "ERROR: you forgot to setup your transformation matrices with set_matrix().");
     // Opengl 3.1 and superior drawing
-    _vaos[mode_t][i]->bind();
+    if (_is_streaming) {
+        int offset = _stream_offsets[mode_t][i];
+        if (offset < 0)
+            return; // Dropped by stream_buffer() which already warned
+
+        _stream_vao->bind();
+        record_layout(_stream_vao, l, _ring->get_id(), offset);
+    }
+    else
+        _vaos[mode_t][i]->bind();
+
+    // Attributes not stored in the VBO are constant
+    for (int attr_t = 0; attr_t < ATTR_SIZE; ++attr_t) {
+        if (l.offset[attr_t] < 0 && l.index[attr_t] > -1) {
+            glAssert(glVertexAttrib4fv(l.index[attr_t], l.value[attr_t]));
+        }
+    }
 
     ///////////////////
     // OpenGl draw call
-    unsigned nb_elts = _cpu_buffers[ATTR_POSITION][mode_t][i].size();
-    unsigned size_comp = (int)_attributes[ATTR_POSITION].size;
-    assert(nb_elts % size_comp == 0);
+    glAssert(glDrawArrays(gl_mode, 0, l.nb_verts));
 
-    GLenum gl_mode = our_mode_to_gl_mode((Mode_t)mode_t);
-    int nb_verts = (nb_elts / size_comp);
-    glAssert(glDrawArrays(gl_mode, 0, nb_verts));
+    // The next streamed batch may store other attributes
+    if (_is_streaming) {
+        for (int attr_t = 0; attr_t < ATTR_SIZE; ++attr_t)
+            if (l.offset[attr_t] > -1 && l.index[attr_t] > -1)
+                _stream_vao->disable_attr(l.index[attr_t]);
+    }
 
-    _vaos[mode_t][i]->unbind();
+    GlVao::unbind();
 #else
     // Opengl legacy (2.1) drawing
     // Activate each attribute in the current buffer
+    _gpu_buffers[mode_t][i]->bind();
+    const char* vbo = 0;
 
     ////////////////////////
     // Enable client states
 
     // Enable position
-    _gpu_buffers[ATTR_POSITION][mode_t][i]->bind();
     glAssert(glEnableClientState(GL_VERTEX_ARRAY));
-    glAssert(glVertexPointer(_attributes[ATTR_POSITION].size, GL_FLOAT, 0, 0));
+    glAssert(glVertexPointer(l.size[ATTR_POSITION], l.type[ATTR_POSITION], l.stride, vbo + l.offset[ATTR_POSITION]));
 
     // Enable normal
-    _gpu_buffers[ATTR_NORMAL][mode_t][i]->bind();
-    glAssert(glEnableClientState(GL_NORMAL_ARRAY));
-    glAssert(glNormalPointer(GL_FLOAT, 0, 0));
+    if (l.offset[ATTR_NORMAL] > -1) {
+        glAssert(glEnableClientState(GL_NORMAL_ARRAY));
+        glAssert(glNormalPointer(l.type[ATTR_NORMAL], l.stride, vbo + l.offset[ATTR_NORMAL]));
+    }
+    else {
+        glAssert(glNormal3fv(l.value[ATTR_NORMAL]));
+    }
 
     // Enable texture coordinates
-    _gpu_buffers[ATTR_TEX_COORD][mode_t][i]->bind();
-    glAssert(glEnableClientState(GL_TEXTURE_COORD_ARRAY));
-    glAssert(glTexCoordPointer(_attributes[ATTR_TEX_COORD].size, GL_FLOAT, 0, 0));
+    if (l.offset[ATTR_TEX_COORD] > -1) {
+        glAssert(glEnableClientState(GL_TEXTURE_COORD_ARRAY));
+        glAssert(glTexCoordPointer(l.size[ATTR_TEX_COORD], l.type[ATTR_TEX_COORD], l.stride, vbo + l.offset[ATTR_TEX_COORD]));
+    }
+    else {
+        glAssert(glTexCoord2fv(l.value[ATTR_TEX_COORD]));
+    }
 
     // Enable color
-    _gpu_buffers[ATTR_COLOR][mode_t][i]->bind();
-    glAssert(glEnableClientState(GL_COLOR_ARRAY));
-    glAssert(glColorPointer(_attributes[ATTR_COLOR].size, GL_FLOAT, 0, 0));
+    if (l.offset[ATTR_COLOR] > -1) {
+        glAssert(glEnableClientState(GL_COLOR_ARRAY));
+        glAssert(glColorPointer(l.size[ATTR_COLOR], l.type[ATTR_COLOR], l.stride, vbo + l.offset[ATTR_COLOR]));
+    }
+    else {
+        glAssert(glColor4fv(l.value[ATTR_COLOR]));
+    }
 
     ///////////////////
     // OpenGl draw call
-    unsigned nb_elts = _cpu_buffers[ATTR_POSITION][mode_t][i].size();
-    unsigned size_comp = (int)_attributes[ATTR_POSITION].size;
-    assert(nb_elts % size_comp == 0);
-
-    GLenum gl_mode = our_mode_to_gl_mode((Mode_t)mode_t);
-    int nb_verts = (nb_elts / size_comp);
-    glAssert(glDrawArrays(gl_mode, 0, nb_verts));
+    glAssert(glDrawArrays(gl_mode, 0, l.nb_verts));
 
     ////////////////////////
     // Disable client states
-    glAssert(glBindBuffer(GL_ARRAY_BUFFER, 0));
-    glAssert(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0));
+    GlState::current().bind_buffer(GL_ARRAY_BUFFER, 0);
+    GlState::current().bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
     glAssert(glDisableClientState(GL_VERTEX_ARRAY));
     glAssert(glDisableClientState(GL_NORMAL_ARRAY));
@@ -2057,7 +2622,6 @@ void GlDirectDraw::draw_buffer(Mode_t mode_t, int i)
 #endif
 }
 
-
 // -----------------------------------------------------------------------------
 
 GLenum GlDirectDraw::our_mode_to_gl_mode(Mode_t mode)
@@ -2079,7 +2643,11 @@ void GlDirectDraw::begin_shader()
         assert_msg(_attrs_index[ATTR_POSITION] > -1, "ERROR: you forgot to setup the attribute index for the custom shader");
         return;
     }
-    glAssert(glGetIntegerv(GL_CURRENT_PROGRAM, &_prev_shader));
+    // Only query the driver when GlState lost track of the program
+    _prev_shader = GlState::current().program();
+    if (_prev_shader == GlState::UNKNOWN) {
+        glAssert(glGetIntegerv(GL_CURRENT_PROGRAM, &_prev_shader));
+    }
     Shader_dd::phong_shader->use();
 
     Shader_dd::phong_shader->set_uniform("materialKd", 1.f, 1.f, 1.f);
@@ -2098,7 +2666,7 @@ void GlDirectDraw::end_shader()
     if (!_use_int_shader)
         return;
     if (_prev_shader >= 0)
-        glAssert(glUseProgram(_prev_shader));
+        GlState::current().use_program(_prev_shader);
 #endif
 }
 
@@ -21,6 +21,7 @@
 
 class GlVao;
 struct GlBuffer_obj;
+class GlRing_buffer;
 #include "opengl.h"
 #include <vector>
 #include <map>
@@ -131,14 +132,36 @@ struct GlBuffer_obj;
  * compiling
  *
  * @note This class is not intended for performances nor low memoy usage.
- * every attributes (position color etc.) are allocated in CPU/GPU wether
- * there are used or not. every pairs of begin() end() will result in a opengl
- * draw call and will create n == ATTR_SIZE VBOs and a VAO.
+ * every attributes (position color etc.) are allocated in CPU wether
+ * there are used or not. On the GPU each pair of begin() end() creates a VAO
+ * and a single VBO of interleaved vertices. The VBO only stores the attributes
+ * set at least once with color3f(), normal3f() etc. (and the normals when
+ * set_auto_flat_normals() is on), other attributes are drawn with a constant
+ * value. set_compact_formats() further shrinks the vertices.
+ * Every pair of begin() end() will result in a opengl draw call, unless
+ * compile() is called once the geometry is built: it merges the batches of
+ * each drawing mode into one VBO drawn with a single call.
  * Use it only for small meshes or to debug. Keep the number of begin()
  * end() low (i.e keep them outside loops as much as possible).
  * For faster rendering I recommand using this utility as a display list ie:
  * build geometry once with begin() end() and draw many time with draw().
  * Otherwise memory allocation/deallocation will severly impact performances
+ *
+ * Geometry rebuilt every frame should rather use the streaming mode:
+ * @code
+ *      GlDirect_draw prim;
+ *      prim.set_streaming(true);
+ *      // each frame:
+ *      prim.begin(GL_LINES);
+ *      ...
+ *      prim.end();
+ *      prim.draw();
+ *      prim.clear(); // ends the frame
+ * @endcode
+ * Vertices are then written into a single ring buffer and each
+ * begin() end() only reserves a range of it: no VBO nor VAO is created
+ * after the first frame. begin_update() end_update() are not available
+ * in this mode.
  */
 
 // Define this symbol to use openGl API lower than 3.1 with fixed pipeline
@@ -160,6 +183,20 @@ public:
         ATTR_CURRENTS
     };
 
+    /// Uniform buffer binding point of the matrices written by set_matrix().
+    /// A custom shader can read them by declaring the block:
+    /// @code
+    /// layout(std140) uniform Matrices {
+    ///     mat4 modelViewMatrix;
+    ///     mat4 projectionMatrix;
+    ///     mat4 MVP;
+    ///     mat4 normalMatrix;
+    /// };
+    /// @endcode
+    /// and binding it with glUniformBlockBinding(program_id,
+    /// glGetUniformBlockIndex(program_id, "Matrices"), MATRICES_BINDING)
+    static const GLuint MATRICES_BINDING = 0;
+
 private:
     /// @brief supported drawing modes. Replace 'MODE_' by 'GL_' to find the
     /// opengl drawing mode macro it corresponds to.
@@ -197,6 +234,31 @@ private:
         }
     };
 
+    /// @brief memory layout of the interleaved vertices of a begin() end()
+    /// batch. Attributes not stored are sent as the constant 'value' when
+    /// drawing.
+    struct Layout {
+        int    nb_verts;
+        int    stride;               ///< byte size of a vertex
+        int    offset[ATTR_SIZE];    ///< byte offset in the vertex (-1: not stored)
+        int    size  [ATTR_SIZE];    ///< number of components given to opengl
+        GLenum type  [ATTR_SIZE];    ///< GL_FLOAT, GL_HALF_FLOAT, GL_UNSIGNED_BYTE...
+        int    index [ATTR_SIZE];    ///< shader attribute index (-1: disabled)
+        float  value [ATTR_SIZE][4]; ///< value of the attributes not stored
+    };
+
+    /// @brief batches of a drawing mode merged by compile()
+    struct Merged {
+        Merged() : vbo(0), elts(0), vao(0), nb_elts(0), map(0) { }
+        GlBuffer_obj* vbo;
+        GlBuffer_obj* elts;     ///< indices with restarts (strips, loops and fans)
+        GlVao*        vao;
+        Layout        layout;
+        int           nb_elts;  ///< number of indices in 'elts'
+        char*         map;      ///< 'vbo' mapped between begin_update() end_update()
+        std::vector<int> first; ///< first vertex of each merged batch in 'vbo'
+    };
+
     // -------------------------------------------------------------------------
 public:
 
@@ -224,8 +286,19 @@ public:
 
     /// Release all previously added attributes in GPU and CPU memory.
     /// Next call to draw() will have no effect.
+    /// @note in streaming mode GPU memory is kept: the ranges used since the
+    /// last clear() are fenced and recycled once the GPU is done with them.
     void clear();
 
+    /// Enable or disable the streaming mode (see class description).
+    /// @param nb_verts : ring buffers capacity in vertices. A begin() end()
+    /// batch bigger than this, or a frame that overflows it before clear(),
+    /// is dropped with a warning.
+    /// @note clears previously added primitives
+    void set_streaming(bool state, int nb_verts = 1 << 16);
+
+    bool is_streaming() const { return _is_streaming; }
+
     /// @defgroup Handling shader resources
     /// For better performances we advice intializing shaders at the application
     /// startup through these statics methods. Otherwise the first instance
@@ -304,12 +377,24 @@ public:
     /// @name Draw
     // =========================================================================
 
+    /// Merge every batch added so far with the same drawing mode into a
+    /// single VBO so that draw() issues one draw call per mode. Strips, loops
+    /// and fans are separated with primitive restart.
+    /// Attr_id handles stay valid. Batches added after compile() are drawn
+    /// separately until the next compile().
+    /// @note no effect in streaming mode. With USE_GL_LEGACY strips, loops
+    /// and fans are not merged (no primitive restart).
+    /// Attributes are stored with the current shader indices and formats.
+    void compile();
+
     /// Draw the previously added attribute within begin() end() calls.
     /// @warning should be call outside a pair of begin() end() or
     /// begin_update() end_update()
     void draw();
 
     /// Set the matrices use to draw with the internal shader.
+    /// They are uploaded once to a uniform buffer shared by every
+    /// GlDirectDraw (see MATRICES_BINDING): the last call wins.
     /// @param model_view, proj : matrix of modelView and projection in OpenGL
     /// format (i.e. column major)
     void set_matrix(const float model_view[16], const float proj[16] );
@@ -370,6 +455,21 @@ public:
     /// @note default value is false
     void set_auto_normalize(bool s){ _auto_normalize = s; }
 
+    /// Store attributes with compact formats in GPU memory: normals as
+    /// 10_10_10_2 signed normalized integers (4 signed bytes when the driver
+    /// lacks GL_ARB_vertex_type_2_10_10_10_rev), colors as 8 bits unsigned
+    /// normalized integers and texture coordinates as half floats.
+    /// Shaders still read floats.
+    /// @note default value is false. Taken into account for the next pair
+    /// of begin() end()
+    void set_compact_formats(bool s){ _compact_formats = s; }
+
+    /// Encode one attribute value of 'nb_components' floats 'in' to 'out'
+    /// in the vertex format 'type': GL_INT_2_10_10_10_REV or GL_BYTE for
+    /// normals, GL_UNSIGNED_BYTE for colors, GL_HALF_FLOAT for texture
+    /// coordinates (4 bytes each), the floats are copied for other types.
+    static void encode_attr(GLenum type, int nb_components, const float* in, char* out);
+
 private:
     // =========================================================================
     /// @name tools
@@ -380,6 +480,29 @@ private:
     /// draw the ith buffer given its mode.
     void draw_buffer(Mode_t mode_t, int i);
 
+    /// draw the batches merged by compile()
+    void draw_merged(Mode_t mode_t);
+
+    /// Delete the GPU buffers merged by compile()
+    void release_merged(Mode_t mode_t);
+
+    /// Copy the ith buffer of the current mode into the ring buffer
+    void stream_buffer(int buff_id);
+
+    /// Delete the ring buffer and the streaming VAO
+    void release_streaming();
+
+    /// @return layout of 'nb_verts' vertices given the attributes used so far
+    /// and the formats settings
+    Layout make_layout(int nb_verts) const;
+
+    /// Interleave and encode the ith CPU buffer of 'mode' into 'out'
+    void pack_buffer(Mode_t mode, int buff_id, const Layout& l, char* out);
+
+    /// Record in the bound 'vao' the attributes of 'l' stored in 'vbo_id'
+    /// starting at byte 'base_offset'
+    void record_layout(GlVao* vao, const Layout& l, GLuint vbo_id, int base_offset);
+
     /// Prepare gl states to use the internal direct draw shader
     void begin_shader();
     /// Restor gl states
@@ -427,6 +550,11 @@ private:
     bool _auto_normals;   ///< automatic computation of normals
     bool _auto_normalize; ///< automatic normalisation
     bool _enable_lighting;///< enable internal shader lighting
+    bool _compact_formats;///< compact encoding of attributes in GPU memory
+
+    /// Wether the attribute value was ever set, unused attributes are not
+    /// stored in the VBOs
+    bool _attr_used[ATTR_SIZE];
 
     Mode_t    _curr_mode;             ///< curent drawing mode
     Attr_data _attributes[ATTR_SIZE]; ///< current attributes value
@@ -440,20 +568,44 @@ private:
     /// begin() end() calls
     /// _vertices[Attribute type][drawing mode][list of buffers][datas (vertex or color or ... components)]
 
-    /// GPU storage of the attributes (position, normals etc.)
-    std::vector< GlBuffer_obj* > _gpu_buffers[ATTR_SIZE][MODE_SIZE];
+    /// GPU storage of the interleaved attributes (position, normals etc.)
+    std::vector< GlBuffer_obj* > _gpu_buffers[MODE_SIZE];
+
+    /// Vertex layout of each buffer (in streaming mode as well)
+    std::vector< Layout > _layouts[MODE_SIZE];
 
-    /// Vertex array buffer for each group of buffer object
+    /// Vertex array buffer for each buffer object
     std::vector< GlVao* > _vaos[MODE_SIZE];
 
     /// GPU mapped pointers on cpu (mapping effective between begin_update() and
     /// end_update() )
-    std::vector<float*> _gpu_maps[ATTR_SIZE][MODE_SIZE];
+    std::vector<char*> _gpu_maps[MODE_SIZE];
+
+    /// Batches merged by compile(). The first merged[mode].first.size()
+    /// entries of '_gpu_buffers' and '_vaos' are then released (null)
+    Merged _merged[MODE_SIZE];
 
     /// CPU storage of the attributes (position, normals etc.)
     std::vector< std::vector<float> > _cpu_buffers[ATTR_SIZE][MODE_SIZE];
 
     GLint _prev_shader; ///< saved shader id by begin_shader()
+
+    // -------------------------------------------------------------------------
+    /// @name Streaming mode
+    // -------------------------------------------------------------------------
+
+    bool _is_streaming;
+    int  _stream_capacity; ///< ring buffer capacity in (full float) vertices
+
+    /// Interleaved vertices of every batch, in 32 bits words
+    GlRing_buffer* _ring;
+
+    /// Single VAO over the ring, attribute pointers are set for each batch
+    GlVao* _stream_vao;
+
+    /// Byte offset in the ring of each begin() end() (-1 if dropped).
+    /// Indexed like '_layouts'
+    std::vector<int> _stream_offsets[MODE_SIZE];
 };
 
 #endif // GL_DIRECT_DRAW_HPP__
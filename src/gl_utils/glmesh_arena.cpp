@@ -0,0 +1,324 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include "glmesh_arena.h"
+#include "glstate.h"
+
+#include <algorithm>
+#include <cassert>
+
+// -----------------------------------------------------------------------------
+
+GlMesh_arena::GlMesh_arena(int vertex_size, int nb_vertices, int nb_indices)
+    : _vertex_size(vertex_size)
+    , _vertex_alloc(nb_vertices)
+    , _index_alloc(nb_indices)
+    , _nb_meshes(0)
+    , _vao(0)
+    , _vertex_buffer(0)
+    , _index_buffer(0)
+    , _indirect_buffer(0)
+    , _has_indirect(false)
+    , _nb_defragments(0)
+    , _nb_reallocs(0)
+{
+    assert(vertex_size > 0);
+    glAssert(glGenVertexArrays(1, &_vao));
+    realloc_buffer(_vertex_buffer, _vertex_size, 0, nb_vertices);
+    realloc_buffer(_index_buffer, sizeof(GLuint), 0, nb_indices);
+#ifndef __APPLE__
+    _has_indirect = GLEW_VERSION_4_3 || GLEW_ARB_multi_draw_indirect;
+    if (_has_indirect) {
+        glAssert(glGenBuffers(1, &_indirect_buffer));
+    }
+#endif
+    setup_vao();
+}
+
+// -----------------------------------------------------------------------------
+
+GlMesh_arena::~GlMesh_arena()
+{
+    GlState& state = GlState::current();
+    state.forget_vertex_array(_vao);
+    glAssert(glDeleteVertexArrays(1, &_vao));
+    GLuint buffers[3] = { _vertex_buffer, _index_buffer, _indirect_buffer };
+    for (int i = 0; i < 3; ++i)
+        state.forget_buffer(buffers[i]);
+    glAssert(glDeleteBuffers(3, buffers));
+}
+
+// -----------------------------------------------------------------------------
+
+void GlMesh_arena::set_attribute(GLuint index, GLint size, GLenum type, GLboolean normalized, int offset)
+{
+    Attribute a = { index, size, type, normalized, offset };
+    _attributes.push_back(a);
+    setup_vao();
+}
+
+// -----------------------------------------------------------------------------
+
+int GlMesh_arena::add(const void* vertices, int nb_vertices, const GLuint* indices, int nb_indices)
+{
+    assert(nb_vertices > 0 && nb_indices > 0);
+    Range r;
+    alloc(nb_vertices, nb_indices, r);
+
+    GlState& state = GlState::current();
+    state.bind_buffer(GL_COPY_WRITE_BUFFER, _vertex_buffer);
+    glAssert(glBufferSubData(GL_COPY_WRITE_BUFFER, r.first_vertex * _vertex_size, nb_vertices * _vertex_size, vertices));
+    state.bind_buffer(GL_COPY_WRITE_BUFFER, _index_buffer);
+    glAssert(glBufferSubData(GL_COPY_WRITE_BUFFER, r.first_index * sizeof(GLuint), nb_indices * sizeof(GLuint), indices));
+    state.bind_buffer(GL_COPY_WRITE_BUFFER, 0);
+    return new_handle(r);
+}
+
+// -----------------------------------------------------------------------------
+
+int GlMesh_arena::add(GLuint vertex_buffer, int nb_vertices, GLuint index_buffer, int nb_indices)
+{
+    assert(nb_vertices > 0 && nb_indices > 0);
+    Range r;
+    alloc(nb_vertices, nb_indices, r);
+
+    GlState& state = GlState::current();
+    state.bind_buffer(GL_COPY_READ_BUFFER, vertex_buffer);
+    state.bind_buffer(GL_COPY_WRITE_BUFFER, _vertex_buffer);
+    glAssert(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, r.first_vertex * _vertex_size, nb_vertices * _vertex_size));
+    state.bind_buffer(GL_COPY_READ_BUFFER, index_buffer);
+    state.bind_buffer(GL_COPY_WRITE_BUFFER, _index_buffer);
+    glAssert(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, r.first_index * sizeof(GLuint), nb_indices * sizeof(GLuint)));
+    state.bind_buffer(GL_COPY_READ_BUFFER, 0);
+    state.bind_buffer(GL_COPY_WRITE_BUFFER, 0);
+    return new_handle(r);
+}
+
+// -----------------------------------------------------------------------------
+
+int GlMesh_arena::new_handle(const Range& r)
+{
+    int handle = (int)_ranges.size();
+    if (_free_handles.empty())
+        _ranges.push_back(r);
+    else {
+        handle = _free_handles.back();
+        _free_handles.pop_back();
+        _ranges[handle] = r;
+    }
+    _nb_meshes++;
+    return handle;
+}
+
+// -----------------------------------------------------------------------------
+
+void GlMesh_arena::remove(int handle)
+{
+    Range& r = _ranges[handle];
+    assert(r.first_vertex >= 0);
+    _vertex_alloc.free(r.first_vertex);
+    _index_alloc.free(r.first_index);
+    r.first_vertex = r.first_index = -1;
+    r.nb_vertices = r.nb_indices = 0;
+    _free_handles.push_back(handle);
+    _nb_meshes--;
+}
+
+// -----------------------------------------------------------------------------
+
+void GlMesh_arena::defragment()
+{
+    pack(_vertex_alloc, _vertex_buffer, _vertex_size, &Range::first_vertex);
+    pack(_index_alloc, _index_buffer, sizeof(GLuint), &Range::first_index);
+}
+
+// -----------------------------------------------------------------------------
+
+DrawElementsIndirectCommand GlMesh_arena::command(int handle) const
+{
+    const Range& r = _ranges[handle];
+    DrawElementsIndirectCommand cmd;
+    cmd.count = r.nb_indices;
+    cmd.instance_count = 1;
+    cmd.first_index = r.first_index;
+    cmd.base_vertex = r.first_vertex;
+    cmd.base_instance = 0;
+    return cmd;
+}
+
+// -----------------------------------------------------------------------------
+
+void GlMesh_arena::draw(GlState& state, GLenum mode, const DrawElementsIndirectCommand* cmds, int nb_cmds)
+{
+    if (nb_cmds <= 0)
+        return;
+    state.bind_vertex_array(_vao);
+
+#ifndef __APPLE__
+    if (_has_indirect) {
+        // glBufferData() orphans the commands of the last frame, which the
+        // GPU may still be reading
+        state.bind_buffer(GL_DRAW_INDIRECT_BUFFER, _indirect_buffer);
+        glAssert(glBufferData(GL_DRAW_INDIRECT_BUFFER, nb_cmds * sizeof(DrawElementsIndirectCommand), cmds, GL_STREAM_DRAW));
+        glAssert(glMultiDrawElementsIndirect(mode, GL_UNSIGNED_INT, 0, nb_cmds, 0));
+        return;
+    }
+#endif
+
+    _counts.clear();
+    _offsets.clear();
+    _base_vertices.clear();
+    for (int i = 0; i < nb_cmds; ++i) {
+        const DrawElementsIndirectCommand& c = cmds[i];
+        const GLvoid* offset = (const GLvoid*)(c.first_index * sizeof(GLuint));
+        if (c.instance_count == 1) {
+            _counts.push_back(c.count);
+            _offsets.push_back(offset);
+            _base_vertices.push_back(c.base_vertex);
+        }
+        else if (c.instance_count > 1) {
+            glAssert(glDrawElementsInstancedBaseVertex(mode, c.count, GL_UNSIGNED_INT, offset, c.instance_count, c.base_vertex));
+        }
+    }
+    if (!_counts.empty()) {
+        glAssert(glMultiDrawElementsBaseVertex(mode, &_counts[0], GL_UNSIGNED_INT, &_offsets[0], (GLsizei)_counts.size(), &_base_vertices[0]));
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void GlMesh_arena::alloc(int nb_vertices, int nb_indices, Range& r)
+{
+    // Not enough room in one piece: pack the buffer when its free elements
+    // suffice, otherwise enlarge it
+    if (_vertex_alloc.largest_free() < nb_vertices) {
+        const int capacity = _vertex_alloc.capacity();
+        if (capacity - _vertex_alloc.used() >= nb_vertices)
+            pack(_vertex_alloc, _vertex_buffer, _vertex_size, &Range::first_vertex);
+        else
+            grow(_vertex_alloc, _vertex_buffer, _vertex_size, std::max(2 * capacity, capacity + nb_vertices));
+    }
+    if (_index_alloc.largest_free() < nb_indices) {
+        const int capacity = _index_alloc.capacity();
+        if (capacity - _index_alloc.used() >= nb_indices)
+            pack(_index_alloc, _index_buffer, sizeof(GLuint), &Range::first_index);
+        else
+            grow(_index_alloc, _index_buffer, sizeof(GLuint), std::max(2 * capacity, capacity + nb_indices));
+    }
+
+    r.first_vertex = _vertex_alloc.alloc(nb_vertices);
+    r.nb_vertices = nb_vertices;
+    r.first_index = _index_alloc.alloc(nb_indices);
+    r.nb_indices = nb_indices;
+    assert(r.first_vertex >= 0 && r.first_index >= 0);
+}
+
+// -----------------------------------------------------------------------------
+
+void GlMesh_arena::grow(GlBlock_allocator& alloc, GLuint& buffer, int elt_size, int capacity)
+{
+    realloc_buffer(buffer, elt_size, alloc.capacity(), capacity);
+    alloc.grow(capacity);
+    setup_vao();
+    _nb_reallocs++;
+}
+
+// -----------------------------------------------------------------------------
+
+static bool src_less(const GlBlock_allocator::Move& m, int offset)
+{
+    return m.src < offset;
+}
+
+void GlMesh_arena::pack(GlBlock_allocator& alloc, GLuint buffer, int elt_size, int Range::* first)
+{
+    std::vector<GlBlock_allocator::Move> moves;
+    alloc.defragment(moves);
+    if (moves.empty())
+        return;
+
+    // A block may overlap its old place: it goes through a scratch buffer
+    int largest = 0;
+    for (unsigned i = 0; i < moves.size(); ++i)
+        largest = std::max(largest, moves[i].size);
+    GLuint scratch = 0;
+    GlState& state = GlState::current();
+    glAssert(glGenBuffers(1, &scratch));
+    state.bind_buffer(GL_COPY_WRITE_BUFFER, scratch);
+    glAssert(glBufferData(GL_COPY_WRITE_BUFFER, largest * elt_size, NULL, GL_STREAM_COPY));
+    state.bind_buffer(GL_COPY_READ_BUFFER, buffer);
+    for (unsigned i = 0; i < moves.size(); ++i) {
+        const GlBlock_allocator::Move& m = moves[i];
+        glAssert(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, m.src * elt_size, 0, m.size * elt_size));
+        glAssert(glCopyBufferSubData(GL_COPY_WRITE_BUFFER, GL_COPY_READ_BUFFER, 0, m.dst * elt_size, m.size * elt_size));
+    }
+    state.bind_buffer(GL_COPY_READ_BUFFER, 0);
+    state.bind_buffer(GL_COPY_WRITE_BUFFER, 0);
+    state.forget_buffer(scratch);
+    glAssert(glDeleteBuffers(1, &scratch));
+
+    // Moves are sorted by source offset
+    for (unsigned h = 0; h < _ranges.size(); ++h) {
+        int& offset = _ranges[h].*first;
+        if (offset < 0)
+            continue;
+        std::vector<GlBlock_allocator::Move>::const_iterator it =
+            std::lower_bound(moves.begin(), moves.end(), offset, src_less);
+        if (it != moves.end() && it->src == offset)
+            offset = it->dst;
+    }
+    _nb_defragments++;
+}
+
+// -----------------------------------------------------------------------------
+
+void GlMesh_arena::realloc_buffer(GLuint& id, int elt_size, int old_capacity, int capacity)
+{
+    GLuint new_id = 0;
+    GlState& state = GlState::current();
+    glAssert(glGenBuffers(1, &new_id));
+    state.bind_buffer(GL_COPY_WRITE_BUFFER, new_id);
+    glAssert(glBufferData(GL_COPY_WRITE_BUFFER, capacity * elt_size, NULL, GL_STATIC_DRAW));
+    if (id != 0) {
+        if (old_capacity > 0) {
+            state.bind_buffer(GL_COPY_READ_BUFFER, id);
+            glAssert(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, old_capacity * elt_size));
+            state.bind_buffer(GL_COPY_READ_BUFFER, 0);
+        }
+        state.forget_buffer(id);
+        glAssert(glDeleteBuffers(1, &id));
+    }
+    state.bind_buffer(GL_COPY_WRITE_BUFFER, 0);
+    id = new_id;
+}
+
+// -----------------------------------------------------------------------------
+
+void GlMesh_arena::setup_vao()
+{
+    GlState& state = GlState::current();
+    state.bind_vertex_array(_vao);
+    state.bind_buffer(GL_ARRAY_BUFFER, _vertex_buffer);
+    for (unsigned i = 0; i < _attributes.size(); ++i) {
+        const Attribute& a = _attributes[i];
+        glAssert(glVertexAttribPointer(a.index, a.size, a.type, a.normalized, _vertex_size, (const GLvoid*)(size_t)a.offset));
+        glAssert(glEnableVertexAttribArray(a.index));
+    }
+    state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, _index_buffer);
+    state.bind_vertex_array(0);
+    state.bind_buffer(GL_ARRAY_BUFFER, 0);
+}
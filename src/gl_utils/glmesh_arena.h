@@ -0,0 +1,185 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef GL_MESH_ARENA_HPP__
+#define GL_MESH_ARENA_HPP__
+
+#include "opengl.h"
+#include "glblock_allocator.h"
+#include <vector>
+
+class GlState;
+
+/**
+ * @struct DrawElementsIndirectCommand
+ * @brief One draw of glMultiDrawElementsIndirect(), layout fixed by OpenGL
+ */
+struct DrawElementsIndirectCommand {
+    GLuint count;          ///< number of indices
+    GLuint instance_count;
+    GLuint first_index;    ///< in indices, not bytes
+    GLint base_vertex;     ///< added to each index
+    GLuint base_instance;
+};
+
+// =============================================================================
+
+/**
+ * @class GlMesh_arena
+ * @brief Meshes sharing a single vertex buffer, index buffer and VAO
+ *
+ * Each mesh added is a range of vertices and a range of indices of the
+ * shared buffers, its indices start at 0 and are offset by base_vertex when
+ * drawing. Any set of meshes is then drawn with a single VAO bind and a
+ * single draw call (see draw()).
+ *
+ * When the buffers are full, removed meshes are first packed away with
+ * defragment(), and only if that is not enough the buffers are reallocated
+ * twice as big. Mesh handles stay valid through both.
+ *
+ * @code
+ *      GlMesh_arena arena(sizeof(Vertex));
+ *      arena.set_attribute(0, 3, GL_FLOAT, GL_FALSE, 0); // position
+ *      int h = arena.add(verts, nb_verts, tris, nb_tris * 3);
+ *      DrawElementsIndirectCommand cmd = arena.command(h);
+ *      arena.draw(GlState::current(), GL_TRIANGLES, &cmd, 1);
+ * @endcode
+ */
+class GlMesh_arena {
+public:
+    /// @param vertex_size : byte size of a vertex
+    /// @param nb_vertices, nb_indices : initial capacity of the buffers
+    GlMesh_arena(int vertex_size, int nb_vertices = 1 << 16, int nb_indices = 1 << 18);
+
+    ~GlMesh_arena();
+
+    /// Describe a vertex attribute like glVertexAttribPointer()
+    /// @param offset : in bytes from the beginning of a vertex
+    void set_attribute(GLuint index, GLint size, GLenum type, GLboolean normalized, int offset);
+
+    /// Upload a mesh
+    /// @param indices : relative to the first of 'vertices'
+    /// @return handle of the mesh
+    int add(const void* vertices, int nb_vertices, const GLuint* indices, int nb_indices);
+
+    /// Copy a mesh from buffer objects, e.g. filled by a GlUpload_stream.
+    /// The copy stays on the GPU (glCopyBufferSubData()).
+    /// @param vertex_buffer : holds 'nb_vertices' vertices from offset 0
+    /// @param index_buffer : holds 'nb_indices' indices from offset 0
+    /// @return handle of the mesh
+    int add(GLuint vertex_buffer, int nb_vertices, GLuint index_buffer, int nb_indices);
+
+    /// Release the ranges of the mesh 'handle'
+    void remove(int handle);
+
+    /// Pack the meshes at the beginning of the buffers.
+    /// Done by add() when the free space is too fragmented.
+    void defragment();
+
+    /// Ranges of a mesh in the shared buffers
+    struct Range {
+        int first_vertex;
+        int nb_vertices;
+        int first_index;
+        int nb_indices;
+    };
+
+    const Range& range(int handle) const { return _ranges[handle]; }
+
+    /// @return the command drawing the whole mesh 'handle' once
+    DrawElementsIndirectCommand command(int handle) const;
+
+    /// Draw the 'nb_cmds' commands with a single call.
+    /// With OpenGL 4.3 or GL_ARB_multi_draw_indirect the commands are
+    /// uploaded and drawn by glMultiDrawElementsIndirect(). Otherwise
+    /// glMultiDrawElementsBaseVertex() (OpenGL 3.2) draws the commands with
+    /// an instance_count of 1, the others are drawn one by one and their
+    /// base_instance is ignored.
+    /// @note the VAO of the arena stays bound
+    void draw(GlState& state, GLenum mode, const DrawElementsIndirectCommand* cmds, int nb_cmds);
+
+    // =========================================================================
+    /// @name Getter & Setters
+    // =========================================================================
+
+    GLuint get_vao() const { return _vao; }
+
+    int nb_meshes() const { return _nb_meshes; }
+
+    const GlBlock_allocator& vertices() const { return _vertex_alloc; }
+    const GlBlock_allocator& indices() const { return _index_alloc; }
+
+    /// @return number of times the buffers were packed or reallocated
+    int nb_defragments() const { return _nb_defragments; }
+    int nb_reallocs() const { return _nb_reallocs; }
+
+private:
+    GlMesh_arena(const GlMesh_arena&);
+    GlMesh_arena& operator=(const GlMesh_arena&);
+
+    struct Attribute {
+        GLuint index;
+        GLint size;
+        GLenum type;
+        GLboolean normalized;
+        int offset;
+    };
+
+    /// Make room for the ranges then allocate them
+    void alloc(int nb_vertices, int nb_indices, Range& r);
+
+    /// @return a handle for the ranges 'r'
+    int new_handle(const Range& r);
+
+    /// Enlarge 'buffer' managed by 'alloc' to 'capacity' elements
+    void grow(GlBlock_allocator& alloc, GLuint& buffer, int elt_size, int capacity);
+
+    /// Defragment 'alloc' then move the data of 'buffer' and the offsets
+    /// 'first' of the ranges accordingly
+    void pack(GlBlock_allocator& alloc, GLuint buffer, int elt_size, int Range::* first);
+
+    /// Replace the buffer 'id' of 'elt_size' elements by a new one of
+    /// 'capacity' elements holding the same data
+    void realloc_buffer(GLuint& id, int elt_size, int old_capacity, int capacity);
+
+    /// Bind the buffers and set the attributes of #_vao
+    void setup_vao();
+
+    int _vertex_size;
+    GlBlock_allocator _vertex_alloc;
+    GlBlock_allocator _index_alloc;
+    std::vector<Range> _ranges; ///< indexed by handle
+    std::vector<int> _free_handles;
+    int _nb_meshes;
+    std::vector<Attribute> _attributes;
+
+    GLuint _vao;
+    GLuint _vertex_buffer;
+    GLuint _index_buffer;
+    GLuint _indirect_buffer; ///< 0 without glMultiDrawElementsIndirect()
+    bool _has_indirect;
+
+    /// Arrays of the glMultiDrawElementsBaseVertex() fallback
+    std::vector<GLsizei> _counts;
+    std::vector<const GLvoid*> _offsets;
+    std::vector<GLint> _base_vertices;
+
+    int _nb_defragments;
+    int _nb_reallocs;
+};
+
+#endif // GL_MESH_ARENA_HPP__
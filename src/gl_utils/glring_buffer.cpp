@@ -0,0 +1,194 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include "glring_buffer.h"
+#include "glstate.h"
+
+#include <cassert>
+
+// -----------------------------------------------------------------------------
+
+GlRing_buffer::GlRing_buffer(GlRing_backend* backend, int capacity, int elt_size)
+    : _backend(backend)
+    , _capacity(capacity)
+    , _elt_size(elt_size)
+    , _head(0)
+    , _used(0)
+    , _nb_pending(0)
+    , _nb_stalls(0)
+{
+    assert(backend != 0);
+    assert(capacity > 0 && elt_size > 0);
+}
+
+// -----------------------------------------------------------------------------
+
+GlRing_buffer::~GlRing_buffer()
+{
+    for (unsigned i = 0; i < _in_flight.size(); ++i)
+        _backend->wait(_in_flight[i].sync);
+    delete _backend;
+}
+
+// -----------------------------------------------------------------------------
+
+int GlRing_buffer::alloc(int nb_elt)
+{
+    assert(nb_elt > 0);
+    if (nb_elt > _capacity)
+        return -1;
+
+    // A range never straddles the end of the buffer: skip the tail instead
+    int first = _head;
+    int padding = 0;
+    if (first + nb_elt > _capacity) {
+        padding = _capacity - first;
+        first = 0;
+    }
+
+    // Release the oldest ranges until there is room
+    while (_capacity - _used < padding + nb_elt) {
+        if (_in_flight.empty())
+            return -1; // Only unfenced ranges left: we would overwrite them
+        const Region& r = _in_flight.front();
+        _backend->wait(r.sync);
+        _used -= r.nb_elt;
+        _in_flight.pop_front();
+        _nb_stalls++;
+        // Everything released: the skipped tail is free again
+        if (_used == 0)
+            padding = 0;
+    }
+
+    _used += padding + nb_elt;
+    _nb_pending += padding + nb_elt;
+    _head = (first + nb_elt) % _capacity;
+    return first;
+}
+
+// -----------------------------------------------------------------------------
+
+void* GlRing_buffer::map(int first, int nb_elt)
+{
+    assert(first >= 0 && first + nb_elt <= _capacity);
+    return _backend->map_range(first * _elt_size, nb_elt * _elt_size);
+}
+
+// -----------------------------------------------------------------------------
+
+void GlRing_buffer::flush(int first, int nb_elt)
+{
+    assert(first >= 0 && first + nb_elt <= _capacity);
+    _backend->flush_range(first * _elt_size, nb_elt * _elt_size);
+}
+
+// -----------------------------------------------------------------------------
+
+void GlRing_buffer::fence()
+{
+    if (_nb_pending == 0)
+        return;
+    Region r = { _backend->fence(), _nb_pending };
+    _in_flight.push_back(r);
+    _nb_pending = 0;
+}
+
+// -----------------------------------------------------------------------------
+
+GlRing_backend_gl::GlRing_backend_gl(int nb_bytes)
+    : _buffer_id(0)
+    , _persistent_map(0)
+{
+    glAssert(glGenBuffers(1, &_buffer_id));
+    GlState::current().bind_buffer(GL_ARRAY_BUFFER, _buffer_id);
+#ifndef __APPLE__
+    if (GLEW_ARB_buffer_storage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glAssert(glBufferStorage(GL_ARRAY_BUFFER, nb_bytes, NULL, flags));
+        _persistent_map = (char*)glMapBufferRange(GL_ARRAY_BUFFER, 0, nb_bytes, flags);
+        glCheckError();
+    }
+    else
+#endif
+    {
+        glAssert(glBufferData(GL_ARRAY_BUFFER, nb_bytes, NULL, GL_STREAM_DRAW));
+    }
+    GlState::current().bind_buffer(GL_ARRAY_BUFFER, 0);
+}
+
+// -----------------------------------------------------------------------------
+
+GlRing_backend_gl::~GlRing_backend_gl()
+{
+    if (_persistent_map != 0) {
+        GlState::current().bind_buffer(GL_ARRAY_BUFFER, _buffer_id);
+        glAssert(glUnmapBuffer(GL_ARRAY_BUFFER));
+        GlState::current().bind_buffer(GL_ARRAY_BUFFER, 0);
+    }
+    GlState::current().forget_buffer(_buffer_id);
+    glAssert(glDeleteBuffers(1, &_buffer_id));
+}
+
+// -----------------------------------------------------------------------------
+
+void* GlRing_backend_gl::map_range(int offset, int nb_bytes)
+{
+    if (_persistent_map != 0)
+        return _persistent_map + offset;
+
+    GlState::current().bind_buffer(GL_ARRAY_BUFFER, _buffer_id);
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+    void* ptr = glMapBufferRange(GL_ARRAY_BUFFER, offset, nb_bytes, flags);
+    glCheckError();
+    return ptr;
+}
+
+// -----------------------------------------------------------------------------
+
+void GlRing_backend_gl::flush_range(int /*offset*/, int /*nb_bytes*/)
+{
+    // Coherent mapping: writes are visible to the next draw calls
+    if (_persistent_map != 0)
+        return;
+    glAssert(glUnmapBuffer(GL_ARRAY_BUFFER));
+    GlState::current().bind_buffer(GL_ARRAY_BUFFER, 0);
+}
+
+// -----------------------------------------------------------------------------
+
+GLsync GlRing_backend_gl::fence()
+{
+    GLsync sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glCheckError();
+    return sync;
+}
+
+// -----------------------------------------------------------------------------
+
+void GlRing_backend_gl::wait(GLsync sync)
+{
+    // Flush on the first try only, otherwise the fence might never be
+    // submitted and we would wait forever
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    for (;;) {
+        GLenum state = glClientWaitSync(sync, flags, 1000000000 /*1s*/);
+        if (state != GL_TIMEOUT_EXPIRED)
+            break;
+        flags = 0;
+    }
+    glAssert(glDeleteSync(sync));
+}
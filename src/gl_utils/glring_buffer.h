@@ -0,0 +1,168 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef GL_RING_BUFFER_HPP__
+#define GL_RING_BUFFER_HPP__
+
+#include "opengl.h"
+#include <deque>
+
+/**
+ * @class GlRing_backend
+ * @brief Storage behind a GlRing_buffer
+ *
+ * The ring only does the book keeping (where to write next, which range is
+ * still read by the GPU). Everything that touches OpenGL goes through this
+ * interface so the allocator can be exercised without a GL context by
+ * plugging a backend working in host memory.
+ *
+ * Offsets and sizes are expressed in bytes.
+ */
+class GlRing_backend {
+public:
+    virtual ~GlRing_backend() { }
+
+    /// @return a pointer where 'nb_bytes' can be written starting at 'offset'
+    virtual void* map_range(int offset, int nb_bytes) = 0;
+
+    /// Make the range previously returned by map_range() visible to the GPU
+    virtual void flush_range(int offset, int nb_bytes) = 0;
+
+    /// Insert a fence after every command issued so far
+    virtual GLsync fence() = 0;
+
+    /// Block until 'sync' is signaled then release it
+    virtual void wait(GLsync sync) = 0;
+
+    /// @return OpenGL id of the buffer object (0 if there is none)
+    virtual GLuint get_id() const = 0;
+};
+
+// =============================================================================
+
+/**
+ * @class GlRing_backend_gl
+ * @brief OpenGL storage of a GlRing_buffer
+ *
+ * With GL_ARB_buffer_storage the buffer is mapped once for its whole life
+ * (persistent and coherent mapping). Otherwise each range is mapped with
+ * GL_MAP_UNSYNCHRONIZED_BIT: the ring fences already guarantee the GPU is
+ * not reading it anymore so the driver must not synchronize.
+ */
+class GlRing_backend_gl : public GlRing_backend {
+public:
+    explicit GlRing_backend_gl(int nb_bytes);
+
+    ~GlRing_backend_gl();
+
+    void* map_range(int offset, int nb_bytes);
+
+    void flush_range(int offset, int nb_bytes);
+
+    GLsync fence();
+
+    void wait(GLsync sync);
+
+    GLuint get_id() const { return _buffer_id; }
+
+private:
+    GLuint _buffer_id;
+    char* _persistent_map; ///< whole buffer when persistently mapped
+};
+
+// =============================================================================
+
+/**
+ * @class GlRing_buffer
+ * @brief Sub-allocates consecutive ranges of a fixed size buffer object
+ *
+ * Used to stream geometry rewritten every frame: each alloc() returns the
+ * next free range, wrapping around at the end of the buffer. Once the draw
+ * calls reading the ranges allocated so far are issued, fence() marks them
+ * as in flight. alloc() only waits on a fence when it is about to overwrite
+ * a range the GPU may still read, so in the common case writing never
+ * stalls and no buffer object is ever created or resized.
+ *
+ * @code
+ *      GlRing_buffer ring(backend, 1 << 16, sizeof(float) * 3);
+ *      int first = ring.alloc(nb_verts);
+ *      memcpy(ring.map(first, nb_verts), verts, nb_verts * sizeof(float) * 3);
+ *      ring.flush(first, nb_verts);
+ *      // ... glDrawArrays(GL_LINES, first, nb_verts);
+ *      ring.fence(); // once per frame
+ * @endcode
+ */
+class GlRing_buffer {
+public:
+    /// @param backend : storage of the ring, deleted with the ring
+    /// @param capacity : number of elements the ring holds
+    /// @param elt_size : byte size of an element
+    GlRing_buffer(GlRing_backend* backend, int capacity, int elt_size);
+
+    /// Wait for the pending fences then release the backend
+    ~GlRing_buffer();
+
+    /// Reserve 'nb_elt' consecutive elements.
+    /// @return index of the first element, or -1 when 'nb_elt' does not fit
+    /// in the space left by the ranges allocated since the last fence()
+    int alloc(int nb_elt);
+
+    /// @return pointer to write the range [first, first + nb_elt)
+    void* map(int first, int nb_elt);
+
+    /// Publish the range written through map()
+    void flush(int first, int nb_elt);
+
+    /// Mark every range allocated since the last call as used by the GPU.
+    /// To be called after the draw calls reading them.
+    void fence();
+
+    // =========================================================================
+    /// @name Getter & Setters
+    // =========================================================================
+
+    int capacity() const { return _capacity; }
+
+    /// @return number of elements allocated and not yet released
+    int used() const { return _used; }
+
+    /// @return number of fences alloc() had to wait on
+    int nb_stalls() const { return _nb_stalls; }
+
+    GLuint get_id() const { return _backend->get_id(); }
+
+private:
+    GlRing_buffer(const GlRing_buffer&);
+    GlRing_buffer& operator=(const GlRing_buffer&);
+
+    /// A range of the ring read by draw calls older than 'sync'
+    struct Region {
+        GLsync sync;
+        int nb_elt; ///< including the padding wasted when wrapping
+    };
+
+    GlRing_backend* _backend;
+    int _capacity;
+    int _elt_size;
+    int _head;       ///< next element to be allocated
+    int _used;       ///< elements in flight plus the current (unfenced) range
+    int _nb_pending; ///< elements allocated since the last fence()
+    int _nb_stalls;
+    std::deque<Region> _in_flight; ///< oldest first
+};
+
+#endif // GL_RING_BUFFER_HPP__
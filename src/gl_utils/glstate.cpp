@@ -0,0 +1,312 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#include "glstate.h"
+
+// =============================================================================
+namespace Gl_forward {
+// =============================================================================
+
+static void use_program(GLuint program)
+{
+    glAssert(glUseProgram(program));
+}
+
+static void bind_vertex_array(GLuint vao)
+{
+    glAssert(glBindVertexArray(vao));
+}
+
+static void bind_buffer(GLenum target, GLuint buffer)
+{
+    glAssert(glBindBuffer(target, buffer));
+}
+
+static void bind_buffer_base(GLenum target, GLuint index, GLuint buffer)
+{
+    glAssert(glBindBufferBase(target, index, buffer));
+}
+
+static void polygon_mode(GLenum face, GLenum mode)
+{
+    glAssert(glPolygonMode(face, mode));
+}
+
+static void enable(GLenum cap)
+{
+    glAssert(glEnable(cap));
+}
+
+static void disable(GLenum cap)
+{
+    glAssert(glDisable(cap));
+}
+
+static void depth_func(GLenum func)
+{
+    glAssert(glDepthFunc(func));
+}
+
+static void depth_mask(GLboolean flag)
+{
+    glAssert(glDepthMask(flag));
+}
+
+static void viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    glAssert(glViewport(x, y, width, height));
+}
+
+} // END Gl_forward ============================================================
+
+// -----------------------------------------------------------------------------
+
+GlState_functions GlState_functions::opengl()
+{
+    GlState_functions f;
+    f.use_program = Gl_forward::use_program;
+    f.bind_vertex_array = Gl_forward::bind_vertex_array;
+    f.bind_buffer = Gl_forward::bind_buffer;
+    f.bind_buffer_base = Gl_forward::bind_buffer_base;
+    f.polygon_mode = Gl_forward::polygon_mode;
+    f.enable = Gl_forward::enable;
+    f.disable = Gl_forward::disable;
+    f.depth_func = Gl_forward::depth_func;
+    f.depth_mask = Gl_forward::depth_mask;
+    f.viewport = Gl_forward::viewport;
+    return f;
+}
+
+// -----------------------------------------------------------------------------
+
+GlState::GlState(const GlState_functions& gl)
+    : _gl(gl)
+    , _nb_issued(0)
+    , _nb_skipped(0)
+{
+    invalidate();
+}
+
+// -----------------------------------------------------------------------------
+
+GlState& GlState::current()
+{
+    static GlState state;
+    return state;
+}
+
+// -----------------------------------------------------------------------------
+
+bool GlState::changes(GLint& shadow, GLint value)
+{
+    if (shadow == value && shadow != UNKNOWN) {
+        _nb_skipped++;
+        return false;
+    }
+    shadow = value;
+    _nb_issued++;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+int GlState::buffer_slot(GLenum target)
+{
+    switch (target) {
+    case GL_ARRAY_BUFFER:         return BUFF_ARRAY;
+    case GL_ELEMENT_ARRAY_BUFFER: return BUFF_ELEMENT_ARRAY;
+    case GL_UNIFORM_BUFFER:       return BUFF_UNIFORM;
+    case GL_PIXEL_PACK_BUFFER:    return BUFF_PIXEL_PACK;
+    case GL_PIXEL_UNPACK_BUFFER:  return BUFF_PIXEL_UNPACK;
+    case GL_DRAW_INDIRECT_BUFFER: return BUFF_DRAW_INDIRECT;
+    default:                      return -1;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+int GlState::cap_slot(GLenum cap)
+{
+    switch (cap) {
+    case GL_DEPTH_TEST:        return CAP_DEPTH_TEST;
+    case GL_CULL_FACE:         return CAP_CULL_FACE;
+    case GL_BLEND:             return CAP_BLEND;
+    case GL_PRIMITIVE_RESTART: return CAP_PRIMITIVE_RESTART;
+    case GL_SCISSOR_TEST:      return CAP_SCISSOR_TEST;
+    case GL_STENCIL_TEST:      return CAP_STENCIL_TEST;
+    default:                   return -1;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void GlState::use_program(GLuint id)
+{
+    if (changes(_program, (GLint)id))
+        _gl.use_program(id);
+}
+
+// -----------------------------------------------------------------------------
+
+void GlState::bind_vertex_array(GLuint id)
+{
+    if (changes(_vertex_array, (GLint)id)) {
+        _gl.bind_vertex_array(id);
+        _buffers[BUFF_ELEMENT_ARRAY] = UNKNOWN;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void GlState::bind_buffer(GLenum target, GLuint id)
+{
+    int slot = buffer_slot(target);
+    if (slot < 0) {
+        _nb_issued++;
+        _gl.bind_buffer(target, id);
+    }
+    else if (changes(_buffers[slot], (GLint)id))
+        _gl.bind_buffer(target, id);
+}
+
+// -----------------------------------------------------------------------------
+
+void GlState::bind_buffer_base(GLenum target, GLuint index, GLuint id)
+{
+    int slot = buffer_slot(target);
+    if (target != GL_UNIFORM_BUFFER || index >= NB_UNIFORM_BINDINGS) {
+        _nb_issued++;
+        _gl.bind_buffer_base(target, index, id);
+        if (slot >= 0)
+            _buffers[slot] = id;
+        return;
+    }
+
+    if (changes(_uniform_bindings[index], (GLint)id)) {
+        _gl.bind_buffer_base(target, index, id);
+        _buffers[slot] = id;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void GlState::polygon_mode(GLenum mode)
+{
+    if (changes(_polygon_mode, (GLint)mode))
+        _gl.polygon_mode(GL_FRONT_AND_BACK, mode);
+}
+
+// -----------------------------------------------------------------------------
+
+void GlState::set_enabled(GLenum cap, bool state)
+{
+    int slot = cap_slot(cap);
+    if (slot >= 0 && !changes(_caps[slot], state ? 1 : 0))
+        return;
+    if (slot < 0)
+        _nb_issued++;
+
+    if (state)
+        _gl.enable(cap);
+    else
+        _gl.disable(cap);
+}
+
+// -----------------------------------------------------------------------------
+
+void GlState::depth_func(GLenum func)
+{
+    if (changes(_depth_func, (GLint)func))
+        _gl.depth_func(func);
+}
+
+// -----------------------------------------------------------------------------
+
+void GlState::depth_mask(bool state)
+{
+    if (changes(_depth_mask, state ? 1 : 0))
+        _gl.depth_mask(state ? GL_TRUE : GL_FALSE);
+}
+
+// -----------------------------------------------------------------------------
+
+void GlState::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    if (_viewport[0] == x && _viewport[1] == y &&
+        _viewport[2] == width && _viewport[3] == height)
+    {
+        _nb_skipped++;
+        return;
+    }
+    _viewport[0] = x;
+    _viewport[1] = y;
+    _viewport[2] = width;
+    _viewport[3] = height;
+    _nb_issued++;
+    _gl.viewport(x, y, width, height);
+}
+
+// -----------------------------------------------------------------------------
+
+void GlState::forget_program(GLuint id)
+{
+    // A deleted program stays in use until another one is bound
+    if (_program == (GLint)id)
+        _program = UNKNOWN;
+}
+
+// -----------------------------------------------------------------------------
+
+void GlState::forget_vertex_array(GLuint id)
+{
+    if (_vertex_array == (GLint)id) {
+        _vertex_array = 0;
+        _buffers[BUFF_ELEMENT_ARRAY] = UNKNOWN;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void GlState::forget_buffer(GLuint id)
+{
+    for (int i = 0; i < BUFF_SIZE; ++i)
+        if (_buffers[i] == (GLint)id)
+            _buffers[i] = 0;
+    for (int i = 0; i < NB_UNIFORM_BINDINGS; ++i)
+        if (_uniform_bindings[i] == (GLint)id)
+            _uniform_bindings[i] = 0;
+}
+
+// -----------------------------------------------------------------------------
+
+void GlState::invalidate()
+{
+    _program = UNKNOWN;
+    _vertex_array = UNKNOWN;
+    for (int i = 0; i < BUFF_SIZE; ++i)
+        _buffers[i] = UNKNOWN;
+    for (int i = 0; i < NB_UNIFORM_BINDINGS; ++i)
+        _uniform_bindings[i] = UNKNOWN;
+    for (int i = 0; i < CAP_SIZE; ++i)
+        _caps[i] = UNKNOWN;
+    _polygon_mode = UNKNOWN;
+    _depth_func = UNKNOWN;
+    _depth_mask = UNKNOWN;
+    // Negative sizes never match a valid viewport
+    _viewport[0] = _viewport[1] = 0;
+    _viewport[2] = _viewport[3] = UNKNOWN;
+}
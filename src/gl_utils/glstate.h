@@ -0,0 +1,188 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+
+#ifndef GL_STATE_HPP__
+#define GL_STATE_HPP__
+
+#include "opengl.h"
+
+/**
+ * @struct GlState_functions
+ * @brief OpenGL entry points filtered by GlState
+ *
+ * GlState never calls OpenGL directly but through this table. The default
+ * table forwards to the current context. A fake recording the calls can be
+ * plugged instead to check the filtering without a context.
+ */
+struct GlState_functions {
+    void (*use_program)(GLuint program);
+    void (*bind_vertex_array)(GLuint vao);
+    void (*bind_buffer)(GLenum target, GLuint buffer);
+    void (*bind_buffer_base)(GLenum target, GLuint index, GLuint buffer);
+    void (*polygon_mode)(GLenum face, GLenum mode);
+    void (*enable)(GLenum cap);
+    void (*disable)(GLenum cap);
+    void (*depth_func)(GLenum func);
+    void (*depth_mask)(GLboolean flag);
+    void (*viewport)(GLint x, GLint y, GLsizei width, GLsizei height);
+
+    /// @return entry points forwarding to the current OpenGL context
+    static GlState_functions opengl();
+};
+
+// =============================================================================
+
+/**
+ * @class GlState
+ * @brief Shadow copy of the OpenGL states to skip redundant calls
+ *
+ * Bindings (program, VAO, buffers) and a few fixed function states (polygon
+ * mode, depth test etc.) are set through GlState which only forwards the
+ * calls changing the current value. OpenGL is never queried: the shadow
+ * starts unknown, hence the first call of each state is always issued.
+ *
+ * Code changing these states with raw gl calls must call invalidate()
+ * before handing the control back. Code deleting objects must call the
+ * forget_xxx() methods since deleted names are unbound and may be reused.
+ *
+ * @code
+ *      GlState& gl = GlState::current();
+ *      gl.use_program(prog);
+ *      gl.bind_vertex_array(vao);
+ *      glDrawArrays(GL_TRIANGLES, 0, nb_verts);
+ *      gl.bind_vertex_array(vao); // skipped
+ * @endcode
+ */
+class GlState {
+public:
+    /// Value of a state that was never set or invalidated
+    static const GLint UNKNOWN = -1;
+
+    explicit GlState(const GlState_functions& gl = GlState_functions::opengl());
+
+    /// @return the state of the application's OpenGL context
+    static GlState& current();
+
+    // =========================================================================
+    /// @name Bindings
+    // =========================================================================
+
+    void use_program(GLuint id);
+
+    /// @return program in use or UNKNOWN
+    GLint program() const { return _program; }
+
+    /// @note the element array buffer binding is part of the VAO state, it
+    /// becomes unknown when the VAO changes.
+    void bind_vertex_array(GLuint id);
+
+    GLint vertex_array() const { return _vertex_array; }
+
+    /// Targets not tracked are always forwarded
+    void bind_buffer(GLenum target, GLuint id);
+
+    /// Bind 'id' to an indexed target (GL_UNIFORM_BUFFER) and to its generic
+    /// binding like glBindBufferBase()
+    void bind_buffer_base(GLenum target, GLuint index, GLuint id);
+
+    // =========================================================================
+    /// @name Fixed function states
+    // =========================================================================
+
+    /// @param mode : GL_FILL, GL_LINE or GL_POINT (for GL_FRONT_AND_BACK)
+    void polygon_mode(GLenum mode);
+
+    /// Capabilities not tracked are always forwarded
+    void set_enabled(GLenum cap, bool state);
+    void enable(GLenum cap) { set_enabled(cap, true); }
+    void disable(GLenum cap) { set_enabled(cap, false); }
+
+    void depth_func(GLenum func);
+    void depth_mask(bool state);
+    void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+    // =========================================================================
+    /// @name Shadow maintenance
+    // =========================================================================
+
+    /// Objects about to be deleted: bindings to them fall back to 0
+    void forget_program(GLuint id);
+    void forget_vertex_array(GLuint id);
+    void forget_buffer(GLuint id);
+
+    /// Every state becomes unknown (raw gl calls, context switch...)
+    void invalidate();
+
+    // =========================================================================
+    /// @name Statistics
+    // =========================================================================
+
+    /// @return number of calls forwarded to OpenGL
+    int nb_issued() const { return _nb_issued; }
+
+    /// @return number of redundant calls dropped
+    int nb_skipped() const { return _nb_skipped; }
+
+    void reset_counters() { _nb_issued = _nb_skipped = 0; }
+
+private:
+    enum Buffer_t {
+        BUFF_ARRAY = 0,
+        BUFF_ELEMENT_ARRAY,
+        BUFF_UNIFORM,
+        BUFF_PIXEL_PACK,
+        BUFF_PIXEL_UNPACK,
+        BUFF_DRAW_INDIRECT,
+        BUFF_SIZE
+    };
+
+    enum Cap_t {
+        CAP_DEPTH_TEST = 0,
+        CAP_CULL_FACE,
+        CAP_BLEND,
+        CAP_PRIMITIVE_RESTART,
+        CAP_SCISSOR_TEST,
+        CAP_STENCIL_TEST,
+        CAP_SIZE
+    };
+
+    enum { NB_UNIFORM_BINDINGS = 16 };
+
+    /// @return true if the call setting 'shadow' to 'value' must be issued
+    /// and update 'shadow' accordingly
+    bool changes(GLint& shadow, GLint value);
+
+    static int buffer_slot(GLenum target);
+    static int cap_slot(GLenum cap);
+
+    GlState_functions _gl;
+
+    GLint _program;
+    GLint _vertex_array;
+    GLint _buffers[BUFF_SIZE];
+    GLint _uniform_bindings[NB_UNIFORM_BINDINGS];
+    GLint _caps[CAP_SIZE];
+    GLint _polygon_mode;
+    GLint _depth_func;
+    GLint _depth_mask;
+    GLint _viewport[4];
+
+    int _nb_issued;
+    int _nb_skipped;
+};
+
+#endif // GL_STATE_HPP__
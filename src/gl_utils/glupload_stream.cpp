@@ -0,0 +1,201 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "glupload_stream.h"
+#include "glassert.h"
+
+#include <algorithm>
+#include <cstring>
+
+// -----------------------------------------------------------------------------
+
+GlUpload::GlUpload(const void* data, GLsizeiptr size)
+    : _data(data)
+    , _size(size)
+    , _buffer(0)
+    , _fence(0)
+    , _submitted(false)
+    , _failed(false)
+    , _ready(false)
+{
+}
+
+// -----------------------------------------------------------------------------
+
+GlUpload::~GlUpload()
+{
+    if (!_submitted)
+        return; // Never uploaded, or still uploading: the stream must be stopped
+    if (_fence != 0) {
+        glAssert(glDeleteSync(_fence));
+    }
+    if (_buffer != 0) {
+        glAssert(glDeleteBuffers(1, &_buffer));
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+bool GlUpload::is_ready()
+{
+    if (_ready)
+        return true;
+    if (!_submitted || _fence == 0)
+        return false;
+    // A null timeout only polls the fence
+    GLenum status = glClientWaitSync(_fence, 0, 0);
+    glCheckError();
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+        return false;
+    glAssert(glDeleteSync(_fence));
+    _fence = 0;
+    _ready = true;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+GLuint GlUpload::release_buffer()
+{
+    GLuint buffer = _buffer;
+    _buffer = 0;
+    return buffer;
+}
+
+// -----------------------------------------------------------------------------
+
+GlUpload_stream::GlUpload_stream(GLsizeiptr chunk_size)
+    : _chunk_size(chunk_size)
+    , _nb_running(0)
+    , _stop(false)
+    , _failed(false)
+{
+}
+
+// -----------------------------------------------------------------------------
+
+void GlUpload_stream::push(GlUpload* upload)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_failed) {
+        upload->_failed = true;
+        return;
+    }
+    _queue.push_back(upload);
+    _cond.notify_one();
+}
+
+// -----------------------------------------------------------------------------
+
+void GlUpload_stream::run()
+{
+    GLuint staging = 0;
+    glAssert(glGenBuffers(1, &staging));
+    glAssert(glBindBuffer(GL_COPY_READ_BUFFER, staging));
+    glAssert(glBufferData(GL_COPY_READ_BUFFER, _chunk_size, 0, GL_STREAM_DRAW));
+    glAssert(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+    while (true) {
+        GlUpload* u = 0;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _cond.wait(lock, [this] { return _stop || !_queue.empty(); });
+            if (_stop)
+                break;
+            u = _queue.front();
+            _queue.pop_front();
+            _nb_running = 1;
+        }
+        bool done = upload(*u, staging);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _nb_running = 0;
+        if (!done)
+            break;
+    }
+    glAssert(glDeleteBuffers(1, &staging));
+    // Objects deleted by this context are only released once it flushed
+    glAssert(glFinish());
+}
+
+// -----------------------------------------------------------------------------
+
+bool GlUpload_stream::upload(GlUpload& u, GLuint staging)
+{
+    // Raw calls: GlState shadows the drawing context, not this one
+    glAssert(glGenBuffers(1, &u._buffer));
+    glAssert(glBindBuffer(GL_COPY_WRITE_BUFFER, u._buffer));
+    glAssert(glBufferData(GL_COPY_WRITE_BUFFER, u._size, 0, GL_STATIC_DRAW));
+    glAssert(glBindBuffer(GL_COPY_READ_BUFFER, staging));
+
+    const char* src = (const char*)u._data;
+    bool stopped = false;
+    for (GLsizeiptr offset = 0; offset < u._size && !stopped; offset += _chunk_size) {
+        GLsizeiptr size = std::min(_chunk_size, u._size - offset);
+        // Invalidating the whole staging buffer lets the driver hand over
+        // fresh memory instead of waiting for the copy of the previous chunk
+        void* dst = 0;
+        glAssert(dst = glMapBufferRange(GL_COPY_READ_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+        if (dst != 0) {
+            memcpy(dst, src + offset, size);
+            glAssert(glUnmapBuffer(GL_COPY_READ_BUFFER));
+            glAssert(glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, offset, size));
+        }
+        else { // Out of memory for the mapping: fall back to a plain copy
+            glAssert(glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, src + offset));
+        }
+        stopped = _stop;
+    }
+    glAssert(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+    glAssert(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+
+    if (!stopped) {
+        glAssert(u._fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+    }
+    // The drawing context only sees the fence signaled once this one is
+    // flushed
+    glAssert(glFlush());
+    u._submitted = true;
+    return !stopped;
+}
+
+// -----------------------------------------------------------------------------
+
+void GlUpload_stream::stop()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+    _cond.notify_all();
+}
+
+// -----------------------------------------------------------------------------
+
+void GlUpload_stream::fail()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+    _failed = true;
+    for (unsigned i = 0; i < _queue.size(); ++i)
+        _queue[i]->_failed = true;
+    _queue.clear();
+    _cond.notify_all();
+}
+
+// -----------------------------------------------------------------------------
+
+int GlUpload_stream::nb_pending() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return (int)_queue.size() + _nb_running;
+}
@@ -0,0 +1,147 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef GL_UPLOAD_STREAM_HPP__
+#define GL_UPLOAD_STREAM_HPP__
+
+#include "opengl.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+
+/**
+ * @class GlUpload
+ * @brief A buffer object filled by a GlUpload_stream
+ *
+ * Created and polled by the drawing thread, filled by the thread of the
+ * stream. The buffer may only be used once is_ready() returned true.
+ */
+class GlUpload {
+public:
+    /// @param data : 'size' bytes copied into the buffer, must stay valid
+    /// until is_ready() returns true or the stream is stopped
+    GlUpload(const void* data, GLsizeiptr size);
+
+    /// Delete the fence, and the buffer unless release_buffer() was called
+    /// @note needs a current context sharing objects with the stream's one
+    ~GlUpload();
+
+    /// Non blocking check of the fence ending the upload
+    bool is_ready();
+
+    /// The buffer is no longer deleted with this object
+    GLuint release_buffer();
+
+    GLuint get_buffer() const { return _buffer; }
+
+    /// The stream gave up on this upload (see GlUpload_stream::fail()): it
+    /// is never ready and its data must be uploaded another way
+    bool has_failed() const { return _failed; }
+
+    GLsizeiptr size() const { return _size; }
+
+private:
+    GlUpload(const GlUpload&);
+    GlUpload& operator=(const GlUpload&);
+
+    friend class GlUpload_stream;
+
+    const void* _data;
+    GLsizeiptr _size;
+    GLuint _buffer;
+    GLsync _fence;
+    /// Set once _buffer and _fence are flushed by the stream's context
+    std::atomic<bool> _submitted;
+    std::atomic<bool> _failed;
+    bool _ready;
+};
+
+// =============================================================================
+
+/**
+ * @class GlUpload_stream
+ * @brief Fills buffer objects from a thread with its own shared context
+ *
+ * A big glBufferData() stalls the thread calling it for as long as the
+ * driver copies the data. Here the copies are done by another thread (see
+ * run()) whose context shares its objects with the drawing one. Each upload
+ * goes through a small staging buffer, chunk by chunk: the chunk is written
+ * in the mapped staging buffer then moved to the destination with
+ * glCopyBufferSubData(). The upload ends with glFenceSync(), which the
+ * drawing thread polls through GlUpload::is_ready().
+ *
+ * @code
+ *      // Worker thread, with the shared context current
+ *      stream.run();
+ *      // Drawing thread
+ *      GlUpload* u = new GlUpload(vertices, size);
+ *      stream.push(u);
+ *      // ... then every frame:
+ *      if (u->is_ready())
+ *          vbo = u->release_buffer();
+ * @endcode
+ */
+class GlUpload_stream {
+public:
+    /// @param chunk_size : size in bytes of the staging buffer
+    GlUpload_stream(GLsizeiptr chunk_size = 1 << 20);
+
+    /// Queue 'upload', thread safe. The stream does not own it.
+    /// Once the stream failed 'upload' is marked failed instead.
+    void push(GlUpload* upload);
+
+    /// Upload what is pushed until stop() is called. The uploads still
+    /// queued at that point are left untouched.
+    /// @note to call on the stream's thread with its context current
+    void run();
+
+    /// Make run() return after the chunk in progress, thread safe.
+    /// An upload interrupted keeps its fence unset and is never ready.
+    void stop();
+
+    /// Stop, then mark failed the uploads queued and those pushed later on,
+    /// thread safe. For the stream's thread when it cannot run(), e.g. its
+    /// context could not be made current.
+    void fail();
+
+    /// fail() was called, thread safe
+    bool has_failed() const { return _failed; }
+
+    /// @return number of uploads pushed and not finished yet, thread safe
+    int nb_pending() const;
+
+    GLsizeiptr chunk_size() const { return _chunk_size; }
+
+private:
+    GlUpload_stream(const GlUpload_stream&);
+    GlUpload_stream& operator=(const GlUpload_stream&);
+
+    /// Copy 'upload' chunk by chunk through 'staging'
+    /// @return false if stopped
+    bool upload(GlUpload& upload, GLuint staging);
+
+    GLsizeiptr _chunk_size;
+
+    mutable std::mutex _mutex;
+    std::condition_variable _cond;
+    std::deque<GlUpload*> _queue;
+    int _nb_running; ///< 1 while run() copies an upload
+    std::atomic<bool> _stop;
+    std::atomic<bool> _failed;
+};
+
+#endif // GL_UPLOAD_STREAM_HPP__
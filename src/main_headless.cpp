@@ -0,0 +1,1311 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "rendersystem/renderer.h"
+#include "rendersystem/boundsculler.h"
+#include "rendersystem/frustum.h"
+#include "rendersystem/scenebvh.h"
+#include "rendersystem/renderqueue.h"
+#include "fileloaders/objloader.h"
+#include "fileloaders/mappedfile.h"
+#include "fileloaders/vertexwelder.h"
+#include "fileloaders/mesh.h"
+#include "gl_utils/opengl.h"
+#include "gl_utils/glassert.h"
+#include "gl_utils/glupload_stream.h"
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Options of the command line, see usage()
+struct Options {
+    std::string objFile;
+    int width;
+    int height;
+    int nbFrames;
+    int nbWarmup;
+    int nbImages;
+    std::string outPrefix;
+    int nbCullObjects; ///< > 0 : culling benchmark instead of rendering
+    int nbSortPackets; ///< > 0 : render queue benchmark instead of rendering
+    std::string parseFile; ///< not empty : OBJ parsers benchmark instead of rendering
+    int nbWeldQuads;   ///< > 0 : vertex welding benchmark instead of rendering
+    int nbNormalTriangles; ///< > 0 : normals benchmark instead of rendering
+    int nbLayoutTriangles; ///< > 0 : vertex layouts benchmark instead of rendering
+    int nbRayTriangles; ///< > 0 : ray queries benchmark instead of rendering
+    int nbStreamMegabytes; ///< > 0 : upload stream check instead of rendering
+
+    Options()
+        : width(800)
+        , height(450)
+        , nbFrames(120)
+        , nbWarmup(10)
+        , nbImages(4)
+        , outPrefix("headless")
+        , nbCullObjects(0)
+        , nbSortPackets(0)
+        , nbWeldQuads(0)
+        , nbNormalTriangles(0)
+        , nbLayoutTriangles(0)
+        , nbRayTriangles(0)
+        , nbStreamMegabytes(0)
+    {
+    }
+};
+
+// -----------------------------------------------------------------------------
+
+static void usage(const char* program)
+{
+    std::cerr << "Usage: " << program << " file.obj [options]\n"
+              << "       " << program << " -cull N [-frames N] [-size WxH]\n"
+              << "       " << program << " -sort N [-frames N]\n"
+              << "       " << program << " -parse file.obj\n"
+              << "       " << program << " -weld N\n"
+              << "       " << program << " -normals N\n"
+              << "       " << program << " -layout N\n"
+              << "       " << program << " -rays N\n"
+              << "       " << program << " -stream N\n"
+              << "Renders \"file.obj\" offscreen, the camera orbiting once around it.\n"
+              << "Run it from the bin/ folder so that ../shaders/ is found.\n"
+              << "  -frames N   frames timed (default 120)\n"
+              << "  -warmup N   frames drawn before timing (default 10)\n"
+              << "  -size WxH   image size (default 800x450)\n"
+              << "  -images N   frames saved as <prefix>_<i>.ppm (default 4)\n"
+              << "  -out PREFIX prefix of the files written (default \"headless\"),\n"
+              << "              frame times go to <prefix>_timings.csv\n"
+              << "  -cull N     no rendering: times the frustum culling of N random\n"
+              << "              boxes seen from the orbiting cameras\n"
+              << "  -sort N     no rendering: times the submission and the sort of\n"
+              << "              N draw packets in the render queue\n"
+              << "  -parse FILE no rendering: throughput of the OBJ parsers on FILE\n"
+              << "  -weld N     no rendering: times the welding of the corners of N\n"
+              << "              quads, hash table against std::map\n"
+              << "  -normals N  no rendering: times the normals of a grid of N triangles\n"
+              << "              (e.g. 10000000), parallel gather against serial scatter\n"
+              << "  -layout N   no rendering: times the bounding box and the transform of\n"
+              << "              a grid of N triangles, interleaved against separate streams\n"
+              << "  -rays N     no rendering: times the ray queries on a grid of N triangles\n"
+              << "              (e.g. 4000000) through its triangle hierarchy\n"
+              << "  -stream N   no rendering: uploads N MiB in buffers of various sizes\n"
+              << "              from a second shared context, reads them back and times\n"
+              << "              the render thread against glBufferData()\n";
+}
+
+// -----------------------------------------------------------------------------
+
+/// @return false on a malformed command line
+static bool parseArgs(int argc, char* argv[], Options& opt)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "-frames" && hasValue)
+            opt.nbFrames = std::max(1, atoi(argv[++i]));
+        else if (arg == "-warmup" && hasValue)
+            opt.nbWarmup = std::max(0, atoi(argv[++i]));
+        else if (arg == "-images" && hasValue)
+            opt.nbImages = std::max(0, atoi(argv[++i]));
+        else if (arg == "-out" && hasValue)
+            opt.outPrefix = argv[++i];
+        else if (arg == "-cull" && hasValue)
+            opt.nbCullObjects = std::max(1, atoi(argv[++i]));
+        else if (arg == "-sort" && hasValue)
+            opt.nbSortPackets = std::max(1, atoi(argv[++i]));
+        else if (arg == "-parse" && hasValue)
+            opt.parseFile = argv[++i];
+        else if (arg == "-weld" && hasValue)
+            opt.nbWeldQuads = std::max(1, atoi(argv[++i]));
+        else if (arg == "-normals" && hasValue)
+            opt.nbNormalTriangles = std::max(2, atoi(argv[++i]));
+        else if (arg == "-layout" && hasValue)
+            opt.nbLayoutTriangles = std::max(2, atoi(argv[++i]));
+        else if (arg == "-rays" && hasValue)
+            opt.nbRayTriangles = std::max(2, atoi(argv[++i]));
+        else if (arg == "-stream" && hasValue)
+            opt.nbStreamMegabytes = std::max(1, atoi(argv[++i]));
+        else if (arg == "-size" && hasValue) {
+            if (sscanf(argv[++i], "%dx%d", &opt.width, &opt.height) != 2 || opt.width <= 0 || opt.height <= 0)
+                return false;
+        }
+        else if (arg[0] != '-' && opt.objFile.empty())
+            opt.objFile = arg;
+        else
+            return false;
+    }
+    return !opt.objFile.empty() || opt.nbCullObjects > 0 || opt.nbSortPackets > 0 ||
+           !opt.parseFile.empty() || opt.nbWeldQuads > 0 || opt.nbNormalTriangles > 0 ||
+           opt.nbLayoutTriangles > 0 || opt.nbRayTriangles > 0 || opt.nbStreamMegabytes > 0;
+}
+
+// -----------------------------------------------------------------------------
+
+/**
+  * OpenGL 3.2 core context without any window: EGL on the Mesa surfaceless
+  * platform when available (no X server nor GPU needed, e.g. llvmpipe),
+  * the default EGL display otherwise. Images are drawn in a framebuffer
+  * object, see Framebuffer. Other threads get contexts sharing its objects
+  * from createShared().
+  */
+class HeadlessContext {
+public:
+    HeadlessContext()
+        : mDisplay(EGL_NO_DISPLAY)
+        , mConfig(0)
+        , mContext(EGL_NO_CONTEXT)
+    {
+    }
+
+    ~HeadlessContext()
+    {
+        if (mDisplay == EGL_NO_DISPLAY)
+            return;
+        eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        for (unsigned i = 0; i < mShared.size(); ++i)
+            eglDestroyContext(mDisplay, mShared[i]);
+        if (mContext != EGL_NO_CONTEXT)
+            eglDestroyContext(mDisplay, mContext);
+        eglTerminate(mDisplay);
+    }
+
+    /// Create the context and make it current
+    bool create(std::string& reason)
+    {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay != 0)
+            mDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+        if (mDisplay == EGL_NO_DISPLAY)
+            mDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        if (mDisplay == EGL_NO_DISPLAY || !eglInitialize(mDisplay, 0, 0)) {
+            mDisplay = EGL_NO_DISPLAY;
+            reason = "no EGL display";
+            return false;
+        }
+        if (!eglBindAPI(EGL_OPENGL_API)) {
+            reason = "EGL has no desktop OpenGL";
+            return false;
+        }
+
+        // No window: the default EGL_WINDOW_BIT would match no config
+        const EGLint configAttribs[] = {
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+            EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+            EGL_NONE
+        };
+        EGLint nbConfigs = 0;
+        if (!eglChooseConfig(mDisplay, configAttribs, &mConfig, 1, &nbConfigs) || nbConfigs == 0) {
+            reason = "no EGL config for OpenGL";
+            return false;
+        }
+        mContext = createContext(EGL_NO_CONTEXT);
+        if (mContext == EGL_NO_CONTEXT) {
+            reason = "cannot create an OpenGL 3.2 core context";
+            return false;
+        }
+        // Without surface: needs EGL_KHR_surfaceless_context
+        if (!makeCurrent(mContext)) {
+            reason = "cannot make the context current without surface";
+            return false;
+        }
+        return true;
+    }
+
+    /// Context sharing its objects with the one of create(), to be made
+    /// current by another thread. Destroyed with this object.
+    /// @return EGL_NO_CONTEXT on failure
+    EGLContext createShared()
+    {
+        EGLContext context = createContext(mContext);
+        if (context != EGL_NO_CONTEXT)
+            mShared.push_back(context);
+        return context;
+    }
+
+    /// Make "context" current on the calling thread without surface,
+    /// EGL_NO_CONTEXT releases the current one
+    bool makeCurrent(EGLContext context) const
+    {
+        return eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, context) == EGL_TRUE;
+    }
+
+private:
+    EGLContext createContext(EGLContext shared) const
+    {
+        // Same version and profile as Gui::OpenGLWidget
+        const EGLint contextAttribs[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 3,
+            EGL_CONTEXT_MINOR_VERSION, 2,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+            EGL_NONE
+        };
+        return eglCreateContext(mDisplay, mConfig, shared, contextAttribs);
+    }
+
+    EGLDisplay mDisplay;
+    EGLConfig mConfig;
+    EGLContext mContext;
+    std::vector<EGLContext> mShared; ///< see createShared()
+};
+
+// -----------------------------------------------------------------------------
+
+/// Color and depth render target standing for the window
+class Framebuffer {
+public:
+    Framebuffer(int width, int height)
+        : mWidth(width)
+        , mHeight(height)
+        , mFbo(0)
+    {
+        glAssert(glGenRenderbuffers(2, mRenderbuffers));
+        glAssert(glBindRenderbuffer(GL_RENDERBUFFER, mRenderbuffers[0]));
+        glAssert(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height));
+        glAssert(glBindRenderbuffer(GL_RENDERBUFFER, mRenderbuffers[1]));
+        glAssert(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height));
+        glAssert(glBindRenderbuffer(GL_RENDERBUFFER, 0));
+
+        glAssert(glGenFramebuffers(1, &mFbo));
+        glAssert(glBindFramebuffer(GL_FRAMEBUFFER, mFbo));
+        glAssert(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, mRenderbuffers[0]));
+        glAssert(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, mRenderbuffers[1]));
+    }
+
+    ~Framebuffer()
+    {
+        glAssert(glBindFramebuffer(GL_FRAMEBUFFER, 0));
+        glAssert(glDeleteFramebuffers(1, &mFbo));
+        glAssert(glDeleteRenderbuffers(2, mRenderbuffers));
+    }
+
+    bool isComplete() const { return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE; }
+
+    /// Bind the framebuffer and erase it, the renderer draws over it
+    void begin()
+    {
+        glAssert(glBindFramebuffer(GL_FRAMEBUFFER, mFbo));
+        glAssert(glClearColor(0.f, 0.f, 0.f, 1.f));
+        glAssert(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
+    }
+
+    /// Write the color buffer as a binary PPM file
+    bool save(const std::string& fileName) const
+    {
+        std::vector<unsigned char> pixels(mWidth * mHeight * 4);
+        glAssert(glBindFramebuffer(GL_READ_FRAMEBUFFER, mFbo));
+        glAssert(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+        glAssert(glReadPixels(0, 0, mWidth, mHeight, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]));
+
+        std::ofstream file(fileName.c_str(), std::ios::binary);
+        if (!file)
+            return false;
+        file << "P6\n" << mWidth << " " << mHeight << "\n255\n";
+        // OpenGL rows go bottom up
+        std::vector<char> row(mWidth * 3);
+        for (int y = mHeight - 1; y >= 0; --y) {
+            const unsigned char* src = &pixels[y * mWidth * 4];
+            for (int x = 0; x < mWidth; ++x)
+                memcpy(&row[x * 3], src + x * 4, 3);
+            file.write(&row[0], row.size());
+        }
+        return (bool)file;
+    }
+
+private:
+    int mWidth;
+    int mHeight;
+    GLuint mFbo;
+    GLuint mRenderbuffers[2]; ///< color and depth
+};
+
+// -----------------------------------------------------------------------------
+
+/// Parse "fileName" and hand its meshes to "renderer", uploading them all
+/// @param bmin, bmax : bounding box of the meshes
+static bool loadScene(RenderSystem::Renderer& renderer, const std::string& fileName,
+                      glm::vec3& bmin, glm::vec3& bmax)
+{
+    Loaders::Obj_mtl::ObjLoader loader;
+    QString reason;
+    if (!loader.load(QString(fileName.c_str()), reason)) {
+        std::cerr << "Cannot read " << fileName << ": " << reason.toStdString() << std::endl;
+        return false;
+    }
+    std::vector<Loaders::Mesh*> meshes;
+    loader.getObjects(meshes);
+
+    bmin = glm::vec3(std::numeric_limits<float>::max());
+    bmax = glm::vec3(-std::numeric_limits<float>::max());
+    for (unsigned i = 0; i < meshes.size(); ++i) {
+        if (meshes[i]->nbVertices() == 0)
+            continue;
+        glm::vec3 mmin, mmax;
+        meshes[i]->boundingBox(mmin, mmax);
+        bmin = glm::min(bmin, mmin);
+        bmax = glm::max(bmax, mmax);
+    }
+    if (bmin.x > bmax.x)
+        bmin = bmax = glm::vec3(0.f);
+
+    // Same path as the files opened by the GUI (see Gui::MeshLoader), but
+    // everything is uploaded before timing
+    renderer.setUploadBudget(std::numeric_limits<int>::max());
+    for (unsigned i = 0; i < meshes.size(); ++i) {
+        while (!renderer.queueMesh(meshes[i], 0))
+            renderer.render();
+    }
+    while (renderer.nbPendingMeshes() > 0)
+        renderer.render();
+    // Streamed meshes have no levels of detail yet
+    renderer.buildMeshLods();
+    renderer.updateMeshBounds();
+    std::cout << meshes.size() << " meshes loaded" << std::endl;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Camera of frame "i" over "n": one turn around the box, slightly above it
+static glm::mat4 orbitCamera(int i, int n, const glm::vec3& bmin, const glm::vec3& bmax)
+{
+    const glm::vec3 center = (bmin + bmax) * 0.5f;
+    const float radius = std::max(glm::length(bmax - bmin) * 0.5f, 1e-3f);
+    // The bounding sphere fits the 60 degrees field of view of the renderer
+    const float distance = radius * 2.2f;
+    const float angle = 2.f * float(M_PI) * float(i) / float(n);
+    const float elevation = 0.35f;
+    glm::vec3 eye = center + distance * glm::vec3(std::cos(elevation) * std::sin(angle),
+                                                  std::sin(elevation),
+                                                  std::cos(elevation) * std::cos(angle));
+    return glm::lookAt(eye, center, glm::vec3(0.f, 1.f, 0.f));
+}
+
+// -----------------------------------------------------------------------------
+
+/// Scalar version of RenderSystem::BoundsCuller::cull(), reference of the
+/// SIMD paths
+static int cullScalar(const RenderSystem::Frustum& frustum,
+                      const std::vector<glm::vec3>& bmin, const std::vector<glm::vec3>& bmax,
+                      std::vector<unsigned char>& visible)
+{
+    visible.resize(bmin.size());
+    int nbVisible = 0;
+    for (unsigned i = 0; i < bmin.size(); ++i) {
+        glm::vec3 c = (bmin[i] + bmax[i]) * 0.5f;
+        glm::vec3 e = (bmax[i] - bmin[i]) * 0.5f;
+        float radius = glm::length(e);
+        bool inside = true;
+        for (int p = 0; p < RenderSystem::Frustum::NB_PLANES && inside; ++p) {
+            const glm::vec4& pl = frustum.plane(p);
+            float d = pl.x * c.x + pl.y * c.y + pl.z * c.z + pl.w;
+            float r = std::fabs(pl.x) * e.x + std::fabs(pl.y) * e.y + std::fabs(pl.z) * e.z;
+            inside = d >= -std::min(r, radius);
+        }
+        visible[i] = inside ? 1 : 0;
+        nbVisible += visible[i];
+    }
+    return nbVisible;
+}
+
+// -----------------------------------------------------------------------------
+
+/// True when the box touches one of the frustum planes up to float rounding:
+/// there the culling results of two methods may legitimately differ
+static bool onFrustumBoundary(const RenderSystem::Frustum& frustum,
+                              const glm::vec3& bmin, const glm::vec3& bmax)
+{
+    glm::vec3 c = (bmin + bmax) * 0.5f;
+    glm::vec3 e = (bmax - bmin) * 0.5f;
+    for (int p = 0; p < RenderSystem::Frustum::NB_PLANES; ++p) {
+        const glm::vec4& pl = frustum.plane(p);
+        float d = pl.x * c.x + pl.y * c.y + pl.z * c.z + pl.w;
+        float r = std::fabs(pl.x) * e.x + std::fabs(pl.y) * e.y + std::fabs(pl.z) * e.z;
+        if (std::fabs(d + r) <= 1e-4f * (1.f + std::fabs(d)))
+            return true;
+    }
+    return false;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Milliseconds since "start"
+static double elapsedMs(const std::chrono::steady_clock::time_point& start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// -----------------------------------------------------------------------------
+
+/// Time the frustum culling of "opt.nbCullObjects" random boxes (0.5 to 3
+/// units wide in a 200 units cube) from the cameras of "opt.nbFrames" frames
+/// orbiting around them, with the scalar reference, the SIMD culler and the
+/// scene hierarchy (the three are box against planes tests), then the
+/// build of the hierarchy and its refit once every box moved.
+/// @return false when they disagree
+static bool cullBenchmark(const Options& opt)
+{
+    const int n = opt.nbCullObjects;
+    std::vector<glm::vec3> bmin(n), bmax(n);
+    srand(1);
+    for (int i = 0; i < n; ++i) {
+        glm::vec3 c(rand() % 20001 - 10000, rand() % 20001 - 10000, rand() % 20001 - 10000);
+        glm::vec3 e(rand() % 101, rand() % 101, rand() % 101);
+        bmin[i] = c * 0.01f - (0.25f + e * 0.0125f);
+        bmax[i] = c * 0.01f + (0.25f + e * 0.0125f);
+    }
+    RenderSystem::BoundsCuller culler;
+    for (int i = 0; i < n; ++i)
+        culler.add(bmin[i], bmax[i]);
+    // Best of a few builds
+    RenderSystem::SceneBvh bvh;
+    double buildMs = 1e30;
+    for (int r = 0; r < 3; ++r) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bvh.build(bmin, bmax);
+        buildMs = std::min(buildMs, elapsedMs(start));
+    }
+
+    // Same projection as the renderer, the orbit passes through the boxes so
+    // that most of them are culled
+    const glm::mat4 projection = glm::perspective(60.f, float(opt.width) / float(opt.height), 0.1f, 1000.f);
+    const glm::vec3 worldMin(-20.f), worldMax(20.f);
+
+    std::vector<unsigned char> reference, visible, bvhVisible;
+    double scalarMs = 0., simdMs = 0., bvhMs = 0.;
+    long long nbVisible = 0, nbDifferences = 0, nbBvhDifferences = 0, nbBvhBoundary = 0;
+    for (int f = 0; f < opt.nbFrames; ++f) {
+        RenderSystem::Frustum frustum(projection * orbitCamera(f, opt.nbFrames, worldMin, worldMax));
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        nbVisible += cullScalar(frustum, bmin, bmax, reference);
+        scalarMs += elapsedMs(start);
+
+        start = std::chrono::steady_clock::now();
+        culler.cull(frustum, visible);
+        simdMs += elapsedMs(start);
+
+        start = std::chrono::steady_clock::now();
+        bvh.cull(frustum, bvhVisible);
+        bvhMs += elapsedMs(start);
+
+        for (int i = 0; i < n; ++i) {
+            nbDifferences += reference[i] != visible[i] ? 1 : 0;
+            if (reference[i] != bvhVisible[i]) {
+                if (onFrustumBoundary(frustum, bmin[i], bmax[i]))
+                    ++nbBvhBoundary;
+                else
+                    ++nbBvhDifferences;
+            }
+        }
+    }
+
+#if defined(CULLER_USE_AVX)
+    const char* simd = "AVX";
+#elif defined(CULLER_USE_SSE)
+    const char* simd = "SSE";
+#else
+    const char* simd = "scalar (no SIMD)";
+#endif
+    std::cout << n << " boxes, " << opt.nbFrames << " cameras, "
+              << 100. * nbVisible / (double(n) * opt.nbFrames) << "% visible\n"
+              << "  scalar : " << scalarMs / opt.nbFrames << " ms per cull\n"
+              << "  " << simd << " : " << simdMs / opt.nbFrames << " ms per cull (x"
+              << scalarMs / std::max(simdMs, 1e-9) << ")\n"
+              << "  BVH : " << bvhMs / opt.nbFrames << " ms per cull (x"
+              << scalarMs / std::max(bvhMs, 1e-9) << ")\n"
+              << "  " << nbDifferences << " " << simd << " and " << nbBvhDifferences
+              << " BVH differences with the scalar reference ("
+              << nbBvhBoundary << " more on a frustum plane)" << std::endl;
+
+    // Every box moves by up to one unit: refit of the whole tree, then of
+    // the path to the root of 1% of the objects, one by one
+    for (int i = 0; i < n; ++i) {
+        const glm::vec3 move(rand() % 201 - 100, rand() % 201 - 100, rand() % 201 - 100);
+        bmin[i] += move * 0.01f;
+        bmax[i] += move * 0.01f;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    bvh.refit(bmin, bmax);
+    const double refitMs = elapsedMs(start);
+    const int nbUpdates = std::max(1, n / 100);
+    start = std::chrono::steady_clock::now();
+    for (int u = 0; u < nbUpdates; ++u) {
+        const int i = (int)((long long)u * n / nbUpdates);
+        bvh.updateObject(i, bmin[i], bmax[i]);
+    }
+    const double updateMs = elapsedMs(start);
+    std::cout << "  BVH build : " << buildMs << " ms, " << bvh.nbNodes() << " nodes\n"
+              << "  BVH refit : " << refitMs << " ms, " << nbUpdates << " objects updated in "
+              << updateMs << " ms" << std::endl;
+
+    // The refitted tree still culls like the reference
+    RenderSystem::Frustum frustum(projection * orbitCamera(0, opt.nbFrames, worldMin, worldMax));
+    cullScalar(frustum, bmin, bmax, reference);
+    bvh.cull(frustum, bvhVisible);
+    long long nbRefitDifferences = 0;
+    for (int i = 0; i < n; ++i)
+        if (reference[i] != bvhVisible[i] && !onFrustumBoundary(frustum, bmin[i], bmax[i]))
+            ++nbRefitDifferences;
+    if (nbRefitDifferences > 0)
+        std::cout << "  " << nbRefitDifferences << " differences after the refit" << std::endl;
+    return nbDifferences == 0 && nbBvhDifferences == 0 && nbRefitDifferences == 0;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Time "opt.nbFrames" frames submitting then sorting "opt.nbSortPackets"
+/// packets, keyed like Renderer::draw_list_mesh(): a few programs, one
+/// material per mesh and the distance to the camera.
+/// @return false when a frame is not sorted by key
+static bool sortBenchmark(const Options& opt)
+{
+    const int n = opt.nbSortPackets;
+    std::vector<unsigned> programs(n), materials(n);
+    std::vector<float> depths(n);
+    srand(1);
+    for (int i = 0; i < n; ++i) {
+        programs[i] = 1 + rand() % 4;
+        materials[i] = 1 + rand() % n;
+        depths[i] = 1.f + float(rand() % 100000) * 0.01f;
+    }
+
+    RenderSystem::RenderQueue queue;
+    std::vector<double> submitMs, sortMs;
+    bool sorted = true;
+    for (int f = 0; f < opt.nbFrames; ++f) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        queue.clear();
+        for (int i = 0; i < n; ++i) {
+            // The camera moves: the depths change every frame
+            const float depth = depths[i] + float(f) * 0.37f;
+            RenderSystem::DrawPacket& p = queue.submit(
+                    RenderSystem::RenderQueue::makeKey(0, programs[i], materials[i], depth));
+            p.program = programs[i];
+            p.vertexArray = materials[i];
+            p.count = 3;
+        }
+        submitMs.push_back(elapsedMs(start));
+
+        start = std::chrono::steady_clock::now();
+        queue.sort();
+        sortMs.push_back(elapsedMs(start));
+
+        for (int i = 1; i < queue.size() && sorted; ++i)
+            sorted = queue.key(i - 1) <= queue.key(i);
+    }
+
+    std::sort(submitMs.begin(), submitMs.end());
+    std::sort(sortMs.begin(), sortMs.end());
+    const double medianSort = sortMs[sortMs.size() / 2];
+    std::cout << n << " packets, " << opt.nbFrames << " frames\n"
+              << "  submit : median " << submitMs[submitMs.size() / 2] << " ms\n"
+              << "  sort   : median " << medianSort << " ms, max " << sortMs.back() << " ms"
+              << (medianSort < 1. ? " (under 1 ms)" : " (over 1 ms)") << "\n"
+              << "  " << (sorted ? "sorted by key" : "NOT sorted by key") << std::endl;
+    return sorted;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Parser whose callbacks only count what is read, so that the tokenizers
+/// are timed without building any mesh
+struct CountingParser {
+    Loaders::Obj_mtl::obj_parser parser;
+    long long nbVertices;
+    long long nbFaces;
+    long long nbOthers; ///< groups, materials, comments...
+
+    CountingParser(Loaders::Obj_mtl::obj_parser::flags_type flags)
+        : parser(flags)
+        , nbVertices(0)
+        , nbFaces(0)
+        , nbOthers(0)
+    {
+        using namespace Loaders::Obj_mtl;
+        long long* v = &nbVertices;
+        long long* f = &nbFaces;
+        long long* o = &nbOthers;
+        parser.geometric_vertex_callback([v](float_type, float_type, float_type) { ++*v; });
+        parser.texture_vertex_callback([v](float_type, float_type) { ++*v; });
+        parser.vertex_normal_callback([v](float_type, float_type, float_type) { ++*v; });
+        parser.face_callbacks(
+            [f](index_type, index_type, index_type) { ++*f; },
+            [f](const index_2_tuple_type&, const index_2_tuple_type&, const index_2_tuple_type&) { ++*f; },
+            [f](const index_2_tuple_type&, const index_2_tuple_type&, const index_2_tuple_type&) { ++*f; },
+            [f](const index_3_tuple_type&, const index_3_tuple_type&, const index_3_tuple_type&) { ++*f; },
+            [f](index_type, index_type, index_type, index_type) { ++*f; },
+            [f](const index_2_tuple_type&, const index_2_tuple_type&, const index_2_tuple_type&, const index_2_tuple_type&) { ++*f; },
+            [f](const index_2_tuple_type&, const index_2_tuple_type&, const index_2_tuple_type&, const index_2_tuple_type&) { ++*f; },
+            [f](const index_3_tuple_type&, const index_3_tuple_type&, const index_3_tuple_type&, const index_3_tuple_type&) { ++*f; });
+        parser.group_name_callback([o](const std::string&) { ++*o; });
+        parser.smoothing_group_callback([o](size_type) { ++*o; });
+        parser.object_name_callback([o](const std::string&) { ++*o; });
+        parser.material_library_callback([o](const std::string&) { ++*o; });
+        parser.material_name_callback([o](const std::string&) { ++*o; });
+        parser.comment_callback([o](const std::string&) { ++*o; });
+    }
+};
+
+// -----------------------------------------------------------------------------
+
+/// Time the OBJ tokenizers on "opt.parseFile": the historical std::istream
+/// parser against the memory mapped one, on one thread then on all of them,
+/// then the whole ObjLoader::load() with both (mesh cache off). The best of
+/// three runs is kept, the file being in the system cache after the first.
+/// @return false when the parsers fail or do not read the same elements
+static bool parseBenchmark(const Options& opt)
+{
+    using Loaders::Obj_mtl::obj_parser;
+    Loaders::MappedFile file;
+    if (!file.open(opt.parseFile)) {
+        std::cerr << "Cannot read " << opt.parseFile << std::endl;
+        return false;
+    }
+    const double megaBytes = double(file.size()) / (1024. * 1024.);
+    file.close();
+    std::cout << opt.parseFile << ": " << megaBytes << " MB" << std::endl;
+
+    const int nbRuns = 3;
+    const char* names[] = { "istream parser", "mapped, 1 thread", "mapped, threads" };
+    double baseMs = 0.;
+    long long reference[3] = { 0, 0, 0 };
+    bool same = true;
+    for (int m = 0; m < 3; ++m) {
+        double bestMs = std::numeric_limits<double>::max();
+        bool ok = true;
+        for (int r = 0; r < nbRuns && ok; ++r) {
+            CountingParser counter(obj_parser::parse_multithreaded);
+            counter.parser.set_threading(m == 1 ? 1 : 0, std::size_t(1) << 20);
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if (m == 0) {
+                std::ifstream stream(opt.parseFile.c_str());
+                ok = counter.parser.parse(stream);
+            }
+            else
+                ok = counter.parser.parse_mapped(opt.parseFile);
+            bestMs = std::min(bestMs, elapsedMs(start));
+            const long long counts[3] = { counter.nbVertices, counter.nbFaces, counter.nbOthers };
+            for (int c = 0; c < 3; ++c) {
+                if (m == 0 && r == 0)
+                    reference[c] = counts[c];
+                same = same && counts[c] == reference[c];
+            }
+        }
+        if (!ok) {
+            std::cerr << "  " << names[m] << " failed" << std::endl;
+            return false;
+        }
+        if (m == 0)
+            baseMs = bestMs;
+        std::cout << "  " << names[m] << " : " << bestMs << " ms, " << megaBytes * 1000. / bestMs
+                  << " MB/s (x" << baseMs / bestMs << ")" << std::endl;
+    }
+    std::cout << "  " << reference[0] << " vertex elements, " << reference[1] << " faces, "
+              << reference[2] << " other lines" << (same ? "" : ", NOT the same for all parsers") << std::endl;
+
+    // Meshes built too (welding, normals...)
+    for (int mapped = 0; mapped < 2; ++mapped) {
+        double bestMs = std::numeric_limits<double>::max();
+        for (int r = 0; r < nbRuns; ++r) {
+            Loaders::Obj_mtl::ObjLoader loader;
+            loader.setUseMappedParser(mapped != 0);
+            loader.setUseMeshCache(false);
+            QString reason;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            if (!loader.load(QString(opt.parseFile.c_str()), reason))
+                return false;
+            std::vector<Loaders::Mesh*> meshes;
+            loader.getObjects(meshes);
+            bestMs = std::min(bestMs, elapsedMs(start));
+            for (unsigned i = 0; i < meshes.size(); ++i)
+                delete meshes[i];
+        }
+        std::cout << "  ObjLoader, " << (mapped ? "mapped" : "istream") << " : " << bestMs << " ms, "
+                  << megaBytes * 1000. / bestMs << " MB/s" << std::endl;
+    }
+    return same;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Attributes of a welded vertex, ordered like the std::map<VertexObj, int>
+/// the OBJ loader used before Loaders::Obj_mtl::VertexWelder
+struct WeldedVertex {
+    float values[8]; ///< position, normal, texture coordinates
+
+    bool operator<(const WeldedVertex& other) const
+    {
+        return std::lexicographical_compare(values, values + 8, other.values, other.values + 8);
+    }
+};
+
+// -----------------------------------------------------------------------------
+
+/// Time the welding of the corners of a grid of "opt.nbWeldQuads" quads,
+/// each grid vertex being shared by 4 quads: the previous std::map on the attributes (insertion, numbering then lookup of
+/// every corner) against the VertexWelder hash table on the index triples
+/// (one pass).
+/// @return false when they do not find the same number of vertices
+static bool weldBenchmark(const Options& opt)
+{
+    const int side = std::max(1, int(std::sqrt(double(opt.nbWeldQuads))));
+    const int nbQuads = side * side;
+    std::vector<glm::vec3> positions((side + 1) * (side + 1));
+    std::vector<glm::vec2> texcoords(positions.size());
+    for (int j = 0; j <= side; ++j) {
+        for (int i = 0; i <= side; ++i) {
+            positions[j * (side + 1) + i] = glm::vec3(i, std::sin(i * 0.1f) * std::cos(j * 0.1f), j);
+            texcoords[j * (side + 1) + i] = glm::vec2(i, j) / float(side);
+        }
+    }
+    // Corners (v, vt, vn) of every quad, in file order
+    std::vector<int> corners;
+    corners.reserve(nbQuads * 12);
+    for (int j = 0; j < side; ++j) {
+        for (int i = 0; i < side; ++i) {
+            const int a = j * (side + 1) + i;
+            const int quad[4] = { a, a + 1, a + side + 2, a + side + 1 };
+            for (int c = 0; c < 4; ++c) {
+                corners.push_back(quad[c]);
+                corners.push_back(quad[c]);
+                corners.push_back(quad[c]);
+            }
+        }
+    }
+    std::vector<glm::vec3> normals(positions.size());
+    for (unsigned v = 0; v < normals.size(); ++v)
+        normals[v] = glm::normalize(glm::vec3(std::sin(v * 0.37f), 4.f, std::cos(v * 0.11f)));
+    const int nbCorners = (int)corners.size() / 3;
+    std::cout << nbQuads << " quads, " << nbCorners << " corners" << std::endl;
+
+    std::vector<int> mapIndices(nbCorners), welderIndices(nbCorners);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    int mapVertices;
+    {
+        std::map<WeldedVertex, int> vertices;
+        std::vector<WeldedVertex> keys(nbCorners);
+        for (int c = 0; c < nbCorners; ++c) {
+            const glm::vec3& p = positions[corners[3 * c]];
+            const glm::vec2& t = texcoords[corners[3 * c + 1]];
+            const glm::vec3& n = normals[corners[3 * c + 2]];
+            const float values[8] = { p.x, p.y, p.z, n.x, n.y, n.z, t.x, t.y };
+            std::copy(values, values + 8, keys[c].values);
+            vertices[keys[c]] = c;
+        }
+        int number = 0;
+        for (std::map<WeldedVertex, int>::iterator it = vertices.begin(); it != vertices.end(); ++it)
+            it->second = number++;
+        for (int c = 0; c < nbCorners; ++c)
+            mapIndices[c] = vertices.find(keys[c])->second;
+        mapVertices = (int)vertices.size();
+    }
+    const double mapMs = elapsedMs(start);
+
+    start = std::chrono::steady_clock::now();
+    Loaders::Obj_mtl::VertexWelder welder(nbQuads);
+    std::vector<float> vertexBuffer;
+    vertexBuffer.reserve(8 * nbCorners);
+    for (int c = 0; c < nbCorners; ++c) {
+        bool inserted;
+        welderIndices[c] = welder.weld(corners[3 * c], corners[3 * c + 1], corners[3 * c + 2], inserted);
+        if (inserted) {
+            // The attributes are copied once per vertex, as ObjLoader does
+            const glm::vec3& p = positions[corners[3 * c]];
+            const glm::vec2& t = texcoords[corners[3 * c + 1]];
+            const glm::vec3& n = normals[corners[3 * c + 2]];
+            const float values[8] = { p.x, p.y, p.z, n.x, n.y, n.z, t.x, t.y };
+            vertexBuffer.insert(vertexBuffer.end(), values, values + 8);
+        }
+    }
+    const double welderMs = elapsedMs(start);
+
+    std::cout << "  std::map      : " << mapMs << " ms, " << mapVertices << " vertices\n"
+              << "  VertexWelder  : " << welderMs << " ms, " << welder.size() << " vertices (x"
+              << mapMs / std::max(welderMs, 1e-9) << ")" << std::endl;
+    // Both number the same vertices, in a different order
+    bool same = mapVertices == welder.size();
+    std::vector<int> mapToWelder(mapVertices, -1);
+    for (int c = 0; c < nbCorners && same; ++c) {
+        int& w = mapToWelder[mapIndices[c]];
+        same = w < 0 || w == welderIndices[c];
+        w = welderIndices[c];
+    }
+    if (!same)
+        std::cout << "  the corners are NOT welded the same way" << std::endl;
+    return same;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Bumpy square grid of about "nbTriangles" triangles, vertices interleaved
+/// like Loaders::Mesh::Vertex with null normals and texture coordinates
+static void makeGrid(int nbTriangles, std::vector<float>& vertices, std::vector<int>& triangles)
+{
+    const int side = std::max(1, int(std::sqrt(nbTriangles * 0.5)));
+    vertices.reserve(std::size_t(side + 1) * (side + 1) * 8);
+    triangles.reserve(std::size_t(side) * side * 6);
+    for (int j = 0; j <= side; ++j) {
+        for (int i = 0; i <= side; ++i) {
+            const float vertex[8] = { float(i), std::sin(i * 0.07f) * std::cos(j * 0.05f) * 4.f, float(j),
+                                      0.f, 0.f, 0.f, 0.f, 0.f };
+            vertices.insert(vertices.end(), vertex, vertex + 8);
+        }
+    }
+    for (int j = 0; j < side; ++j) {
+        for (int i = 0; i < side; ++i) {
+            const int a = j * (side + 1) + i, b = a + 1, c = a + side + 2, d = a + side + 1;
+            const int quad[6] = { a, c, b, a, d, c };
+            triangles.insert(triangles.end(), quad, quad + 6);
+        }
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+/// Time Mesh::computeNormals() on a grid of "opt.nbNormalTriangles"
+/// triangles, for each weighting, against the serial per face scatter it
+/// replaced (area weights)
+/// @return false when the area weighted normals differ from the scatter ones
+static bool normalsBenchmark(const Options& opt)
+{
+    std::vector<float> vertices;
+    std::vector<int> triangles;
+    makeGrid(opt.nbNormalTriangles, vertices, triangles);
+    const std::size_t nbVertices = vertices.size() / 8;
+    std::cout << triangles.size() / 3 << " triangles, " << nbVertices << " vertices" << std::endl;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<glm::vec3> reference(nbVertices, glm::vec3(0.f));
+    for (std::size_t f = 0; f < triangles.size(); f += 3) {
+        const float* p0 = &vertices[8 * triangles[f]];
+        const float* p1 = &vertices[8 * triangles[f + 1]];
+        const float* p2 = &vertices[8 * triangles[f + 2]];
+        const glm::vec3 n = glm::cross(glm::vec3(p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]),
+                                       glm::vec3(p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]));
+        reference[triangles[f]] += n;
+        reference[triangles[f + 1]] += n;
+        reference[triangles[f + 2]] += n;
+    }
+    for (std::size_t v = 0; v < nbVertices; ++v)
+        reference[v] = glm::normalize(reference[v]);
+    const double scatterMs = elapsedMs(start);
+    std::cout << "  serial scatter : " << scatterMs << " ms" << std::endl;
+
+    Loaders::Mesh mesh(std::move(vertices), std::move(triangles), std::vector<int>(), true, true);
+    const char* names[] = { "uniform", "angle", "area" };
+    const Loaders::Mesh::NormalWeighting weightings[] = { Loaders::Mesh::UNIFORM_WEIGHTS,
+                                                          Loaders::Mesh::ANGLE_WEIGHTS,
+                                                          Loaders::Mesh::AREA_WEIGHTS };
+    for (int w = 0; w < 3; ++w) {
+        start = std::chrono::steady_clock::now();
+        mesh.computeNormals(weightings[w]);
+        const double ms = elapsedMs(start);
+        std::cout << "  gather, " << names[w] << " weights : " << ms << " ms (x"
+                  << scatterMs / std::max(ms, 1e-9) << ")" << std::endl;
+    }
+
+    // Area weights last: compare them with the scatter
+    std::vector<float> data;
+    std::vector<int> indices;
+    bool parametrized;
+    mesh.getData(data, indices, parametrized);
+    float maxError = 0.f;
+    for (std::size_t v = 0; v < nbVertices; ++v)
+        maxError = std::max(maxError, glm::length(glm::vec3(data[8 * v + 3], data[8 * v + 4], data[8 * v + 5]) - reference[v]));
+    std::cout << "  largest difference with the scatter : " << maxError << std::endl;
+    return maxError < 1e-4f;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Time Mesh::boundingBox() and Mesh::transform() on a grid of
+/// "opt.nbLayoutTriangles" triangles, vertices interleaved against one
+/// stream per component (best of a few runs)
+/// @return false when both layouts disagree
+static bool layoutBenchmark(const Options& opt)
+{
+    std::vector<float> vertices;
+    std::vector<int> triangles;
+    makeGrid(opt.nbLayoutTriangles, vertices, triangles);
+    std::cout << triangles.size() / 3 << " triangles, " << vertices.size() / 8 << " vertices" << std::endl;
+
+    Loaders::Mesh meshes[2] = {
+        Loaders::Mesh(vertices, triangles, std::vector<int>(), true, true),
+        Loaders::Mesh(std::move(vertices), std::move(triangles), std::vector<int>(), true, true)
+    };
+    meshes[1].setVertexLayout(Loaders::Mesh::SEPARATE_STREAMS);
+    const char* names[] = { "interleaved", "streams    " };
+    const glm::mat4 m = glm::rotate(glm::translate(glm::mat4(1.f), glm::vec3(1.f, -2.f, 3.f)),
+                                    0.3f, glm::vec3(0.f, 1.f, 0.f));
+    const int nbRuns = 5;
+    double boundsMs[2], transformMs[2];
+    glm::vec3 bmin[2], bmax[2];
+    for (int l = 0; l < 2; ++l) {
+        boundsMs[l] = transformMs[l] = 1e30;
+        for (int r = 0; r < nbRuns; ++r) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            meshes[l].boundingBox(bmin[l], bmax[l]);
+            boundsMs[l] = std::min(boundsMs[l], elapsedMs(start));
+            start = std::chrono::steady_clock::now();
+            meshes[l].transform(m);
+            transformMs[l] = std::min(transformMs[l], elapsedMs(start));
+        }
+        meshes[l].boundingBox(bmin[l], bmax[l]);
+        std::cout << "  " << names[l] << " : bounding box " << boundsMs[l] << " ms, transform "
+                  << transformMs[l] << " ms" << std::endl;
+    }
+    std::cout << "  streams speedup : bounding box x" << boundsMs[0] / std::max(boundsMs[1], 1e-9)
+              << ", transform x" << transformMs[0] / std::max(transformMs[1], 1e-9) << std::endl;
+
+    // Both meshes went through the same transforms
+    const float error = std::max(glm::length(bmin[0] - bmin[1]), glm::length(bmax[0] - bmax[1]));
+    const bool same = error <= 1e-3f * std::max(1.f, glm::length(bmax[0] - bmin[0]));
+    if (!same)
+        std::cout << "  the layouts give different bounding boxes" << std::endl;
+    return same;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Time the build of the triangle hierarchy of a grid of
+/// "opt.nbRayTriangles" triangles, then single ray queries (picking, the
+/// target is 1 ms each) going down onto the grid with various slopes, some
+/// of them missing it, and a batch of rays from one eye through a rectangle
+/// (area selection).
+/// @return false when a query differs from the test of every triangle
+static bool raysBenchmark(const Options& opt)
+{
+    std::vector<float> vertices;
+    std::vector<int> triangles;
+    makeGrid(opt.nbRayTriangles, vertices, triangles);
+    const float side = std::sqrt(float(vertices.size() / 8)) - 1.f;
+    Loaders::Mesh mesh(std::move(vertices), std::move(triangles), std::vector<int>(), true, true);
+    std::cout << mesh.nbTriangles() << " triangles" << std::endl;
+    // Tests every triangle
+    const Loaders::Mesh bruteForce = mesh;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    mesh.buildBvh();
+    std::cout << "  hierarchy built in " << elapsedMs(start) << " ms" << std::endl;
+
+    const int nbRays = 10000;
+    std::vector<Loaders::Ray> rays(nbRays);
+    srand(3);
+    for (int r = 0; r < nbRays; ++r) {
+        // Targets up to 10% outside of the grid
+        const glm::vec3 target(side * (rand() % 1201 - 100) / 1000.f, 0.f,
+                               side * (rand() % 1201 - 100) / 1000.f);
+        const glm::vec3 origin = target + glm::vec3(rand() % 201 - 100, 20.f + rand() % 100, rand() % 201 - 100);
+        rays[r] = Loaders::Ray(origin, target - origin);
+    }
+
+    std::vector<Loaders::RayHit> hits(nbRays);
+    double totalMs = 0., maxMs = 0.;
+    int nbHits = 0;
+    for (int r = 0; r < nbRays; ++r) {
+        start = std::chrono::steady_clock::now();
+        nbHits += mesh.intersect(rays[r], hits[r]) ? 1 : 0;
+        const double ms = elapsedMs(start);
+        totalMs += ms;
+        maxMs = std::max(maxMs, ms);
+    }
+    const int selectionSide = 100;
+    std::vector<Loaders::Ray> selection;
+    const glm::vec3 eye(side * 0.5f, side * 0.3f, -side * 0.2f);
+    for (int j = 0; j < selectionSide; ++j)
+        for (int i = 0; i < selectionSide; ++i)
+            selection.push_back(Loaders::Ray(eye, glm::vec3(side * (0.3f + 0.4f * i / selectionSide), 0.f,
+                                                            side * (0.2f + 0.4f * j / selectionSide)) - eye));
+    std::vector<Loaders::RayHit> selectionHits;
+    start = std::chrono::steady_clock::now();
+    mesh.intersect(selection, selectionHits);
+    const double batchMs = elapsedMs(start);
+    std::cout << "  " << nbRays << " rays, " << 100. * nbHits / nbRays << "% hit\n"
+              << "  single query : " << totalMs / nbRays << " ms on average, " << maxMs
+              << " ms at most (target 1 ms)\n"
+              << "  selection of " << selection.size() << " rays : " << batchMs << " ms, "
+              << batchMs / selection.size() << " ms per ray" << std::endl;
+
+    // The batch against single queries, and a few rays against every triangle
+    int nbDifferences = 0;
+    for (std::size_t r = 0; r < selection.size(); ++r) {
+        Loaders::RayHit single;
+        mesh.intersect(selection[r], single);
+        if (single.triangle != selectionHits[r].triangle)
+            ++nbDifferences;
+    }
+    for (int r = 0; r < nbRays; r += 500) {
+        Loaders::RayHit reference;
+        bruteForce.intersect(rays[r], reference);
+        if (reference.triangle != hits[r].triangle &&
+            std::fabs(reference.distance - hits[r].distance) > 1e-4f * reference.distance)
+            ++nbDifferences;
+    }
+    if (nbDifferences > 0)
+        std::cout << "  " << nbDifferences << " queries differ from the reference" << std::endl;
+    return nbDifferences == 0;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Thread of streamBenchmark(): runs "stream" with "shared" current, or
+/// fails it so that its uploads are done another way
+static void runUploadStream(const HeadlessContext* context, EGLContext shared, GlUpload_stream* stream)
+{
+    if (shared == EGL_NO_CONTEXT || !context->makeCurrent(shared)) {
+        stream->fail();
+        return;
+    }
+    stream->run();
+    context->makeCurrent(EGL_NO_CONTEXT);
+}
+
+/// Upload "opt.nbStreamMegabytes" MiB in buffers of various sizes (smaller
+/// and larger than the staging buffer, not multiples of it) through a
+/// GlUpload_stream run by a thread with a context sharing its objects with
+/// the current one, the one of the render thread. The buffers are read
+/// back from the render thread once their fences signaled. Then times the
+/// render thread pushing and polling the uploads against filling the same
+/// buffers itself with glBufferData().
+/// @return false when the stream fails or a buffer differs from its data
+static bool streamBenchmark(HeadlessContext& context, const Options& opt)
+{
+    const GLsizeiptr chunkSize = 256 << 10;
+    const GLsizeiptr total = GLsizeiptr(opt.nbStreamMegabytes) << 20;
+    std::vector<GLsizeiptr> sizes;
+    GLsizeiptr sum = 0;
+    for (int i = 0; sum < total; ++i) {
+        // From a few bytes to a few staging buffers
+        const GLsizeiptr size = std::min(total - sum, GLsizeiptr(4 + (i * 7919 % 13) * chunkSize / 3 + i % 5 * 12));
+        sizes.push_back(size);
+        sum += size;
+    }
+    std::vector<std::vector<unsigned char> > data(sizes.size());
+    for (std::size_t i = 0; i < sizes.size(); ++i) {
+        data[i].resize(sizes[i]);
+        for (GLsizeiptr j = 0; j < sizes[i]; ++j)
+            data[i][j] = (unsigned char)((i * 131 + j * 7 + j / 251) & 0xff);
+    }
+
+    GlUpload_stream stream(chunkSize);
+    std::thread worker(runUploadStream, &context, context.createShared(), &stream);
+
+    // The render thread only pushes, then polls once per "frame"
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<GlUpload*> uploads(sizes.size());
+    for (std::size_t i = 0; i < sizes.size(); ++i) {
+        uploads[i] = new GlUpload(&data[i][0], sizes[i]);
+        stream.push(uploads[i]);
+    }
+    double renderThreadMs = elapsedMs(start);
+    std::size_t nbReady = 0;
+    int nbPolls = 0;
+    bool failed = false;
+    while (nbReady < uploads.size() && !failed) {
+        const std::chrono::steady_clock::time_point poll = std::chrono::steady_clock::now();
+        while (nbReady < uploads.size() && uploads[nbReady]->is_ready())
+            ++nbReady;
+        failed = nbReady < uploads.size() && uploads[nbReady]->has_failed();
+        renderThreadMs += elapsedMs(poll);
+        ++nbPolls;
+        std::this_thread::yield();
+    }
+    const double streamMs = elapsedMs(start);
+    stream.stop();
+    worker.join();
+    if (failed) {
+        std::cerr << "The upload stream failed: no shared context" << std::endl;
+        for (std::size_t i = 0; i < uploads.size(); ++i)
+            delete uploads[i];
+        return false;
+    }
+
+    // Read back by the render thread
+    int nbDifferent = 0;
+    std::vector<unsigned char> readBack;
+    for (std::size_t i = 0; i < uploads.size(); ++i) {
+        readBack.assign(sizes[i], 0);
+        glAssert(glBindBuffer(GL_COPY_READ_BUFFER, uploads[i]->get_buffer()));
+        glAssert(glGetBufferSubData(GL_COPY_READ_BUFFER, 0, sizes[i], &readBack[0]));
+        if (readBack != data[i])
+            ++nbDifferent;
+        delete uploads[i];
+    }
+    glAssert(glBindBuffer(GL_COPY_READ_BUFFER, 0));
+
+    // The same buffers filled by the render thread
+    start = std::chrono::steady_clock::now();
+    std::vector<GLuint> buffers(sizes.size());
+    glAssert(glGenBuffers((GLsizei)buffers.size(), &buffers[0]));
+    for (std::size_t i = 0; i < sizes.size(); ++i) {
+        glAssert(glBindBuffer(GL_COPY_WRITE_BUFFER, buffers[i]));
+        glAssert(glBufferData(GL_COPY_WRITE_BUFFER, sizes[i], &data[i][0], GL_STATIC_DRAW));
+    }
+    glAssert(glBindBuffer(GL_COPY_WRITE_BUFFER, 0));
+    glFinish();
+    const double bufferDataMs = elapsedMs(start);
+    glAssert(glDeleteBuffers((GLsizei)buffers.size(), &buffers[0]));
+
+    std::cout << sizes.size() << " buffers, " << opt.nbStreamMegabytes << " MiB, staging buffer of "
+              << (chunkSize >> 10) << " KiB\n"
+              << "  stream      : " << streamMs << " ms until every fence signaled ("
+              << nbPolls << " polls), render thread busy " << renderThreadMs << " ms\n"
+              << "  glBufferData: " << bufferDataMs << " ms on the render thread\n"
+              << "  " << (nbDifferent == 0 ? "every buffer read back as uploaded" : "buffers DIFFER from their data")
+              << std::endl;
+    if (nbDifferent > 0)
+        std::cout << "  " << nbDifferent << " buffers differ" << std::endl;
+    return nbDifferent == 0;
+}
+
+// -----------------------------------------------------------------------------
+
+/**
+  * Batch renderer without GUI, for benchmarks and regression renders on
+  * machines without GPU nor display (Mesa llvmpipe).
+  * Loads an OBJ file, renders it with RenderSystem::Renderer::render() from
+  * cameras orbiting around it, then writes some frames as images and the
+  * time of every frame.
+  * With "-cull N", "-sort N", "-parse file.obj", "-weld N", "-normals N",
+  * "-layout N" or "-rays N" it only benchmarks the frustum culling, the
+  * render queue, the OBJ parsers, the vertex welding, the normals, the vertex
+  * layouts or the ray queries, no context needed.
+  * With "-stream N" it checks the buffers filled by the upload stream from a
+  * second context, without rendering.
+  */
+int main(int argc, char* argv[])
+{
+    Options opt;
+    if (!parseArgs(argc, argv, opt)) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (opt.nbCullObjects > 0)
+        return cullBenchmark(opt) ? 0 : 1;
+    if (opt.nbSortPackets > 0)
+        return sortBenchmark(opt) ? 0 : 1;
+    if (!opt.parseFile.empty())
+        return parseBenchmark(opt) ? 0 : 1;
+    if (opt.nbWeldQuads > 0)
+        return weldBenchmark(opt) ? 0 : 1;
+    if (opt.nbNormalTriangles > 0)
+        return normalsBenchmark(opt) ? 0 : 1;
+    if (opt.nbLayoutTriangles > 0)
+        return layoutBenchmark(opt) ? 0 : 1;
+    if (opt.nbRayTriangles > 0)
+        return raysBenchmark(opt) ? 0 : 1;
+
+    HeadlessContext context;
+    std::string reason;
+    if (!context.create(reason)) {
+        std::cerr << "Headless OpenGL context: " << reason << std::endl;
+        return 1;
+    }
+    std::cout << "Renderer : " << glGetString(GL_RENDERER) << std::endl;
+    std::cout << "OpenGL Version : " << glGetString(GL_VERSION) << std::endl;
+    RenderSystem::initGlew();
+    if (opt.nbStreamMegabytes > 0)
+        return streamBenchmark(context, opt) ? 0 : 1;
+
+    int result = 0;
+    {
+        Framebuffer framebuffer(opt.width, opt.height);
+        if (!framebuffer.isComplete()) {
+            std::cerr << "Incomplete framebuffer" << std::endl;
+            return 1;
+        }
+
+        RenderSystem::Renderer renderer;
+        framebuffer.begin();
+        renderer.initRessources();
+        renderer.setViewport(opt.width, opt.height);
+
+        glm::vec3 bmin, bmax;
+        if (!loadScene(renderer, opt.objFile, bmin, bmax))
+            return 1;
+
+        for (int i = 0; i < opt.nbWarmup; ++i) {
+            renderer.setViewMatrix(orbitCamera(i, std::max(opt.nbWarmup, 1), bmin, bmax));
+            framebuffer.begin();
+            renderer.render();
+        }
+        glFinish();
+
+        std::string csvName = opt.outPrefix + "_timings.csv";
+        std::ofstream csv(csvName.c_str());
+        csv << "frame,ms,drawn,culled,state_changes,state_skipped\n";
+        std::vector<double> times;
+        int nbImages = 0;
+        for (int i = 0; i < opt.nbFrames; ++i) {
+            renderer.setViewMatrix(orbitCamera(i, opt.nbFrames, bmin, bmax));
+            // glFinish(): the frame time includes the GPU work
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            framebuffer.begin();
+            renderer.render();
+            glFinish();
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            times.push_back(ms);
+
+            const RenderSystem::FrameStats& stats = renderer.frameStats();
+            csv << i << "," << ms << "," << stats.nbDrawn << "," << stats.nbCulled << ","
+                << stats.nbStateChanges << "," << stats.nbStateSkipped << "\n";
+
+            // Images evenly spaced along the orbit
+            if (nbImages < opt.nbImages && i == nbImages * opt.nbFrames / opt.nbImages) {
+                char suffix[32];
+                sprintf(suffix, "_%d.ppm", nbImages++);
+                if (!framebuffer.save(opt.outPrefix + suffix)) {
+                    std::cerr << "Cannot write " << opt.outPrefix + suffix << std::endl;
+                    result = 1;
+                }
+            }
+        }
+        if (!csv) {
+            std::cerr << "Cannot write " << csvName << std::endl;
+            result = 1;
+        }
+
+        std::vector<double> sorted = times;
+        std::sort(sorted.begin(), sorted.end());
+        double total = 0.;
+        for (unsigned i = 0; i < times.size(); ++i)
+            total += times[i];
+        std::cout << opt.nbFrames << " frames " << opt.width << "x" << opt.height
+                  << ": mean " << total / times.size() << " ms"
+                  << ", median " << sorted[sorted.size() / 2] << " ms"
+                  << ", 95% " << sorted[sorted.size() * 95 / 100] << " ms"
+                  << ", max " << sorted.back() << " ms"
+                  << " (" << 1000. * times.size() / total << " fps)" << std::endl;
+        glCheckError();
+    } // GL objects released before the context
+    return result;
+}
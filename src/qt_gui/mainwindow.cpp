@@ -42,6 +42,8 @@ MainWindow::MainWindow()
     : curFile("")
     , fileMenu(0)
     , renderMenu(0)
+    , mLoader(0)
+    , mNextLoadId(0)
 {
     std::cout << std::endl
               << " -------- IG3D Renderer -------- "
@@ -71,6 +73,11 @@ MainWindow::MainWindow()
 
 void MainWindow::clear()
 {
+    // Loaders still running use the renderer: stop them first
+    QList<MeshLoader*> loaders = findChildren<MeshLoader*>();
+    for (int i = 0; i < loaders.size(); ++i)
+        delete loaders[i];
+    mLoader = 0;
     delete openGLWindow;
     delete fileMenu;
     delete renderMenu;
@@ -110,6 +117,12 @@ void MainWindow::createActions()
     openAct->setStatusTip(tr("Open an existing file"));
     connect(openAct, SIGNAL(triggered()), this, SLOT(open()));
 
+    cancelLoadAct = new QAction(tr("&Cancel Loading"), this);
+    cancelLoadAct->setShortcut(tr("Ctrl+K"));
+    cancelLoadAct->setStatusTip(tr("Stop loading the file being opened"));
+    cancelLoadAct->setEnabled(false);
+    connect(cancelLoadAct, SIGNAL(triggered()), this, SLOT(cancelLoading()));
+
     exitAct = new QAction(tr("E&xit"), this);
     exitAct->setShortcut(tr("Ctrl+Q"));
     exitAct->setStatusTip(tr("Exit the application"));
@@ -132,6 +145,7 @@ void MainWindow::createMenus()
 {
     fileMenu = menuBar()->addMenu(tr("&File"));
     fileMenu->addAction(openAct);
+    fileMenu->addAction(cancelLoadAct);
     fileMenu->addSeparator();
     fileMenu->addAction(exitAct);
 
@@ -173,7 +187,6 @@ void MainWindow::writeSettings()
 void MainWindow::loadFile(const QString& fileName)
 {
     QFile file(fileName);
-    QString reason;
     if (!file.open(QFile::ReadOnly | QFile::Text)) {
         QMessageBox::warning(this, tr("Application"),
                              tr("Cannot read file %1:\n%2.")
@@ -181,24 +194,66 @@ void MainWindow::loadFile(const QString& fileName)
                                  .arg(file.errorString()));
         return;
     }
+    file.close();
+
+    // The file is parsed by a worker thread and its meshes appear as they
+    // are uploaded: the window stays responsive meanwhile
+    cancelLoading();
+    mLoader = new MeshLoader(openGLWindow->renderer(), fileName, mNextLoadId++, this);
+    connect(mLoader, SIGNAL(progressChanged(int, const QString&)),
+            this, SLOT(loadProgress(int, const QString&)));
+    connect(mLoader, SIGNAL(finished(bool, const QString&)),
+            this, SLOT(loadFinished(bool, const QString&)));
+    cancelLoadAct->setEnabled(true);
+    mLoader->start();
+}
+
+// -----------------------------------------------------------------------------
 
-    QApplication::setOverrideCursor(Qt::WaitCursor);
+void MainWindow::cancelLoading()
+{
+    if (mLoader == 0)
+        return;
+    // The worker deletes what it has not handed over yet, the renderer the
+    // meshes still queued. It is released once finished() is received.
+    mLoader->cancel();
+    openGLWindow->renderer()->cancelLoad(mLoader->loadId());
+    mLoader = 0;
+    cancelLoadAct->setEnabled(false);
+    statusBar()->showMessage(tr("Loading canceled"), 2000);
+}
 
+// -----------------------------------------------------------------------------
 
-    //bool succeed = loadScene(fileName, reason);
+void MainWindow::loadProgress(int percent, const QString& step)
+{
+    if (sender() != mLoader)
+        return;
+    statusBar()->showMessage(tr("%1 (%2%)").arg(step).arg(percent));
+    // Draws and uploads the meshes received so far
+    openGLWindow->updateGL();
+}
 
-    bool succeed = true;
+// -----------------------------------------------------------------------------
 
-    QApplication::restoreOverrideCursor();
+void MainWindow::loadFinished(bool succeed, const QString& message)
+{
+    MeshLoader* loader = static_cast<MeshLoader*>(sender());
+    // The worker returns right after this signal
+    loader->deleteLater();
+    if (loader != mLoader)
+        return; // canceled
+    mLoader = 0;
+    cancelLoadAct->setEnabled(false);
 
     if (succeed) {
         reset();
-        setCurrentFile(fileName);
-        statusBar()->showMessage(tr("File loaded"), 2000);
+        setCurrentFile(loader->fileName());
+        statusBar()->showMessage(tr("File loaded: %1").arg(message), 2000);
         openGLWindow->updateGL();
     }
     else {
-        QMessageBox::warning(this, tr("Application"), tr("Cannot read file %1\n%2").arg(fileName));
+        QMessageBox::warning(this, tr("Application"), tr("Cannot read file %1\n%2").arg(loader->fileName()).arg(message));
         statusBar()->showMessage(tr("Error loading file"), 2000);
     }
 }
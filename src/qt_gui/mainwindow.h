@@ -28,6 +28,7 @@
 #include <QLabel>
 
 #include "openglwidget.h"
+#include "meshloader.h"
 
 
 /** @defgroup InterfaceSystem Qt-OpenGL graphical interface
@@ -71,6 +72,11 @@ private slots:
     void resetCamera();
     void reloadShaders();
 
+    /// Stop the file being loaded, the meshes already displayed are kept
+    void cancelLoading();
+    void loadProgress(int percent, const QString& step);
+    void loadFinished(bool succeed, const QString& message);
+
 
 private:
     void clear();
@@ -91,11 +97,16 @@ private:
     QMenu* fileMenu;
     QMenu* renderMenu;
     QAction* openAct;
+    QAction* cancelLoadAct;
     QAction* exitAct;
     QAction* checkResetCamera;
     QAction* checkReloadShaders;
     QSize getSize();
     QString mNameFile;
+
+    /// Load in progress (see loadFile()), null if none
+    MeshLoader* mLoader;
+    unsigned mNextLoadId;
 };
 
 
@@ -0,0 +1,122 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "meshloader.h"
+
+#include "rendersystem/renderer.h"
+#include "fileloaders/objloader.h"
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+// =============================================================================
+namespace Gui {
+// =============================================================================
+
+MeshLoader::MeshLoader(RenderSystem::Renderer* renderer, const QString& fileName,
+                       unsigned loadId, QObject* parent)
+    : QObject(parent)
+    , mRenderer(renderer)
+    , mFileName(fileName)
+    , mLoadId(loadId)
+    , mCanceled(false)
+{
+}
+
+// -----------------------------------------------------------------------------
+
+MeshLoader::~MeshLoader()
+{
+    cancel();
+    if (mThread.joinable())
+        mThread.join();
+}
+
+// -----------------------------------------------------------------------------
+
+void MeshLoader::start()
+{
+    mThread = std::thread(&MeshLoader::run, this);
+}
+
+// -----------------------------------------------------------------------------
+
+void MeshLoader::progress(int from, int to, int i, int n, const QString& step)
+{
+    emit progressChanged(from + (to - from) * i / std::max(n, 1), step);
+}
+
+// -----------------------------------------------------------------------------
+
+void MeshLoader::run()
+{
+    // Parsing: the parser itself is multithreaded and cannot be interrupted
+    emit progressChanged(0, tr("Parsing %1").arg(mFileName));
+    Loaders::Obj_mtl::ObjLoader loader;
+    // Reopening a file skips the parsing, without writing beside the models
+    // ($XDG_CACHE_HOME/<application> on Linux)
+    loader.setUseMeshCache(true);
+    loader.setCacheDirectory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/meshes");
+    QString reason;
+    if (!loader.load(mFileName, reason)) {
+        endLoad();
+        emit finished(false, reason);
+        return;
+    }
+
+    // Building the meshes, stopped between two meshes when canceled
+    loader.setProgressCallback([this](int i, int n) -> bool {
+        progress(50, 90, i, n, tr("Building meshes"));
+        return !mCanceled;
+    });
+    std::vector<Loaders::Mesh*> meshes;
+    loader.getObjects(meshes);
+
+    // Hand over to the renderer, waiting while its queue is full
+    for (unsigned i = 0; i < meshes.size() && !mCanceled; ++i) {
+        bool queued = false;
+        while (!(queued = mRenderer->queueMesh(meshes[i], mLoadId)) && !mCanceled)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        if (queued) {
+            meshes[i] = 0; // owned by the renderer
+            progress(90, 100, i + 1, meshes.size(), tr("Uploading meshes"));
+        }
+    }
+    endLoad();
+    if (mCanceled) {
+        for (unsigned i = 0; i < meshes.size(); ++i)
+            delete meshes[i];
+        emit finished(false, tr("Loading canceled"));
+        return;
+    }
+    emit finished(true, tr("%1 meshes loaded").arg(meshes.size()));
+}
+
+// -----------------------------------------------------------------------------
+
+void MeshLoader::endLoad()
+{
+    // Waits for room in the queue even when canceled, but not forever: a
+    // lost marker only leaves the id in the canceled list of the renderer
+    for (int i = 0; i < 1000 && !mRenderer->endLoad(mLoadId); ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+// -----------------------------------------------------------------------------
+
+} // END namespace gui =========================================================
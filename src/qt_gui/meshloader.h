@@ -0,0 +1,98 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef MESHLOADER_H
+#define MESHLOADER_H
+
+#include <QObject>
+#include <QString>
+
+#include <atomic>
+#include <thread>
+
+namespace RenderSystem {
+class Renderer;
+}
+
+// =============================================================================
+namespace Gui {
+// =============================================================================
+
+/**
+  * @ingroup InterfaceSystem
+  * Loads an OBJ file on a worker thread.
+  *
+  * The file is parsed and its meshes built (Loaders::Obj_mtl::ObjLoader)
+  * without blocking the GUI, then each mesh is handed to the renderer
+  * through its lock free queue (RenderSystem::Renderer::queueMesh()), which
+  * uploads them a few per frame. Progress is reported by signals, delivered
+  * in the thread of the receiver.
+  */
+class MeshLoader : public QObject {
+    Q_OBJECT
+
+public:
+    /// @param loadId : tags the meshes given to "renderer"
+    MeshLoader(RenderSystem::Renderer* renderer, const QString& fileName,
+               unsigned loadId, QObject* parent = 0);
+
+    /// Cancel then wait for the worker thread
+    ~MeshLoader();
+
+    /// Start the worker thread
+    void start();
+
+    /// Ask the worker to stop as soon as possible: meshes not handed to the
+    /// renderer yet are dropped and finished() is emitted with "false".
+    /// Does not wait.
+    void cancel() { mCanceled = true; }
+
+    bool isCanceled() const { return mCanceled; }
+
+    const QString& fileName() const { return mFileName; }
+
+    unsigned loadId() const { return mLoadId; }
+
+signals:
+    /// @param percent : 0 to 100
+    /// @param step : what the worker is doing
+    void progressChanged(int percent, const QString& step);
+
+    /// Last signal emitted by the worker
+    /// @param message : error or number of meshes loaded
+    void finished(bool succeed, const QString& message);
+
+private:
+    /// Body of the worker thread
+    void run();
+
+    /// Emit progressChanged() for the mesh "i" over "n" of a step covering
+    /// percents [from, to]
+    void progress(int from, int to, int i, int n, const QString& step);
+
+    /// Tell the renderer no mesh of this load follows (Renderer::endLoad())
+    void endLoad();
+
+    RenderSystem::Renderer* mRenderer;
+    QString mFileName;
+    unsigned mLoadId;
+    std::atomic<bool> mCanceled;
+    std::thread mThread;
+};
+
+} // END namespace gui =========================================================
+
+#endif // MESHLOADER_H
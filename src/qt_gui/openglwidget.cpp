@@ -21,9 +21,11 @@
 
 #include "timer.hpp"
 #include "gl_utils/glassert.h"
+#include "gl_utils/glstate.h"
 
 #include <QWheelEvent>
 #include <QApplication>
+#include <QTimer>
 #include <iostream>
 
 // =============================================================================
@@ -50,6 +52,7 @@ OpenGLWidget::OpenGLWidget(QScreen* screen)
     , mWidth(-1)
     , mHeight(-1)
     , m_theRenderer(nullptr)
+    , mUploadWorker(0)
     , mContext(0)
 {
     setSurfaceType(OpenGLSurface);
@@ -73,6 +76,10 @@ OpenGLWidget::OpenGLWidget(QScreen* screen)
     m_theRenderer = new RenderSystem::Renderer();
     m_theRenderer->initRessources();
 
+    mUploadWorker = new UploadWorker(mContext);
+    if (mUploadWorker->startStream())
+        m_theRenderer->setUploadStream(mUploadWorker->stream());
+
     resize(QSize(800, 450));
 
     connect(this, SIGNAL(widthChanged(int)), this, SLOT(resizeGL()));
@@ -86,7 +93,11 @@ OpenGLWidget::OpenGLWidget(QScreen* screen)
 
 OpenGLWidget::~OpenGLWidget()
 {
+    // The worker reads the meshes of the renderer
+    mUploadWorker->stop();
+    makeCurrent();
     delete m_theRenderer;
+    delete mUploadWorker;
     // Must be last to release all OpenGL objects before (VBOs shaders ...):
     delete mContext;
 }
@@ -100,6 +111,9 @@ void OpenGLWidget::initializeGL()
     printContextInfos();
     RenderSystem::initGlew();
     glCheckError();
+    // States set by Qt or by a previous context are not those shadowed by
+    // GlState. Afterwards only the renderer touches this context.
+    GlState::current().invalidate();
 }
 
 // -----------------------------------------------------------------------------
@@ -167,6 +181,10 @@ void OpenGLWidget::paintGL()
     }
     frames += 1;
     swapBuffers();
+
+    // Meshes loaded in the background are uploaded a few per frame
+    if (m_theRenderer->nbPendingMeshes() > 0)
+        QTimer::singleShot(0, this, SLOT(updateGL()));
 }
 
 // -----------------------------------------------------------------------------
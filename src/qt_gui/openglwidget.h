@@ -22,6 +22,7 @@
 
 
 #include "rendersystem/renderer.h"
+#include "uploadworker.h"
 #include <QWindow>
 #include <QOpenGLContext>
 #include <QImage>
@@ -49,6 +50,8 @@ public:
 
     void printContextInfos();
 
+    RenderSystem::Renderer* renderer() { return m_theRenderer; }
+
 signals:
     void fpsChanged ( const QString & );
 
@@ -74,6 +77,9 @@ private:
 
     RenderSystem::Renderer* m_theRenderer;
 
+    /// Fills the buffers of the meshes streamed in #m_theRenderer
+    UploadWorker* mUploadWorker;
+
     QOpenGLContext* mContext;
 };
 
@@ -0,0 +1,109 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "uploadworker.h"
+
+#include <QCoreApplication>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <iostream>
+
+// =============================================================================
+namespace Gui {
+// =============================================================================
+
+UploadWorker::UploadWorker(QOpenGLContext* shareContext, QObject* parent)
+    : QThread(parent)
+    , mShareContext(shareContext)
+    , mContext(0)
+    , mSurface(0)
+{
+}
+
+// -----------------------------------------------------------------------------
+
+UploadWorker::~UploadWorker()
+{
+    stop();
+    delete mContext;
+    delete mSurface;
+}
+
+// -----------------------------------------------------------------------------
+
+bool UploadWorker::startStream()
+{
+    // The surface must be created and destroyed by the GUI thread
+    mSurface = new QOffscreenSurface();
+    mSurface->setFormat(mShareContext->format());
+    mSurface->create();
+
+    mContext = new QOpenGLContext();
+    mContext->setFormat(mShareContext->format());
+    mContext->setShareContext(mShareContext);
+
+    // Check the context can be used before handing it to the thread
+    QOpenGLContext* current = QOpenGLContext::currentContext();
+    QSurface* currentSurface = current ? current->surface() : 0;
+    bool valid = mSurface->isValid() && mContext->create() &&
+                 QOpenGLContext::areSharing(mContext, mShareContext) &&
+                 mContext->makeCurrent(mSurface);
+    if (valid)
+        mContext->doneCurrent();
+    if (current != 0)
+        current->makeCurrent(currentSurface);
+
+    if (!valid) {
+        std::cerr << "Cannot create a shared OpenGL context: ";
+        std::cerr << "meshes are uploaded by the drawing thread" << std::endl;
+        delete mContext;
+        delete mSurface;
+        mContext = 0;
+        mSurface = 0;
+        return false;
+    }
+    mContext->moveToThread(this);
+    start();
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+void UploadWorker::stop()
+{
+    mStream.stop();
+    wait();
+}
+
+// -----------------------------------------------------------------------------
+
+void UploadWorker::run()
+{
+    if (!mContext->makeCurrent(mSurface)) {
+        std::cerr << "Cannot use the shared OpenGL context: ";
+        std::cerr << "meshes are uploaded by the drawing thread" << std::endl;
+        // The renderer compiles the meshes whose uploads failed itself
+        mStream.fail();
+        mContext->moveToThread(QCoreApplication::instance()->thread());
+        return;
+    }
+    mStream.run();
+    mContext->doneCurrent();
+    // So that the GUI thread can delete it
+    mContext->moveToThread(QCoreApplication::instance()->thread());
+}
+
+} // END namespace gui =========================================================
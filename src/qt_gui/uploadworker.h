@@ -0,0 +1,75 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef UPLOADWORKER_H
+#define UPLOADWORKER_H
+
+#include "gl_utils/glupload_stream.h"
+
+#include <QThread>
+
+class QOpenGLContext;
+class QOffscreenSurface;
+
+// =============================================================================
+namespace Gui {
+// =============================================================================
+
+/**
+  * @ingroup InterfaceSystem
+  * Thread filling the buffers of the meshes streamed in the renderer.
+  *
+  * It owns an OpenGL context sharing its objects with the one drawing, made
+  * current on an offscreen surface, and runs a GlUpload_stream with it
+  * (see RenderSystem::Renderer::setUploadStream()). A QThread is needed
+  * rather than a std::thread: a QOpenGLContext can only be made current in
+  * the thread it belongs to.
+  */
+class UploadWorker : public QThread {
+public:
+    /// @param shareContext : context drawing the buffers uploaded
+    UploadWorker(QOpenGLContext* shareContext, QObject* parent = 0);
+
+    /// Stop then release the context
+    ~UploadWorker();
+
+    /// Create the shared context and start the thread.
+    /// The context current before the call is current again after it.
+    /// Should the thread fail to use the context the stream fails (see
+    /// GlUpload_stream::fail()).
+    /// @return false when the shared context could not be created, nothing
+    /// must be pushed to stream() then
+    bool startStream();
+
+    /// Make the stream return and wait for the thread.
+    /// Uploads still queued are never done.
+    void stop();
+
+    GlUpload_stream* stream() { return &mStream; }
+
+protected:
+    void run();
+
+private:
+    QOpenGLContext* mShareContext;
+    QOpenGLContext* mContext;
+    QOffscreenSurface* mSurface;
+    GlUpload_stream mStream;
+};
+
+} // END namespace gui =========================================================
+
+#endif // UPLOADWORKER_H
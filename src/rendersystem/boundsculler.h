@@ -0,0 +1,183 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef BOUNDSCULLER_H
+#define BOUNDSCULLER_H
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "glm/glm.hpp"
+#include "fileloaders/alignedallocator.h"
+#include "frustum.h"
+
+#if defined(__AVX__)
+#define CULLER_USE_AVX
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define CULLER_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+// =============================================================================
+namespace RenderSystem {
+// =============================================================================
+
+/**
+  * @ingroup RenderSystem
+  * Bounding volumes of many objects tested at once against a frustum.
+  *
+  * Each object is bounded by a box and a sphere sharing the same center.
+  * They are stored as a structure of arrays so that #cull() tests 4 (SSE)
+  * or 8 (AVX) objects per instruction. An object is culled when one of the
+  * two volumes lies entirely outside a plane of the frustum.
+  */
+class BoundsCuller {
+public:
+    BoundsCuller() {}
+
+    int size() const { return (int)mCx.size(); }
+
+    void clear()
+    {
+        mCx.clear(); mCy.clear(); mCz.clear();
+        mEx.clear(); mEy.clear(); mEz.clear();
+        mRadius.clear();
+    }
+
+    /// Append the box (bmin, bmax) and the sphere of radius "radius"
+    /// around its center (a negative radius uses the sphere around the box).
+    /// @return the index of the object
+    int add(const glm::vec3& bmin, const glm::vec3& bmax, float radius = -1.f)
+    {
+        mCx.push_back(0.f); mCy.push_back(0.f); mCz.push_back(0.f);
+        mEx.push_back(0.f); mEy.push_back(0.f); mEz.push_back(0.f);
+        mRadius.push_back(0.f);
+        set(size() - 1, bmin, bmax, radius);
+        return size() - 1;
+    }
+
+    /// Update the bounds of object "i", @see add()
+    void set(int i, const glm::vec3& bmin, const glm::vec3& bmax, float radius = -1.f)
+    {
+        glm::vec3 c = (bmin + bmax) * 0.5f;
+        glm::vec3 e = (bmax - bmin) * 0.5f;
+        mCx[i] = c.x; mCy[i] = c.y; mCz[i] = c.z;
+        mEx[i] = e.x; mEy[i] = e.y; mEz[i] = e.z;
+        mRadius[i] = radius < 0.f ? glm::length(e) : radius;
+    }
+
+    /// Test every object against "frustum".
+    /// @param visible : resized to #size(), 1 when the object may be visible
+    /// and 0 when it is culled
+    /// @return the number of visible objects
+    int cull(const Frustum& frustum, std::vector<unsigned char>& visible) const
+    {
+        const int n = size();
+        visible.resize(n);
+        int nbVisible = 0;
+        int i = 0;
+#if defined(CULLER_USE_AVX)
+        // planes broadcast once: (nx, ny, nz, w, |nx|, |ny|, |nz|)
+        const __m256 signMask = _mm256_set1_ps(-0.f);
+        __m256 planes[Frustum::NB_PLANES][7];
+        for (int p = 0; p < Frustum::NB_PLANES; ++p) {
+            const glm::vec4& pl = frustum.plane(p);
+            for (int k = 0; k < 4; ++k)
+                planes[p][k] = _mm256_set1_ps(pl[k]);
+            for (int k = 0; k < 3; ++k)
+                planes[p][4 + k] = _mm256_set1_ps(std::fabs(pl[k]));
+        }
+        for (; i + 8 <= n; i += 8) {
+            __m256 cx = _mm256_load_ps(&mCx[i]), cy = _mm256_load_ps(&mCy[i]), cz = _mm256_load_ps(&mCz[i]);
+            __m256 ex = _mm256_load_ps(&mEx[i]), ey = _mm256_load_ps(&mEy[i]), ez = _mm256_load_ps(&mEz[i]);
+            __m256 radius = _mm256_load_ps(&mRadius[i]);
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (int p = 0; p < Frustum::NB_PLANES; ++p) {
+                const __m256* pl = planes[p];
+                // signed distance of the centers
+                __m256 d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(pl[0], cx), _mm256_mul_ps(pl[1], cy)),
+                                         _mm256_add_ps(_mm256_mul_ps(pl[2], cz), pl[3]));
+                // extent of the boxes along the normal
+                __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(pl[4], ex), _mm256_mul_ps(pl[5], ey)),
+                                         _mm256_mul_ps(pl[6], ez));
+                r = _mm256_min_ps(r, radius);
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, _mm256_xor_ps(r, signMask), _CMP_GE_OQ));
+            }
+            int mask = _mm256_movemask_ps(inside);
+            for (int k = 0; k < 8; ++k) {
+                visible[i + k] = (mask >> k) & 1;
+                nbVisible += visible[i + k];
+            }
+        }
+#elif defined(CULLER_USE_SSE)
+        // planes broadcast once: (nx, ny, nz, w, |nx|, |ny|, |nz|)
+        const __m128 signMask = _mm_set1_ps(-0.f);
+        __m128 planes[Frustum::NB_PLANES][7];
+        for (int p = 0; p < Frustum::NB_PLANES; ++p) {
+            const glm::vec4& pl = frustum.plane(p);
+            for (int k = 0; k < 4; ++k)
+                planes[p][k] = _mm_set1_ps(pl[k]);
+            for (int k = 0; k < 3; ++k)
+                planes[p][4 + k] = _mm_set1_ps(std::fabs(pl[k]));
+        }
+        for (; i + 4 <= n; i += 4) {
+            __m128 cx = _mm_load_ps(&mCx[i]), cy = _mm_load_ps(&mCy[i]), cz = _mm_load_ps(&mCz[i]);
+            __m128 ex = _mm_load_ps(&mEx[i]), ey = _mm_load_ps(&mEy[i]), ez = _mm_load_ps(&mEz[i]);
+            __m128 radius = _mm_load_ps(&mRadius[i]);
+            __m128 inside = _mm_cmpeq_ps(cx, cx); // all ones (bounds are never NaN)
+            for (int p = 0; p < Frustum::NB_PLANES; ++p) {
+                const __m128* pl = planes[p];
+                // signed distance of the centers
+                __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pl[0], cx), _mm_mul_ps(pl[1], cy)),
+                                      _mm_add_ps(_mm_mul_ps(pl[2], cz), pl[3]));
+                // extent of the boxes along the normal
+                __m128 r = _mm_add_ps(_mm_add_ps(_mm_mul_ps(pl[4], ex), _mm_mul_ps(pl[5], ey)),
+                                      _mm_mul_ps(pl[6], ez));
+                r = _mm_min_ps(r, radius);
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(d, _mm_xor_ps(r, signMask)));
+            }
+            int mask = _mm_movemask_ps(inside);
+            for (int k = 0; k < 4; ++k) {
+                visible[i + k] = (mask >> k) & 1;
+                nbVisible += visible[i + k];
+            }
+        }
+#endif
+        for (; i < n; ++i) {
+            bool inside = true;
+            for (int p = 0; p < Frustum::NB_PLANES && inside; ++p) {
+                const glm::vec4& pl = frustum.plane(p);
+                float d = pl.x * mCx[i] + pl.y * mCy[i] + pl.z * mCz[i] + pl.w;
+                float r = std::fabs(pl.x) * mEx[i] + std::fabs(pl.y) * mEy[i] + std::fabs(pl.z) * mEz[i];
+                inside = d >= -std::min(r, mRadius[i]);
+            }
+            visible[i] = inside ? 1 : 0;
+            nbVisible += visible[i];
+        }
+        return nbVisible;
+    }
+
+private:
+    typedef Loaders::AlignedVector<float>::type Stream;
+    Stream mCx, mCy, mCz; ///< centers
+    Stream mEx, mEy, mEz; ///< half sizes of the boxes
+    Stream mRadius;       ///< radii of the spheres
+};
+
+} // END namespace RenderSystem ================================================
+
+#endif // BOUNDSCULLER_H
@@ -0,0 +1,80 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include "glm/glm.hpp"
+#include <glm/gtc/matrix_access.hpp>
+
+// =============================================================================
+namespace RenderSystem {
+// =============================================================================
+
+/**
+  * @ingroup RenderSystem
+  * The six planes of a view frustum, extracted from a projection matrix
+  * (Gribb & Hartmann). A point p is inside a plane when
+  * dot(plane, vec4(p, 1)) >= 0.
+  */
+class Frustum {
+public:
+    enum { LEFT = 0, RIGHT, BOTTOM, TOP, NEAR_PLANE, FAR_PLANE, NB_PLANES };
+
+    Frustum() {}
+
+    /// @see set()
+    explicit Frustum(const glm::mat4& viewProjection) { set(viewProjection); }
+
+    /// Extract the planes of "viewProjection" (projection * view * model),
+    /// they are expressed in the frame before this transformation.
+    void set(const glm::mat4& viewProjection)
+    {
+        const glm::vec4 r0 = glm::row(viewProjection, 0);
+        const glm::vec4 r1 = glm::row(viewProjection, 1);
+        const glm::vec4 r2 = glm::row(viewProjection, 2);
+        const glm::vec4 r3 = glm::row(viewProjection, 3);
+        mPlanes[LEFT]       = r3 + r0;
+        mPlanes[RIGHT]      = r3 - r0;
+        mPlanes[BOTTOM]     = r3 + r1;
+        mPlanes[TOP]        = r3 - r1;
+        mPlanes[NEAR_PLANE] = r3 + r2;
+        mPlanes[FAR_PLANE]  = r3 - r2;
+        // unit normals so that plane equations give distances
+        for (int i = 0; i < NB_PLANES; ++i)
+            mPlanes[i] /= glm::length(glm::vec3(mPlanes[i]));
+    }
+
+    const glm::vec4& plane(int i) const { return mPlanes[i]; }
+
+    /// Conservative test: false only when the sphere is entirely outside
+    /// one of the planes.
+    bool intersectsSphere(const glm::vec3& center, float radius) const
+    {
+        for (int i = 0; i < NB_PLANES; ++i) {
+            if (glm::dot(glm::vec3(mPlanes[i]), center) + mPlanes[i].w < -radius)
+                return false;
+        }
+        return true;
+    }
+
+private:
+    glm::vec4 mPlanes[NB_PLANES];
+};
+
+} // END namespace RenderSystem ================================================
+
+#endif // FRUSTUM_H
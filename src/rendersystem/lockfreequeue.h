@@ -0,0 +1,139 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef LOCKFREEQUEUE_H
+#define LOCKFREEQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+// =============================================================================
+namespace RenderSystem {
+// =============================================================================
+
+/**
+  * @ingroup RenderSystem
+  * Bounded queue shared by threads without any lock.
+  *
+  * Any number of threads can push and pop concurrently (D. Vyukov's bounded
+  * MPMC queue): each cell carries a sequence number telling whether it is
+  * ready to be written or read at the current position, so a thread only
+  * has to win a compare and swap on the position to own the cell.
+  * Neither push() nor pop() ever block, they fail when the queue is
+  * full or empty.
+  *
+  * T must be cheap to copy (pointers, small structs).
+  */
+template<class T>
+class LockFreeQueue {
+public:
+    /// @param capacity : rounded up to a power of two
+    explicit LockFreeQueue(std::size_t capacity)
+        : mEnqueuePos(0)
+        , mDequeuePos(0)
+    {
+        std::size_t size = 2;
+        while (size < capacity)
+            size *= 2;
+        mMask = size - 1;
+        mCells = new Cell[size];
+        for (std::size_t i = 0; i < size; ++i)
+            mCells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    ~LockFreeQueue() { delete[] mCells; }
+
+    /// @return false when the queue is full
+    bool push(const T& value)
+    {
+        std::size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &mCells[pos & mMask];
+            const std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)pos;
+            if (diff == 0) {
+                if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false; // the cell still holds the value of the last lap
+            else
+                pos = mEnqueuePos.load(std::memory_order_relaxed);
+        }
+        cell->value = value;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// @return false when the queue is empty
+    bool pop(T& value)
+    {
+        std::size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+        Cell* cell;
+        for (;;) {
+            cell = &mCells[pos & mMask];
+            const std::size_t seq = cell->sequence.load(std::memory_order_acquire);
+            const std::ptrdiff_t diff = (std::ptrdiff_t)seq - (std::ptrdiff_t)(pos + 1);
+            if (diff == 0) {
+                if (mDequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            }
+            else if (diff < 0)
+                return false; // not written yet
+            else
+                pos = mDequeuePos.load(std::memory_order_relaxed);
+        }
+        value = cell->value;
+        cell->sequence.store(pos + mMask + 1, std::memory_order_release);
+        return true;
+    }
+
+    /// Number of values queued. Only a hint when other threads are
+    /// pushing or popping.
+    std::size_t size() const
+    {
+        const std::size_t enqueued = mEnqueuePos.load(std::memory_order_relaxed);
+        const std::size_t dequeued = mDequeuePos.load(std::memory_order_relaxed);
+        return enqueued > dequeued ? enqueued - dequeued : 0;
+    }
+
+    std::size_t capacity() const { return mMask + 1; }
+
+private:
+    LockFreeQueue(const LockFreeQueue&);
+    LockFreeQueue& operator=(const LockFreeQueue&);
+
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        T value;
+    };
+
+    /// Cache line size: producers and consumers don't share their position
+    enum { PADDING = 64 };
+
+    Cell* mCells;
+    std::size_t mMask;
+    char mPad0[PADDING];
+    std::atomic<std::size_t> mEnqueuePos;
+    char mPad1[PADDING];
+    std::atomic<std::size_t> mDequeuePos;
+    char mPad2[PADDING];
+};
+
+} // END namespace RenderSystem ================================================
+
+#endif // LOCKFREEQUEUE_H
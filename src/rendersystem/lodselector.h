@@ -0,0 +1,101 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef LODSELECTOR_H
+#define LODSELECTOR_H
+
+#include <vector>
+#include "glm/glm.hpp"
+#include "fileloaders/meshsimplifier.h"
+
+// =============================================================================
+namespace RenderSystem {
+// =============================================================================
+
+/**
+  * @ingroup RenderSystem
+  * Levels of detail of a mesh stored as ranges of a single index buffer,
+  * and choice of the level to draw from its size on screen.
+  */
+class LodSelector {
+public:
+    /// Part of the index buffer holding one level
+    struct Range {
+        int firstIndex;
+        int nbIndices;
+        float error; ///< object space error of the level
+    };
+
+    LodSelector()
+        : mCurrent(0)
+        , mCenter(0.f)
+        , mRadius(0.f)
+    {
+    }
+
+    /// Concatenate the triangles of every level into "indices".
+    /// @param center, radius : bounding sphere of the mesh
+    void set(const std::vector<Loaders::MeshLod>& lods,
+             std::vector<unsigned int>& indices,
+             const glm::vec3& center, float radius)
+    {
+        mRanges.clear();
+        indices.clear();
+        for (unsigned i = 0; i < lods.size(); ++i) {
+            Range r = { (int)indices.size(), (int)lods[i].indices.size(), lods[i].error };
+            indices.insert(indices.end(), lods[i].indices.begin(), lods[i].indices.end());
+            mRanges.push_back(r);
+        }
+        mCurrent = 0;
+        mCenter = center;
+        mRadius = radius;
+    }
+
+    int nbLevels() const { return (int)mRanges.size(); }
+    const Range& range(int level) const { return mRanges[level]; }
+    int current() const { return mCurrent; }
+
+    /// Select the coarsest level whose error covers less than
+    /// "maxPixelError" pixels on screen.
+    /// @param eye : camera position in the frame of the mesh
+    /// @param pixelsPerUnit : size in pixels of one unit seen at distance 1,
+    /// i.e. viewport height / (2 tan(fovy / 2))
+    /// @return the selected level
+    int select(const glm::vec3& eye, float pixelsPerUnit, float maxPixelError = 1.f)
+    {
+        mCurrent = 0;
+        // distance to the closest point of the bounding sphere
+        float distance = glm::length(eye - mCenter) - mRadius;
+        if (distance <= 0.f)
+            return mCurrent;
+        for (int i = 1; i < nbLevels(); ++i) {
+            if (mRanges[i].error * pixelsPerUnit / distance > maxPixelError)
+                break;
+            mCurrent = i;
+        }
+        return mCurrent;
+    }
+
+private:
+    std::vector<Range> mRanges;
+    int mCurrent;
+    glm::vec3 mCenter;
+    float mRadius;
+};
+
+} // END namespace RenderSystem ================================================
+
+#endif // LODSELECTOR_H
@@ -0,0 +1,149 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef PENDINGMESHES_H
+#define PENDINGMESHES_H
+
+#include "fileloaders/mesh.h"
+#include "lockfreequeue.h"
+
+#include <algorithm>
+#include <vector>
+
+// =============================================================================
+namespace RenderSystem {
+// =============================================================================
+
+/**
+  * @ingroup RenderSystem
+  * A mesh loaded by another thread waiting to be uploaded.
+  * @see Renderer::queueMesh()
+  */
+struct PendingMesh {
+    Loaders::Mesh* mesh; ///< 0: end of the load, see PendingMeshes::endLoad()
+    unsigned loadId;
+};
+
+// -----------------------------------------------------------------------------
+
+/**
+  * @ingroup RenderSystem
+  * Meshes handed by loading threads to the renderer, which takes a few of
+  * them per frame.
+  *
+  * The loading threads push() their meshes without any lock, the render
+  * thread pop()s them within a byte budget per frame and drops those of
+  * the canceled loads. No OpenGL call: the renderer uploads what pop()
+  * returns.
+  */
+class PendingMeshes {
+public:
+    /// @param capacity : meshes queued at most
+    /// @param budget : bytes of vertices and indices popped per frame
+    PendingMeshes(std::size_t capacity, int budget)
+        : mQueue(capacity)
+        , mBudget(budget)
+        , mNbBytes(0)
+    {
+    }
+
+    ~PendingMeshes() { clear(); }
+
+    /// Queue "mesh" of the load "loadId" and take its ownership. Thread safe.
+    /// @return false when the queue is full, try again later
+    bool push(Loaders::Mesh* mesh, unsigned loadId)
+    {
+        PendingMesh pending;
+        pending.mesh = mesh;
+        pending.loadId = loadId;
+        return mQueue.push(pending);
+    }
+
+    /// Pushed after the last mesh of "loadId": its cancellation is
+    /// forgotten once the meshes pushed before are popped.
+    /// @return false when the queue is full, try again later
+    bool endLoad(unsigned loadId) { return push(0, loadId); }
+
+    /// Delete the meshes of "loadId" instead of returning them, until its
+    /// endLoad() is popped
+    void cancelLoad(unsigned loadId) { mCanceled.push_back(loadId); }
+
+    /// Start counting the bytes popped for a new frame
+    void beginFrame() { mNbBytes = 0; }
+
+    /// Next mesh to upload, the caller takes its ownership.
+    /// At least one mesh is returned per frame whatever its size.
+    /// @return 0 when the queue is empty or the budget of the frame spent
+    Loaders::Mesh* pop()
+    {
+        PendingMesh pending;
+        while (mNbBytes < mBudget && mQueue.pop(pending)) {
+            if (pending.mesh == 0) {
+                // End of a load: its meshes, all queued before, are consumed
+                mCanceled.erase(std::remove(mCanceled.begin(), mCanceled.end(), pending.loadId), mCanceled.end());
+                continue;
+            }
+            if (std::find(mCanceled.begin(), mCanceled.end(), pending.loadId) != mCanceled.end()) {
+                delete pending.mesh;
+                continue;
+            }
+            mNbBytes += uploadSize(*pending.mesh);
+            return pending.mesh;
+        }
+        return 0;
+    }
+
+    /// Delete every queued mesh. Not thread safe.
+    void clear()
+    {
+        PendingMesh pending;
+        while (mQueue.pop(pending))
+            delete pending.mesh;
+        mCanceled.clear();
+    }
+
+    /// Bytes of interleaved vertices (x,y,z, nx,ny,nz, u,v) and triangles
+    /// uploaded for "mesh"
+    static int uploadSize(const Loaders::Mesh& mesh)
+    {
+        return mesh.nbVertices() * 8 * (int)sizeof(float) + mesh.nbTriangles() * 3 * (int)sizeof(unsigned int);
+    }
+
+    /// Bytes popped since beginFrame()
+    int nbBytes() const { return mNbBytes; }
+
+    void setBudget(int nbBytes) { mBudget = nbBytes; }
+
+    /// Number of meshes and end of loads queued (only a hint while other
+    /// threads are pushing)
+    std::size_t size() const { return mQueue.size(); }
+
+    /// Loads canceled whose endLoad() is not popped yet
+    const std::vector<unsigned>& canceledLoads() const { return mCanceled; }
+
+private:
+    PendingMeshes(const PendingMeshes&);
+    PendingMeshes& operator=(const PendingMeshes&);
+
+    LockFreeQueue<PendingMesh> mQueue;
+    std::vector<unsigned> mCanceled;
+    int mBudget;
+    int mNbBytes;
+};
+
+} // END namespace RenderSystem ================================================
+
+#endif // PENDINGMESHES_H
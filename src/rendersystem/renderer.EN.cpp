@@ -22,11 +22,27 @@
 
 #include "gl_utils/opengl.h"
 #include "gl_utils/gldirect_draw.h"
+#include "gl_utils/glstate.h"
 #include "fileloaders/objloader.h"
 #include "fileloaders/fileloader.h"
+#include "fileloaders/meshsimplifier.h"
+#include "fileloaders/meshlet.h"
+#include "lodselector.h"
+#include "frustum.h"
+#include "boundsculler.h"
+#include "scenebvh.h"
+#include "renderqueue.h"
+#include "gl_utils/glring_buffer.h"
+#include "gl_utils/glmesh_arena.h"
+#include "gl_utils/glupload_stream.h"
 
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_access.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
 
 /** @defgroup RendererGlobalFunctions
   * @author Mathias Paulin <Mathias.Paulin@irit.fr>
@@ -76,6 +92,10 @@ void Renderer::initRessources()
 
 
     initGeometry(); // LAB 1 / PART II: Loading or building geometric data.
+    buildMeshLods();
+    for (unsigned i = 0; i < mMeshes.size(); ++i)
+        moveToArena(mMeshes[i]);
+    updateMeshBounds();
 }
 
 //------------------------------------------------------------------------------
@@ -246,6 +266,14 @@ void Renderer::initShaders()
 
     // LAB 1 / PART I: END CODE TO COMPLETE
     // #########################################################################
+
+    // Uniforms of vertexdefault.glsl reading the instances (see
+    // submitInstances()), looked up once the program is linked
+    mInstanceBaseLocation = mInstanceBufferLocation = -1;
+    if (mProgram > 0) {
+        glAssert(mInstanceBaseLocation = glGetUniformLocation(mProgram, "instanceBase"));
+        glAssert(mInstanceBufferLocation = glGetUniformLocation(mProgram, "instanceBuffer"));
+    }
 }
 
 //------------------------------------------------------------------------------
@@ -342,6 +370,12 @@ void Renderer::render()
     // #########################################################################
 
 
+    // OpenGL calls added above bypass GlState (glUseProgram()...)
+    GlState::current().invalidate();
+
+    // Meshes loaded in the background (see queueMesh())
+    uploadPendingMeshes();
+
     // #########################################################################
     // LAB 1 / PART II:
     // In part I leave this code untouched
@@ -355,6 +389,12 @@ void Renderer::render()
 
     // LAB 1 / PART II:END CODE TO COMPLETE
     // #########################################################################
+
+    // GL state changes of the frame (see GlState)
+    GlState& state = GlState::current();
+    mFrameStats.nbStateChanges = state.nb_issued();
+    mFrameStats.nbStateSkipped = state.nb_skipped();
+    state.reset_counters();
 }
 
 
@@ -365,7 +405,7 @@ void Renderer::render()
   * A mesh with OpenGL rendering capabilities.
   */
 class MyGLMesh : public Loaders::Mesh {
-private:
+protected:
     /// OpenGL identifier for the "Vertex Array Object" (VAO) of the mesh
     GLuint mVertexArrayObject;
 
@@ -379,10 +419,49 @@ private:
     /// N.B: use VBO_VERTICES and VBO_INDICES to access this array elements
     GLuint mVertexBufferObjects[NB_VBOS];
 
+    /// Levels of detail of the mesh (see setLods())
+    LodSelector mLods;
+    /// Index buffer holding every level of detail (0 until submitLodGL())
+    GLuint mLodIndexBuffer;
+    /// Indices of the levels waiting to be uploaded
+    std::vector<unsigned int> mLodIndices;
+
+    /// Shared buffers holding a copy of the mesh (see addToArena())
+    GlMesh_arena* mArena;
+    int mArenaHandle;
+    /// True when the VBOs hold Loaders::Mesh::Vertex (see
+    /// compileGL(GLuint, GLuint)), addToArena() then copies them on the GPU
+    bool mInterleavedBuffers;
+
+    /// Bounding box and bounding sphere (centered on the box) of the mesh
+    glm::vec3 mBoundsMin;
+    glm::vec3 mBoundsMax;
+    float mBoundsRadius;
+
 public:
     MyGLMesh(const Loaders::Mesh& mesh)
         : Loaders::Mesh(mesh)
+        , mVertexArrayObject(0)
+        , mLodIndexBuffer(0)
+        , mArena(0)
+        , mArenaHandle(-1)
+        , mInterleavedBuffers(false)
+    {
+        mVertexBufferObjects[VBO_VERTICES] = mVertexBufferObjects[VBO_INDICES] = 0;
+        computeBounds();
+    }
+
+    /// "mesh" is left empty
+    MyGLMesh(Loaders::Mesh&& mesh)
+        : Loaders::Mesh(std::move(mesh))
+        , mVertexArrayObject(0)
+        , mLodIndexBuffer(0)
+        , mArena(0)
+        , mArenaHandle(-1)
+        , mInterleavedBuffers(false)
     {
+        mVertexBufferObjects[VBO_VERTICES] = mVertexBufferObjects[VBO_INDICES] = 0;
+        computeBounds();
     }
 
     MyGLMesh(const std::vector<float>& vertexBuffer,
@@ -394,7 +473,14 @@ public:
                         std::vector<int>(),
                         hasNormals,
                         hasTextureCoords)
+        , mVertexArrayObject(0)
+        , mLodIndexBuffer(0)
+        , mArena(0)
+        , mArenaHandle(-1)
+        , mInterleavedBuffers(false)
     {
+        mVertexBufferObjects[VBO_VERTICES] = mVertexBufferObjects[VBO_INDICES] = 0;
+        computeBounds();
     }
 
     /// Upload du maillage sur GPU
@@ -499,11 +585,21 @@ public:
 
 	    // Binding to 0 means 'unBind()' and garantees no buffer is enabled
 	    glAssert(glBindVertexArray(0));
+	    // The code above binds with raw gl calls: forget the cached states
+	    GlState::current().invalidate();
 	}
 
 	/// Draw the VertexArrayObjects (VAO "mVertexArrayObject") of the mesh.
 	void drawGL()
 	{
+		// Meshes moved to the arena have no VAO of their own anymore (see
+		// Renderer::moveToArena())
+		if (mVertexArrayObject == 0 && mArena != 0) {
+			const DrawElementsIndirectCommand command = mArena->command(mArenaHandle);
+			mArena->draw(GlState::current(), GL_TRIANGLES, &command, 1);
+			return;
+		}
+
 		// Draw the mesh loaded in video memory thanks to our VAO
 
 		// #####################################################################
@@ -525,6 +621,231 @@ public:
 		// #####################################################################
 	}
 
+    /// Replace the levels of detail of the mesh.
+    /// Level 0 must be the mesh itself.
+    void setLods(const std::vector<Loaders::MeshLod>& lods)
+    {
+        mLods.set(lods, mLodIndices, (mBoundsMin + mBoundsMax) * 0.5f, mBoundsRadius);
+    }
+
+    /// Bounds computed when the mesh is built (see computeBounds())
+    const glm::vec3& boundsMin() const { return mBoundsMin; }
+    const glm::vec3& boundsMax() const { return mBoundsMax; }
+    float boundsRadius() const { return mBoundsRadius; }
+
+    /// Update the bounds after the vertices changed
+    void computeBounds()
+    {
+        boundingBox(mBoundsMin, mBoundsMax);
+        glm::vec3 center;
+        boundingSphere(center, mBoundsRadius);
+    }
+
+    bool hasLods() const { return mLods.nbLevels() > 1; }
+
+    LodSelector& lods() { return mLods; }
+
+    /// OpenGL identifier of the VAO built by compileGL()
+    GLuint vertexArray() const { return mVertexArrayObject; }
+
+    /// Submit drawGL() to "queue". It is called back with its raw OpenGL
+    /// calls when the queue is executed.
+    void submitGL(RenderQueue& queue, uint64_t key)
+    {
+        queue.submitCallback(key, &MyGLMesh::drawCallback, this);
+    }
+
+    /// Submit the level of detail selected in #lods() to "queue".
+    /// It uses the vertices of the VAO built by compileGL() with its own
+    /// index buffer, uploaded on first use.
+    void submitLodGL(RenderQueue& queue, uint64_t key)
+    {
+        if (mVertexArrayObject == 0 || !hasLods()) {
+            submitGL(queue, key);
+            return;
+        }
+        if (mLodIndexBuffer == 0)
+            mLodIndexBuffer = uploadIndices(mLodIndices);
+
+        const LodSelector::Range& r = mLods.range(mLods.current());
+        DrawPacket& p = queue.submit(key);
+        p.vertexArray = mVertexArrayObject;
+        p.vaoIndexBuffer = mVertexBufferObjects[VBO_INDICES];
+        p.indexBuffer = mLodIndexBuffer;
+        p.mode = GL_TRIANGLES;
+        p.count = r.nbIndices;
+        p.offset = (const GLvoid*)(r.firstIndex * sizeof(GLuint));
+    }
+
+    /// Submit "count" instances of the whole mesh to "queue". The shader
+    /// "program" reads them from instance "first" on, see Renderer::addInstance()
+    void submitInstancedGL(RenderQueue& queue, uint64_t key, GLuint program,
+                           GLint instanceBaseLocation, int first, int count)
+    {
+        DrawPacket& p = queue.submit(key);
+        p.program = program;
+        p.instanceCount = count;
+        p.instanceBase = first;
+        p.instanceBaseLocation = instanceBaseLocation;
+        if (mVertexArrayObject == 0 && mArena != 0) {
+            // Only in the arena: one command drawing every instance
+            DrawElementsIndirectCommand* command = queue.arena().allocateArray<DrawElementsIndirectCommand>(1);
+            *command = mArena->command(mArenaHandle);
+            command->instance_count = count;
+            p.mode = GL_TRIANGLES;
+            p.meshArena = mArena;
+            p.commands = command;
+            p.drawCount = 1;
+            return;
+        }
+        p.vertexArray = mVertexArrayObject;
+        p.vaoIndexBuffer = mVertexBufferObjects[VBO_INDICES];
+        p.mode = GL_TRIANGLES;
+        p.count = 3 * nbTriangles();
+    }
+
+    /// Build the VAO of the mesh around buffers already filled with its
+    /// vertices, laid out like Loaders::Mesh::Vertex, and its triangles, e.g.
+    /// by streamGL(). The mesh owns the buffers from now on.
+    void compileGL(GLuint vertexBuffer, GLuint indexBuffer)
+    {
+        mVertexBufferObjects[VBO_VERTICES] = vertexBuffer;
+        mVertexBufferObjects[VBO_INDICES] = indexBuffer;
+        mInterleavedBuffers = true;
+
+        GlState& state = GlState::current();
+        glAssert(glGenVertexArrays(1, &mVertexArrayObject));
+        state.bind_vertex_array(mVertexArrayObject);
+        state.bind_buffer(GL_ARRAY_BUFFER, vertexBuffer);
+        // Same attribute indices as createArena()
+        glAssert(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, position)));
+        glAssert(glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, normal)));
+        glAssert(glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, texcoord)));
+        glAssert(glEnableVertexAttribArray(0));
+        glAssert(glEnableVertexAttribArray(1));
+        glAssert(glEnableVertexAttribArray(2));
+        state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        state.bind_vertex_array(0);
+        // The VAO stores the index buffer, not the vertex buffer
+        state.bind_buffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    /// Queue the vertices and triangles of the mesh in "stream", which fills
+    /// new buffers on its own thread. Once both uploads are ready their
+    /// buffers are given to compileGL(GLuint, GLuint).
+    /// @return uploads to poll, the mesh data must not change meanwhile
+    UploadingMesh* streamGL(GlUpload_stream& stream)
+    {
+        UploadingMesh* u = new UploadingMesh;
+        u->mesh = this;
+        const void* vertices = &mVertices[0];
+        if (mLayout != INTERLEAVED) {
+            std::vector<int> triangles;
+            bool parametrized;
+            getData(u->vertexData, triangles, parametrized);
+            vertices = &u->vertexData[0];
+        }
+        u->vertices = new GlUpload(vertices, mNbVertices * sizeof(Vertex));
+        u->indices = new GlUpload(&mTriangles[0].indexes[0], 3 * mNbTriangles * sizeof(GLuint));
+        stream.push(u->vertices);
+        stream.push(u->indices);
+        return u;
+    }
+
+    /// Arena whose vertices are laid out like Loaders::Mesh::Vertex, with
+    /// the attribute indices of compileGL(): position 0, normal 1 and
+    /// texture coordinates 2
+    static GlMesh_arena* createArena()
+    {
+        GlMesh_arena* arena = new GlMesh_arena(sizeof(Vertex));
+        arena->set_attribute(0, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, position));
+        arena->set_attribute(1, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, normal));
+        arena->set_attribute(2, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, texcoord));
+        return arena;
+    }
+
+    /// Copy the mesh in "arena" built by createArena(), unless already done
+    /// @return handle of the mesh in "arena", -1 if the mesh is empty
+    int addToArena(GlMesh_arena& arena)
+    {
+        if (mArena == &arena)
+            return mArenaHandle;
+        removeFromArena();
+        if (mNbVertices == 0 || mNbTriangles == 0)
+            return -1;
+
+        const GLuint* indices = &mTriangles[0].indexes[0];
+        if (mInterleavedBuffers)
+            // Copied on the GPU without reading the vertices again
+            mArenaHandle = arena.add(mVertexBufferObjects[VBO_VERTICES], mNbVertices,
+                                     mVertexBufferObjects[VBO_INDICES], 3 * mNbTriangles);
+        else if (mLayout == INTERLEAVED)
+            mArenaHandle = arena.add(&mVertices[0], mNbVertices, indices, 3 * mNbTriangles);
+        else {
+            std::vector<float> vertices;
+            std::vector<int> triangles;
+            bool parametrized;
+            getData(vertices, triangles, parametrized);
+            mArenaHandle = arena.add(&vertices[0], mNbVertices, indices, 3 * mNbTriangles);
+        }
+        mArena = &arena;
+        return mArenaHandle;
+    }
+
+    /// Release the copy of the mesh made by addToArena(), e.g. when its
+    /// vertices changed
+    void removeFromArena()
+    {
+        if (mArena == 0)
+            return;
+        mArena->remove(mArenaHandle);
+        mArena = 0;
+        mArenaHandle = -1;
+    }
+
+    /// Handle of the mesh in the arena of addToArena(), -1 if none
+    int arenaHandle() const { return mArenaHandle; }
+
+    /// Delete the VAO and the buffers of the mesh, e.g. once copied in an
+    /// arena which then draws it. The vertices and triangles stay on the
+    /// CPU for picking and levels of detail.
+    void releaseGL()
+    {
+        GlState& state = GlState::current();
+        if (mVertexArrayObject != 0) {
+            state.forget_vertex_array(mVertexArrayObject);
+            glAssert(glDeleteVertexArrays(1, &mVertexArrayObject));
+            mVertexArrayObject = 0;
+        }
+        for (int i = 0; i < NB_VBOS; ++i) {
+            if (mVertexBufferObjects[i] == 0)
+                continue;
+            state.forget_buffer(mVertexBufferObjects[i]);
+            glAssert(glDeleteBuffers(1, &mVertexBufferObjects[i]));
+            mVertexBufferObjects[i] = 0;
+        }
+        mInterleavedBuffers = false;
+    }
+
+protected:
+    /// Upload "indices" in a new index buffer, then release them
+    static GLuint uploadIndices(std::vector<unsigned int>& indices)
+    {
+        GLuint id = 0;
+        glAssert(glGenBuffers(1, &id));
+        // Unlike GL_ELEMENT_ARRAY_BUFFER this target is not stored in the
+        // VAO currently bound
+        GlState::current().bind_buffer(GL_COPY_WRITE_BUFFER, id);
+        glAssert(glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW));
+        GlState::current().bind_buffer(GL_COPY_WRITE_BUFFER, 0);
+        std::vector<unsigned int>().swap(indices);
+        return id;
+    }
+
+    static void drawCallback(void* mesh) { static_cast<MyGLMesh*>(mesh)->drawGL(); }
+
+public:
+
 	/// Destructor
 	~MyGLMesh()
 	{
@@ -540,11 +861,102 @@ public:
 
 		// LAB 1 / PART II: END CODE TO COMPLETE
 		// #####################################################################
+
+		if (mLodIndexBuffer != 0) {
+			GlState::current().forget_buffer(mLodIndexBuffer);
+			glAssert(glDeleteBuffers(1, &mLodIndexBuffer));
+		}
+		removeFromArena();
 	}
 };
 
 // -----------------------------------------------------------------------------
 
+/**
+  * @ingroup RenderSystem
+  * A MyGLMesh split into meshlets (see Loaders::Meshlet).
+  * Meshlets outside the view frustum or back-facing are skipped, the others
+  * are drawn with a single glMultiDrawElements().
+  */
+class MyClusteredGLMesh : public MyGLMesh {
+public:
+    MyClusteredGLMesh(const Loaders::Mesh& mesh)
+        : MyGLMesh(mesh)
+        , mClusterIndexBuffer(0)
+        , mNbMeshletsDrawn(0)
+    {
+        Loaders::Meshlet::build(*this, mMeshlets, mClusterIndices);
+    }
+
+    const std::vector<Loaders::Meshlet>& meshlets() const { return mMeshlets; }
+
+    /// Number of meshlets submitted by the last submitClustersGL()
+    int nbMeshletsDrawn() const { return mNbMeshletsDrawn; }
+
+    /// Submit the meshlets intersecting "frustum" and not back-facing from
+    /// "eye" to "queue". Both are expressed in the frame of the mesh.
+    /// The ranges of the multi draw live in the arena of the queue.
+    void submitClustersGL(RenderQueue& queue, uint64_t key, const Frustum& frustum, const glm::vec3& eye)
+    {
+        if (mVertexArrayObject == 0 || mMeshlets.empty()) {
+            submitGL(queue, key);
+            return;
+        }
+
+        // Consecutive visible meshlets are merged into one range
+        GLsizei* counts = queue.arena().allocateArray<GLsizei>(mMeshlets.size());
+        const GLvoid** offsets = queue.arena().allocateArray<const GLvoid*>(mMeshlets.size());
+        GLsizei nbRanges = 0;
+        mNbMeshletsDrawn = 0;
+        int end = -1;
+        for (unsigned i = 0; i < mMeshlets.size(); ++i) {
+            const Loaders::Meshlet& m = mMeshlets[i];
+            if (!frustum.intersectsSphere(m.center, m.radius) || m.isBackFacing(eye))
+                continue;
+            ++mNbMeshletsDrawn;
+            if (m.firstIndex == end)
+                counts[nbRanges - 1] += 3 * m.nbTriangles;
+            else {
+                counts[nbRanges] = 3 * m.nbTriangles;
+                offsets[nbRanges] = (const GLvoid*)(m.firstIndex * sizeof(GLuint));
+                ++nbRanges;
+            }
+            end = m.firstIndex + 3 * m.nbTriangles;
+        }
+        if (nbRanges == 0)
+            return;
+
+        if (mClusterIndexBuffer == 0)
+            mClusterIndexBuffer = uploadIndices(mClusterIndices);
+
+        DrawPacket& p = queue.submit(key);
+        p.vertexArray = mVertexArrayObject;
+        p.vaoIndexBuffer = mVertexBufferObjects[VBO_INDICES];
+        p.indexBuffer = mClusterIndexBuffer;
+        p.mode = GL_TRIANGLES;
+        p.drawCount = nbRanges;
+        p.counts = counts;
+        p.offsets = offsets;
+    }
+
+    ~MyClusteredGLMesh()
+    {
+        if (mClusterIndexBuffer != 0) {
+            GlState::current().forget_buffer(mClusterIndexBuffer);
+            glAssert(glDeleteBuffers(1, &mClusterIndexBuffer));
+        }
+    }
+
+private:
+    std::vector<Loaders::Meshlet> mMeshlets;
+    /// Triangles in meshlet order, released once uploaded
+    std::vector<unsigned int> mClusterIndices;
+    GLuint mClusterIndexBuffer;
+    int mNbMeshletsDrawn;
+};
+
+// -----------------------------------------------------------------------------
+
 /// Load (from file) and upload to GPU (compile) the various meshes of our scene.
 /// (Called once when the application is launched)
 void Renderer::initGeometry()
@@ -577,6 +989,8 @@ void Renderer::initGeometry()
 
     // 2 - Convert the list of meshes to "MyGLMesh"
     // (use this->mMeshes to store the converted objects)
+    // Very dense meshes can be converted to "MyClusteredGLMesh" instead so
+    // that their hidden parts are culled.
 
     // 3 - Upload to GPU with ".compileGL()"
 
@@ -586,8 +1000,22 @@ void Renderer::initGeometry()
 
 // -----------------------------------------------------------------------------
 
+glm::mat4 Renderer::projectionMatrix() const
+{
+    return glm::perspective(mFieldOfView, float(mWidth) / float(mHeight), mZNear, mZFar);
+}
+
+// -----------------------------------------------------------------------------
+
 void Renderer::draw_list_mesh()
 {
+    // Meshes culled then drawn sorted by state (see drawVisibleMeshes()),
+    // the 'q' key switches to the lab code below
+    if (mUseRenderQueue) {
+        drawVisibleMeshes();
+        return;
+    }
+
     // #########################################################################
     // LAB 1 / PARTIE II: 
 
@@ -602,6 +1030,397 @@ void Renderer::draw_list_mesh()
 
 // -----------------------------------------------------------------------------
 
+void Renderer::drawVisibleMeshes()
+{
+    // Camera position and size in pixels of one unit seen at distance 1,
+    // used to pick the level of detail of the dense meshes
+    const glm::vec3 eye = glm::vec3(glm::inverse(mViewMatrix)[3]);
+    const float pixelsPerUnit = mHeight / (2.f * std::tan(glm::radians(mFieldOfView) * 0.5f));
+    // The model matrix is the identity: the frustum is in the frame of the meshes
+    const Frustum frustum(projectionMatrix() * mViewMatrix);
+
+    // Meshes entirely outside the frustum are skipped. The flat SIMD loop
+    // beats the scene hierarchy at every scene size ("-cull" benchmark of
+    // minimal_renderer_headless), which is only used for picking.
+    if (mCuller == 0 || mCuller->size() != (int)mMeshes.size())
+        updateMeshBounds();
+    mFrameStats.nbDrawn = mCuller->cull(frustum, mVisible);
+    mFrameStats.nbCulled = (int)mMeshes.size() - mFrameStats.nbDrawn;
+
+    // Visible meshes are queued then drawn sorted by state: meshes sharing
+    // a VAO are drawn together, front to back
+    if (mQueue == 0)
+        mQueue = new RenderQueue();
+    mQueue->clear();
+    const unsigned program = mProgram > 0 ? (unsigned)mProgram : 0;
+
+    // Meshes without levels of detail nor meshlets live in a single arena
+    // (see moveToArena()) and are all drawn by one multi draw
+    const bool useArena = mUseMeshArena && mMeshArena != 0;
+    int* handles = 0;
+    int nbCommands = 0;
+    float nearest = std::numeric_limits<float>::max();
+    if (useArena)
+        handles = mQueue->arena().allocateArray<int>(mMeshes.size());
+    for (unsigned i = 0; i < mMeshes.size(); ++i) {
+        // Meshes having instances are only drawn through them
+        if (!mVisible[i] || (i < mInstances.size() && !mInstances[i].empty()))
+            continue;
+        MyGLMesh* mesh = mMeshes[i];
+        const glm::vec3 center = (mesh->boundsMin() + mesh->boundsMax()) * 0.5f;
+        const float depth = -(mViewMatrix * glm::vec4(center, 1.f)).z;
+        const uint64_t key = RenderQueue::makeKey(0, program, mesh->vertexArray(), depth);
+        if (MyClusteredGLMesh* clustered = dynamic_cast<MyClusteredGLMesh*>(mesh))
+            clustered->submitClustersGL(*mQueue, key, frustum, eye);
+        else if (mesh->hasLods()) {
+            mesh->lods().select(eye, pixelsPerUnit);
+            mesh->submitLodGL(*mQueue, key);
+        }
+        else if (useArena && mesh->arenaHandle() >= 0) {
+            handles[nbCommands++] = mesh->arenaHandle();
+            nearest = std::min(nearest, depth);
+        }
+        else
+            mesh->submitGL(*mQueue, key);
+    }
+    if (nbCommands > 0) {
+        DrawElementsIndirectCommand* commands = mQueue->arena().allocateArray<DrawElementsIndirectCommand>(nbCommands);
+        for (int c = 0; c < nbCommands; ++c)
+            commands[c] = mMeshArena->command(handles[c]);
+        DrawPacket& p = mQueue->submit(RenderQueue::makeKey(0, program, mMeshArena->get_vao(), nearest));
+        p.mode = GL_TRIANGLES;
+        p.meshArena = mMeshArena;
+        p.commands = commands;
+        p.drawCount = nbCommands;
+    }
+    submitInstances(frustum);
+    mQueue->sort();
+    mQueue->execute(GlState::current());
+    if (mInstanceRing != 0)
+        mInstanceRing->fence();
+}
+
+// -----------------------------------------------------------------------------
+
+int Renderer::addInstance(int mesh, const glm::mat4& modelMatrix, const glm::vec4& color)
+{
+    MeshInstance instance;
+    instance.modelMatrix = modelMatrix;
+    instance.color = color;
+    std::vector<MeshInstance>& list = instances(mesh);
+    list.push_back(instance);
+    return (int)list.size() - 1;
+}
+
+// -----------------------------------------------------------------------------
+
+std::vector<MeshInstance>& Renderer::instances(int mesh)
+{
+    if (mesh >= (int)mInstances.size())
+        mInstances.resize(mesh + 1);
+    return mInstances[mesh];
+}
+
+// -----------------------------------------------------------------------------
+
+/// Texture unit of the buffer texture holding the instances
+const int INSTANCE_TEXTURE_UNIT = 7;
+
+void Renderer::submitInstances(const Frustum& frustum)
+{
+    mFrameStats.nbInstancesDrawn = mFrameStats.nbInstancesCulled = 0;
+    int nbInstances = 0;
+    for (unsigned i = 0; i < mInstances.size() && i < mMeshes.size(); ++i)
+        nbInstances += (int)mInstances[i].size();
+    if (nbInstances == 0 || mProgram <= 0 || mInstanceBaseLocation < 0 || mInstanceBufferLocation < 0)
+        return;
+
+    // Ranges never straddle the end of the ring, so a frame may need up to
+    // twice its instances. The ring can't exceed the size of a buffer
+    // texture: compare with the clamped size or it would be rebuilt every
+    // frame.
+    if (mInstanceRing == 0 || mInstanceRing->capacity() < std::min(2 * nbInstances, mMaxInstanceCapacity))
+        allocInstanceBuffer(nbInstances);
+    // Instances split in draws of at most half the ring: with a clamped ring
+    // a mesh with too many instances still gets the ranges fitting in it
+    const int maxPerDraw = std::max(1, mInstanceRing->capacity() / 2);
+
+    GlState::current().use_program(mProgram);
+    glAssert(glUniform1i(mInstanceBufferLocation, INSTANCE_TEXTURE_UNIT));
+    glAssert(glActiveTexture(GL_TEXTURE0 + INSTANCE_TEXTURE_UNIT));
+    glAssert(glBindTexture(GL_TEXTURE_BUFFER, mInstanceTexture));
+    glAssert(glActiveTexture(GL_TEXTURE0));
+
+    for (unsigned m = 0; m < mInstances.size() && m < mMeshes.size(); ++m) {
+        const std::vector<MeshInstance>& instances = mInstances[m];
+        MyGLMesh* mesh = mMeshes[m];
+        if (instances.empty() || (mesh->vertexArray() == 0 && mesh->arenaHandle() < 0))
+            continue;
+        const glm::vec3 center = (mesh->boundsMin() + mesh->boundsMax()) * 0.5f;
+        for (int begin = 0; begin < (int)instances.size(); begin += maxPerDraw)
+            submitInstanceRange(frustum, m, center, begin, std::min((int)instances.size() - begin, maxPerDraw));
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::submitInstanceRange(const Frustum& frustum, int m, const glm::vec3& center, int begin, int size)
+{
+    const std::vector<MeshInstance>& instances = mInstances[m];
+    MyGLMesh* mesh = mMeshes[m];
+    const int first = mInstanceRing->alloc(size);
+    if (first < 0) {
+        // The instances of the frame don't fit in a ring limited by
+        // GL_MAX_TEXTURE_BUFFER_SIZE
+        mFrameStats.nbInstancesCulled += size;
+        return;
+    }
+
+    // The visible instances are written in a row, the end of the range is
+    // left unused
+    InstanceTexels* visible = (InstanceTexels*)mInstanceRing->map(first, size);
+    int nbVisible = 0;
+    float nearest = std::numeric_limits<float>::max();
+    for (int i = begin; i < begin + size; ++i) {
+        const glm::mat4& model = instances[i].modelMatrix;
+        const glm::vec3 c = glm::vec3(model * glm::vec4(center, 1.f));
+        const float scale = std::max(glm::length(glm::vec3(model[0])),
+                                     std::max(glm::length(glm::vec3(model[1])),
+                                              glm::length(glm::vec3(model[2]))));
+        if (!frustum.intersectsSphere(c, mesh->boundsRadius() * scale))
+            continue;
+        InstanceTexels& texels = visible[nbVisible++];
+        texels.modelMatrix = model;
+        const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+        for (int col = 0; col < 3; ++col)
+            texels.normalMatrix[col] = glm::vec4(normalMatrix[col], 0.f);
+        texels.color = instances[i].color;
+        nearest = std::min(nearest, -(mViewMatrix * glm::vec4(c, 1.f)).z);
+    }
+    mInstanceRing->flush(first, size);
+    mFrameStats.nbInstancesDrawn += nbVisible;
+    mFrameStats.nbInstancesCulled += size - nbVisible;
+    if (nbVisible == 0)
+        return;
+
+    const uint64_t key = RenderQueue::makeKey(0, mProgram, mesh->vertexArray(), nearest);
+    mesh->submitInstancedGL(*mQueue, key, mProgram, mInstanceBaseLocation, first, nbVisible);
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::allocInstanceBuffer(int nbInstances)
+{
+    if (mMaxInstanceCapacity == 0) {
+        GLint maxTexels = 0;
+        glAssert(glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels));
+        const int texelsPerInstance = sizeof(InstanceTexels) / sizeof(glm::vec4);
+        mMaxInstanceCapacity = std::max(1, maxTexels / texelsPerInstance);
+    }
+    // Room for a few frames: the GPU still reads the last ones while the
+    // next one is written
+    const int capacity = std::min(4 * nbInstances, mMaxInstanceCapacity);
+
+    delete mInstanceRing;
+    GlRing_backend* backend = new GlRing_backend_gl(capacity * (int)sizeof(InstanceTexels));
+    mInstanceRing = new GlRing_buffer(backend, capacity, sizeof(InstanceTexels));
+
+    if (mInstanceTexture == 0) {
+        glAssert(glGenTextures(1, &mInstanceTexture));
+    }
+    glAssert(glBindTexture(GL_TEXTURE_BUFFER, mInstanceTexture));
+    glAssert(glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, mInstanceRing->get_id()));
+    glAssert(glBindTexture(GL_TEXTURE_BUFFER, 0));
+}
+
+// -----------------------------------------------------------------------------
+
+bool Renderer::queueMesh(Loaders::Mesh* mesh, unsigned loadId)
+{
+    return mPendingMeshes.push(mesh, loadId);
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::cancelLoad(unsigned loadId)
+{
+    mPendingMeshes.cancelLoad(loadId);
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::uploadPendingMeshes()
+{
+    mFrameStats.nbBytesUploaded = 0;
+    finishUploads();
+    if (mUploadStream != 0 && mUploadStream->has_failed()) {
+        // Failed meshes are compiled by finishUploads(), the next ones here
+        mUploadStream = 0;
+    }
+    mPendingMeshes.beginFrame();
+    while (Loaders::Mesh* loaded = mPendingMeshes.pop()) {
+        MyGLMesh* mesh = new MyGLMesh(std::move(*loaded));
+        delete loaded;
+        // Counted by mPendingMeshes, handed to the stream or not
+        mFrameStats.nbBytesUploaded = mPendingMeshes.nbBytes();
+        if (mUploadStream != 0 && mesh->nbVertices() > 0 && mesh->nbTriangles() > 0) {
+            // Filled by the thread of the stream, see finishUploads()
+            mUploadingMeshes.push_back(mesh->streamGL(*mUploadStream));
+            continue;
+        }
+        addUploadedMesh(mesh);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::finishUploads()
+{
+    // The stream uploads in order: the meshes are added in the order they
+    // were queued
+    unsigned nbReady = 0;
+    while (nbReady < mUploadingMeshes.size()) {
+        UploadingMesh* u = mUploadingMeshes[nbReady];
+        if (u->vertices->has_failed() || u->indices->has_failed()) {
+            // The thread of the stream could not run: uploaded from here by
+            // addUploadedMesh()
+        }
+        else if (u->vertices->is_ready() && u->indices->is_ready())
+            u->mesh->compileGL(u->vertices->release_buffer(), u->indices->release_buffer());
+        else
+            break;
+        addUploadedMesh(u->mesh);
+        delete u->vertices;
+        delete u->indices;
+        delete u;
+        ++nbReady;
+    }
+    mUploadingMeshes.erase(mUploadingMeshes.begin(), mUploadingMeshes.begin() + nbReady);
+    mFrameStats.nbUploading = (int)mUploadingMeshes.size();
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::addUploadedMesh(MyGLMesh* mesh)
+{
+    // Buffers of its own unless only drawn from the arena
+    if (!moveToArena(mesh) && mesh->vertexArray() == 0)
+        mesh->compileGL();
+    mMeshes.push_back(mesh);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Meshes simplified by buildMeshLods(): simplification is only worth it for
+/// dense meshes
+const int MIN_LOD_TRIANGLES = 20000;
+
+bool Renderer::moveToArena(MyGLMesh* mesh)
+{
+    // Levels of detail and meshlets draw with index buffers of their own
+    if (!mUseMeshArena || mesh->hasLods() || mesh->nbTriangles() >= MIN_LOD_TRIANGLES
+        || dynamic_cast<MyClusteredGLMesh*>(mesh) != 0)
+        return false;
+    if (mMeshArena == 0)
+        mMeshArena = MyGLMesh::createArena();
+    if (mesh->addToArena(*mMeshArena) < 0)
+        return false;
+    mesh->releaseGL();
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::buildMeshLods()
+{
+    std::vector<const Loaders::Mesh*> meshes;
+    std::vector<MyGLMesh*> denseMeshes;
+    for (unsigned i = 0; i < mMeshes.size(); ++i) {
+        if (mMeshes[i]->nbTriangles() >= MIN_LOD_TRIANGLES) {
+            meshes.push_back(mMeshes[i]);
+            denseMeshes.push_back(mMeshes[i]);
+        }
+    }
+
+    std::vector<std::vector<Loaders::MeshLod> > chains;
+    Loaders::MeshSimplifier::buildLodChains(meshes, chains);
+    for (unsigned i = 0; i < denseMeshes.size(); ++i)
+        denseMeshes[i]->setLods(chains[i]);
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::updateMeshBounds()
+{
+    if (mCuller == 0)
+        mCuller = new BoundsCuller();
+    if (mBvh == 0)
+        mBvh = new SceneBvh();
+
+    std::vector<glm::vec3> bmin(mMeshes.size()), bmax(mMeshes.size());
+    mCuller->clear();
+    for (unsigned i = 0; i < mMeshes.size(); ++i) {
+        bmin[i] = mMeshes[i]->boundsMin();
+        bmax[i] = mMeshes[i]->boundsMax();
+        mCuller->add(bmin[i], bmax[i], mMeshes[i]->boundsRadius());
+    }
+    mBvh->build(bmin, bmax);
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::refitMeshBounds(int i)
+{
+    if (mCuller == 0 || mCuller->size() != (int)mMeshes.size()) {
+        updateMeshBounds();
+        return;
+    }
+    MyGLMesh* mesh = mMeshes[i];
+    mesh->computeBounds();
+    // Copied again in the arena by the next draw_list_mesh()
+    mesh->removeFromArena();
+    mCuller->set(i, mesh->boundsMin(), mesh->boundsMax(), mesh->boundsRadius());
+    mBvh->updateObject(i, mesh->boundsMin(), mesh->boundsMax());
+}
+
+// -----------------------------------------------------------------------------
+
+int Renderer::pick(int x, int y, Loaders::RayHit* hit)
+{
+    if (mBvh == 0 || mBvh->nbObjects() != (int)mMeshes.size())
+        updateMeshBounds();
+
+    // Ray through the pixel, from the near to the far plane
+    const glm::mat4 inverseViewProjection = glm::inverse(projectionMatrix() * mViewMatrix);
+    const float ndcX = 2.f * (x + 0.5f) / mWidth - 1.f;
+    const float ndcY = 1.f - 2.f * (y + 0.5f) / mHeight;
+    glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, -1.f, 1.f);
+    glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, 1.f, 1.f);
+    const glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+    const glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - origin;
+
+    // Triangles of the meshes whose box is hit (hierarchies built on first use)
+    const Loaders::Ray ray(origin, direction);
+    Loaders::RayHit closest;
+    float t;
+    int picked = mBvh->raycast(origin, direction, t, [&](int i, float& distance) {
+        MyGLMesh* mesh = mMeshes[i];
+        if (!mesh->hasBvh())
+            mesh->buildBvh();
+        Loaders::RayHit meshHit;
+        if (!mesh->intersect(ray, meshHit) || meshHit.distance >= distance)
+            return false;
+        distance = meshHit.distance;
+        closest = meshHit;
+        return true;
+    });
+    if (hit)
+        *hit = closest;
+    return picked;
+}
+
+// -----------------------------------------------------------------------------
+
 int Renderer::handleMouseEvent(const MouseEvent& event)
 {
     //static int modifiers = 0;
@@ -610,6 +1429,12 @@ int Renderer::handleMouseEvent(const MouseEvent& event)
     static int y = 0;
     static int button = 0;
 
+    // Ctrl + left click selects the mesh under the cursor, see pickedMesh()
+    if (event.click && event.button == MouseEvent::LEFT && (event.modifiers & MouseEvent::CONTROL)) {
+        mPickedMesh = pick(event.x, event.y, &mPickedHit);
+        return 1;
+    }
+
     if (event.click) {
         x = event.x;
         y = event.y;
@@ -679,7 +1504,7 @@ void Renderer::setViewport(int width, int height)
 {
     mWidth = width;
     mHeight = height;
-    glAssert(glViewport(0, 0, mWidth, mHeight));
+    GlState::current().viewport(0, 0, mWidth, mHeight);
 }
 
 // -----------------------------------------------------------------------------
@@ -689,10 +1514,16 @@ int Renderer::handleKeyEvent(char key)
 
     switch (key) {
     case 'w':
-        glAssert(glPolygonMode(GL_FRONT_AND_BACK, GL_LINE));
+        GlState::current().polygon_mode(GL_LINE);
         break;
     case 'f':
-        glAssert(glPolygonMode(GL_FRONT_AND_BACK, GL_FILL));
+        GlState::current().polygon_mode(GL_FILL);
+        break;
+    case 'a':
+        mUseMeshArena = !mUseMeshArena;
+        break;
+    case 'q':
+        mUseRenderQueue = !mUseRenderQueue;
         break;
     }
     return 1;
@@ -704,9 +1535,26 @@ Renderer::~Renderer()
 {
     for (unsigned i = 0; i < mMeshes.size(); ++i)
         delete mMeshes[i];
+    mPendingMeshes.clear();
+    // The upload stream is stopped (see setUploadStream())
+    for (unsigned i = 0; i < mUploadingMeshes.size(); ++i) {
+        delete mUploadingMeshes[i]->vertices;
+        delete mUploadingMeshes[i]->indices;
+        delete mUploadingMeshes[i]->mesh;
+        delete mUploadingMeshes[i];
+    }
 
     clearShaders();
     delete mDummyObject;
+    delete mCuller;
+    delete mBvh;
+    delete mQueue;
+    delete mInstanceRing;
+    // After the meshes, which remove themselves from it
+    delete mMeshArena;
+    if (mInstanceTexture != 0) {
+        glAssert(glDeleteTextures(1, &mInstanceTexture));
+    }
 }
 
 // -----------------------------------------------------------------------------
@@ -754,6 +1602,9 @@ void Renderer::init_dummy_object()
         }
     }
     mDummyObject->end();
+
+    // Merge the blocks of each drawing mode: one draw call per mode
+    mDummyObject->compile();
 }
 
 // -----------------------------------------------------------------------------
@@ -21,11 +21,27 @@
 
 #include "gl_utils/opengl.h"
 #include "gl_utils/gldirect_draw.h"
+#include "gl_utils/glstate.h"
 #include "fileloaders/objloader.h"
 #include "fileloaders/fileloader.h"
+#include "fileloaders/meshsimplifier.h"
+#include "fileloaders/meshlet.h"
+#include "lodselector.h"
+#include "frustum.h"
+#include "boundsculler.h"
+#include "scenebvh.h"
+#include "renderqueue.h"
+#include "gl_utils/glring_buffer.h"
+#include "gl_utils/glmesh_arena.h"
+#include "gl_utils/glupload_stream.h"
 
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtc/matrix_access.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <limits>
 
 /** @defgroup RendererGlobalFunctions
   * @author Mathias Paulin <Mathias.Paulin@irit.fr>
@@ -71,6 +87,10 @@ void Renderer::initRessources()
 
 
     initGeometry(); // TP 1 / PARTIE II: Loading or building geometric data.
+    buildMeshLods();
+    for (unsigned i = 0; i < mMeshes.size(); ++i)
+        moveToArena(mMeshes[i]);
+    updateMeshBounds();
 }
 
 //------------------------------------------------------------------------------
@@ -232,6 +252,14 @@ void Renderer::initShaders()
     // #####################################
     // TP 1 / PARTIE I: Fin du code à écrire
     // #####################################
+
+    // Uniforms de vertexdefault.glsl lisant les instances (voir
+    // submitInstances()), cherchées une fois le programme lié
+    mInstanceBaseLocation = mInstanceBufferLocation = -1;
+    if (mProgram > 0) {
+        glAssert(mInstanceBaseLocation = glGetUniformLocation(mProgram, "instanceBase"));
+        glAssert(mInstanceBufferLocation = glGetUniformLocation(mProgram, "instanceBuffer"));
+    }
 }
 
 //------------------------------------------------------------------------------
@@ -309,6 +337,13 @@ void Renderer::render()
 // TP 1 / PARTIE I:Fin du code à écrire
 // ####################################
 
+    // Les appels OpenGL ajoutés ci-dessus court-circuitent GlState
+    // (glUseProgram()...)
+    GlState::current().invalidate();
+
+    // Maillages chargés en arrière plan (voir queueMesh())
+    uploadPendingMeshes();
+
 // #################
 // TP 1 / PARTIE II:
 // #################
@@ -323,6 +358,12 @@ void Renderer::render()
     // #####################################
     // TP 1 / PARTIE II:Fin du code à écrire
     // #####################################
+
+    // Changements d'états GL de la frame (voir GlState)
+    GlState& state = GlState::current();
+    mFrameStats.nbStateChanges = state.nb_issued();
+    mFrameStats.nbStateSkipped = state.nb_skipped();
+    state.reset_counters();
 }
 
  /**
@@ -330,7 +371,7 @@ void Renderer::render()
   * A mesh with OpenGL rendering capabilities.
   */
 class MyGLMesh : public Loaders::Mesh {
-private:
+protected:
     /// Identifiant OpenGL du Vertex Array Object (VAO) du maillage
     GLuint mVertexArrayObject;
 
@@ -338,6 +379,25 @@ private:
     /// N.B: utilisez VBO_VERTICES et VBO_INDICES pour accéder au tableau
     GLuint mVertexBufferObjects[2];
 
+    /// Niveaux de détail du maillage (voir setLods())
+    LodSelector mLods;
+    /// Index buffer contenant tous les niveaux de détail (0 avant submitLodGL())
+    GLuint mLodIndexBuffer;
+    /// Indices des niveaux en attente d'upload
+    std::vector<unsigned int> mLodIndices;
+
+    /// Buffers partagés contenant une copie du maillage (voir addToArena())
+    GlMesh_arena* mArena;
+    int mArenaHandle;
+    /// Vrai quand les VBOs contiennent des Loaders::Mesh::Vertex (voir
+    /// compileGL(GLuint, GLuint)), addToArena() les copie alors sur le GPU
+    bool mInterleavedBuffers;
+
+    /// Boîte englobante et sphère englobante (centrée sur la boîte) du maillage
+    glm::vec3 mBoundsMin;
+    glm::vec3 mBoundsMax;
+    float mBoundsRadius;
+
     /// Index pour accéder mVertexBufferObjects[]
     enum { VBO_VERTICES = 0,
            VBO_INDICES = 1 };
@@ -345,7 +405,27 @@ private:
 public:
     MyGLMesh(const Loaders::Mesh& mesh)
         : Loaders::Mesh(mesh)
+        , mVertexArrayObject(0)
+        , mLodIndexBuffer(0)
+        , mArena(0)
+        , mArenaHandle(-1)
+        , mInterleavedBuffers(false)
     {
+        mVertexBufferObjects[VBO_VERTICES] = mVertexBufferObjects[VBO_INDICES] = 0;
+        computeBounds();
+    }
+
+    /// "mesh" est vidé
+    MyGLMesh(Loaders::Mesh&& mesh)
+        : Loaders::Mesh(std::move(mesh))
+        , mVertexArrayObject(0)
+        , mLodIndexBuffer(0)
+        , mArena(0)
+        , mArenaHandle(-1)
+        , mInterleavedBuffers(false)
+    {
+        mVertexBufferObjects[VBO_VERTICES] = mVertexBufferObjects[VBO_INDICES] = 0;
+        computeBounds();
     }
 
     MyGLMesh(const std::vector<float>& vertexBuffer,
@@ -357,7 +437,14 @@ public:
                         std::vector<int>(),
                         hasNormals,
                         hasTextureCoords)
+        , mVertexArrayObject(0)
+        , mLodIndexBuffer(0)
+        , mArena(0)
+        , mArenaHandle(-1)
+        , mInterleavedBuffers(false)
     {
+        mVertexBufferObjects[VBO_VERTICES] = mVertexBufferObjects[VBO_INDICES] = 0;
+        computeBounds();
     }
 
     /**
@@ -448,11 +535,21 @@ public:
         // Un bind sur l'index 0 est en fait un 'unBind()' garantissant qu'aucun
         // buffer n'est activé
         glAssert(glBindVertexArray(0));
+        // Le code ci-dessus fait des bind OpenGL directs : oublier les états en cache
+        GlState::current().invalidate();
 }
 
 /// Draws the VertexArrayObjects (VAO "mVertexArrayObject") of the mesh.
 void drawGL()
 {
+    // Les maillages déplacés dans l'arène n'ont plus de VAO à eux (voir
+    // Renderer::moveToArena())
+    if (mVertexArrayObject == 0 && mArena != 0) {
+        const DrawElementsIndirectCommand command = mArena->command(mArenaHandle);
+        mArena->draw(GlState::current(), GL_TRIANGLES, &command, 1);
+        return;
+    }
+
     // Affiche le maillage chargé en mémoire vidéo en utilisant le VAO
 
     // ########################################
@@ -472,6 +569,233 @@ void drawGL()
     // ######################################
 }
 
+/// Remplace les niveaux de détail du maillage.
+/// Le niveau 0 doit être le maillage lui-même.
+void setLods(const std::vector<Loaders::MeshLod>& lods)
+{
+    mLods.set(lods, mLodIndices, (mBoundsMin + mBoundsMax) * 0.5f, mBoundsRadius);
+}
+
+/// Englobants calculés à la construction du maillage (voir computeBounds())
+const glm::vec3& boundsMin() const { return mBoundsMin; }
+const glm::vec3& boundsMax() const { return mBoundsMax; }
+float boundsRadius() const { return mBoundsRadius; }
+
+/// Met à jour les englobants après une modification des sommets
+void computeBounds()
+{
+    boundingBox(mBoundsMin, mBoundsMax);
+    glm::vec3 center;
+    boundingSphere(center, mBoundsRadius);
+}
+
+bool hasLods() const { return mLods.nbLevels() > 1; }
+
+LodSelector& lods() { return mLods; }
+
+/// Identifiant OpenGL du VAO construit par compileGL()
+GLuint vertexArray() const { return mVertexArrayObject; }
+
+/// Ajoute drawGL() à "queue". Elle est rappelée avec ses appels OpenGL
+/// directs à l'exécution de la file.
+void submitGL(RenderQueue& queue, uint64_t key)
+{
+    queue.submitCallback(key, &MyGLMesh::drawCallback, this);
+}
+
+/// Ajoute à "queue" le niveau de détail choisi dans #lods().
+/// Utilise les sommets du VAO construit par compileGL() avec son propre
+/// index buffer, envoyé au GPU à la première utilisation.
+void submitLodGL(RenderQueue& queue, uint64_t key)
+{
+    if (mVertexArrayObject == 0 || !hasLods()) {
+        submitGL(queue, key);
+        return;
+    }
+    if (mLodIndexBuffer == 0)
+        mLodIndexBuffer = uploadIndices(mLodIndices);
+
+    const LodSelector::Range& r = mLods.range(mLods.current());
+    DrawPacket& p = queue.submit(key);
+    p.vertexArray = mVertexArrayObject;
+    p.vaoIndexBuffer = mVertexBufferObjects[VBO_INDICES];
+    p.indexBuffer = mLodIndexBuffer;
+    p.mode = GL_TRIANGLES;
+    p.count = r.nbIndices;
+    p.offset = (const GLvoid*)(r.firstIndex * sizeof(GLuint));
+}
+
+/// Ajoute à "queue" "count" instances du maillage entier. Le shader
+/// "program" les lit à partir de l'instance "first", voir Renderer::addInstance()
+void submitInstancedGL(RenderQueue& queue, uint64_t key, GLuint program,
+                       GLint instanceBaseLocation, int first, int count)
+{
+    DrawPacket& p = queue.submit(key);
+    p.program = program;
+    p.instanceCount = count;
+    p.instanceBase = first;
+    p.instanceBaseLocation = instanceBaseLocation;
+    if (mVertexArrayObject == 0 && mArena != 0) {
+        // Seulement dans l'arène : une commande dessinant toutes les instances
+        DrawElementsIndirectCommand* command = queue.arena().allocateArray<DrawElementsIndirectCommand>(1);
+        *command = mArena->command(mArenaHandle);
+        command->instance_count = count;
+        p.mode = GL_TRIANGLES;
+        p.meshArena = mArena;
+        p.commands = command;
+        p.drawCount = 1;
+        return;
+    }
+    p.vertexArray = mVertexArrayObject;
+    p.vaoIndexBuffer = mVertexBufferObjects[VBO_INDICES];
+    p.mode = GL_TRIANGLES;
+    p.count = 3 * nbTriangles();
+}
+
+/// Construit le VAO du maillage autour de buffers déjà remplis avec ses
+/// sommets, organisés comme Loaders::Mesh::Vertex, et ses triangles, par
+/// exemple par streamGL(). Le maillage possède les buffers désormais.
+void compileGL(GLuint vertexBuffer, GLuint indexBuffer)
+{
+    mVertexBufferObjects[VBO_VERTICES] = vertexBuffer;
+    mVertexBufferObjects[VBO_INDICES] = indexBuffer;
+    mInterleavedBuffers = true;
+
+    GlState& state = GlState::current();
+    glAssert(glGenVertexArrays(1, &mVertexArrayObject));
+    state.bind_vertex_array(mVertexArrayObject);
+    state.bind_buffer(GL_ARRAY_BUFFER, vertexBuffer);
+    // Mêmes indices d'attributs que createArena()
+    glAssert(glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, position)));
+    glAssert(glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, normal)));
+    glAssert(glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, texcoord)));
+    glAssert(glEnableVertexAttribArray(0));
+    glAssert(glEnableVertexAttribArray(1));
+    glAssert(glEnableVertexAttribArray(2));
+    state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+    state.bind_vertex_array(0);
+    // Le VAO mémorise le buffer d'indices, pas celui des sommets
+    state.bind_buffer(GL_ARRAY_BUFFER, 0);
+}
+
+/// Met en file les sommets et triangles du maillage dans "stream", qui
+/// remplit de nouveaux buffers dans son propre thread. Une fois les deux
+/// transferts prêts leurs buffers sont donnés à compileGL(GLuint, GLuint).
+/// @return transferts à interroger, les données du maillage ne doivent pas
+/// changer entre temps
+UploadingMesh* streamGL(GlUpload_stream& stream)
+{
+    UploadingMesh* u = new UploadingMesh;
+    u->mesh = this;
+    const void* vertices = &mVertices[0];
+    if (mLayout != INTERLEAVED) {
+        std::vector<int> triangles;
+        bool parametrized;
+        getData(u->vertexData, triangles, parametrized);
+        vertices = &u->vertexData[0];
+    }
+    u->vertices = new GlUpload(vertices, mNbVertices * sizeof(Vertex));
+    u->indices = new GlUpload(&mTriangles[0].indexes[0], 3 * mNbTriangles * sizeof(GLuint));
+    stream.push(u->vertices);
+    stream.push(u->indices);
+    return u;
+}
+
+/// Arène dont les sommets sont organisés comme Loaders::Mesh::Vertex,
+/// avec les indices d'attributs de compileGL() : position 0, normale 1 et
+/// coordonnées de texture 2
+static GlMesh_arena* createArena()
+{
+    GlMesh_arena* arena = new GlMesh_arena(sizeof(Vertex));
+    arena->set_attribute(0, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, position));
+    arena->set_attribute(1, 3, GL_FLOAT, GL_FALSE, offsetof(Vertex, normal));
+    arena->set_attribute(2, 2, GL_FLOAT, GL_FALSE, offsetof(Vertex, texcoord));
+    return arena;
+}
+
+/// Copie le maillage dans "arena" construite par createArena(), sauf si
+/// c'est déjà fait
+/// @return identifiant du maillage dans "arena", -1 si le maillage est vide
+int addToArena(GlMesh_arena& arena)
+{
+    if (mArena == &arena)
+        return mArenaHandle;
+    removeFromArena();
+    if (mNbVertices == 0 || mNbTriangles == 0)
+        return -1;
+
+    const GLuint* indices = &mTriangles[0].indexes[0];
+    if (mInterleavedBuffers)
+        // Copie faite sur le GPU sans relire les sommets
+        mArenaHandle = arena.add(mVertexBufferObjects[VBO_VERTICES], mNbVertices,
+                                 mVertexBufferObjects[VBO_INDICES], 3 * mNbTriangles);
+    else if (mLayout == INTERLEAVED)
+        mArenaHandle = arena.add(&mVertices[0], mNbVertices, indices, 3 * mNbTriangles);
+    else {
+        std::vector<float> vertices;
+        std::vector<int> triangles;
+        bool parametrized;
+        getData(vertices, triangles, parametrized);
+        mArenaHandle = arena.add(&vertices[0], mNbVertices, indices, 3 * mNbTriangles);
+    }
+    mArena = &arena;
+    return mArenaHandle;
+}
+
+/// Libère la copie du maillage faite par addToArena(), par exemple quand
+/// ses sommets ont changé
+void removeFromArena()
+{
+    if (mArena == 0)
+        return;
+    mArena->remove(mArenaHandle);
+    mArena = 0;
+    mArenaHandle = -1;
+}
+
+/// Handle du maillage dans l'arène de addToArena(), -1 s'il n'y est pas
+int arenaHandle() const { return mArenaHandle; }
+
+/// Supprime le VAO et les buffers du maillage, par exemple une fois copié
+/// dans une arène qui le dessine alors. Les sommets et les triangles restent
+/// sur le CPU pour la sélection et les niveaux de détail.
+void releaseGL()
+{
+    GlState& state = GlState::current();
+    if (mVertexArrayObject != 0) {
+        state.forget_vertex_array(mVertexArrayObject);
+        glAssert(glDeleteVertexArrays(1, &mVertexArrayObject));
+        mVertexArrayObject = 0;
+    }
+    for (int i = 0; i <= VBO_INDICES; ++i) {
+        if (mVertexBufferObjects[i] == 0)
+            continue;
+        state.forget_buffer(mVertexBufferObjects[i]);
+        glAssert(glDeleteBuffers(1, &mVertexBufferObjects[i]));
+        mVertexBufferObjects[i] = 0;
+    }
+    mInterleavedBuffers = false;
+}
+
+protected:
+/// Envoie "indices" dans un nouvel index buffer puis les libère
+static GLuint uploadIndices(std::vector<unsigned int>& indices)
+{
+    GLuint id = 0;
+    glAssert(glGenBuffers(1, &id));
+    // Contrairement à GL_ELEMENT_ARRAY_BUFFER cette cible n'est pas
+    // enregistrée dans le VAO courant
+    GlState::current().bind_buffer(GL_COPY_WRITE_BUFFER, id);
+    glAssert(glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(GLuint), &indices[0], GL_STATIC_DRAW));
+    GlState::current().bind_buffer(GL_COPY_WRITE_BUFFER, 0);
+    std::vector<unsigned int>().swap(indices);
+    return id;
+}
+
+static void drawCallback(void* mesh) { static_cast<MyGLMesh*>(mesh)->drawGL(); }
+
+public:
+
 /// Destructor
 ~MyGLMesh()
 {
@@ -485,11 +809,102 @@ void drawGL()
     // ######################################
     // TP 1 / PARTIE II: Fin du code à écrire
     // ######################################
+
+    if (mLodIndexBuffer != 0) {
+        GlState::current().forget_buffer(mLodIndexBuffer);
+        glAssert(glDeleteBuffers(1, &mLodIndexBuffer));
+    }
+    removeFromArena();
 }
 };
 
 // -----------------------------------------------------------------------------
 
+/**
+  * @ingroup RenderSystem
+  * Un MyGLMesh découpé en meshlets (voir Loaders::Meshlet).
+  * Les meshlets hors du frustum de vue ou vus de dos sont ignorés, les autres
+  * sont dessinés en un seul glMultiDrawElements().
+  */
+class MyClusteredGLMesh : public MyGLMesh {
+public:
+    MyClusteredGLMesh(const Loaders::Mesh& mesh)
+        : MyGLMesh(mesh)
+        , mClusterIndexBuffer(0)
+        , mNbMeshletsDrawn(0)
+    {
+        Loaders::Meshlet::build(*this, mMeshlets, mClusterIndices);
+    }
+
+    const std::vector<Loaders::Meshlet>& meshlets() const { return mMeshlets; }
+
+    /// Nombre de meshlets ajoutés par le dernier submitClustersGL()
+    int nbMeshletsDrawn() const { return mNbMeshletsDrawn; }
+
+    /// Ajoute à "queue" les meshlets intersectant "frustum" et vus de face
+    /// depuis "eye". Tous deux sont exprimés dans le repère du maillage.
+    /// Les intervalles du multi draw sont alloués dans l'arène de la file.
+    void submitClustersGL(RenderQueue& queue, uint64_t key, const Frustum& frustum, const glm::vec3& eye)
+    {
+        if (mVertexArrayObject == 0 || mMeshlets.empty()) {
+            submitGL(queue, key);
+            return;
+        }
+
+        // Les meshlets visibles consécutifs sont fusionnés en un seul intervalle
+        GLsizei* counts = queue.arena().allocateArray<GLsizei>(mMeshlets.size());
+        const GLvoid** offsets = queue.arena().allocateArray<const GLvoid*>(mMeshlets.size());
+        GLsizei nbRanges = 0;
+        mNbMeshletsDrawn = 0;
+        int end = -1;
+        for (unsigned i = 0; i < mMeshlets.size(); ++i) {
+            const Loaders::Meshlet& m = mMeshlets[i];
+            if (!frustum.intersectsSphere(m.center, m.radius) || m.isBackFacing(eye))
+                continue;
+            ++mNbMeshletsDrawn;
+            if (m.firstIndex == end)
+                counts[nbRanges - 1] += 3 * m.nbTriangles;
+            else {
+                counts[nbRanges] = 3 * m.nbTriangles;
+                offsets[nbRanges] = (const GLvoid*)(m.firstIndex * sizeof(GLuint));
+                ++nbRanges;
+            }
+            end = m.firstIndex + 3 * m.nbTriangles;
+        }
+        if (nbRanges == 0)
+            return;
+
+        if (mClusterIndexBuffer == 0)
+            mClusterIndexBuffer = uploadIndices(mClusterIndices);
+
+        DrawPacket& p = queue.submit(key);
+        p.vertexArray = mVertexArrayObject;
+        p.vaoIndexBuffer = mVertexBufferObjects[VBO_INDICES];
+        p.indexBuffer = mClusterIndexBuffer;
+        p.mode = GL_TRIANGLES;
+        p.drawCount = nbRanges;
+        p.counts = counts;
+        p.offsets = offsets;
+    }
+
+    ~MyClusteredGLMesh()
+    {
+        if (mClusterIndexBuffer != 0) {
+            GlState::current().forget_buffer(mClusterIndexBuffer);
+            glAssert(glDeleteBuffers(1, &mClusterIndexBuffer));
+        }
+    }
+
+private:
+    std::vector<Loaders::Meshlet> mMeshlets;
+    /// Triangles dans l'ordre des meshlets, libérés après l'upload
+    std::vector<unsigned int> mClusterIndices;
+    GLuint mClusterIndexBuffer;
+    int mNbMeshletsDrawn;
+};
+
+// -----------------------------------------------------------------------------
+
 //-------------------------------------------
 // Chargement et compilation des données géométriques de l'application.
 //-------------------------------------------
@@ -530,6 +945,8 @@ void Renderer::initGeometry()
 
     // 2 - Transformer ces maillages en maillages affichables de type "MyGLMesh"
     // (ils seront stockés dans l'attribut mMeshes)
+    // Les maillages très denses peuvent devenir des "MyClusteredGLMesh" pour
+    // que leurs parties cachées soient éliminées.
 
     // 3 - Faites l'upload vers GPU avec ".compileGL()"
 
@@ -540,8 +957,22 @@ void Renderer::initGeometry()
  
 // -----------------------------------------------------------------------------
 
+glm::mat4 Renderer::projectionMatrix() const
+{
+    return glm::perspective(mFieldOfView, float(mWidth) / float(mHeight), mZNear, mZFar);
+}
+
+// -----------------------------------------------------------------------------
+
 void Renderer::draw_list_mesh()
 {
+    // Maillages cullés puis dessinés triés par état (voir drawVisibleMeshes()),
+    // la touche 'q' bascule sur le code du TP ci-dessous
+    if (mUseRenderQueue) {
+        drawVisibleMeshes();
+        return;
+    }
+
     // #########################################################################
     // TP 1 / PARTIE II: Début du code à écrire
 
@@ -551,6 +982,399 @@ void Renderer::draw_list_mesh()
     // #########################################################################
 }
 
+// -----------------------------------------------------------------------------
+
+void Renderer::drawVisibleMeshes()
+{
+    // Position de la caméra et taille en pixels d'une unité vue à distance 1,
+    // pour choisir le niveau de détail des maillages denses
+    const glm::vec3 eye = glm::vec3(glm::inverse(mViewMatrix)[3]);
+    const float pixelsPerUnit = mHeight / (2.f * std::tan(glm::radians(mFieldOfView) * 0.5f));
+    // La matrice modèle est l'identité : le frustum est dans le repère des maillages
+    const Frustum frustum(projectionMatrix() * mViewMatrix);
+
+    // Les maillages entièrement hors du frustum sont ignorés. La boucle SIMD
+    // bat la hiérarchie de la scène quelle que soit sa taille (benchmark
+    // "-cull" de minimal_renderer_headless), qui ne sert qu'au picking.
+    if (mCuller == 0 || mCuller->size() != (int)mMeshes.size())
+        updateMeshBounds();
+    mFrameStats.nbDrawn = mCuller->cull(frustum, mVisible);
+    mFrameStats.nbCulled = (int)mMeshes.size() - mFrameStats.nbDrawn;
+
+    // Les maillages visibles sont mis en file puis dessinés triés par état :
+    // ceux qui partagent un VAO ensemble, de l'avant vers l'arrière
+    if (mQueue == 0)
+        mQueue = new RenderQueue();
+    mQueue->clear();
+    const unsigned program = mProgram > 0 ? (unsigned)mProgram : 0;
+
+    // Les maillages sans niveaux de détail ni meshlets sont dans une seule
+    // arène (voir moveToArena()) et tous dessinés par un seul multi draw
+    const bool useArena = mUseMeshArena && mMeshArena != 0;
+    int* handles = 0;
+    int nbCommands = 0;
+    float nearest = std::numeric_limits<float>::max();
+    if (useArena)
+        handles = mQueue->arena().allocateArray<int>(mMeshes.size());
+    for (unsigned i = 0; i < mMeshes.size(); ++i) {
+        // Les maillages ayant des instances ne sont dessinés que par elles
+        if (!mVisible[i] || (i < mInstances.size() && !mInstances[i].empty()))
+            continue;
+        MyGLMesh* mesh = mMeshes[i];
+        const glm::vec3 center = (mesh->boundsMin() + mesh->boundsMax()) * 0.5f;
+        const float depth = -(mViewMatrix * glm::vec4(center, 1.f)).z;
+        const uint64_t key = RenderQueue::makeKey(0, program, mesh->vertexArray(), depth);
+        if (MyClusteredGLMesh* clustered = dynamic_cast<MyClusteredGLMesh*>(mesh))
+            clustered->submitClustersGL(*mQueue, key, frustum, eye);
+        else if (mesh->hasLods()) {
+            mesh->lods().select(eye, pixelsPerUnit);
+            mesh->submitLodGL(*mQueue, key);
+        }
+        else if (useArena && mesh->arenaHandle() >= 0) {
+            handles[nbCommands++] = mesh->arenaHandle();
+            nearest = std::min(nearest, depth);
+        }
+        else
+            mesh->submitGL(*mQueue, key);
+    }
+    if (nbCommands > 0) {
+        DrawElementsIndirectCommand* commands = mQueue->arena().allocateArray<DrawElementsIndirectCommand>(nbCommands);
+        for (int c = 0; c < nbCommands; ++c)
+            commands[c] = mMeshArena->command(handles[c]);
+        DrawPacket& p = mQueue->submit(RenderQueue::makeKey(0, program, mMeshArena->get_vao(), nearest));
+        p.mode = GL_TRIANGLES;
+        p.meshArena = mMeshArena;
+        p.commands = commands;
+        p.drawCount = nbCommands;
+    }
+    submitInstances(frustum);
+    mQueue->sort();
+    mQueue->execute(GlState::current());
+    if (mInstanceRing != 0)
+        mInstanceRing->fence();
+}
+
+// -----------------------------------------------------------------------------
+
+int Renderer::addInstance(int mesh, const glm::mat4& modelMatrix, const glm::vec4& color)
+{
+    MeshInstance instance;
+    instance.modelMatrix = modelMatrix;
+    instance.color = color;
+    std::vector<MeshInstance>& list = instances(mesh);
+    list.push_back(instance);
+    return (int)list.size() - 1;
+}
+
+// -----------------------------------------------------------------------------
+
+std::vector<MeshInstance>& Renderer::instances(int mesh)
+{
+    if (mesh >= (int)mInstances.size())
+        mInstances.resize(mesh + 1);
+    return mInstances[mesh];
+}
+
+// -----------------------------------------------------------------------------
+
+/// Unité de texture de la texture buffer contenant les instances
+const int INSTANCE_TEXTURE_UNIT = 7;
+
+void Renderer::submitInstances(const Frustum& frustum)
+{
+    mFrameStats.nbInstancesDrawn = mFrameStats.nbInstancesCulled = 0;
+    int nbInstances = 0;
+    for (unsigned i = 0; i < mInstances.size() && i < mMeshes.size(); ++i)
+        nbInstances += (int)mInstances[i].size();
+    if (nbInstances == 0 || mProgram <= 0 || mInstanceBaseLocation < 0 || mInstanceBufferLocation < 0)
+        return;
+
+    // Les intervalles ne chevauchent jamais la fin de l'anneau, une frame
+    // peut donc occuper jusqu'au double de ses instances. L'anneau ne peut
+    // dépasser la taille d'une texture buffer : comparer avec la taille
+    // limitée, sinon il serait reconstruit à chaque frame.
+    if (mInstanceRing == 0 || mInstanceRing->capacity() < std::min(2 * nbInstances, mMaxInstanceCapacity))
+        allocInstanceBuffer(nbInstances);
+    // Instances découpées en draws d'au plus la moitié de l'anneau : avec un
+    // anneau limité, un maillage ayant trop d'instances garde celles qui y
+    // tiennent
+    const int maxPerDraw = std::max(1, mInstanceRing->capacity() / 2);
+
+    GlState::current().use_program(mProgram);
+    glAssert(glUniform1i(mInstanceBufferLocation, INSTANCE_TEXTURE_UNIT));
+    glAssert(glActiveTexture(GL_TEXTURE0 + INSTANCE_TEXTURE_UNIT));
+    glAssert(glBindTexture(GL_TEXTURE_BUFFER, mInstanceTexture));
+    glAssert(glActiveTexture(GL_TEXTURE0));
+
+    for (unsigned m = 0; m < mInstances.size() && m < mMeshes.size(); ++m) {
+        const std::vector<MeshInstance>& instances = mInstances[m];
+        MyGLMesh* mesh = mMeshes[m];
+        if (instances.empty() || (mesh->vertexArray() == 0 && mesh->arenaHandle() < 0))
+            continue;
+        const glm::vec3 center = (mesh->boundsMin() + mesh->boundsMax()) * 0.5f;
+        for (int begin = 0; begin < (int)instances.size(); begin += maxPerDraw)
+            submitInstanceRange(frustum, m, center, begin, std::min((int)instances.size() - begin, maxPerDraw));
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::submitInstanceRange(const Frustum& frustum, int m, const glm::vec3& center, int begin, int size)
+{
+    const std::vector<MeshInstance>& instances = mInstances[m];
+    MyGLMesh* mesh = mMeshes[m];
+    const int first = mInstanceRing->alloc(size);
+    if (first < 0) {
+        // Les instances de la frame ne tiennent pas dans un anneau limité
+        // par GL_MAX_TEXTURE_BUFFER_SIZE
+        mFrameStats.nbInstancesCulled += size;
+        return;
+    }
+
+    // Les instances visibles sont écrites à la suite, la fin de l'intervalle
+    // reste inutilisée
+    InstanceTexels* visible = (InstanceTexels*)mInstanceRing->map(first, size);
+    int nbVisible = 0;
+    float nearest = std::numeric_limits<float>::max();
+    for (int i = begin; i < begin + size; ++i) {
+        const glm::mat4& model = instances[i].modelMatrix;
+        const glm::vec3 c = glm::vec3(model * glm::vec4(center, 1.f));
+        const float scale = std::max(glm::length(glm::vec3(model[0])),
+                                     std::max(glm::length(glm::vec3(model[1])),
+                                              glm::length(glm::vec3(model[2]))));
+        if (!frustum.intersectsSphere(c, mesh->boundsRadius() * scale))
+            continue;
+        InstanceTexels& texels = visible[nbVisible++];
+        texels.modelMatrix = model;
+        const glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+        for (int col = 0; col < 3; ++col)
+            texels.normalMatrix[col] = glm::vec4(normalMatrix[col], 0.f);
+        texels.color = instances[i].color;
+        nearest = std::min(nearest, -(mViewMatrix * glm::vec4(c, 1.f)).z);
+    }
+    mInstanceRing->flush(first, size);
+    mFrameStats.nbInstancesDrawn += nbVisible;
+    mFrameStats.nbInstancesCulled += size - nbVisible;
+    if (nbVisible == 0)
+        return;
+
+    const uint64_t key = RenderQueue::makeKey(0, mProgram, mesh->vertexArray(), nearest);
+    mesh->submitInstancedGL(*mQueue, key, mProgram, mInstanceBaseLocation, first, nbVisible);
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::allocInstanceBuffer(int nbInstances)
+{
+    if (mMaxInstanceCapacity == 0) {
+        GLint maxTexels = 0;
+        glAssert(glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels));
+        const int texelsPerInstance = sizeof(InstanceTexels) / sizeof(glm::vec4);
+        mMaxInstanceCapacity = std::max(1, maxTexels / texelsPerInstance);
+    }
+    // De la place pour quelques frames : le GPU lit encore les dernières
+    // pendant que la suivante est écrite
+    const int capacity = std::min(4 * nbInstances, mMaxInstanceCapacity);
+
+    delete mInstanceRing;
+    GlRing_backend* backend = new GlRing_backend_gl(capacity * (int)sizeof(InstanceTexels));
+    mInstanceRing = new GlRing_buffer(backend, capacity, sizeof(InstanceTexels));
+
+    if (mInstanceTexture == 0) {
+        glAssert(glGenTextures(1, &mInstanceTexture));
+    }
+    glAssert(glBindTexture(GL_TEXTURE_BUFFER, mInstanceTexture));
+    glAssert(glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, mInstanceRing->get_id()));
+    glAssert(glBindTexture(GL_TEXTURE_BUFFER, 0));
+}
+
+// -----------------------------------------------------------------------------
+
+bool Renderer::queueMesh(Loaders::Mesh* mesh, unsigned loadId)
+{
+    return mPendingMeshes.push(mesh, loadId);
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::cancelLoad(unsigned loadId)
+{
+    mPendingMeshes.cancelLoad(loadId);
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::uploadPendingMeshes()
+{
+    mFrameStats.nbBytesUploaded = 0;
+    finishUploads();
+    if (mUploadStream != 0 && mUploadStream->has_failed()) {
+        // Les maillages en échec sont compilés par finishUploads(), les suivants ici
+        mUploadStream = 0;
+    }
+    mPendingMeshes.beginFrame();
+    while (Loaders::Mesh* loaded = mPendingMeshes.pop()) {
+        MyGLMesh* mesh = new MyGLMesh(std::move(*loaded));
+        delete loaded;
+        // Comptés par mPendingMeshes, confiés au flux ou non
+        mFrameStats.nbBytesUploaded = mPendingMeshes.nbBytes();
+        if (mUploadStream != 0 && mesh->nbVertices() > 0 && mesh->nbTriangles() > 0) {
+            // Rempli par le thread du flux, voir finishUploads()
+            mUploadingMeshes.push_back(mesh->streamGL(*mUploadStream));
+            continue;
+        }
+        addUploadedMesh(mesh);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::finishUploads()
+{
+    // Le flux transfère dans l'ordre : les maillages sont ajoutés dans
+    // l'ordre de la file
+    unsigned nbReady = 0;
+    while (nbReady < mUploadingMeshes.size()) {
+        UploadingMesh* u = mUploadingMeshes[nbReady];
+        if (u->vertices->has_failed() || u->indices->has_failed()) {
+            // Le thread du flux n'a pas pu tourner : transféré d'ici par
+            // addUploadedMesh()
+        }
+        else if (u->vertices->is_ready() && u->indices->is_ready())
+            u->mesh->compileGL(u->vertices->release_buffer(), u->indices->release_buffer());
+        else
+            break;
+        addUploadedMesh(u->mesh);
+        delete u->vertices;
+        delete u->indices;
+        delete u;
+        ++nbReady;
+    }
+    mUploadingMeshes.erase(mUploadingMeshes.begin(), mUploadingMeshes.begin() + nbReady);
+    mFrameStats.nbUploading = (int)mUploadingMeshes.size();
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::addUploadedMesh(MyGLMesh* mesh)
+{
+    // Des buffers à lui sauf s'il n'est dessiné que depuis l'arène
+    if (!moveToArena(mesh) && mesh->vertexArray() == 0)
+        mesh->compileGL();
+    mMeshes.push_back(mesh);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Maillages simplifiés par buildMeshLods() : la simplification ne vaut la
+/// peine que pour les maillages denses
+const int MIN_LOD_TRIANGLES = 20000;
+
+bool Renderer::moveToArena(MyGLMesh* mesh)
+{
+    // Les niveaux de détail et les meshlets dessinent avec leurs propres
+    // index buffers
+    if (!mUseMeshArena || mesh->hasLods() || mesh->nbTriangles() >= MIN_LOD_TRIANGLES
+        || dynamic_cast<MyClusteredGLMesh*>(mesh) != 0)
+        return false;
+    if (mMeshArena == 0)
+        mMeshArena = MyGLMesh::createArena();
+    if (mesh->addToArena(*mMeshArena) < 0)
+        return false;
+    mesh->releaseGL();
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::buildMeshLods()
+{
+    std::vector<const Loaders::Mesh*> meshes;
+    std::vector<MyGLMesh*> denseMeshes;
+    for (unsigned i = 0; i < mMeshes.size(); ++i) {
+        if (mMeshes[i]->nbTriangles() >= MIN_LOD_TRIANGLES) {
+            meshes.push_back(mMeshes[i]);
+            denseMeshes.push_back(mMeshes[i]);
+        }
+    }
+
+    std::vector<std::vector<Loaders::MeshLod> > chains;
+    Loaders::MeshSimplifier::buildLodChains(meshes, chains);
+    for (unsigned i = 0; i < denseMeshes.size(); ++i)
+        denseMeshes[i]->setLods(chains[i]);
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::updateMeshBounds()
+{
+    if (mCuller == 0)
+        mCuller = new BoundsCuller();
+    if (mBvh == 0)
+        mBvh = new SceneBvh();
+
+    std::vector<glm::vec3> bmin(mMeshes.size()), bmax(mMeshes.size());
+    mCuller->clear();
+    for (unsigned i = 0; i < mMeshes.size(); ++i) {
+        bmin[i] = mMeshes[i]->boundsMin();
+        bmax[i] = mMeshes[i]->boundsMax();
+        mCuller->add(bmin[i], bmax[i], mMeshes[i]->boundsRadius());
+    }
+    mBvh->build(bmin, bmax);
+}
+
+// -----------------------------------------------------------------------------
+
+void Renderer::refitMeshBounds(int i)
+{
+    if (mCuller == 0 || mCuller->size() != (int)mMeshes.size()) {
+        updateMeshBounds();
+        return;
+    }
+    MyGLMesh* mesh = mMeshes[i];
+    mesh->computeBounds();
+    // Recopié dans l'arène au prochain draw_list_mesh()
+    mesh->removeFromArena();
+    mCuller->set(i, mesh->boundsMin(), mesh->boundsMax(), mesh->boundsRadius());
+    mBvh->updateObject(i, mesh->boundsMin(), mesh->boundsMax());
+}
+
+// -----------------------------------------------------------------------------
+
+int Renderer::pick(int x, int y, Loaders::RayHit* hit)
+{
+    if (mBvh == 0 || mBvh->nbObjects() != (int)mMeshes.size())
+        updateMeshBounds();
+
+    // Rayon passant par le pixel, du plan proche au plan lointain
+    const glm::mat4 inverseViewProjection = glm::inverse(projectionMatrix() * mViewMatrix);
+    const float ndcX = 2.f * (x + 0.5f) / mWidth - 1.f;
+    const float ndcY = 1.f - 2.f * (y + 0.5f) / mHeight;
+    glm::vec4 nearPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, -1.f, 1.f);
+    glm::vec4 farPoint = inverseViewProjection * glm::vec4(ndcX, ndcY, 1.f, 1.f);
+    const glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+    const glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - origin;
+
+    // Triangles des maillages dont la boîte est touchée (hiérarchies construites au premier usage)
+    const Loaders::Ray ray(origin, direction);
+    Loaders::RayHit closest;
+    float t;
+    int picked = mBvh->raycast(origin, direction, t, [&](int i, float& distance) {
+        MyGLMesh* mesh = mMeshes[i];
+        if (!mesh->hasBvh())
+            mesh->buildBvh();
+        Loaders::RayHit meshHit;
+        if (!mesh->intersect(ray, meshHit) || meshHit.distance >= distance)
+            return false;
+        distance = meshHit.distance;
+        closest = meshHit;
+        return true;
+    });
+    if (hit)
+        *hit = closest;
+    return picked;
+}
+
 // -----------------------------------------------------------------------------
  
 int Renderer::handleMouseEvent(const MouseEvent& event)
@@ -561,6 +1385,12 @@ int Renderer::handleMouseEvent(const MouseEvent& event)
     static int y = 0;
     static int button = 0;
 
+    // Ctrl + clic gauche sélectionne le maillage sous le curseur, voir pickedMesh()
+    if (event.click && event.button == MouseEvent::LEFT && (event.modifiers & MouseEvent::CONTROL)) {
+        mPickedMesh = pick(event.x, event.y, &mPickedHit);
+        return 1;
+    }
+
     if (event.click) {
         x = event.x;
         y = event.y;
@@ -630,7 +1460,7 @@ void Renderer::setViewport(int width, int height)
 {
     mWidth = width;
     mHeight = height;
-    glAssert(glViewport(0, 0, mWidth, mHeight));
+    GlState::current().viewport(0, 0, mWidth, mHeight);
 }
 
 // -----------------------------------------------------------------------------
@@ -640,10 +1470,16 @@ int Renderer::handleKeyEvent(char key)
 
     switch (key) {
     case 'w':
-        glAssert(glPolygonMode(GL_FRONT_AND_BACK, GL_LINE));
+        GlState::current().polygon_mode(GL_LINE);
         break;
     case 'f':
-        glAssert(glPolygonMode(GL_FRONT_AND_BACK, GL_FILL));
+        GlState::current().polygon_mode(GL_FILL);
+        break;
+    case 'a':
+        mUseMeshArena = !mUseMeshArena;
+        break;
+    case 'q':
+        mUseRenderQueue = !mUseRenderQueue;
         break;
     }
     return 1;
@@ -655,9 +1491,26 @@ Renderer::~Renderer()
 {
     for (unsigned i = 0; i < mMeshes.size(); ++i)
         delete mMeshes[i];
+    mPendingMeshes.clear();
+    // Le flux de transfert est arrêté (voir setUploadStream())
+    for (unsigned i = 0; i < mUploadingMeshes.size(); ++i) {
+        delete mUploadingMeshes[i]->vertices;
+        delete mUploadingMeshes[i]->indices;
+        delete mUploadingMeshes[i]->mesh;
+        delete mUploadingMeshes[i];
+    }
 
     clearShaders();
     delete mDummyObject;
+    delete mCuller;
+    delete mBvh;
+    delete mQueue;
+    delete mInstanceRing;
+    // Après les maillages, qui s'en retirent eux-mêmes
+    delete mMeshArena;
+    if (mInstanceTexture != 0) {
+        glAssert(glDeleteTextures(1, &mInstanceTexture));
+    }
 }
 
 // -----------------------------------------------------------------------------
@@ -701,6 +1554,9 @@ void Renderer::init_dummy_object()
         }
     }
     mDummyObject->end();
+
+    // Fusionne les blocs de chaque mode de dessin : un seul appel de dessin par mode
+    mDummyObject->compile();
 }
 
 // -----------------------------------------------------------------------------
@@ -21,9 +21,15 @@
 #define RENDERER_H
 
 #include "glm/glm.hpp"
+#include "fileloaders/trianglebvh.h"
+#include "pendingmeshes.h"
 
 #include <vector>
 class GlDirectDraw;
+class GlRing_buffer;
+class GlMesh_arena;
+class GlUpload;
+class GlUpload_stream;
 
 /** @defgroup RenderSystem Simple OpenGL Rendering system
  *  Simple OpenGL 3.2 core renderer.
@@ -37,6 +43,10 @@ namespace RenderSystem {
 // =============================================================================
 
 class MyGLMesh;
+class BoundsCuller;
+class SceneBvh;
+class RenderQueue;
+class Frustum;
 
 
 /**
@@ -66,6 +76,68 @@ struct MouseEvent {
 
 // -----------------------------------------------------------------------------
 
+/**
+  * @ingroup RenderSystem
+  * Statistics of the last frame drawn by Renderer::render().
+  */
+struct FrameStats {
+    int nbDrawn;        ///< meshes intersecting the view frustum
+    int nbCulled;       ///< meshes skipped
+    int nbStateChanges; ///< GL state changes issued (see GlState)
+    int nbStateSkipped; ///< redundant GL state changes filtered out
+    int nbInstancesDrawn;  ///< see Renderer::addInstance()
+    int nbInstancesCulled;
+    int nbBytesUploaded;   ///< meshes given to Renderer::queueMesh()
+    int nbUploading; ///< meshes filled by the upload stream, not drawn yet
+};
+
+// -----------------------------------------------------------------------------
+
+/**
+  * @ingroup RenderSystem
+  * A copy of a mesh of the renderer placed in the scene.
+  * Instances share the GPU buffers of their mesh: each one only costs these
+  * 80 bytes, uploaded every frame with its normal matrix as an
+  * InstanceTexels (see Renderer::addInstance()).
+  */
+struct MeshInstance {
+    glm::mat4 modelMatrix;
+    glm::vec4 color; ///< multiplies the color computed by the shader
+};
+
+// -----------------------------------------------------------------------------
+
+/**
+  * @ingroup RenderSystem
+  * A visible MeshInstance as read by the vertex shader: 8 RGBA32F texels of
+  * the instance buffer texture.
+  */
+struct InstanceTexels {
+    glm::mat4 modelMatrix;
+    /// Columns of the inverse transpose of the upper 3x3 of #modelMatrix,
+    /// computed once per instance instead of once per vertex
+    glm::vec4 normalMatrix[3];
+    glm::vec4 color;
+};
+
+// -----------------------------------------------------------------------------
+
+/**
+  * @ingroup RenderSystem
+  * A mesh whose buffers are filled by the upload stream of the renderer.
+  * @see Renderer::setUploadStream()
+  */
+struct UploadingMesh {
+    MyGLMesh* mesh;
+    GlUpload* vertices;
+    GlUpload* indices;
+    /// Interleaved copy of the vertices, when the mesh stores them as
+    /// separate streams
+    std::vector<float> vertexData;
+};
+
+// -----------------------------------------------------------------------------
+
 /**
   * @ingroup RenderSystem
   * OpenGL renderer.
@@ -81,7 +153,28 @@ public:
         , mVertexShaderId(-1)
         , mFragmentShaderId(-1)
         , mViewMatrix(1.0f)
+        , mFieldOfView(60.f)
+        , mZNear(0.1f)
+        , mZFar(1000.f)
+        , mCuller(0)
+        , mBvh(0)
+        , mQueue(0)
+        , mInstanceRing(0)
+        , mInstanceTexture(0)
+        , mMaxInstanceCapacity(0)
+        , mInstanceBaseLocation(-1)
+        , mInstanceBufferLocation(-1)
+        , mMeshArena(0)
+        , mUseMeshArena(true)
+        , mUseRenderQueue(true)
+        , mPendingMeshes(256, 4 << 20)
+        , mUploadStream(0)
+        , mPickedMesh(-1)
     {
+        mFrameStats.nbDrawn = mFrameStats.nbCulled = 0;
+        mFrameStats.nbStateChanges = mFrameStats.nbStateSkipped = 0;
+        mFrameStats.nbInstancesDrawn = mFrameStats.nbInstancesCulled = 0;
+        mFrameStats.nbBytesUploaded = mFrameStats.nbUploading = 0;
     }
 
     /// Destructor
@@ -95,6 +188,87 @@ public:
 
     void draw_list_mesh();
 
+    /// Perspective projection from #mFieldOfView, the viewport and the
+    /// clipping planes. Used to cull the meshes.
+    glm::mat4 projectionMatrix() const;
+
+    /// Camera placement, e.g. scripted by a benchmark
+    void setViewMatrix(const glm::mat4& view) { mViewMatrix = view; }
+    const glm::mat4& viewMatrix() const { return mViewMatrix; }
+
+    /// Build the levels of detail of the dense meshes of #mMeshes
+    /// (all meshes are simplified in parallel).
+    /// @see LodSelector, Loaders::MeshSimplifier
+    void buildMeshLods();
+
+    /// Gather the bounds of #mMeshes for the frustum culling and build
+    /// the hierarchy used for picking.
+    /// Done again by draw_list_mesh() when meshes are added or removed.
+    void updateMeshBounds();
+
+    /// Update the bounds of mesh "i" after its vertices moved.
+    /// Only the branch of the hierarchy holding it is refitted.
+    void refitMeshBounds(int i);
+
+    /// Index in #mMeshes of the mesh seen through pixel (x, y)
+    /// (measured from the top left corner), -1 when there is none.
+    /// The scene hierarchy selects the meshes whose box is hit, then their
+    /// triangles are tested (see Loaders::Mesh::intersect()).
+    /// @param hit : if not null, triangle and vertex under the pixel
+    int pick(int x, int y, Loaders::RayHit* hit = 0);
+
+    /// Last mesh picked with Ctrl + left click, -1 if none
+    int pickedMesh() const { return mPickedMesh; }
+    /// Triangle and vertex of the last pick
+    const Loaders::RayHit& pickedHit() const { return mPickedHit; }
+
+    const FrameStats& frameStats() const { return mFrameStats; }
+
+    /// Place a copy of mMeshes[mesh] in the scene. A mesh having instances
+    /// is only drawn through them, all at once with glDrawElementsInstanced().
+    /// Memory stays the one of the mesh whatever the number of instances.
+    /// @return index of the instance in instances(mesh)
+    int addInstance(int mesh, const glm::mat4& modelMatrix,
+                    const glm::vec4& color = glm::vec4(1.f));
+
+    /// Instances of mMeshes[mesh], they can be moved or removed freely
+    std::vector<MeshInstance>& instances(int mesh);
+
+    void clearInstances() { mInstances.clear(); }
+
+    /// Hand "mesh", loaded by another thread, to the renderer which takes
+    /// its ownership. Thread safe and lock free: the mesh is only queued,
+    /// render() uploads the queued meshes within the upload budget.
+    /// @param loadId : load the mesh belongs to, see cancelLoad()
+    /// @return false when the queue is full, try again later
+    bool queueMesh(Loaders::Mesh* mesh, unsigned loadId);
+
+    /// Queued by the loading thread after its last queueMesh(): the
+    /// cancellation of "loadId" is forgotten once the meshes queued before
+    /// are consumed.
+    /// @return false when the queue is full, try again later
+    bool endLoad(unsigned loadId) { return queueMesh(0, loadId); }
+
+    /// Drop the queued meshes of "loadId", even those queued later on until
+    /// endLoad(). The meshes already uploaded are kept.
+    void cancelLoad(unsigned loadId);
+
+    /// Number of meshes waiting to be uploaded or drawn (only a hint while
+    /// meshes are queued)
+    int nbPendingMeshes() const { return (int)(mPendingMeshes.size() + mUploadingMeshes.size()); }
+
+    /// Bytes of vertices and indices render() uploads per frame, so that
+    /// frame times stay steady while large files are streamed in.
+    /// At least one mesh is uploaded per frame whatever its size.
+    void setUploadBudget(int nbBytes) { mPendingMeshes.setBudget(nbBytes); }
+
+    /// Upload the queued meshes through "stream", run by another thread with
+    /// a context sharing its objects with the one of render(). A mesh is
+    /// only drawn once its buffers are filled. The stream must be stopped
+    /// before the renderer is destroyed. 0 to upload from render(), which is
+    /// also done once the stream failed (see GlUpload_stream::fail()).
+    void setUploadStream(GlUpload_stream* stream) { mUploadStream = stream; }
+
     /// Handle mouse event given by the vortexEngine
     /// @return 1 if event is understood and fully managed. 0 otherwise.
     int handleMouseEvent(const MouseEvent& event);
@@ -134,6 +308,33 @@ protected:
 private:
     void init_dummy_object();
 
+    /// Cull #mMeshes and their instances against the view frustum, then
+    /// draw the visible ones through #mQueue sorted by state
+    void drawVisibleMeshes();
+
+    /// Upload the instances intersecting "frustum" and submit one instanced
+    /// draw per mesh to #mQueue
+    void submitInstances(const Frustum& frustum);
+    /// Upload the visible instances among mInstances[m][begin, begin + size)
+    /// in #mInstanceRing and submit their instanced draw
+    /// @param center : center of the bounding box of the mesh
+    void submitInstanceRange(const Frustum& frustum, int m, const glm::vec3& center, int begin, int size);
+    /// (Re)create #mInstanceRing to hold "nbInstances", at most
+    /// #mMaxInstanceCapacity
+    void allocInstanceBuffer(int nbInstances);
+
+    /// Turn the meshes of #mPendingMeshes into MyGLMesh within its budget
+    void uploadPendingMeshes();
+    /// Move the meshes of #mUploadingMeshes whose buffers are filled to #mMeshes
+    void finishUploads();
+    /// Append "mesh" to the meshes drawn, moved to #mMeshArena or with
+    /// buffers of its own (those filled by the upload stream, if any)
+    void addUploadedMesh(MyGLMesh* mesh);
+    /// Copy "mesh" in #mMeshArena and release its own VAO and buffers,
+    /// unless it has or may get levels of detail or meshlets
+    /// @return false when the mesh keeps its buffers
+    bool moveToArena(MyGLMesh* mesh);
+
     /// Vector of meshes to be drawn.
     std::vector<MyGLMesh*> mMeshes;
 
@@ -145,6 +346,51 @@ private:
     /// Viewing matrix for the rendering.
     glm::mat4 mViewMatrix;
 
+    /// Vertical field of view in degrees, used to choose the levels of
+    /// detail. Keep it equal to the one of the projection built in render().
+    float mFieldOfView;
+    /// Near and far clipping planes of #projectionMatrix()
+    float mZNear;
+    float mZFar;
+
+    /// Bounds of #mMeshes in the same order
+    BoundsCuller* mCuller;
+    /// Hierarchy over the bounds of #mMeshes (same indices), for #pick()
+    SceneBvh* mBvh;
+    /// Draws of draw_list_mesh() sorted by state
+    RenderQueue* mQueue;
+    /// Instances of each mesh, indexed like #mMeshes
+    std::vector<std::vector<MeshInstance> > mInstances;
+    /// Visible instances of the last frames, read by the vertex shader
+    /// through the buffer texture #mInstanceTexture
+    GlRing_buffer* mInstanceRing;
+    unsigned mInstanceTexture;
+    /// Largest ring the buffer texture can address, 0 until queried
+    int mMaxInstanceCapacity;
+    /// Uniforms of #mProgram reading the instances, set by initShaders()
+    int mInstanceBaseLocation;
+    int mInstanceBufferLocation;
+    /// Vertices and indices of the meshes drawn by a single multi draw
+    /// (meshes without levels of detail nor meshlets), copied at upload time
+    GlMesh_arena* mMeshArena;
+    /// Toggled with the 'a' key, false: each mesh is drawn by drawGL(), from
+    /// the arena for the meshes already in it. Meshes uploaded meanwhile
+    /// keep buffers of their own.
+    bool mUseMeshArena;
+    /// Toggled with the 'q' key, false: draw_list_mesh() runs the lab code
+    /// instead of drawVisibleMeshes()
+    bool mUseRenderQueue;
+    /// Meshes given by queueMesh()
+    PendingMeshes mPendingMeshes;
+    /// Thread filling the buffers of the meshes, see setUploadStream()
+    GlUpload_stream* mUploadStream;
+    std::vector<UploadingMesh*> mUploadingMeshes;
+    int mPickedMesh;
+    Loaders::RayHit mPickedHit;
+    /// Result of the last culling, one entry per mesh
+    std::vector<unsigned char> mVisible;
+    FrameStats mFrameStats;
+
     /// An utility to draw objects easily as in the old Opengl 2.1
     GlDirectDraw* mDummyObject;
 };
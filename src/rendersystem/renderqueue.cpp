@@ -0,0 +1,488 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "renderqueue.h"
+#include "gl_utils/glstate.h"
+#include "gl_utils/glmesh_arena.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace RenderSystem {
+
+namespace {
+
+/// Under this size sort() falls back to a comparison sort
+const std::size_t MIN_RADIX_SORT = 64;
+
+/// Digits of the radix sort: 2048 buckets, the histograms fit in L1
+const int RADIX_BITS = 11;
+
+/// Bits of the packed keys sorted by radix passes beyond those numbering the
+/// packets: with 16 times more values than packets few keys share them
+const int SPARE_BITS = 4;
+
+inline int highestBit(uint64_t x)
+{
+    int i = -1;
+    while (x != 0) {
+        x >>= 1;
+        ++i;
+    }
+    return i;
+}
+
+/// Gathers the bits differing between the keys at the bottom of a word, in
+/// the same order: compacted keys compare like the keys, on fewer bits.
+/// The smallest gaps between the differing bits are kept when they would
+/// need more than MAX_RUNS shifts per key.
+class KeyCompactor {
+public:
+    enum { MAX_RUNS = 4 };
+
+    explicit KeyCompactor(uint64_t keyDiff)
+    {
+        // Runs of differing bits [begin, end)
+        int begin[32], end[32];
+        int nbRuns = 0;
+        for (int bit = 0; bit < 64; ) {
+            if (!((keyDiff >> bit) & 1)) {
+                ++bit;
+                continue;
+            }
+            begin[nbRuns] = bit;
+            while (bit < 64 && ((keyDiff >> bit) & 1))
+                ++bit;
+            end[nbRuns++] = bit;
+        }
+        while (nbRuns > MAX_RUNS) {
+            int merged = 0;
+            for (int r = 1; r + 1 < nbRuns; ++r)
+                if (begin[r + 1] - end[r] < begin[merged + 1] - end[merged])
+                    merged = r;
+            end[merged] = end[merged + 1];
+            for (int r = merged + 1; r + 1 < nbRuns; ++r) {
+                begin[r] = begin[r + 1];
+                end[r] = end[r + 1];
+            }
+            --nbRuns;
+        }
+
+        mNbRuns = nbRuns;
+        mNbBits = 0;
+        for (int r = 0; r < MAX_RUNS; ++r) {
+            const int width = r < nbRuns ? end[r] - begin[r] : 0;
+            mRuns[r].shift = r < nbRuns ? begin[r] : 0;
+            mRuns[r].dest = mNbBits;
+            mRuns[r].mask = width == 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1;
+            mNbBits += width;
+        }
+    }
+
+    int nbBits() const { return mNbBits; }
+    int nbRuns() const { return mNbRuns; }
+
+    uint64_t operator()(uint64_t key) const { return compact<MAX_RUNS>(key); }
+
+    /// Compacted key when only the first "NbRuns" runs are used: the loop is
+    /// unrolled, without the shifts of the unused runs
+    template<int NbRuns>
+    uint64_t compact(uint64_t key) const
+    {
+        uint64_t compacted = 0;
+        for (int r = 0; r < NbRuns; ++r)
+            compacted |= ((key >> mRuns[r].shift) & mRuns[r].mask) << mRuns[r].dest;
+        return compacted;
+    }
+
+private:
+    /// Contiguous bits moved to "dest", unused runs have a null mask
+    struct Run {
+        int shift;
+        int dest;
+        uint64_t mask;
+    };
+    Run mRuns[MAX_RUNS];
+    int mNbRuns;
+    int mNbBits;
+};
+
+/// Sort the runs of "data" equal on their bits from "shift", left in
+/// submission order by a radix sort of these bits only
+inline void sortTies(uint64_t* data, std::size_t n, int shift)
+{
+    for (std::size_t begin = 0; begin < n; ) {
+        const uint64_t prefix = data[begin] >> shift;
+        std::size_t end = begin + 1;
+        while (end < n && (data[end] >> shift) == prefix)
+            ++end;
+        std::sort(data + begin, data + end);
+        begin = end;
+    }
+}
+
+/// Number of elements with each digit of "nbPasses" digits of "key"
+inline void countDigits(uint64_t key, int nbPasses, uint32_t* histograms)
+{
+    for (int pass = 0; pass < nbPasses; ++pass, key >>= RADIX_BITS)
+        ++histograms[(pass << RADIX_BITS) + (key & ((1u << RADIX_BITS) - 1))];
+}
+
+/// Pack the compacted keys above their index and count their digits from
+/// bit "shift", see countDigits()
+template<int NbRuns>
+void packKeys(const KeyCompactor& compact, const uint64_t* keys, std::size_t n,
+              int indexBits, int shift, int nbPasses, uint64_t* packed, uint32_t* histograms)
+{
+    for (std::size_t i = 0; i < n; ++i) {
+        packed[i] = (compact.compact<NbRuns>(keys[i]) << indexBits) | i;
+        countDigits(packed[i] >> shift, nbPasses, histograms);
+    }
+}
+
+struct PackedKey {
+    uint64_t operator()(uint64_t value) const { return value; }
+};
+
+template<class Item>
+struct ItemKey {
+    uint64_t operator()(const Item& item) const { return item.key; }
+};
+
+/// Least significant digit radix sort of "n" elements on "nbPasses" digits
+/// of their key, starting at bit "shift". Each pass is stable.
+/// @param tmp : buffer of "n" elements
+/// @param histograms : filled by countDigits() for each element, while
+/// writing "data"
+/// @return the buffer holding the sorted elements, "data" or "tmp"
+template<class T, class KeyOf>
+T* radixSort(T* data, T* tmp, std::size_t n, int shift, int nbPasses,
+             std::vector<uint32_t>& histograms, KeyOf keyOf)
+{
+    const uint32_t nbBuckets = 1u << RADIX_BITS;
+    const uint64_t mask = nbBuckets - 1;
+
+    T* src = data;
+    T* dst = tmp;
+    for (int pass = 0; pass < nbPasses; ++pass) {
+        uint32_t* offsets = &histograms[pass * nbBuckets];
+        const int digitShift = shift + pass * RADIX_BITS;
+        // Every key has the same digit: nothing would move
+        if (offsets[(keyOf(src[0]) >> digitShift) & mask] == n)
+            continue;
+
+        uint32_t sum = 0;
+        for (uint32_t b = 0; b < nbBuckets; ++b) {
+            const uint32_t count = offsets[b];
+            offsets[b] = sum;
+            sum += count;
+        }
+        for (std::size_t i = 0; i < n; ++i)
+            dst[offsets[(keyOf(src[i]) >> digitShift) & mask]++] = src[i];
+        std::swap(src, dst);
+    }
+    return src;
+}
+
+/// Bind back the index buffer recorded in "vao" (which must be bound)
+inline void giveBackIndexBuffer(GlState& state, GLuint& vao, GLuint vaoIndexBuffer)
+{
+    if (vao == 0)
+        return;
+    state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, vaoIndexBuffer);
+    vao = 0;
+}
+
+} // end anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+FrameArena::FrameArena(std::size_t blockSize)
+    : mBlockSize(blockSize)
+    , mOffset(0)
+    , mUsed(0)
+{
+}
+
+// -----------------------------------------------------------------------------
+
+FrameArena::~FrameArena()
+{
+    for (unsigned i = 0; i < mBlocks.size(); ++i)
+        delete[] mBlocks[i].data;
+}
+
+// -----------------------------------------------------------------------------
+
+void* FrameArena::allocate(std::size_t size, std::size_t align)
+{
+    if (!mBlocks.empty()) {
+        const Block& b = mBlocks.back();
+        const uintptr_t base = (uintptr_t)b.data;
+        const uintptr_t ptr = (base + mOffset + align - 1) & ~(uintptr_t)(align - 1);
+        if (ptr + size <= base + b.size) {
+            mOffset = ptr + size - base;
+            mUsed += size;
+            return (void*)ptr;
+        }
+    }
+    addBlock(std::max(mBlockSize, size + align));
+    return allocate(size, align);
+}
+
+// -----------------------------------------------------------------------------
+
+void FrameArena::reset()
+{
+    if (mBlocks.size() > 1) {
+        // Merge the blocks so that the next frame fits in one
+        const std::size_t size = capacity();
+        for (unsigned i = 0; i < mBlocks.size(); ++i)
+            delete[] mBlocks[i].data;
+        mBlocks.clear();
+        addBlock(size);
+    }
+    mOffset = 0;
+    mUsed = 0;
+}
+
+// -----------------------------------------------------------------------------
+
+std::size_t FrameArena::capacity() const
+{
+    std::size_t size = 0;
+    for (unsigned i = 0; i < mBlocks.size(); ++i)
+        size += mBlocks[i].size;
+    return size;
+}
+
+// -----------------------------------------------------------------------------
+
+void FrameArena::addBlock(std::size_t size)
+{
+    Block b;
+    b.data = new char[size];
+    b.size = size;
+    mBlocks.push_back(b);
+    mOffset = 0;
+}
+
+// -----------------------------------------------------------------------------
+
+uint64_t RenderQueue::makeKey(unsigned layer, unsigned program, unsigned material,
+                              float depth, bool backToFront)
+{
+    // The bits of a positive float sort like the float itself: the sign bit
+    // and the lowest bits of the mantissa are dropped
+    uint32_t d = 0;
+    if (depth > 0.f) {
+        std::memcpy(&d, &depth, sizeof(d));
+        d >>= 31 - DEPTH_BITS;
+    }
+    if (backToFront)
+        d = ~d & ((1u << DEPTH_BITS) - 1);
+
+    uint64_t key = layer & ((1u << LAYER_BITS) - 1);
+    key = (key << PROGRAM_BITS) | (program & ((1u << PROGRAM_BITS) - 1));
+    key = (key << MATERIAL_BITS) | (material & ((1u << MATERIAL_BITS) - 1));
+    key = (key << DEPTH_BITS) | d;
+    return key;
+}
+
+// -----------------------------------------------------------------------------
+
+void RenderQueue::clear()
+{
+    mKeys.clear();
+    mPackets.clear();
+    mKeyDiff = 0;
+    mOrder.clear();
+    mArena.reset();
+}
+
+// -----------------------------------------------------------------------------
+
+DrawPacket& RenderQueue::submit(uint64_t key)
+{
+    DrawPacket* p = mArena.allocateArray<DrawPacket>(1);
+    std::memset(p, 0, sizeof(DrawPacket));
+    if (!mKeys.empty())
+        mKeyDiff |= key ^ mKeys[0];
+    mOrder.push_back((uint32_t)mKeys.size());
+    mKeys.push_back(key);
+    mPackets.push_back(p);
+    return *p;
+}
+
+// -----------------------------------------------------------------------------
+
+void RenderQueue::submitCallback(uint64_t key, void (*callback)(void*), void* data)
+{
+    DrawPacket& p = submit(key);
+    p.callback = callback;
+    p.data = data;
+}
+
+// -----------------------------------------------------------------------------
+
+void RenderQueue::sort()
+{
+    const std::size_t n = mKeys.size();
+    if (n < MIN_RADIX_SORT) {
+        // Insertion sort: stable and fast on the few packets of small scenes
+        for (std::size_t i = 1; i < n; ++i) {
+            const uint32_t index = mOrder[i];
+            const uint64_t key = mKeys[index];
+            std::size_t j = i;
+            for (; j > 0 && key < mKeys[mOrder[j - 1]]; --j)
+                mOrder[j] = mOrder[j - 1];
+            mOrder[j] = index;
+        }
+        return;
+    }
+
+    // Only the bits differing between the keys are sorted
+    if (mKeyDiff == 0)
+        return;
+    const KeyCompactor compact(mKeyDiff);
+    const int nbBits = compact.nbBits();
+    const int indexBits = highestBit(n - 1) + 1;
+
+    if (nbBits + indexBits <= 64) {
+        // Key bits above the index: the radix sort being stable, indices of
+        // equal keys stay in submission order without sorting them.
+        // The passes only sort the highest bits, enough to tell most packets
+        // apart: the few sharing them are then sorted on the whole word.
+        const int nbPasses = std::min((nbBits + RADIX_BITS - 1) / RADIX_BITS,
+                                      (indexBits + SPARE_BITS + RADIX_BITS - 1) / RADIX_BITS);
+        const int sortedBits = std::min(nbBits, nbPasses * RADIX_BITS);
+        const int shift = indexBits + nbBits - sortedBits;
+        std::vector<uint64_t>& packed = mPacked[0];
+        packed.resize(n);
+        mPacked[1].resize(n);
+        mHistograms.assign(nbPasses << RADIX_BITS, 0);
+        void (*pack)(const KeyCompactor&, const uint64_t*, std::size_t, int, int, int,
+                     uint64_t*, uint32_t*) = &packKeys<KeyCompactor::MAX_RUNS>;
+        switch (compact.nbRuns()) {
+        case 1: pack = &packKeys<1>; break;
+        case 2: pack = &packKeys<2>; break;
+        case 3: pack = &packKeys<3>; break;
+        }
+        pack(compact, &mKeys[0], n, indexBits, shift, nbPasses, &packed[0], &mHistograms[0]);
+        uint64_t* sorted = radixSort(&packed[0], &mPacked[1][0], n, shift, nbPasses,
+                                     mHistograms, PackedKey());
+
+        // Insertion sort of the ties while reading the indices. An element
+        // only moves back within its run: too many moves mean long runs,
+        // sorted instead.
+        const uint64_t indexMask = (uint64_t(1) << indexBits) - 1;
+        std::size_t budget = 8 * n;
+        uint64_t previous = 0;
+        for (std::size_t i = 0; i < n && budget > 0; ++i) {
+            const uint64_t value = sorted[i];
+            if (value >= previous) {
+                mOrder[i] = (uint32_t)(value & indexMask);
+                previous = value;
+                continue;
+            }
+            std::size_t j = i;
+            for (; j > 0 && value < sorted[j - 1] && budget > 0; --j, --budget) {
+                sorted[j] = sorted[j - 1];
+                mOrder[j] = mOrder[j - 1];
+            }
+            sorted[j] = value;
+            mOrder[j] = (uint32_t)(value & indexMask);
+            previous = sorted[i];
+        }
+        if (budget == 0) {
+            sortTies(sorted, n, shift);
+            for (std::size_t i = 0; i < n; ++i)
+                mOrder[i] = (uint32_t)(sorted[i] & indexMask);
+        }
+    }
+    else {
+        const int nbPasses = (nbBits + RADIX_BITS - 1) / RADIX_BITS;
+        std::vector<SortItem>& items = mItems[0];
+        items.resize(n);
+        mItems[1].resize(n);
+        mHistograms.assign(nbPasses << RADIX_BITS, 0);
+        for (std::size_t i = 0; i < n; ++i) {
+            items[i].key = compact(mKeys[i]);
+            items[i].index = (uint32_t)i;
+            countDigits(items[i].key, nbPasses, &mHistograms[0]);
+        }
+        const SortItem* sorted = radixSort(&items[0], &mItems[1][0], n, 0, nbPasses,
+                                           mHistograms, ItemKey<SortItem>());
+        for (std::size_t i = 0; i < n; ++i)
+            mOrder[i] = sorted[i].index;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void RenderQueue::execute(GlState& state) const
+{
+    // VAO bound with another index buffer than its own
+    GLuint swappedVao = 0;
+    GLuint vaoIndexBuffer = 0;
+    for (unsigned i = 0; i < mOrder.size(); ++i) {
+        const DrawPacket& p = *mPackets[mOrder[i]];
+        if (p.callback != 0) {
+            giveBackIndexBuffer(state, swappedVao, vaoIndexBuffer);
+            p.callback(p.data);
+            state.invalidate();
+            continue;
+        }
+        if (p.meshArena != 0) {
+            giveBackIndexBuffer(state, swappedVao, vaoIndexBuffer);
+            if (p.program != 0)
+                state.use_program(p.program);
+            if (p.instanceCount > 0)
+                glAssert(glUniform1i(p.instanceBaseLocation, p.instanceBase));
+            p.meshArena->draw(state, p.mode, p.commands, p.drawCount);
+            if (p.instanceCount > 0)
+                glAssert(glUniform1i(p.instanceBaseLocation, -1));
+            continue;
+        }
+
+        if (p.program != 0)
+            state.use_program(p.program);
+        if (swappedVao != p.vertexArray)
+            giveBackIndexBuffer(state, swappedVao, vaoIndexBuffer);
+        state.bind_vertex_array(p.vertexArray);
+
+        const GLuint indexBuffer = p.indexBuffer != 0 ? p.indexBuffer : p.vaoIndexBuffer;
+        state.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+        swappedVao = indexBuffer != p.vaoIndexBuffer ? p.vertexArray : 0;
+        vaoIndexBuffer = p.vaoIndexBuffer;
+
+        if (p.instanceCount > 0) {
+            glAssert(glUniform1i(p.instanceBaseLocation, p.instanceBase));
+            glAssert(glDrawElementsInstanced(p.mode, p.count, GL_UNSIGNED_INT, p.offset, p.instanceCount));
+            glAssert(glUniform1i(p.instanceBaseLocation, -1));
+        }
+        else if (p.drawCount > 0) {
+            glAssert(glMultiDrawElements(p.mode, p.counts, GL_UNSIGNED_INT, p.offsets, p.drawCount));
+        }
+        else {
+            glAssert(glDrawElements(p.mode, p.count, GL_UNSIGNED_INT, p.offset));
+        }
+    }
+    giveBackIndexBuffer(state, swappedVao, vaoIndexBuffer);
+    state.bind_vertex_array(0);
+}
+
+} // END namespace RenderSystem
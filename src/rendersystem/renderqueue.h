@@ -0,0 +1,214 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <cstddef>
+#include <vector>
+#include <stdint.h>
+#include "gl_utils/opengl.h"
+
+class GlState;
+class GlMesh_arena;
+struct DrawElementsIndirectCommand;
+
+// =============================================================================
+namespace RenderSystem {
+// =============================================================================
+
+/**
+  * @ingroup RenderSystem
+  * Linear allocator emptied every frame.
+  *
+  * Allocations are carved one after the other in large blocks and are never
+  * freed one by one: reset() releases all of them at once. When a frame
+  * needed more than one block, reset() replaces them by a single block large
+  * enough for the whole frame, so that after a few frames no allocation
+  * reaches the system anymore.
+  */
+class FrameArena {
+public:
+    explicit FrameArena(std::size_t blockSize = 1 << 16);
+    ~FrameArena();
+
+    /// Uninitialized memory valid until the next reset()
+    /// @param align : power of two
+    void* allocate(std::size_t size, std::size_t align = sizeof(void*));
+
+    /// Uninitialized array of "n" T valid until the next reset().
+    /// No constructor nor destructor is called: T must be a plain struct.
+    template<class T>
+    T* allocateArray(std::size_t n)
+    {
+        return static_cast<T*>(allocate(n * sizeof(T), alignof(T)));
+    }
+
+    /// Release every allocation
+    void reset();
+
+    /// Bytes allocated since the last reset()
+    std::size_t used() const { return mUsed; }
+    /// Bytes reserved by the blocks
+    std::size_t capacity() const;
+
+private:
+    FrameArena(const FrameArena&);
+    FrameArena& operator=(const FrameArena&);
+
+    struct Block {
+        char* data;
+        std::size_t size;
+    };
+
+    void addBlock(std::size_t size);
+
+    std::vector<Block> mBlocks;
+    std::size_t mBlockSize;
+    std::size_t mOffset; ///< first free byte of the last block
+    std::size_t mUsed;
+};
+
+// -----------------------------------------------------------------------------
+
+/**
+  * @ingroup RenderSystem
+  * One draw of a RenderQueue.
+  *
+  * Either triangles indexed by GL_UNSIGNED_INT of a VAO, as one range
+  * (#count, #offset) or as several ranges drawn by glMultiDrawElements()
+  * (#drawCount > 0), or meshes of a #meshArena drawn by a single multi draw,
+  * or a #callback drawing with raw OpenGL calls.
+  * A single range can be drawn #instanceCount times: the shader then reads
+  * the data of its instances from #instanceBase (see Renderer::addInstance()).
+  * So can the commands of a #meshArena, whose instance_count must match.
+  */
+struct DrawPacket {
+    GLuint program;        ///< 0: keep the current program
+    GLuint vertexArray;
+    /// Index buffer recorded in the VAO. Mandatory: it is given back to the
+    /// VAO when the packet draws with another #indexBuffer.
+    GLuint vaoIndexBuffer;
+    GLuint indexBuffer;    ///< 0: use #vaoIndexBuffer
+    GLenum mode;
+    GLsizei count;
+    const GLvoid* offset;  ///< in bytes
+    GLsizei drawCount;     ///< number of ranges in #counts and #offsets
+    const GLsizei* counts;
+    const GLvoid* const* offsets;
+    GLsizei instanceCount; ///< > 0: glDrawElementsInstanced()
+    /// First instance given to the uniform at #instanceBaseLocation of
+    /// #program, which is set back to -1 after the draw
+    GLint instanceBase;
+    GLint instanceBaseLocation;
+    /// Not null: draw the #drawCount #commands of this arena with its own VAO
+    /// (see GlMesh_arena::draw())
+    GlMesh_arena* meshArena;
+    const DrawElementsIndirectCommand* commands;
+    /// Foreign draw, called with #data. The states it changes are unknown,
+    /// so every state is set again after it.
+    void (*callback)(void* data);
+    void* data;
+};
+
+// -----------------------------------------------------------------------------
+
+/**
+  * @ingroup RenderSystem
+  * Draws of a frame sorted to minimize the state changes.
+  *
+  * Each packet comes with a 64 bits key, see makeKey(). Packets are stored
+  * in the frame arena and never move: sort() only orders their indices,
+  * with a radix sort restricted to the bits that differ between the keys.
+  * When these bits and the index fit in 64 bits (e.g. a frame using a single
+  * layer) keys and indices are packed and sorted as plain integers, and the
+  * radix passes only sort the highest bits: a few more than the bits of the
+  * index, which tell most packets apart. The packets left sharing them are
+  * finished by an insertion sort while reading the order. 100k packets with
+  * keys like those of the renderer (a few programs, one material per mesh,
+  * varying depths) take 2 passes, see "minimal_renderer_headless -sort".
+  */
+class RenderQueue {
+public:
+    /// Sort key layout, from the most significant bits
+    enum {
+        LAYER_BITS    = 8,
+        PROGRAM_BITS  = 12,
+        MATERIAL_BITS = 20,
+        DEPTH_BITS    = 24
+    };
+
+    RenderQueue() : mKeyDiff(0) {}
+
+    /// Key ordering packets by layer, program, material and depth.
+    /// Program and material are only compared: any id (e.g. the OpenGL name
+    /// of the program and of the VAO) can be used, truncated to its bits.
+    /// @param depth : distance to the camera, clamped to 0. Its 24 bits keep
+    /// the exponent and 15 bits of mantissa of the float.
+    /// @param backToFront : reverse the depth order (transparent layers)
+    static uint64_t makeKey(unsigned layer, unsigned program, unsigned material,
+                            float depth, bool backToFront = false);
+
+    /// Forget the packets of the last frame and reset the arena
+    void clear();
+
+    /// New packet, zero initialized, valid until clear()
+    DrawPacket& submit(uint64_t key);
+
+    /// Submit a packet only calling callback(data)
+    void submitCallback(uint64_t key, void (*callback)(void*), void* data);
+
+    /// Sort the packets by key. Packets with equal keys keep the order of
+    /// submission.
+    void sort();
+
+    /// Draw the packets in their current order. Bindings go through "state"
+    /// which filters out the redundant ones. No VAO is bound afterward.
+    void execute(GlState& state) const;
+
+    int size() const { return (int)mKeys.size(); }
+    /// Key and packet of the i-th draw, in the order of execute()
+    uint64_t key(int i) const { return mKeys[mOrder[i]]; }
+    const DrawPacket& packet(int i) const { return *mPackets[mOrder[i]]; }
+
+    /// Memory freed at clear(), e.g. for the ranges of multi draws
+    FrameArena& arena() { return mArena; }
+
+private:
+    /// Key and submission index, sorted when the keys are too wide to be
+    /// packed with the index in 64 bits
+    struct SortItem {
+        uint64_t key;
+        uint32_t index;
+    };
+
+    /// Keys and packets in submission order
+    std::vector<uint64_t> mKeys;
+    std::vector<DrawPacket*> mPackets;
+    /// Bits differing between the keys
+    uint64_t mKeyDiff;
+    /// Indices in #mKeys sorted by key
+    std::vector<uint32_t> mOrder;
+    /// Work buffers of sort() kept from one frame to the next
+    std::vector<uint64_t> mPacked[2];
+    std::vector<SortItem> mItems[2];
+    std::vector<uint32_t> mHistograms;
+    FrameArena mArena;
+};
+
+} // END namespace RenderSystem ================================================
+
+#endif // RENDERQUEUE_H
@@ -0,0 +1,389 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "scenebvh.h"
+#include "frustum.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace RenderSystem {
+
+namespace {
+
+/// Objects per leaf under which a node is never split
+const int MIN_LEAF_SIZE = 2;
+/// Objects per leaf above which a node is always split
+const int MAX_LEAF_SIZE = 8;
+const int NB_BINS = 16;
+/// Cost of visiting a node relatively to testing an object
+const float TRAVERSAL_COST = 1.f;
+
+inline float halfArea(const glm::vec3& bmin, const glm::vec3& bmax)
+{
+    glm::vec3 d = glm::max(bmax - bmin, glm::vec3(0.f));
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+/// -1 when the box is outside "plane", 1 when inside, 0 when it crosses it
+inline int classify(const glm::vec4& plane, const glm::vec3& bmin, const glm::vec3& bmax)
+{
+    glm::vec3 c = (bmin + bmax) * 0.5f;
+    glm::vec3 e = (bmax - bmin) * 0.5f;
+    float d = plane.x * c.x + plane.y * c.y + plane.z * c.z + plane.w;
+    float r = std::fabs(plane.x) * e.x + std::fabs(plane.y) * e.y + std::fabs(plane.z) * e.z;
+    return d < -r ? -1 : (d >= r ? 1 : 0);
+}
+
+/// Slab test, @return the entry distance or a negative value on miss
+inline float intersectBox(const glm::vec3& origin, const glm::vec3& invDir,
+                          const glm::vec3& bmin, const glm::vec3& bmax, float tMax)
+{
+    glm::vec3 t0 = (bmin - origin) * invDir;
+    glm::vec3 t1 = (bmax - origin) * invDir;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+    float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, tMax));
+    return enter <= exit ? enter : -1.f;
+}
+
+} // end anonymous namespace
+
+// -----------------------------------------------------------------------------
+
+void SceneBvh::clear()
+{
+    mNodes.clear();
+    mParents.clear();
+    mObjects.clear();
+    mLeafOf.clear();
+    mObjectMin.clear();
+    mObjectMax.clear();
+}
+
+// -----------------------------------------------------------------------------
+
+void SceneBvh::build(const std::vector<glm::vec3>& bmin, const std::vector<glm::vec3>& bmax)
+{
+    clear();
+    mObjectMin = bmin;
+    mObjectMax = bmax;
+    const int n = (int)bmin.size();
+    if (n == 0)
+        return;
+
+    mObjects.resize(n);
+    mCentroids.resize(n);
+    for (int i = 0; i < n; ++i) {
+        mObjects[i] = i;
+        mCentroids[i] = (bmin[i] + bmax[i]) * 0.5f;
+    }
+    mLeafOf.resize(n);
+    mNodes.reserve(2 * n);
+    mParents.reserve(2 * n);
+    buildNode(0, n, -1);
+    std::vector<glm::vec3>().swap(mCentroids);
+}
+
+// -----------------------------------------------------------------------------
+
+int SceneBvh::buildNode(int begin, int end, int parent)
+{
+    const int index = (int)mNodes.size();
+    mNodes.push_back(Node());
+    mParents.push_back(parent);
+
+    glm::vec3 bmin(std::numeric_limits<float>::max()), bmax(-std::numeric_limits<float>::max());
+    glm::vec3 cmin = bmin, cmax = bmax;
+    for (int i = begin; i < end; ++i) {
+        int o = mObjects[i];
+        bmin = glm::min(bmin, mObjectMin[o]);
+        bmax = glm::max(bmax, mObjectMax[o]);
+        cmin = glm::min(cmin, mCentroids[o]);
+        cmax = glm::max(cmax, mCentroids[o]);
+    }
+    mNodes[index].bmin = bmin;
+    mNodes[index].bmax = bmax;
+
+    const int count = end - begin;
+    int axis = 0;
+    glm::vec3 extent = cmax - cmin;
+    if (extent.y > extent[axis]) axis = 1;
+    if (extent.z > extent[axis]) axis = 2;
+
+    int mid = begin;
+    if (count > MIN_LEAF_SIZE && extent[axis] > 0.f) {
+        // Binned SAH along the largest axis of the centroids
+        struct Bin {
+            glm::vec3 bmin, bmax;
+            int count;
+        } bins[NB_BINS];
+        for (int b = 0; b < NB_BINS; ++b) {
+            bins[b].bmin = glm::vec3(std::numeric_limits<float>::max());
+            bins[b].bmax = glm::vec3(-std::numeric_limits<float>::max());
+            bins[b].count = 0;
+        }
+        const float scale = NB_BINS / extent[axis];
+        const float origin = cmin[axis];
+        for (int i = begin; i < end; ++i) {
+            int o = mObjects[i];
+            int b = std::min(NB_BINS - 1, (int)((mCentroids[o][axis] - origin) * scale));
+            bins[b].bmin = glm::min(bins[b].bmin, mObjectMin[o]);
+            bins[b].bmax = glm::max(bins[b].bmax, mObjectMax[o]);
+            ++bins[b].count;
+        }
+
+        // Sweep from the right, then from the left to evaluate each split
+        float rightArea[NB_BINS];
+        int rightCount[NB_BINS];
+        glm::vec3 rmin = bins[NB_BINS - 1].bmin, rmax = bins[NB_BINS - 1].bmax;
+        int rcount = 0;
+        for (int b = NB_BINS - 1; b > 0; --b) {
+            rmin = glm::min(rmin, bins[b].bmin);
+            rmax = glm::max(rmax, bins[b].bmax);
+            rcount += bins[b].count;
+            rightArea[b] = halfArea(rmin, rmax);
+            rightCount[b] = rcount;
+        }
+        float bestCost = std::numeric_limits<float>::max();
+        int bestSplit = -1;
+        glm::vec3 lmin = bins[0].bmin, lmax = bins[0].bmax;
+        int lcount = 0;
+        for (int b = 1; b < NB_BINS; ++b) {
+            lmin = glm::min(lmin, bins[b - 1].bmin);
+            lmax = glm::max(lmax, bins[b - 1].bmax);
+            lcount += bins[b - 1].count;
+            if (lcount == 0 || rightCount[b] == 0)
+                continue;
+            float cost = halfArea(lmin, lmax) * lcount + rightArea[b] * rightCount[b];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestSplit = b;
+            }
+        }
+
+        const float leafCost = (float)count;
+        const float splitCost = TRAVERSAL_COST + bestCost / std::max(halfArea(bmin, bmax), 1e-30f);
+        if (bestSplit > 0 && (splitCost < leafCost || count > MAX_LEAF_SIZE)) {
+            int* first = &mObjects[0] + begin;
+            int* last = &mObjects[0] + end;
+            const std::vector<glm::vec3>& centroids = mCentroids;
+            mid = (int)(std::partition(first, last, [&](int o) {
+                return std::min(NB_BINS - 1, (int)((centroids[o][axis] - origin) * scale)) < bestSplit;
+            }) - &mObjects[0]);
+        }
+    }
+    if (mid == begin && count > MAX_LEAF_SIZE) {
+        // Identical centroids: split in the middle anyway
+        mid = begin + count / 2;
+    }
+
+    if (mid == begin) {
+        mNodes[index].offset = begin;
+        mNodes[index].nbObjects = count;
+        for (int i = begin; i < end; ++i)
+            mLeafOf[mObjects[i]] = index;
+        return index;
+    }
+
+    buildNode(begin, mid, index);
+    int right = buildNode(mid, end, index);
+    mNodes[index].offset = right;
+    mNodes[index].nbObjects = 0;
+    return index;
+}
+
+// -----------------------------------------------------------------------------
+
+void SceneBvh::refitNode(int node)
+{
+    Node& n = mNodes[node];
+    if (n.isLeaf()) {
+        n.bmin = mObjectMin[mObjects[n.offset]];
+        n.bmax = mObjectMax[mObjects[n.offset]];
+        for (int i = n.offset + 1; i < n.offset + n.nbObjects; ++i) {
+            n.bmin = glm::min(n.bmin, mObjectMin[mObjects[i]]);
+            n.bmax = glm::max(n.bmax, mObjectMax[mObjects[i]]);
+        }
+    }
+    else {
+        const Node& left = mNodes[node + 1];
+        const Node& right = mNodes[n.offset];
+        n.bmin = glm::min(left.bmin, right.bmin);
+        n.bmax = glm::max(left.bmax, right.bmax);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void SceneBvh::updateObject(int i, const glm::vec3& bmin, const glm::vec3& bmax)
+{
+    mObjectMin[i] = bmin;
+    mObjectMax[i] = bmax;
+    // Stop as soon as a node keeps its box: its ancestors are unchanged too
+    for (int node = mLeafOf[i]; node >= 0; node = mParents[node]) {
+        glm::vec3 oldMin = mNodes[node].bmin, oldMax = mNodes[node].bmax;
+        refitNode(node);
+        if (mNodes[node].bmin == oldMin && mNodes[node].bmax == oldMax)
+            break;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+void SceneBvh::refit(const std::vector<glm::vec3>& bmin, const std::vector<glm::vec3>& bmax)
+{
+    mObjectMin = bmin;
+    mObjectMax = bmax;
+    // children are stored after their parent
+    for (int node = (int)mNodes.size() - 1; node >= 0; --node)
+        refitNode(node);
+}
+
+// -----------------------------------------------------------------------------
+
+int SceneBvh::cull(const Frustum& frustum, std::vector<unsigned char>& visible) const
+{
+    visible.assign(mObjectMin.size(), 0);
+    if (mNodes.empty())
+        return 0;
+
+    int nbVisible = 0;
+    // (node, planes crossed by its parent)
+    std::vector<std::pair<int, int> > stack;
+    stack.push_back(std::make_pair(0, (1 << Frustum::NB_PLANES) - 1));
+    while (!stack.empty()) {
+        const int node = stack.back().first;
+        int planes = stack.back().second;
+        stack.pop_back();
+        const Node& n = mNodes[node];
+
+        bool outside = false;
+        for (int p = 0; p < Frustum::NB_PLANES && !outside; ++p) {
+            if (!(planes & (1 << p)))
+                continue;
+            int side = classify(frustum.plane(p), n.bmin, n.bmax);
+            if (side < 0)
+                outside = true;
+            else if (side > 0)
+                planes &= ~(1 << p); // the whole subtree is inside this plane
+        }
+        if (outside)
+            continue;
+
+        if (planes == 0) {
+            // Inside the frustum: the objects of a subtree are contiguous,
+            // from its leftmost to its rightmost leaf
+            int first = node, last = node;
+            while (!mNodes[first].isLeaf())
+                first = first + 1;
+            while (!mNodes[last].isLeaf())
+                last = mNodes[last].offset;
+            for (int i = mNodes[first].offset; i < mNodes[last].offset + mNodes[last].nbObjects; ++i)
+                visible[mObjects[i]] = 1;
+            nbVisible += mNodes[last].offset + mNodes[last].nbObjects - mNodes[first].offset;
+        }
+        else if (!n.isLeaf()) {
+            stack.push_back(std::make_pair(n.offset, planes));
+            stack.push_back(std::make_pair(node + 1, planes));
+        }
+        else {
+            for (int i = n.offset; i < n.offset + n.nbObjects; ++i) {
+                int o = mObjects[i];
+                bool inside = true;
+                for (int p = 0; p < Frustum::NB_PLANES && inside; ++p) {
+                    if (planes & (1 << p))
+                        inside = classify(frustum.plane(p), mObjectMin[o], mObjectMax[o]) >= 0;
+                }
+                if (inside) {
+                    visible[o] = 1;
+                    ++nbVisible;
+                }
+            }
+        }
+    }
+    return nbVisible;
+}
+
+// -----------------------------------------------------------------------------
+
+int SceneBvh::raycast(const glm::vec3& origin, const glm::vec3& dir, float& t,
+                      const ObjectIntersector& intersector) const
+{
+    int hit = -1;
+    t = std::numeric_limits<float>::max();
+    if (mNodes.empty())
+        return hit;
+
+    const glm::vec3 invDir(1.f / dir.x, 1.f / dir.y, 1.f / dir.z);
+    if (intersectBox(origin, invDir, mNodes[0].bmin, mNodes[0].bmax, t) < 0.f)
+        return hit;
+
+    std::vector<int> stack;
+    stack.push_back(0);
+    while (!stack.empty()) {
+        const Node& n = mNodes[stack.back()];
+        int node = stack.back();
+        stack.pop_back();
+        if (intersectBox(origin, invDir, n.bmin, n.bmax, t) < 0.f)
+            continue; // missed or farther than the closest hit
+
+        if (n.isLeaf()) {
+            for (int i = n.offset; i < n.offset + n.nbObjects; ++i) {
+                int o = mObjects[i];
+                float d = intersectBox(origin, invDir, mObjectMin[o], mObjectMax[o], t);
+                if (d < 0.f)
+                    continue;
+                if (intersector) {
+                    if (intersector(o, t))
+                        hit = o;
+                }
+                else if (d < t) {
+                    t = d;
+                    hit = o;
+                }
+            }
+            continue;
+        }
+
+        // visit the closest child first
+        const Node& left = mNodes[node + 1];
+        const Node& right = mNodes[n.offset];
+        float dl = intersectBox(origin, invDir, left.bmin, left.bmax, t);
+        float dr = intersectBox(origin, invDir, right.bmin, right.bmax, t);
+        if (dl >= 0.f && dr >= 0.f) {
+            if (dl <= dr) {
+                stack.push_back(n.offset);
+                stack.push_back(node + 1);
+            }
+            else {
+                stack.push_back(node + 1);
+                stack.push_back(n.offset);
+            }
+        }
+        else if (dl >= 0.f)
+            stack.push_back(node + 1);
+        else if (dr >= 0.f)
+            stack.push_back(n.offset);
+    }
+    if (hit < 0)
+        t = 0.f;
+    return hit;
+}
+
+} // END namespace RenderSystem
@@ -0,0 +1,104 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef SCENEBVH_H
+#define SCENEBVH_H
+
+#include <functional>
+#include <vector>
+#include "glm/glm.hpp"
+
+// =============================================================================
+namespace RenderSystem {
+// =============================================================================
+
+class Frustum;
+
+/**
+  * @ingroup RenderSystem
+  * Bounding volume hierarchy over the boxes of the objects of a scene,
+  * built with the surface area heuristic (binned).
+  *
+  * Nodes are stored depth first in a single array: the left child of an
+  * inner node directly follows it, so a node only stores the index of its
+  * right child or, for a leaf, the range of its objects.
+  * When objects move, #updateObject() refits the path from their leaf to
+  * the root, and #refit() the whole tree, without changing its topology.
+  */
+class SceneBvh {
+public:
+    /// 32 bytes node
+    struct Node {
+        glm::vec3 bmin;
+        int offset;     ///< right child (inner node) or first object in #objects() (leaf)
+        glm::vec3 bmax;
+        int nbObjects;  ///< 0 for inner nodes
+        bool isLeaf() const { return nbObjects > 0; }
+    };
+
+    SceneBvh() {}
+
+    /// Build the tree over the boxes (bmin[i], bmax[i]) of the objects
+    void build(const std::vector<glm::vec3>& bmin, const std::vector<glm::vec3>& bmax);
+
+    void clear();
+
+    int nbObjects() const { return (int)mObjectMin.size(); }
+    int nbNodes() const { return (int)mNodes.size(); }
+    const std::vector<Node>& nodes() const { return mNodes; }
+    /// Objects ordered by leaf
+    const std::vector<int>& objects() const { return mObjects; }
+
+    /// Change the box of object "i" and enlarge or shrink its ancestors
+    void updateObject(int i, const glm::vec3& bmin, const glm::vec3& bmax);
+
+    /// Change the boxes of every object and refit all the nodes
+    void refit(const std::vector<glm::vec3>& bmin, const std::vector<glm::vec3>& bmax);
+
+    /// Hierarchical frustum culling.
+    /// @param visible : resized to #nbObjects(), 1 when the object may be
+    /// visible and 0 when it is culled
+    /// @return the number of visible objects
+    int cull(const Frustum& frustum, std::vector<unsigned char>& visible) const;
+
+    /// Exact intersection of a ray with an object whose box is hit:
+    /// (object, t) returns true and lowers t when the object is hit closer.
+    typedef std::function<bool(int, float&)> ObjectIntersector;
+
+    /// Closest object hit by the ray "origin + t dir" (t >= 0).
+    /// Objects are tested by their box, or by "intersector" when given.
+    /// @param t : distance to the hit point, in units of "dir"
+    /// @return the index of the object, -1 when nothing is hit
+    int raycast(const glm::vec3& origin, const glm::vec3& dir, float& t,
+                const ObjectIntersector& intersector = ObjectIntersector()) const;
+
+private:
+    int buildNode(int begin, int end, int parent);
+    /// Recompute the box of "node" from its children or its objects
+    void refitNode(int node);
+
+    std::vector<Node> mNodes;
+    std::vector<int> mParents;    ///< parent of each node, -1 for the root
+    std::vector<int> mObjects;    ///< object indices, contiguous per leaf
+    std::vector<int> mLeafOf;     ///< leaf of each object
+    std::vector<glm::vec3> mObjectMin;
+    std::vector<glm::vec3> mObjectMax;
+    std::vector<glm::vec3> mCentroids; ///< only used during the build
+};
+
+} // END namespace RenderSystem ================================================
+
+#endif // SCENEBVH_H
@@ -0,0 +1,187 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "gl_utils/glblock_allocator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <map>
+#include <vector>
+
+// Checks GlBlock_allocator: best fit, merging of the freed ranges, growth
+// and the moves of defragment(), then random allocations against a model.
+
+// -----------------------------------------------------------------------------
+
+static void testBestFit()
+{
+    GlBlock_allocator a(100);
+    CHECK(a.alloc(10) == 0);
+    const int b = a.alloc(20);
+    CHECK(a.alloc(5) == 30);
+    const int d = a.alloc(30);
+    CHECK(a.alloc(10) == 65);
+    CHECK(b == 10 && d == 35 && a.used() == 75);
+
+    // Holes of 20 (at 10) and 30 (at 35), 25 left at the end
+    a.free(b);
+    a.free(d);
+    CHECK(a.nb_free_ranges() == 3 && a.largest_free() == 30);
+    CHECK(a.alloc(18) == 10);
+    CHECK(a.alloc(26) == 35);
+    CHECK(a.alloc(25) == 75);
+    CHECK(a.alloc(5) == -1);
+    CHECK(a.size(75) == 25 && a.size(76) == 0);
+}
+
+// -----------------------------------------------------------------------------
+
+static void testMerge()
+{
+    GlBlock_allocator a(40);
+    int blocks[4];
+    for (int i = 0; i < 4; ++i)
+        blocks[i] = a.alloc(10);
+    CHECK(a.nb_free_ranges() == 0 && a.largest_free() == 0);
+
+    // Merged with the next free range, then with the previous one
+    a.free(blocks[2]);
+    a.free(blocks[1]);
+    CHECK(a.nb_free_ranges() == 1 && a.largest_free() == 20);
+    a.free(blocks[0]);
+    CHECK(a.nb_free_ranges() == 1 && a.largest_free() == 30);
+
+    // Growing extends the free range touching the end
+    a.free(blocks[3]);
+    a.grow(64);
+    CHECK(a.nb_free_ranges() == 1 && a.largest_free() == 64);
+    CHECK(a.alloc(64) == 0);
+    a.grow(32); // never shrinks
+    CHECK(a.capacity() == 64);
+}
+
+// -----------------------------------------------------------------------------
+
+static void testDefragment()
+{
+    GlBlock_allocator a(64);
+    std::map<int, int> blocks; // offset -> block id
+    int offsets[8];
+    for (int i = 0; i < 8; ++i) {
+        offsets[i] = a.alloc(3 + i);
+        blocks[offsets[i]] = i;
+    }
+    for (int i = 0; i < 8; i += 3) {
+        a.free(offsets[i]);
+        blocks.erase(offsets[i]);
+    }
+
+    // Buffer tagged with the id of the block owning each element
+    std::vector<int> data(64, -1);
+    for (std::map<int, int>::const_iterator it = blocks.begin(); it != blocks.end(); ++it)
+        for (int e = 0; e < 3 + it->second; ++e)
+            data[it->first + e] = it->second;
+
+    std::vector<GlBlock_allocator::Move> moves;
+    a.defragment(moves);
+    CHECK(!moves.empty());
+    for (unsigned m = 0; m < moves.size(); ++m) {
+        CHECK(m == 0 || moves[m].src > moves[m - 1].src);
+        CHECK(moves[m].dst < moves[m].src);
+        CHECK(blocks.count(moves[m].src) == 1);
+        for (int e = 0; e < moves[m].size; ++e)
+            data[moves[m].dst + e] = data[moves[m].src + e];
+    }
+
+    // Blocks packed in the same order, data carried along, one free range
+    int head = 0;
+    for (std::map<int, int>::const_iterator it = blocks.begin(); it != blocks.end(); ++it) {
+        const int size = 3 + it->second;
+        CHECK(a.size(head) == size);
+        bool intact = true;
+        for (int e = 0; e < size; ++e)
+            intact = intact && data[head + e] == it->second;
+        CHECK(intact);
+        head += size;
+    }
+    CHECK(a.used() == head && a.nb_blocks() == (int)blocks.size());
+    CHECK(a.nb_free_ranges() == 1 && a.largest_free() == 64 - head);
+    CHECK(a.alloc(64 - head) == head);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Random allocations and frees checked against the blocks handed out
+static void testRandom()
+{
+    const int capacity = 1000;
+    GlBlock_allocator a(capacity);
+    std::map<int, int> blocks; // offset -> size
+    srand(7);
+    for (int step = 0; step < 20000; ++step) {
+        if (blocks.empty() || rand() % 2 == 0) {
+            const int size = 1 + rand() % 50;
+            const int offset = a.alloc(size);
+            if (offset < 0) {
+                if (!CHECK(a.largest_free() < size))
+                    return;
+                continue;
+            }
+            blocks[offset] = size;
+        }
+        else {
+            std::map<int, int>::iterator it = blocks.begin();
+            std::advance(it, rand() % blocks.size());
+            a.free(it->first);
+            blocks.erase(it);
+        }
+
+        // Blocks don't overlap; the free ranges are the maximal gaps
+        // between them, so adjacent free ranges were merged
+        int used = 0, end = 0, nbGaps = 0, largest = 0;
+        bool overlap = false;
+        for (std::map<int, int>::const_iterator it = blocks.begin(); it != blocks.end(); ++it) {
+            overlap = overlap || it->first < end;
+            if (it->first > end) {
+                ++nbGaps;
+                largest = std::max(largest, it->first - end);
+            }
+            end = it->first + it->second;
+            used += it->second;
+        }
+        if (end < capacity) {
+            ++nbGaps;
+            largest = std::max(largest, capacity - end);
+        }
+        if (!CHECK(!overlap && end <= capacity && a.used() == used &&
+                   a.nb_free_ranges() == nbGaps && a.largest_free() == largest))
+            return;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    testBestFit();
+    testMerge();
+    testDefragment();
+    testRandom();
+    return Tests::testFailures();
+}
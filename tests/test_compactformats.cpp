@@ -0,0 +1,119 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "gl_utils/gldirect_draw.h"
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+
+#include <cstdlib>
+#include <cstring>
+
+// Round trip of the attributes through the compact vertex formats of
+// GlDirectDraw::set_compact_formats(), decoded like OpenGL does. No context
+// needed: GlDirectDraw::encode_attr() only packs bytes.
+
+// -----------------------------------------------------------------------------
+
+static float randomSigned() { return float(std::rand() % 2001) / 1000.f - 1.f; }
+
+static glm::uint32 encode(GLenum type, int nbComponents, const float* in)
+{
+    glm::uint32 out = 0;
+    GlDirectDraw::encode_attr(type, nbComponents, in, (char*)&out);
+    return out;
+}
+
+// -----------------------------------------------------------------------------
+
+/// Unit normals, 10 bits or 8 bits signed normalized components
+static void testNormals()
+{
+    for (int i = 0; i < 1000; ++i) {
+        glm::vec3 n = glm::normalize(glm::vec3(randomSigned(), randomSigned(), randomSigned()) + 1e-3f);
+        glm::uint32 packed = encode(GL_INT_2_10_10_10_REV, 4, &n[0]);
+        glm::vec3 n10 = glm::vec3(glm::unpackSnorm3x10_1x2(packed));
+        CHECK(glm::length(n10 - n) <= 2e-3f);
+
+        packed = encode(GL_BYTE, 4, &n[0]);
+        signed char bytes[4];
+        std::memcpy(bytes, &packed, 4);
+        glm::vec3 n8(bytes[0] / 127.f, bytes[1] / 127.f, bytes[2] / 127.f);
+        CHECK(glm::length(n8 - n) <= 8e-3f);
+        CHECK(bytes[3] == 0);
+    }
+    // Extremes are exact
+    const float axis[3] = { 1.f, -1.f, 0.f };
+    glm::vec4 n10 = glm::unpackSnorm3x10_1x2(encode(GL_INT_2_10_10_10_REV, 4, axis));
+    CHECK(n10.x == 1.f && n10.y == -1.f && n10.z == 0.f);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Colors in [0, 1], 8 bits unsigned normalized, out of range values clamped
+static void testColors()
+{
+    for (int i = 0; i < 1000; ++i) {
+        glm::vec4 c = glm::abs(glm::vec4(randomSigned(), randomSigned(), randomSigned(), randomSigned()));
+        glm::vec4 decoded = glm::unpackUnorm4x8(encode(GL_UNSIGNED_BYTE, 4, &c[0]));
+        for (int k = 0; k < 4; ++k)
+            CHECK(Tests::near(decoded[k], c[k], 0.5f / 255.f + 1e-6f));
+    }
+    const float outOfRange[4] = { -0.5f, 1.5f, 0.f, 1.f };
+    glm::vec4 decoded = glm::unpackUnorm4x8(encode(GL_UNSIGNED_BYTE, 4, outOfRange));
+    CHECK(decoded == glm::vec4(0.f, 1.f, 0.f, 1.f));
+}
+
+// -----------------------------------------------------------------------------
+
+/// Texture coordinates, two half floats (11 significant bits), tiled ones
+/// included
+static void testTexCoords()
+{
+    for (int i = 0; i < 1000; ++i) {
+        glm::vec2 uv(randomSigned() * 8.f, randomSigned() * 8.f);
+        glm::vec2 decoded = glm::unpackHalf2x16(encode(GL_HALF_FLOAT, 2, &uv[0]));
+        for (int k = 0; k < 2; ++k)
+            CHECK(Tests::near(decoded[k], uv[k], std::abs(uv[k]) * (1.f / 2048.f) + 1e-7f));
+    }
+    const float exact[2] = { 0.5f, 1024.f };
+    CHECK(glm::unpackHalf2x16(encode(GL_HALF_FLOAT, 2, exact)) == glm::vec2(0.5f, 1024.f));
+}
+
+// -----------------------------------------------------------------------------
+
+/// Other types are copied as floats
+static void testFloats()
+{
+    const float in[3] = { 0.1f, -2.f, 3e6f };
+    float out[3];
+    GlDirectDraw::encode_attr(GL_FLOAT, 3, in, (char*)out);
+    CHECK(std::memcmp(in, out, sizeof(in)) == 0);
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    std::srand(5);
+    testNormals();
+    testColors();
+    testTexCoords();
+    testFloats();
+    return Tests::testFailures();
+}
@@ -0,0 +1,161 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "gl_utils/glstate.h"
+
+#include <string>
+#include <vector>
+
+// Checks GlState only forwards the calls changing a state, with a fake
+// recording the OpenGL calls instead of a context.
+
+// -----------------------------------------------------------------------------
+
+/// Calls forwarded by the GlState under test
+static std::vector<std::string> g_calls;
+
+static void record(const char* name, long a = 0, long b = 0)
+{
+    g_calls.push_back(std::string(name) + "(" + std::to_string(a) + "," + std::to_string(b) + ")");
+}
+
+static void fake_use_program(GLuint program) { record("use_program", program); }
+static void fake_bind_vertex_array(GLuint vao) { record("bind_vertex_array", vao); }
+static void fake_bind_buffer(GLenum target, GLuint buffer) { record("bind_buffer", target, buffer); }
+static void fake_bind_buffer_base(GLenum target, GLuint /*index*/, GLuint buffer) { record("bind_buffer_base", target, buffer); }
+static void fake_polygon_mode(GLenum /*face*/, GLenum mode) { record("polygon_mode", mode); }
+static void fake_enable(GLenum cap) { record("enable", cap); }
+static void fake_disable(GLenum cap) { record("disable", cap); }
+static void fake_depth_func(GLenum func) { record("depth_func", func); }
+static void fake_depth_mask(GLboolean flag) { record("depth_mask", flag); }
+static void fake_viewport(GLint x, GLint y, GLsizei width, GLsizei height) { record("viewport", x + y, width * height); }
+
+static GlState_functions recording_functions()
+{
+    GlState_functions f;
+    f.use_program = fake_use_program;
+    f.bind_vertex_array = fake_bind_vertex_array;
+    f.bind_buffer = fake_bind_buffer;
+    f.bind_buffer_base = fake_bind_buffer_base;
+    f.polygon_mode = fake_polygon_mode;
+    f.enable = fake_enable;
+    f.disable = fake_disable;
+    f.depth_func = fake_depth_func;
+    f.depth_mask = fake_depth_mask;
+    f.viewport = fake_viewport;
+    return f;
+}
+
+// -----------------------------------------------------------------------------
+
+/// The states set by the renderer for one frame
+static void frame(GlState& gl)
+{
+    gl.viewport(0, 0, 800, 450);
+    gl.enable(GL_DEPTH_TEST);
+    gl.depth_func(GL_LESS);
+    gl.depth_mask(true);
+    gl.polygon_mode(GL_FILL);
+    for (int mesh = 1; mesh <= 3; ++mesh) {
+        gl.use_program(7);
+        gl.bind_vertex_array(mesh);
+        gl.bind_buffer(GL_ARRAY_BUFFER, 10 + mesh);
+    }
+    gl.bind_buffer_base(GL_UNIFORM_BUFFER, 0, 20);
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_redundant_calls()
+{
+    g_calls.clear();
+    GlState gl(recording_functions());
+
+    // First frame: everything is unknown, each distinct value is issued
+    frame(gl);
+    const std::size_t first = g_calls.size();
+    CHECK(first == 5 + 1 + 3 + 3 + 1);
+    CHECK(gl.nb_issued() == int(first) && gl.nb_skipped() == 2);
+
+    // Same frame again, without invalidate() in between: only the bindings
+    // changing inside the frame are issued
+    gl.reset_counters();
+    frame(gl);
+    CHECK(g_calls.size() - first == 3 + 3);
+    CHECK(gl.nb_issued() == 6 && gl.nb_skipped() == 5 + 3 + 1);
+
+    // After invalidate() the first call of every state goes through again
+    gl.invalidate();
+    gl.reset_counters();
+    frame(gl);
+    CHECK(gl.nb_issued() == int(first) && gl.nb_skipped() == 2);
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_shadow_rules()
+{
+    g_calls.clear();
+    GlState gl(recording_functions());
+
+    // The index buffer binding belongs to the VAO
+    gl.bind_vertex_array(1);
+    gl.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 5);
+    gl.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 5);
+    CHECK(g_calls.size() == 2);
+    gl.bind_vertex_array(2);
+    gl.bind_buffer(GL_ELEMENT_ARRAY_BUFFER, 5);
+    CHECK(g_calls.size() == 4);
+
+    // Targets and capabilities not tracked are always forwarded
+    gl.bind_buffer(GL_COPY_WRITE_BUFFER, 3);
+    gl.bind_buffer(GL_COPY_WRITE_BUFFER, 3);
+    gl.enable(GL_POLYGON_OFFSET_FILL);
+    gl.enable(GL_POLYGON_OFFSET_FILL);
+    CHECK(g_calls.size() == 8);
+
+    // A deleted buffer is unbound: binding 0 afterwards is redundant, and
+    // its name bound again once reused
+    gl.bind_buffer(GL_ARRAY_BUFFER, 9);
+    gl.forget_buffer(9);
+    gl.bind_buffer(GL_ARRAY_BUFFER, 0);
+    CHECK(g_calls.size() == 9);
+    gl.bind_buffer(GL_ARRAY_BUFFER, 9);
+    CHECK(g_calls.size() == 10);
+
+    // A deleted program stays in use: the next use_program() is issued
+    gl.use_program(4);
+    gl.forget_program(4);
+    gl.use_program(4);
+    CHECK(g_calls.size() == 12);
+
+    // glBindBufferBase() also binds the generic target
+    gl.bind_buffer_base(GL_UNIFORM_BUFFER, 1, 6);
+    gl.bind_buffer(GL_UNIFORM_BUFFER, 6);
+    CHECK(g_calls.size() == 13);
+    CHECK(g_calls.back() == "bind_buffer_base(" + std::to_string(GL_UNIFORM_BUFFER) + ",6)");
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    test_redundant_calls();
+    test_shadow_rules();
+    return Tests::testFailures();
+}
@@ -0,0 +1,150 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "rendersystem/lockfreequeue.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// Checks LockFreeQueue: full and empty at its capacity over many laps of its
+// cells, then producers and consumers racing on a small queue, every value
+// popped exactly once and in the order its producer pushed it.
+
+using namespace RenderSystem;
+
+// -----------------------------------------------------------------------------
+
+static void testFullEmpty()
+{
+    LockFreeQueue<int> queue(5);
+    CHECK(queue.capacity() == 8);
+    int value = -1;
+    CHECK(!queue.pop(value) && value == -1);
+
+    int next = 0;
+    int expected = 0;
+    for (int lap = 0; lap < 50; ++lap) {
+        // Up to full, then one fewer value popped every lap: the positions
+        // wrap around the cells at every offset
+        while (queue.push(next))
+            ++next;
+        CHECK(queue.size() == queue.capacity());
+        CHECK(!queue.push(-1));
+        const int nbPopped = 1 + lap % 8;
+        for (int i = 0; i < nbPopped; ++i) {
+            CHECK(queue.pop(value));
+            CHECK(value == expected++);
+        }
+        CHECK(queue.size() == queue.capacity() - nbPopped);
+    }
+    while (queue.pop(value))
+        CHECK(value == expected++);
+    CHECK(expected == next);
+    CHECK(queue.size() == 0);
+    CHECK(!queue.pop(value));
+
+    // Still usable once drained
+    CHECK(queue.push(42));
+    CHECK(queue.pop(value) && value == 42);
+}
+
+// -----------------------------------------------------------------------------
+
+static const int NB_PRODUCERS = 4;
+static const int NB_CONSUMERS = 4;
+static const int NB_VALUES = 50000; ///< per producer
+
+struct Stress {
+    LockFreeQueue<int> queue;
+    std::atomic<int> nbPopped;
+    std::vector<std::atomic<int> > seen;
+    std::atomic<int> nbOutOfOrder;
+
+    Stress()
+        : queue(16)
+        , nbPopped(0)
+        , seen(NB_PRODUCERS * NB_VALUES)
+        , nbOutOfOrder(0)
+    {
+        for (std::size_t i = 0; i < seen.size(); ++i)
+            seen[i].store(0);
+    }
+};
+
+static void produce(Stress* s, int producer)
+{
+    for (int i = 0; i < NB_VALUES; ++i) {
+        // Full: the consumers are behind
+        while (!s->queue.push(producer * NB_VALUES + i))
+            std::this_thread::yield();
+    }
+}
+
+static void consume(Stress* s)
+{
+    // The values of a producer reach every consumer in the order pushed
+    int last[NB_PRODUCERS];
+    for (int p = 0; p < NB_PRODUCERS; ++p)
+        last[p] = -1;
+    const int total = NB_PRODUCERS * NB_VALUES;
+    while (s->nbPopped.load() < total) {
+        int value;
+        if (!s->queue.pop(value)) {
+            std::this_thread::yield();
+            continue;
+        }
+        s->seen[value].fetch_add(1);
+        const int producer = value / NB_VALUES;
+        if (value % NB_VALUES <= last[producer])
+            s->nbOutOfOrder.fetch_add(1);
+        last[producer] = value % NB_VALUES;
+        s->nbPopped.fetch_add(1);
+    }
+}
+
+static void testProducersConsumers()
+{
+    Stress s;
+    std::vector<std::thread> threads;
+    for (int c = 0; c < NB_CONSUMERS; ++c)
+        threads.push_back(std::thread(consume, &s));
+    for (int p = 0; p < NB_PRODUCERS; ++p)
+        threads.push_back(std::thread(produce, &s, p));
+    for (std::size_t i = 0; i < threads.size(); ++i)
+        threads[i].join();
+
+    CHECK(s.nbPopped.load() == NB_PRODUCERS * NB_VALUES);
+    int nbWrong = 0;
+    for (std::size_t i = 0; i < s.seen.size(); ++i)
+        if (s.seen[i].load() != 1)
+            ++nbWrong;
+    CHECK(nbWrong == 0);
+    CHECK(s.nbOutOfOrder.load() == 0);
+    int value;
+    CHECK(!s.queue.pop(value));
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    testFullEmpty();
+    testProducersConsumers();
+    return Tests::testFailures();
+}
@@ -0,0 +1,122 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "fileloaders/mesh.h"
+#include "fileloaders/meshcache.h"
+#include "fileloaders/objloader.h"
+
+#include <QFileInfo>
+#include <QString>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+// Checks the binary mesh cache gives back the parsed meshes and is only
+// used with the loader options it was written with.
+
+using namespace Loaders;
+
+// -----------------------------------------------------------------------------
+
+/// @return true if the meshes were read from the cache
+/// @param cacheDirectory : see ObjLoader::setCacheDirectory()
+static bool load(const std::string& path, bool optimize, std::vector<float>& vertices, std::vector<int>& triangles,
+                 bool useCache = true, const std::string& cacheDirectory = std::string())
+{
+    Obj_mtl::ObjLoader loader;
+    loader.setOptimizeMeshes(optimize);
+    loader.setUseMeshCache(useCache);
+    loader.setCacheDirectory(QString(cacheDirectory.c_str()));
+    QString reason;
+    CHECK(loader.load(QString(path.c_str()), reason));
+    std::vector<Mesh*> meshes;
+    loader.getObjects(meshes);
+    bool parametrized;
+    for (std::size_t i = 0; i < meshes.size(); ++i) {
+        meshes[i]->getData(vertices, triangles, parametrized);
+        delete meshes[i];
+    }
+    return reason.toStdString().find("loaded from") != std::string::npos;
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    std::ostringstream obj;
+    const int n = 30;
+    for (int j = 0; j <= n; ++j)
+        for (int i = 0; i <= n; ++i)
+            obj << "v " << i << " " << j << " " << (i * j) % 5 << "\n";
+    obj << "g grid\ns 1\n";
+    // rows in a scrambled order so that the optimization changes the meshes
+    for (int k = 0; k < n; ++k) {
+        int j = (k * 7) % n;
+        for (int i = 0; i < n; ++i) {
+            int a = j * (n + 1) + i + 1;
+            obj << "f " << a << " " << a + 1 << " " << a + n + 2 << " " << a + n + 1 << "\n";
+        }
+    }
+    std::string path = Tests::writeTestFile("test_meshcache.obj", obj.str());
+    std::remove(MeshCache::cachePath(path).c_str());
+
+    std::vector<float> parsed, cached, optimized, optimizedCached;
+    std::vector<int> parsedTris, cachedTris, optimizedTris, optimizedCachedTris;
+    CHECK(!load(path, false, parsed, parsedTris));
+    CHECK(load(path, false, cached, cachedTris));
+    CHECK(parsed == cached);
+    CHECK(parsedTris == cachedTris);
+
+    // other options: the cache is rebuilt, not reused
+    CHECK(!load(path, true, optimized, optimizedTris));
+    CHECK(optimizedTris != parsedTris);
+    CHECK(load(path, true, optimizedCached, optimizedCachedTris));
+    CHECK(optimized == optimizedCached);
+    CHECK(optimizedTris == optimizedCachedTris);
+
+    std::remove(MeshCache::cachePath(path).c_str());
+
+    // Off by default: nothing is written beside the file
+    {
+        std::vector<float> v;
+        std::vector<int> t;
+        CHECK(!load(path, false, v, t, false));
+        CHECK(!load(path, false, v, t, false));
+        CHECK(!std::ifstream(MeshCache::cachePath(path).c_str()));
+    }
+
+    // In a cache directory, created on demand, named after the absolute path
+    {
+        const std::string directory = "test_meshcache_dir";
+        std::vector<float> v0, v1;
+        std::vector<int> t0, t1;
+        CHECK(!load(path, false, v0, t0, true, directory));
+        CHECK(load(path, false, v1, t1, true, directory));
+        CHECK(v0 == parsed && t0 == parsedTris);
+        CHECK(v1 == parsed && t1 == parsedTris);
+        CHECK(!std::ifstream(MeshCache::cachePath(path).c_str()));
+        const std::string cache = MeshCache::cachePath(QFileInfo(path.c_str()).absoluteFilePath().toStdString(), directory);
+        CHECK(cache.compare(0, directory.size(), directory) == 0);
+        CHECK(std::ifstream(cache.c_str()).good());
+        CHECK(MeshCache::cachePath("/a/model.obj", directory) != MeshCache::cachePath("/b/model.obj", directory));
+        std::remove(cache.c_str());
+        std::remove(directory.c_str());
+    }
+    return Tests::testFailures();
+}
@@ -0,0 +1,178 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "fileloaders/mesh.h"
+#include "fileloaders/meshlet.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <set>
+#include <vector>
+#include "glm/glm.hpp"
+
+// Checks Meshlet::build() respects its limits and covers the mesh, and that
+// the normal cone culling is conservative.
+
+using namespace Loaders;
+
+// -----------------------------------------------------------------------------
+
+/// Unit sphere subdivided from an octahedron (8 * 4^level triangles,
+/// counter clockwise seen from outside), one vertex per position
+static Mesh makeSphere(int level, std::vector<float>& buffer)
+{
+    std::vector<glm::vec3> soup;
+    const glm::vec3 axes[6] = { glm::vec3(1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, 0, 1),
+                                glm::vec3(-1, 0, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, -1) };
+    for (int x = 0; x < 6; x += 3)
+        for (int y = 1; y < 6; y += 3)
+            for (int z = 2; z < 6; z += 3) {
+                bool flip = ((x == 3) + (y == 4) + (z == 5)) % 2 == 1;
+                soup.push_back(axes[x]);
+                soup.push_back(flip ? axes[z] : axes[y]);
+                soup.push_back(flip ? axes[y] : axes[z]);
+            }
+    for (int l = 0; l < level; ++l) {
+        std::vector<glm::vec3> finer;
+        for (std::size_t t = 0; t < soup.size(); t += 3) {
+            glm::vec3 a = soup[t], b = soup[t + 1], c = soup[t + 2];
+            glm::vec3 ab = glm::normalize(a + b), bc = glm::normalize(b + c), ca = glm::normalize(c + a);
+            glm::vec3 tris[12] = { a, ab, ca, ab, b, bc, ca, bc, c, ab, bc, ca };
+            finer.insert(finer.end(), tris, tris + 12);
+        }
+        soup.swap(finer);
+    }
+    std::vector<int> triangles;
+    std::vector<glm::vec3> unique;
+    for (std::size_t i = 0; i < soup.size(); ++i) {
+        std::size_t v = std::find(unique.begin(), unique.end(), soup[i]) - unique.begin();
+        if (v == unique.size()) {
+            unique.push_back(soup[i]);
+            float vertex[8] = { soup[i].x, soup[i].y, soup[i].z, soup[i].x, soup[i].y, soup[i].z, 0.f, 0.f };
+            buffer.insert(buffer.end(), vertex, vertex + 8);
+        }
+        triangles.push_back(int(v));
+    }
+    return Mesh(buffer, triangles, std::vector<int>(), true, true);
+}
+
+static glm::vec3 position(const std::vector<float>& buffer, unsigned int v)
+{
+    return glm::vec3(buffer[8 * v], buffer[8 * v + 1], buffer[8 * v + 2]);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Limits, coverage of the mesh and bounds of each meshlet
+static void testLimits(Mesh& mesh, const std::vector<float>& buffer, int maxVertices, int maxTriangles)
+{
+    std::vector<float> data;
+    std::vector<int> originalTriangles;
+    bool parametrized;
+    mesh.getData(data, originalTriangles, parametrized);
+
+    std::vector<Meshlet> meshlets;
+    std::vector<unsigned int> indices;
+    Meshlet::build(mesh, meshlets, indices, maxVertices, maxTriangles);
+
+    CHECK(indices.size() == 3 * std::size_t(mesh.nbTriangles()));
+    int next = 0;
+    int overflows = 0, badBounds = 0;
+    for (std::size_t i = 0; i < meshlets.size(); ++i) {
+        const Meshlet& m = meshlets[i];
+        CHECK(m.firstIndex == next);
+        next += 3 * m.nbTriangles;
+        std::set<unsigned int> vertices(indices.begin() + m.firstIndex, indices.begin() + next);
+        overflows += (m.nbTriangles > maxTriangles || m.nbVertices > maxVertices) ? 1 : 0;
+        CHECK(m.nbVertices == int(vertices.size()));
+
+        for (int k = m.firstIndex; k < next; ++k)
+            badBounds += glm::length(position(buffer, indices[k]) - m.center) > m.radius * 1.0001f ? 1 : 0;
+        for (int k = m.firstIndex; k < next && m.coneCutoff > 0.f; k += 3) {
+            glm::vec3 p0 = position(buffer, indices[k]);
+            glm::vec3 n = glm::normalize(glm::cross(position(buffer, indices[k + 1]) - p0, position(buffer, indices[k + 2]) - p0));
+            badBounds += glm::dot(n, m.coneAxis) < m.coneCutoff - 1e-5f ? 1 : 0;
+        }
+    }
+    CHECK(next == int(indices.size()));
+    CHECK(overflows == 0);
+    CHECK(badBounds == 0);
+
+    // same triangles, each once
+    std::multiset<std::vector<unsigned int> > before, after;
+    for (std::size_t t = 0; t < originalTriangles.size(); t += 3) {
+        std::vector<unsigned int> tri(originalTriangles.begin() + t, originalTriangles.begin() + t + 3);
+        std::vector<unsigned int> built(indices.begin() + t, indices.begin() + t + 3);
+        // same winding: compare from the smallest index
+        std::rotate(tri.begin(), std::min_element(tri.begin(), tri.end()), tri.end());
+        std::rotate(built.begin(), std::min_element(built.begin(), built.end()), built.end());
+        before.insert(tri);
+        after.insert(built);
+    }
+    CHECK(before == after);
+
+    // the greedy growth fills the meshlets
+    CHECK(double(mesh.nbTriangles()) / meshlets.size() > 0.5 * std::min(maxTriangles, maxVertices));
+}
+
+// -----------------------------------------------------------------------------
+
+/// A back facing meshlet has no front facing triangle, and about the far
+/// half of a sphere is culled
+static void testConeCulling(const Mesh& mesh, const std::vector<float>& buffer)
+{
+    std::vector<Meshlet> meshlets;
+    std::vector<unsigned int> indices;
+    Meshlet::build(mesh, meshlets, indices, 64, 124);
+
+    std::srand(17);
+    int wrong = 0;
+    std::size_t culled = 0, tested = 0;
+    for (int e = 0; e < 50; ++e) {
+        glm::vec3 eye(std::rand() % 2001 - 1000, std::rand() % 2001 - 1000, std::rand() % 2001 - 1000);
+        eye = glm::normalize(eye + glm::vec3(0.5f)) * (1.5f + float(std::rand() % 100) / 10.f);
+        for (std::size_t i = 0; i < meshlets.size(); ++i) {
+            const Meshlet& m = meshlets[i];
+            ++tested;
+            if (!m.isBackFacing(eye))
+                continue;
+            ++culled;
+            for (int k = m.firstIndex; k < m.firstIndex + 3 * m.nbTriangles; k += 3) {
+                glm::vec3 p0 = position(buffer, indices[k]);
+                glm::vec3 n = glm::cross(position(buffer, indices[k + 1]) - p0, position(buffer, indices[k + 2]) - p0);
+                wrong += glm::dot(n, eye - p0) > 0.f ? 1 : 0;
+            }
+        }
+    }
+    CHECK(wrong == 0);
+    CHECK(culled > tested / 4);
+    CHECK(culled < tested / 2);
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    std::vector<float> buffer;
+    Mesh sphere = makeSphere(5, buffer); // 8192 triangles
+    testLimits(sphere, buffer, 64, 124);
+    testLimits(sphere, buffer, 32, 32);
+    testLimits(sphere, buffer, 128, 64);
+    testConeCulling(sphere, buffer);
+    return Tests::testFailures();
+}
@@ -0,0 +1,301 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "fileloaders/mesh.h"
+#include "fileloaders/meshsimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <vector>
+#include "glm/glm.hpp"
+
+// Checks the LOD chains of MeshSimplifier: triangle budgets, error bounds,
+// unwelded and flat shaded meshes, and UV seams / hard edges kept intact.
+
+using namespace Loaders;
+
+// -----------------------------------------------------------------------------
+
+enum SphereVertices {
+    WELDED,     ///< one vertex per position, smooth normals
+    DUPLICATED, ///< one vertex per corner, smooth normals
+    FLAT        ///< one vertex per corner, face normals
+};
+
+/// Unit sphere subdivided from an octahedron: 8 * 4^level triangles
+static Mesh makeSphere(int level, SphereVertices vertices)
+{
+    std::vector<glm::vec3> soup;
+    const glm::vec3 axes[6] = { glm::vec3(1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, 0, 1),
+                                glm::vec3(-1, 0, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, -1) };
+    for (int x = 0; x < 6; x += 3)
+        for (int y = 1; y < 6; y += 3)
+            for (int z = 2; z < 6; z += 3) {
+                bool flip = ((x == 3) + (y == 4) + (z == 5)) % 2 == 1;
+                soup.push_back(axes[x]);
+                soup.push_back(flip ? axes[z] : axes[y]);
+                soup.push_back(flip ? axes[y] : axes[z]);
+            }
+    for (int l = 0; l < level; ++l) {
+        std::vector<glm::vec3> finer;
+        for (std::size_t t = 0; t < soup.size(); t += 3) {
+            glm::vec3 a = soup[t], b = soup[t + 1], c = soup[t + 2];
+            glm::vec3 ab = glm::normalize(a + b), bc = glm::normalize(b + c), ca = glm::normalize(c + a);
+            glm::vec3 tris[12] = { a, ab, ca, ab, b, bc, ca, bc, c, ab, bc, ca };
+            finer.insert(finer.end(), tris, tris + 12);
+        }
+        soup.swap(finer);
+    }
+
+    std::vector<float> buffer;
+    std::vector<int> triangles;
+    std::map<std::vector<float>, int> welder;
+    for (std::size_t i = 0; i < soup.size(); ++i) {
+        const glm::vec3& p = soup[i];
+        glm::vec3 n = p;
+        if (vertices == FLAT) {
+            std::size_t t = i - i % 3;
+            n = glm::normalize(glm::cross(soup[t + 1] - soup[t], soup[t + 2] - soup[t]));
+        }
+        float vertex[8] = { p.x, p.y, p.z, n.x, n.y, n.z, 0.f, 0.f };
+        std::vector<float> key(vertex, vertex + 3);
+        if (vertices == WELDED && welder.count(key)) {
+            triangles.push_back(welder[key]);
+            continue;
+        }
+        welder[key] = int(buffer.size() / 8);
+        triangles.push_back(int(buffer.size() / 8));
+        buffer.insert(buffer.end(), vertex, vertex + 8);
+    }
+    return Mesh(buffer, triangles, std::vector<int>(), true, true);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Height field grid of n x n quads on [0, 1]^2, "height" gives z
+template <class Height>
+static Mesh makeGrid(int n, Height height, bool uvSeam)
+{
+    std::vector<float> buffer;
+    std::vector<int> triangles;
+    // with a seam, the middle column has two vertices: one per UV island
+    const int seamColumn = uvSeam ? n / 2 : -1;
+    std::vector<int> left((n + 1) * (n + 1)), right((n + 1) * (n + 1));
+    for (int j = 0; j <= n; ++j) {
+        for (int i = 0; i <= n; ++i) {
+            float x = float(i) / n, y = float(j) / n;
+            for (int island = 0; island < (i == seamColumn ? 2 : 1); ++island) {
+                float u = (i < seamColumn || (i == seamColumn && island == 0)) ? x : x + 1.f;
+                float vertex[8] = { x, y, height(x, y), 0.f, 0.f, 1.f, u, y };
+                int index = int(buffer.size() / 8);
+                (island == 0 ? left : right)[j * (n + 1) + i] = index;
+                if (i != seamColumn)
+                    right[j * (n + 1) + i] = index;
+                buffer.insert(buffer.end(), vertex, vertex + 8);
+            }
+        }
+    }
+    for (int j = 0; j < n; ++j) {
+        for (int i = 0; i < n; ++i) {
+            const std::vector<int>& side = (i < seamColumn) ? left : right;
+            int a = side[j * (n + 1) + i], b = side[j * (n + 1) + i + 1];
+            int c = side[(j + 1) * (n + 1) + i + 1], d = side[(j + 1) * (n + 1) + i];
+            int quad[6] = { a, b, c, a, c, d };
+            triangles.insert(triangles.end(), quad, quad + 6);
+        }
+    }
+    Mesh mesh(buffer, triangles, std::vector<int>(), true, true);
+    mesh.computeNormals();
+    return mesh;
+}
+
+static float flat(float, float) { return 0.f; }
+static float wave(float x, float y) { return 0.05f * std::sin(6.f * x) * std::cos(5.f * y); }
+
+// -----------------------------------------------------------------------------
+
+static std::size_t nbTriangles(const MeshLod& lod) { return lod.indices.size() / 3; }
+
+/// Positions of the vertices of a mesh, through its 8 floats vertices
+static std::vector<float> vertexData(Mesh& mesh)
+{
+    std::vector<float> data;
+    std::vector<int> triangles;
+    bool parametrized;
+    mesh.getData(data, triangles, parametrized);
+    return data;
+}
+
+// -----------------------------------------------------------------------------
+
+/// simplify() reaches the budget asked and each level halves the previous one
+static void testTriangleBudget()
+{
+    Mesh sphere = makeSphere(5, WELDED); // 8192 triangles
+    MeshSimplifier simplifier(sphere);
+
+    std::vector<MeshLod> lods;
+    simplifier.buildLodChain(lods, 6, 0.5f, 100);
+    CHECK(lods.size() == 6);
+    CHECK(nbTriangles(lods[0]) == 8192);
+    for (std::size_t l = 1; l < lods.size(); ++l) {
+        CHECK(nbTriangles(lods[l]) <= nbTriangles(lods[l - 1]) / 2);
+        // within a few triangles of the target
+        CHECK(nbTriangles(lods[l]) + 8 >= nbTriangles(lods[l - 1]) / 2);
+    }
+
+    const std::size_t budgets[] = { 4000, 1000, 200 };
+    for (int b = 0; b < 3; ++b) {
+        std::vector<unsigned int> indices = lods[0].indices;
+        simplifier.simplify(indices, budgets[b]);
+        CHECK(indices.size() / 3 <= budgets[b]);
+        CHECK(indices.size() / 3 > budgets[b] / 2);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+/// Errors grow with the levels and bound the deviation of the simplified
+/// surface; a plane is simplified without error
+static void testErrorBound()
+{
+    Mesh sphere = makeSphere(5, WELDED);
+    std::vector<MeshLod> lods;
+    MeshSimplifier(sphere).buildLodChain(lods, 6, 0.5f, 100);
+    std::vector<float> data = vertexData(sphere);
+    for (std::size_t l = 1; l < lods.size(); ++l) {
+        CHECK(lods[l].error >= lods[l - 1].error);
+        // the surface between the kept vertices sinks inside the sphere
+        float deviation = 0.f;
+        for (std::size_t i = 0; i < lods[l].indices.size(); i += 3) {
+            glm::vec3 centroid(0.f);
+            for (int k = 0; k < 3; ++k)
+                centroid += glm::vec3(data[8 * lods[l].indices[i + k]], data[8 * lods[l].indices[i + k] + 1], data[8 * lods[l].indices[i + k] + 2]) / 3.f;
+            deviation = std::max(deviation, 1.f - glm::length(centroid));
+        }
+        CHECK(lods[l].error > 0.f);
+        CHECK(deviation <= 2.f * lods[l].error + 1e-3f);
+    }
+
+    Mesh plane = makeGrid(32, flat, false);
+    MeshSimplifier(plane).buildLodChain(lods, 4, 0.5f, 16);
+    CHECK(lods.size() == 4);
+    for (std::size_t l = 1; l < lods.size(); ++l)
+        CHECK(lods[l].error < 1e-4f);
+
+    Mesh waves = makeGrid(32, wave, false);
+    MeshSimplifier(waves).buildLodChain(lods, 4, 0.5f, 16);
+    CHECK(lods.size() == 4);
+    CHECK(lods.back().error > 0.f && lods.back().error < 0.05f);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Vertices duplicated per corner, with equal or flat normals, simplify
+/// like the welded mesh
+static void testUnweldedMeshes()
+{
+    std::vector<MeshLod> welded;
+    MeshSimplifier(makeSphere(4, WELDED)).buildLodChain(welded, 5, 0.5f, 64);
+    const SphereVertices modes[] = { DUPLICATED, FLAT };
+    for (int m = 0; m < 2; ++m) {
+        std::vector<MeshLod> lods;
+        MeshSimplifier(makeSphere(4, modes[m])).buildLodChain(lods, 5, 0.5f, 64);
+        CHECK(lods.size() == welded.size());
+        for (std::size_t l = 1; l < lods.size() && l < welded.size(); ++l)
+            CHECK(nbTriangles(lods[l]) <= nbTriangles(welded[l - 1]) / 2);
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+/// Every triangle of a level keeps its corners in one UV island, and in a
+/// flat shaded cube each triangle keeps the normal of its face
+static void testSeamsKept()
+{
+    Mesh grid = makeGrid(32, wave, true);
+    std::vector<float> data = vertexData(grid);
+    std::vector<MeshLod> lods;
+    MeshSimplifier(grid).buildLodChain(lods, 4, 0.5f, 16);
+    CHECK(lods.size() > 2);
+    int mixed = 0;
+    for (std::size_t l = 1; l < lods.size(); ++l) {
+        for (std::size_t i = 0; i < lods[l].indices.size(); i += 3) {
+            int island[3];
+            for (int k = 0; k < 3; ++k) {
+                unsigned int v = lods[l].indices[i + k];
+                island[k] = data[8 * v + 6] > data[8 * v] + 0.5f ? 1 : 0;
+            }
+            mixed += (island[0] != island[1] || island[1] != island[2]) ? 1 : 0;
+        }
+    }
+    CHECK(mixed == 0);
+
+    // cube: 6 faces of 8 x 8 quads, flat shaded by face
+    std::vector<float> buffer;
+    std::vector<int> triangles;
+    const int n = 8;
+    for (int f = 0; f < 6; ++f) {
+        glm::vec3 normal(0.f);
+        normal[f % 3] = f < 3 ? 1.f : -1.f;
+        glm::vec3 u(0.f), v(0.f);
+        u[(f + 1) % 3] = 1.f;
+        v[(f + 2) % 3] = f < 3 ? 1.f : -1.f;
+        int first = int(buffer.size() / 8);
+        for (int j = 0; j <= n; ++j)
+            for (int i = 0; i <= n; ++i) {
+                glm::vec3 p = normal + (2.f * i / n - 1.f) * u + (2.f * j / n - 1.f) * v;
+                float vertex[8] = { p.x, p.y, p.z, normal.x, normal.y, normal.z, 0.f, 0.f };
+                buffer.insert(buffer.end(), vertex, vertex + 8);
+            }
+        for (int j = 0; j < n; ++j)
+            for (int i = 0; i < n; ++i) {
+                int a = first + j * (n + 1) + i, b = a + 1, c = a + n + 2, d = a + n + 1;
+                int quad[6] = { a, b, c, a, c, d };
+                triangles.insert(triangles.end(), quad, quad + 6);
+            }
+    }
+    Mesh cube(buffer, triangles, std::vector<int>(), true, true);
+    MeshSimplifier(cube).buildLodChain(lods, 4, 0.5f, 16);
+    CHECK(lods.size() > 2);
+    int creased = 0;
+    for (std::size_t l = 1; l < lods.size(); ++l) {
+        for (std::size_t i = 0; i < lods[l].indices.size(); i += 3) {
+            const float* n0 = &buffer[8 * lods[l].indices[i] + 3];
+            for (int k = 1; k < 3; ++k) {
+                const float* nk = &buffer[8 * lods[l].indices[i + k] + 3];
+                creased += (n0[0] != nk[0] || n0[1] != nk[1] || n0[2] != nk[2]) ? 1 : 0;
+            }
+        }
+        CHECK(lods[l].error < 1e-4f);
+    }
+    CHECK(creased == 0);
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    testTriangleBudget();
+    testErrorBound();
+    testUnweldedMeshes();
+    testSeamsKept();
+    return Tests::testFailures();
+}
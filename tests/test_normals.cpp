@@ -0,0 +1,144 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "fileloaders/mesh.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <vector>
+#include "glm/glm.hpp"
+
+// Checks the parallel per vertex gather of Mesh::computeNormals() against
+// the serial per face scatter it replaced, for each weighting.
+
+using namespace Loaders;
+
+// -----------------------------------------------------------------------------
+
+/// Bumpy grid of n x n quads, plus a degenerated triangle and a vertex no
+/// face uses (both must end up with a null normal)
+static void makeGrid(int n, std::vector<float>& vertices, std::vector<int>& triangles)
+{
+    std::srand(3);
+    for (int j = 0; j <= n; ++j) {
+        for (int i = 0; i <= n; ++i) {
+            float h = float(std::rand() % 1000) / 1000.f;
+            float vertex[8] = { float(i), float(j), h, 1.f, 1.f, 1.f, 0.f, 0.f };
+            vertices.insert(vertices.end(), vertex, vertex + 8);
+        }
+    }
+    for (int j = 0; j < n; ++j) {
+        for (int i = 0; i < n; ++i) {
+            int a = j * (n + 1) + i, b = a + 1, c = a + n + 2, d = a + n + 1;
+            int quad[6] = { a, b, c, a, c, d };
+            triangles.insert(triangles.end(), quad, quad + 6);
+        }
+    }
+    int first = int(vertices.size() / 8);
+    for (int k = 0; k < 4; ++k) {
+        float vertex[8] = { 5.f, 5.f, 5.f, 1.f, 1.f, 1.f, 0.f, 0.f };
+        vertices.insert(vertices.end(), vertex, vertex + 8);
+    }
+    int degenerated[3] = { first, first + 1, first + 2 };
+    triangles.insert(triangles.end(), degenerated, degenerated + 3);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Serial scatter: each face adds its weighted unit normal to its corners
+static std::vector<glm::vec3> referenceNormals(const std::vector<float>& vertices,
+                                               const std::vector<int>& triangles,
+                                               Mesh::NormalWeighting weighting)
+{
+    std::vector<glm::vec3> normals(vertices.size() / 8, glm::vec3(0.f));
+    for (std::size_t f = 0; f < triangles.size(); f += 3) {
+        glm::vec3 p[3];
+        for (int k = 0; k < 3; ++k)
+            p[k] = glm::vec3(vertices[8 * triangles[f + k]], vertices[8 * triangles[f + k] + 1], vertices[8 * triangles[f + k] + 2]);
+        glm::vec3 c = glm::cross(p[1] - p[0], p[2] - p[0]);
+        float area2 = glm::length(c);
+        if (area2 <= 0.f)
+            continue;
+        for (int k = 0; k < 3; ++k) {
+            float w = 1.f;
+            if (weighting == Mesh::AREA_WEIGHTS) {
+                w = area2;
+            }
+            else if (weighting == Mesh::ANGLE_WEIGHTS) {
+                glm::vec3 e1 = glm::normalize(p[(k + 1) % 3] - p[k]);
+                glm::vec3 e2 = glm::normalize(p[(k + 2) % 3] - p[k]);
+                w = std::acos(glm::clamp(glm::dot(e1, e2), -1.f, 1.f));
+            }
+            normals[triangles[f + k]] += w * (c / area2);
+        }
+    }
+    for (std::size_t v = 0; v < normals.size(); ++v)
+        if (glm::length(normals[v]) > 0.f)
+            normals[v] = glm::normalize(normals[v]);
+    return normals;
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    std::vector<float> vertices;
+    std::vector<int> triangles;
+    makeGrid(64, vertices, triangles);
+    const int nbVertices = int(vertices.size() / 8);
+
+    // big enough to be spread over several threads
+    std::vector<float> bigVertices;
+    std::vector<int> bigTriangles;
+    makeGrid(400, bigVertices, bigTriangles);
+
+    const Mesh::NormalWeighting weightings[] = { Mesh::UNIFORM_WEIGHTS, Mesh::AREA_WEIGHTS, Mesh::ANGLE_WEIGHTS };
+    for (int w = 0; w < 3; ++w) {
+        for (int size = 0; size < 2; ++size) {
+            const std::vector<float>& v = size ? bigVertices : vertices;
+            const std::vector<int>& t = size ? bigTriangles : triangles;
+            Mesh mesh(v, t, std::vector<int>(), true, true);
+            mesh.computeNormals(weightings[w]);
+            std::vector<glm::vec3> expected = referenceNormals(v, t, weightings[w]);
+
+            std::vector<float> data;
+            std::vector<int> indices;
+            bool parametrized;
+            mesh.getData(data, indices, parametrized);
+            CHECK(data.size() == v.size());
+            int mismatches = 0;
+            for (std::size_t i = 0; i < expected.size() && 8 * i + 5 < data.size(); ++i) {
+                glm::vec3 n(data[8 * i + 3], data[8 * i + 4], data[8 * i + 5]);
+                mismatches += glm::length(n - expected[i]) > 1e-5f ? 1 : 0;
+            }
+            CHECK(mismatches == 0);
+        }
+    }
+
+    // the unused vertex and the degenerated face get a null normal
+    Mesh mesh(vertices, triangles, std::vector<int>(), true, true);
+    mesh.computeNormals();
+    std::vector<float> data;
+    std::vector<int> indices;
+    bool parametrized;
+    mesh.getData(data, indices, parametrized);
+    for (int i = nbVertices - 4; i < nbVertices; ++i)
+        CHECK(data[8 * i + 3] == 0.f && data[8 * i + 4] == 0.f && data[8 * i + 5] == 0.f);
+
+    return Tests::testFailures();
+}
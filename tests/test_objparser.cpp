@@ -0,0 +1,287 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "fileloaders/mesh.h"
+#include "fileloaders/objloader.h"
+
+#include <QString>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <vector>
+
+// Checks the memory mapped multithreaded tokenizer against the historical
+// std::istream parser: both must build the same meshes from the same file.
+
+using namespace Loaders;
+
+// -----------------------------------------------------------------------------
+
+/// OBJ with every face format, groups, smoothing groups and negative indices.
+/// A "n" x "n" grid is big enough for the tokenizer to cut several chunks.
+static std::string makeObj(int n)
+{
+    std::ostringstream obj;
+    obj << "# test file\n";
+    for (int j = 0; j <= n; ++j) {
+        for (int i = 0; i <= n; ++i) {
+            obj << "v " << i * 0.25f << " " << j * 0.5f << " " << (i * j % 7) * 0.125f << "\n";
+            obj << "vt " << float(i) / n << " " << float(j) / n << "\n";
+        }
+    }
+    obj << "vn 0 0 1\nvn 0 1 0\nvn 1 0 0\n";
+
+    // quads v/vt/vn in a smoothing group
+    obj << "g grid\ns 1\n";
+    for (int j = 0; j < n; ++j) {
+        for (int i = 0; i < n; ++i) {
+            int a = j * (n + 1) + i + 1, b = a + 1, c = a + n + 2, d = a + n + 1;
+            obj << "f " << a << "/" << a << "/1 " << b << "/" << b << "/2 "
+                << c << "/" << c << "/3 " << d << "/" << d << "/1\n";
+        }
+    }
+    // triangles v//vn with relative indices, no smoothing
+    obj << "g relative\ns off\n";
+    for (int k = 0; k < n; ++k)
+        obj << "f -" << k + 1 << "//-1 -" << k + 2 << "//-2 -" << k + 3 << "//-3\n";
+    // v/vt in another object and v only in the default group
+    obj << "o textured\ns 2\n";
+    for (int k = 1; k < n; ++k)
+        obj << "f " << k << "/" << k << " " << k + 1 << "/" << k + 1 << " " << k + n + 1 << "/" << k + n + 1 << "\n";
+    obj << "g default\n";
+    for (int k = 1; k < n; ++k)
+        obj << "f " << k << " " << k + n + 2 << " " << k + n + 1 << "\n";
+    return obj.str();
+}
+
+// -----------------------------------------------------------------------------
+
+static bool load(const std::string& path, bool mapped, std::vector<Mesh*>& meshes, QString& reason)
+{
+    Obj_mtl::ObjLoader loader;
+    loader.setUseMappedParser(mapped);
+    loader.setUseMeshCache(false);
+    if (!loader.load(QString(path.c_str()), reason))
+        return false;
+    loader.getObjects(meshes);
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+static void testSameMeshes()
+{
+    std::string path = Tests::writeTestFile("test_objparser.obj", makeObj(300));
+    std::vector<Mesh*> mapped, stream;
+    QString reason;
+    CHECK(load(path, true, mapped, reason));
+    CHECK(load(path, false, stream, reason));
+    CHECK(mapped.size() == 4);
+    CHECK(mapped.size() == stream.size());
+
+    for (std::size_t m = 0; m < mapped.size() && m < stream.size(); ++m) {
+        CHECK(mapped[m]->nbVertices() == stream[m]->nbVertices());
+        CHECK(mapped[m]->nbTriangles() == stream[m]->nbTriangles());
+        std::vector<float> v0, v1;
+        std::vector<int> t0, t1;
+        bool p0, p1;
+        mapped[m]->getData(v0, t0, p0);
+        stream[m]->getData(v1, t1, p1);
+        CHECK(v0 == v1);
+        CHECK(t0 == t1);
+        CHECK(p0 == p1);
+    }
+    for (std::size_t m = 0; m < mapped.size(); ++m)
+        delete mapped[m];
+    for (std::size_t m = 0; m < stream.size(); ++m)
+        delete stream[m];
+}
+
+// -----------------------------------------------------------------------------
+
+/// Index limits: "-2147483648" and "2147483647" are read by both parsers
+/// (then rejected as out of bounds), one more digit fails in both.
+static void testIndexLimits()
+{
+    const char* faces[] = { "f 1 2 -2147483648\n", "f 1 2 2147483647\n", "f 1 2 -21474836480\n" };
+    for (int i = 0; i < 3; ++i) {
+        std::string path = Tests::writeTestFile("test_objparser_limits.obj",
+                                                std::string("v 0 0 0\nv 1 0 0\nv 0 1 0\n") + faces[i]);
+        std::vector<Mesh*> mapped, stream;
+        QString reasonMapped, reasonStream;
+        CHECK(!load(path, true, mapped, reasonMapped));
+        CHECK(!load(path, false, stream, reasonStream));
+        if (i < 2)
+            CHECK(reasonMapped.toStdString() == reasonStream.toStdString());
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+/// OBJ whose state changes every few lines: wherever a chunk is cut, it cuts
+/// near a "g", "o", "s" or "usemtl" line, and faces use relative indices
+/// going back into the previous chunks.
+static std::string makeDirectivesObj(int n)
+{
+    std::ostringstream obj;
+    obj << "mtllib test.mtl\n";
+    for (int k = 0; k < n; ++k) {
+        obj << "v " << k * 0.1f << " " << (k % 13) * 0.7f << " -" << k * 0.003f << "\n";
+        obj << "vt " << (k % 5) * 0.2f << " " << (k % 11) * 0.09f << "\n";
+        obj << "vn 0 " << (k % 2) << " " << 1 - k % 2 << "\n";
+        switch (k % 6) {
+        case 0: obj << "g part" << k / 6 << "\n"; break;
+        case 1: obj << "s " << (k % 4 == 1 ? "off" : "3") << "\n"; break;
+        case 2: obj << "usemtl mat" << k % 3 << "\n"; break;
+        case 3: obj << "o object" << k << "\n"; break;
+        case 4: obj << "unknown_keyword " << k << "\n"; break;
+        default: obj << "# comment " << k << "\n"; break;
+        }
+        if (k < 4)
+            continue;
+        // Negative indices, then the same vertices with absolute ones
+        obj << "f -1/-1/-1 -2/-2/-2 -3/-3/-3 -4/-4/-4\n";
+        obj << "f -3//-2 -2//-3 -1//-1\n";
+        obj << "f " << k - 1 << "/" << k << " " << k << "/" << k - 1 << " " << k + 1 << "/" << k + 1 << "\n";
+        obj << "f " << k + 1 << " " << k << " " << k - 2 << "\n";
+    }
+    return obj.str();
+}
+
+// -----------------------------------------------------------------------------
+
+/// Every callback of an obj_parser, appended to a log in call order. Floats
+/// are logged by their bits so that the logs of two parses only match when
+/// the values are bit-identical.
+struct ParseLog {
+    std::ostringstream log;
+
+    void floats(const char* name, float a, float b, float c)
+    {
+        unsigned bits[3];
+        memcpy(&bits[0], &a, sizeof(float));
+        memcpy(&bits[1], &b, sizeof(float));
+        memcpy(&bits[2], &c, sizeof(float));
+        log << name << " " << std::hex << bits[0] << " " << bits[1] << " " << bits[2] << std::dec << "\n";
+    }
+
+    template <class T>
+    void corner(const T& t) { log << " " << t; }
+    void corner(const Obj_mtl::index_2_tuple_type& t) { log << " " << std::get<0>(t) << "/" << std::get<1>(t); }
+    void corner(const Obj_mtl::index_3_tuple_type& t) { log << " " << std::get<0>(t) << "/" << std::get<1>(t) << "/" << std::get<2>(t); }
+
+    template <class T>
+    void triangle(const char* name, const T& a, const T& b, const T& c)
+    {
+        log << name;
+        corner(a), corner(b), corner(c);
+        log << "\n";
+    }
+
+    template <class T>
+    void quad(const char* name, const T& a, const T& b, const T& c, const T& d)
+    {
+        log << name;
+        corner(a), corner(b), corner(c), corner(d);
+        log << "\n";
+    }
+
+    void connect(Obj_mtl::obj_parser& parser)
+    {
+        using namespace std::placeholders;
+        typedef Obj_mtl::index_type I;
+        typedef Obj_mtl::index_2_tuple_type I2;
+        typedef Obj_mtl::index_3_tuple_type I3;
+        parser.info_callback([this](std::size_t line, const std::string& m) { log << "info " << line << " " << m << "\n"; });
+        parser.warning_callback([this](std::size_t line, const std::string& m) { log << "warning " << line << " " << m << "\n"; });
+        parser.error_callback([this](std::size_t line, const std::string& m) { log << "error " << line << " " << m << "\n"; });
+        parser.geometric_vertex_callback([this](float x, float y, float z) { floats("v", x, y, z); });
+        parser.texture_vertex_callback([this](float u, float v) { floats("vt", u, v, 0.f); });
+        parser.vertex_normal_callback([this](float x, float y, float z) { floats("vn", x, y, z); });
+        parser.face_callbacks(std::bind(&ParseLog::triangle<I>, this, "f", _1, _2, _3),
+                              std::bind(&ParseLog::triangle<I2>, this, "f/t", _1, _2, _3),
+                              std::bind(&ParseLog::triangle<I2>, this, "f/n", _1, _2, _3),
+                              std::bind(&ParseLog::triangle<I3>, this, "f/t/n", _1, _2, _3),
+                              std::bind(&ParseLog::quad<I>, this, "q", _1, _2, _3, _4),
+                              std::bind(&ParseLog::quad<I2>, this, "q/t", _1, _2, _3, _4),
+                              std::bind(&ParseLog::quad<I2>, this, "q/n", _1, _2, _3, _4),
+                              std::bind(&ParseLog::quad<I3>, this, "q/t/n", _1, _2, _3, _4));
+        parser.group_name_callback([this](const std::string& name) { log << "g " << name << "\n"; });
+        parser.smoothing_group_callback([this](Obj_mtl::size_type s) { log << "s " << s << "\n"; });
+        parser.object_name_callback([this](const std::string& name) { log << "o " << name << "\n"; });
+        parser.material_library_callback([this](const std::string& name) { log << "mtllib " << name << "\n"; });
+        parser.material_name_callback([this](const std::string& name) { log << "usemtl " << name << "\n"; });
+        parser.comment_callback([this](const std::string& text) { log << "# " << text << "\n"; });
+    }
+};
+
+// -----------------------------------------------------------------------------
+
+/// Log of parse_buffer() on "text" with "nbThreads" (1: serial path)
+static std::string parseLog(const std::string& text, unsigned nbThreads, std::size_t minChunkSize)
+{
+    const Obj_mtl::obj_parser::flags_type flags = Obj_mtl::obj_parser::translate_negative_indices |
+                                                  Obj_mtl::obj_parser::parse_multithreaded;
+    Obj_mtl::obj_parser parser(flags);
+    parser.set_threading(nbThreads, minChunkSize);
+    ParseLog log;
+    log.connect(parser);
+    log.log << (parser.parse_buffer(text.data(), text.data() + text.size()) ? "ok" : "failed") << "\n";
+    return log.log.str();
+}
+
+// -----------------------------------------------------------------------------
+
+/// The chunked path, cut in at least 4 chunks at many different places,
+/// calls the same callbacks with the same values as the serial path
+static void testChunkedReplay()
+{
+    const std::string text = makeDirectivesObj(800);
+    const std::string serial = parseLog(text, 1, 1);
+    CHECK(serial.find("error") == std::string::npos);
+    CHECK(serial.find("warning") != std::string::npos); // the unknown keywords
+    CHECK(serial.find("usemtl mat2") != std::string::npos);
+
+    // Chunks are at least size / (4 * threads) bytes
+    const unsigned threads[] = { 2, 3, 4, 8 };
+    for (unsigned t = 0; t < 4; ++t) {
+        for (std::size_t minChunk = 97; minChunk < text.size() / 4; minChunk = minChunk * 3 + 1) {
+            const std::string chunked = parseLog(text, threads[t], minChunk);
+            if (!CHECK(chunked == serial)) {
+                std::cerr << "  " << threads[t] << " threads, chunks of " << minChunk << " bytes" << std::endl;
+                return;
+            }
+        }
+    }
+
+    // An error in a late chunk stops at the same line, with the same message
+    const std::string broken = text + "f 1 2 -100000000\nv 0 0 0\n";
+    const std::string serialError = parseLog(broken, 1, 1);
+    CHECK(serialError.find("error") != std::string::npos);
+    CHECK(parseLog(broken, 4, 256) == serialError);
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    testSameMeshes();
+    testIndexLimits();
+    testChunkedReplay();
+    return Tests::testFailures();
+}
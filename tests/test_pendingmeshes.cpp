@@ -0,0 +1,212 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "rendersystem/pendingmeshes.h"
+
+#include <vector>
+
+// Checks the bookkeeping of the meshes handed to the renderer by loading
+// threads: order, canceled loads forgotten at their end, and the byte budget
+// of a frame. No OpenGL call: PendingMeshes only hands meshes over.
+
+using namespace RenderSystem;
+
+// -----------------------------------------------------------------------------
+
+static int nbAlive = 0;
+
+/// Mesh counting the instances alive, to check the dropped ones are deleted
+class CountedMesh : public Loaders::Mesh {
+public:
+    CountedMesh(int id, int nbTriangles)
+        : Loaders::Mesh(std::vector<float>(18 * nbTriangles, 1.f), triangles(nbTriangles),
+                        std::vector<int>(), true, false)
+        , mId(id)
+    {
+        ++nbAlive;
+    }
+    ~CountedMesh() { --nbAlive; }
+
+    int id() const { return mId; }
+
+private:
+    static std::vector<int> triangles(int nbTriangles)
+    {
+        std::vector<int> indices(3 * nbTriangles);
+        for (int i = 0; i < 3 * nbTriangles; ++i)
+            indices[i] = i;
+        return indices;
+    }
+
+    int mId;
+};
+
+/// Id of the next mesh popped and deleted, -1 if none
+static int popId(PendingMeshes& pending)
+{
+    Loaders::Mesh* mesh = pending.pop();
+    if (mesh == 0)
+        return -1;
+    const int id = static_cast<CountedMesh*>(mesh)->id();
+    delete mesh;
+    return id;
+}
+
+// -----------------------------------------------------------------------------
+
+static void testOrder()
+{
+    PendingMeshes pending(16, 1 << 30);
+    for (int i = 0; i < 4; ++i)
+        CHECK(pending.push(new CountedMesh(i, 2), 1));
+    CHECK(pending.endLoad(1));
+    CHECK(pending.size() == 5);
+
+    pending.beginFrame();
+    for (int i = 0; i < 4; ++i)
+        CHECK(popId(pending) == i);
+    CHECK(popId(pending) == -1);
+    CHECK(pending.size() == 0);
+    CHECK(nbAlive == 0);
+
+    // Full queue: the loading thread tries again later
+    PendingMeshes small(2, 1 << 30);
+    CountedMesh* extra = new CountedMesh(9, 1);
+    CHECK(small.push(new CountedMesh(0, 1), 1));
+    CHECK(small.push(new CountedMesh(1, 1), 1));
+    CHECK(!small.push(extra, 1));
+    delete extra;
+}
+
+// -----------------------------------------------------------------------------
+
+static void testCancel()
+{
+    PendingMeshes pending(16, 1 << 30);
+    pending.push(new CountedMesh(0, 2), 1);
+    pending.push(new CountedMesh(1, 2), 2);
+    pending.cancelLoad(1);
+    // Queued after the cancellation but before its end: dropped too
+    pending.push(new CountedMesh(2, 2), 1);
+    pending.push(new CountedMesh(3, 2), 2);
+
+    pending.beginFrame();
+    CHECK(popId(pending) == 1);
+    CHECK(popId(pending) == 3);
+    CHECK(popId(pending) == -1);
+    CHECK(nbAlive == 0);
+
+    // Still canceled while its end is not popped
+    CHECK(pending.canceledLoads().size() == 1 && pending.canceledLoads()[0] == 1);
+    pending.push(new CountedMesh(4, 2), 1);
+    pending.endLoad(1);
+    CHECK(popId(pending) == -1);
+    CHECK(nbAlive == 0);
+    CHECK(pending.canceledLoads().empty());
+
+    // Forgotten at its end: a new load may use the same id
+    pending.push(new CountedMesh(5, 2), 1);
+    CHECK(popId(pending) == 5);
+
+    // Canceled loads without a mesh left are forgotten too, the others kept
+    pending.cancelLoad(3);
+    pending.cancelLoad(4);
+    pending.endLoad(3);
+    CHECK(popId(pending) == -1);
+    CHECK(pending.canceledLoads().size() == 1 && pending.canceledLoads()[0] == 4);
+}
+
+// -----------------------------------------------------------------------------
+
+static void testBudget()
+{
+    const int size = PendingMeshes::uploadSize(CountedMesh(-1, 10));
+    CHECK(size == 30 * 8 * (int)sizeof(float) + 10 * 3 * (int)sizeof(unsigned int));
+
+    // Popped while the bytes of the frame are under the budget
+    PendingMeshes pending(16, size * 5 / 2);
+    for (int i = 0; i < 5; ++i)
+        pending.push(new CountedMesh(i, 10), 1);
+    pending.beginFrame();
+    CHECK(popId(pending) == 0);
+    CHECK(popId(pending) == 1);
+    CHECK(popId(pending) == 2);
+    CHECK(popId(pending) == -1);
+    CHECK(pending.nbBytes() == 3 * size);
+    CHECK(pending.size() == 2);
+
+    // Still over budget until the next frame
+    CHECK(popId(pending) == -1);
+    pending.beginFrame();
+    CHECK(pending.nbBytes() == 0);
+    CHECK(popId(pending) == 3);
+    CHECK(popId(pending) == 4);
+    CHECK(popId(pending) == -1);
+    CHECK(pending.nbBytes() == 2 * size);
+
+    // Canceled meshes and ends of loads don't count
+    pending.push(new CountedMesh(5, 10), 2);
+    pending.push(new CountedMesh(6, 10), 2);
+    pending.endLoad(2);
+    pending.push(new CountedMesh(7, 10), 1);
+    pending.cancelLoad(2);
+    pending.beginFrame();
+    CHECK(popId(pending) == 7);
+    CHECK(pending.nbBytes() == size);
+    CHECK(nbAlive == 0);
+
+    // A mesh larger than the budget still goes, alone in its frame
+    pending.setBudget(size / 2);
+    pending.push(new CountedMesh(8, 10), 1);
+    pending.push(new CountedMesh(9, 10), 1);
+    pending.beginFrame();
+    CHECK(popId(pending) == 8);
+    CHECK(popId(pending) == -1);
+    pending.beginFrame();
+    CHECK(popId(pending) == 9);
+}
+
+// -----------------------------------------------------------------------------
+
+static void testClear()
+{
+    {
+        PendingMeshes pending(16, 1 << 30);
+        pending.push(new CountedMesh(0, 2), 1);
+        pending.push(new CountedMesh(1, 2), 1);
+        pending.cancelLoad(2);
+        pending.clear();
+        CHECK(nbAlive == 0);
+        CHECK(pending.size() == 0 && pending.canceledLoads().empty());
+
+        // The destructor deletes the meshes left
+        pending.push(new CountedMesh(2, 2), 1);
+    }
+    CHECK(nbAlive == 0);
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    testOrder();
+    testCancel();
+    testBudget();
+    testClear();
+    return Tests::testFailures();
+}
@@ -0,0 +1,160 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "rendersystem/renderqueue.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+// Checks RenderQueue::sort() against std::stable_sort for the three paths
+// (insertion sort, packed keys, wide keys), the order of makeKey() and the
+// frame arena.
+
+using namespace RenderSystem;
+
+// -----------------------------------------------------------------------------
+
+static uint64_t random64()
+{
+    uint64_t r = 0;
+    for (int i = 0; i < 4; ++i)
+        r = (r << 16) ^ (uint64_t)(rand() & 0xffff);
+    return r;
+}
+
+struct KeyLess {
+    const std::vector<uint64_t>* keys;
+    bool operator()(int a, int b) const { return (*keys)[a] < (*keys)[b]; }
+};
+
+/// Submit "keys", sort, and compare with a stable sort of the submission
+/// indices (the packet data holds its index)
+static bool sortsLikeStableSort(RenderQueue& queue, const std::vector<uint64_t>& keys)
+{
+    queue.clear();
+    for (std::size_t i = 0; i < keys.size(); ++i)
+        queue.submit(keys[i]).count = (GLsizei)i;
+    queue.sort();
+
+    std::vector<int> expected(keys.size());
+    for (std::size_t i = 0; i < keys.size(); ++i)
+        expected[i] = (int)i;
+    KeyLess less = { &keys };
+    std::stable_sort(expected.begin(), expected.end(), less);
+
+    if (queue.size() != (int)keys.size())
+        return false;
+    for (int i = 0; i < queue.size(); ++i)
+        if (queue.packet(i).count != expected[i] || queue.key(i) != keys[expected[i]])
+            return false;
+    return true;
+}
+
+// -----------------------------------------------------------------------------
+
+static void testSort()
+{
+    RenderQueue queue;
+    srand(11);
+    const std::size_t sizes[] = { 1, 10, 63, 64, 1000, 100000 };
+    for (int s = 0; s < 6; ++s) {
+        const std::size_t n = sizes[s];
+        std::vector<uint64_t> keys(n);
+
+        // Few programs and materials, many depths: packed keys, many equal
+        for (std::size_t i = 0; i < n; ++i)
+            keys[i] = RenderQueue::makeKey(0, rand() % 4, rand() % 16, float(rand() % 100));
+        CHECK(sortsLikeStableSort(queue, keys));
+
+        // Like the renderer, one material per packet: the radix passes leave
+        // a few packets sharing their highest bits
+        for (std::size_t i = 0; i < n; ++i)
+            keys[i] = RenderQueue::makeKey(0, 1 + rand() % 4, 1 + rand() % n, 1.f + float(rand() % 100000) * 0.01f);
+        CHECK(sortsLikeStableSort(queue, keys));
+
+        // High bits rarely set: most packets share the sorted bits, their
+        // runs are too long for the insertion sort
+        for (std::size_t i = 0; i < n; ++i)
+            keys[i] = (rand() % 100 == 0 ? (random64() >> 14) << 30 : 0) | uint64_t(rand() % 64);
+        CHECK(sortsLikeStableSort(queue, keys));
+
+        // Every bit differs: too wide to be packed with the index
+        for (std::size_t i = 0; i < n; ++i)
+            keys[i] = random64();
+        CHECK(sortsLikeStableSort(queue, keys));
+
+        // All equal: submission order
+        keys.assign(n, RenderQueue::makeKey(1, 2, 3, 4.f));
+        CHECK(sortsLikeStableSort(queue, keys));
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+static void testKeys()
+{
+    // Layer first, then program, material and depth
+    CHECK(RenderQueue::makeKey(0, 9, 9, 1e6f) < RenderQueue::makeKey(1, 0, 0, 0.f));
+    CHECK(RenderQueue::makeKey(0, 1, 9, 1e6f) < RenderQueue::makeKey(0, 2, 0, 0.f));
+    CHECK(RenderQueue::makeKey(0, 1, 1, 1e6f) < RenderQueue::makeKey(0, 1, 2, 0.f));
+
+    // Depth: front to back by default, back to front on demand, negative
+    // depths clamped to 0
+    float depths[] = { 0.f, 1e-3f, 0.5f, 1.f, 1.001f, 3.f, 100.f, 1e5f };
+    for (int i = 0; i + 1 < 8; ++i) {
+        CHECK(RenderQueue::makeKey(0, 0, 0, depths[i]) < RenderQueue::makeKey(0, 0, 0, depths[i + 1]));
+        CHECK(RenderQueue::makeKey(0, 0, 0, depths[i], true) > RenderQueue::makeKey(0, 0, 0, depths[i + 1], true));
+    }
+    CHECK(RenderQueue::makeKey(0, 0, 0, -5.f) == RenderQueue::makeKey(0, 0, 0, 0.f));
+}
+
+// -----------------------------------------------------------------------------
+
+static void testArena()
+{
+    FrameArena arena(256);
+    char* a = (char*)arena.allocate(3, 1);
+    double* b = arena.allocateArray<double>(4);
+    CHECK(((uintptr_t)b % alignof(double)) == 0);
+    CHECK((char*)b >= a + 3);
+    CHECK(arena.used() == 3 + 4 * sizeof(double));
+
+    // Larger than a block: a new block just for it
+    arena.allocate(1000);
+    CHECK(arena.capacity() >= 256 + 1000);
+
+    // reset() merges the blocks: the same frame fits in a single one
+    const std::size_t capacity = arena.capacity();
+    arena.reset();
+    CHECK(arena.used() == 0 && arena.capacity() == capacity);
+    char* first = (char*)arena.allocate(3, 1);
+    arena.allocateArray<double>(4);
+    char* last = (char*)arena.allocate(1000);
+    CHECK(last > first && last + 1000 <= first + capacity);
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    testSort();
+    testKeys();
+    testArena();
+    return Tests::testFailures();
+}
@@ -0,0 +1,184 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "gl_utils/glring_buffer.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+// Checks the GlRing_buffer book keeping with a backend in host memory:
+// wrap-around, stalls on the oldest fence, and that a range is never handed
+// out while the "GPU" may still read it.
+
+// -----------------------------------------------------------------------------
+
+/// What the host backend saw, kept out of the backend deleted with the ring
+struct BackendLog {
+    std::vector<char> memory;
+    int nb_fences;
+    int nb_waits;
+    int nb_flushed_bytes;
+    int nb_overwrites;  ///< ranges mapped while a fence still covers them
+    int nb_bad_waits;   ///< unknown or already released fences
+    int last_waited;
+
+    BackendLog(int nb_bytes)
+        : memory(nb_bytes, 0), nb_fences(0), nb_waits(0), nb_flushed_bytes(0)
+        , nb_overwrites(0), nb_bad_waits(0), last_waited(0) { }
+};
+
+/// GlRing_backend in host memory. The ranges mapped since the previous
+/// fence() are read by the "GPU" until the fence is waited on.
+class GlRing_backend_host : public GlRing_backend {
+public:
+    explicit GlRing_backend_host(BackendLog& log) : _log(log) { }
+
+    void* map_range(int offset, int nb_bytes)
+    {
+        for (unsigned f = 0; f < _fenced.size(); ++f)
+            for (unsigned r = 0; r < _fenced[f].size(); ++r)
+                if (offset < _fenced[f][r].second && _fenced[f][r].first < offset + nb_bytes)
+                    _log.nb_overwrites++;
+        _pending.push_back(std::make_pair(offset, offset + nb_bytes));
+        return &_log.memory[offset];
+    }
+
+    void flush_range(int /*offset*/, int nb_bytes) { _log.nb_flushed_bytes += nb_bytes; }
+
+    GLsync fence()
+    {
+        _fenced.push_back(_pending);
+        _pending.clear();
+        return (GLsync)(std::size_t)++_log.nb_fences; // never 0
+    }
+
+    void wait(GLsync sync)
+    {
+        // Fences are released in order, the ones before 'sync' already are
+        const int id = (int)(std::size_t)sync;
+        if (id != _log.last_waited + 1 || _fenced.empty())
+            _log.nb_bad_waits++;
+        else
+            _fenced.erase(_fenced.begin());
+        _log.last_waited = id;
+        _log.nb_waits++;
+    }
+
+    GLuint get_id() const { return 0; }
+
+private:
+    typedef std::vector<std::pair<int, int> > Ranges; ///< [begin, end) bytes
+    BackendLog& _log;
+    Ranges _pending;
+    std::vector<Ranges> _fenced; ///< oldest first
+};
+
+// -----------------------------------------------------------------------------
+
+static int alloc_and_write(GlRing_buffer& ring, int nb_elt, float value)
+{
+    int first = ring.alloc(nb_elt);
+    if (first < 0)
+        return first;
+    float* ptr = (float*)ring.map(first, nb_elt);
+    for (int i = 0; i < nb_elt; ++i)
+        ptr[i] = value;
+    ring.flush(first, nb_elt);
+    return first;
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_wrap_around()
+{
+    BackendLog log(10 * sizeof(float));
+    {
+        GlRing_buffer ring(new GlRing_backend_host(log), 10, sizeof(float));
+        CHECK(alloc_and_write(ring, 6, 1.f) == 0);
+        ring.fence();
+        CHECK(alloc_and_write(ring, 3, 2.f) == 6);
+        ring.fence();
+        CHECK(ring.used() == 9 && ring.nb_stalls() == 0);
+
+        // 1 element left at the tail: skipped, the range restarts at 0 over
+        // the first frame which must be waited on
+        CHECK(alloc_and_write(ring, 4, 3.f) == 0);
+        CHECK(ring.nb_stalls() == 1 && log.nb_waits == 1 && log.last_waited == 1);
+        CHECK(ring.used() == 3 + 1 + 4);
+        const float* mem = (const float*)&log.memory[0];
+        CHECK(mem[0] == 3.f && mem[3] == 3.f && mem[4] == 1.f && mem[6] == 2.f && mem[9] == 0.f);
+
+        // Fits between the head (4) and the second frame (6) without waiting
+        CHECK(alloc_and_write(ring, 2, 4.f) == 4);
+        CHECK(ring.nb_stalls() == 1);
+
+        // Nothing fenced left to wait on: the unfenced ranges are not
+        // overwritten
+        ring.fence();
+        CHECK(alloc_and_write(ring, 10, 5.f) == 0);
+        CHECK(ring.nb_stalls() == 3);
+        CHECK(alloc_and_write(ring, 1, 6.f) == -1);
+        CHECK(alloc_and_write(ring, 11, 6.f) == -1);
+        ring.fence();
+    }
+    // The destructor waits on the last fence
+    CHECK(log.nb_fences == 4 && log.nb_waits == 4);
+    CHECK(log.nb_flushed_bytes == int((6 + 3 + 4 + 2 + 10) * sizeof(float)));
+    CHECK(log.nb_overwrites == 0 && log.nb_bad_waits == 0);
+}
+
+// -----------------------------------------------------------------------------
+
+/// Random batches over many frames, as GlDirect_draw streams its geometry
+static void test_streaming()
+{
+    const int capacity = 1000;
+    BackendLog log(capacity * sizeof(float));
+    int nb_batches = 0;
+    {
+        GlRing_buffer ring(new GlRing_backend_host(log), capacity, sizeof(float));
+        srand(5);
+        for (int frame = 0; frame < 500; ++frame) {
+            const int nb = 1 + rand() % 8;
+            for (int b = 0; b < nb; ++b) {
+                const int nb_elt = 1 + rand() % 120;
+                const int first = alloc_and_write(ring, nb_elt, float(frame));
+                if (!CHECK(first >= 0 && first + nb_elt <= capacity))
+                    return;
+                nb_batches++;
+            }
+            CHECK(ring.used() <= capacity);
+            ring.fence();
+        }
+        // Several frames fit in the ring: it stalls far less than once a frame
+        CHECK(ring.nb_stalls() > 0 && ring.nb_stalls() < 500);
+    }
+    CHECK(nb_batches > 500);
+    CHECK(log.nb_waits == log.nb_fences);
+    CHECK(log.nb_overwrites == 0 && log.nb_bad_waits == 0);
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    test_wrap_around();
+    test_streaming();
+    return Tests::testFailures();
+}
@@ -0,0 +1,147 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "fileloaders/mesh.h"
+#include "fileloaders/trianglebvh.h"
+
+#include <cstdlib>
+#include <vector>
+#include "glm/glm.hpp"
+
+// Checks the closest hits found through TriangleBvh against a brute force
+// loop over all the triangles, for single rays and for packets.
+
+using namespace Loaders;
+
+// -----------------------------------------------------------------------------
+
+static float random(float min, float max)
+{
+    return min + (max - min) * float(rand()) / float(RAND_MAX);
+}
+
+static glm::vec3 randomPoint(float min, float max)
+{
+    return glm::vec3(random(min, max), random(min, max), random(min, max));
+}
+
+// -----------------------------------------------------------------------------
+
+/// Soup of "nbTriangles" small triangles in the [-1, 1] cube
+static Mesh makeSoup(int nbTriangles, std::vector<float>& buffer, std::vector<int>& triangles)
+{
+    for (int t = 0; t < nbTriangles; ++t) {
+        const glm::vec3 center = randomPoint(-1.f, 1.f);
+        for (int k = 0; k < 3; ++k) {
+            glm::vec3 p = center + randomPoint(-0.1f, 0.1f);
+            float vertex[8] = { p.x, p.y, p.z, 0.f, 0.f, 1.f, 0.f, 0.f };
+            buffer.insert(buffer.end(), vertex, vertex + 8);
+            triangles.push_back(3 * t + k);
+        }
+    }
+    return Mesh(buffer, triangles, std::vector<int>(), true, true);
+}
+
+/// Closest hit by testing every triangle, same arithmetic as the tree
+static RayHit bruteForce(const std::vector<float>& buffer, const std::vector<int>& triangles, const Ray& ray)
+{
+    RayHit hit;
+    for (std::size_t i = 0; i < triangles.size() / 3; ++i) {
+        glm::vec3 p[3];
+        for (int k = 0; k < 3; ++k) {
+            const float* v = &buffer[8 * triangles[3 * i + k]];
+            p[k] = glm::vec3(v[0], v[1], v[2]);
+        }
+        const glm::vec3 e1 = p[1] - p[0];
+        const glm::vec3 e2 = p[2] - p[0];
+        const glm::vec3 pv = glm::cross(ray.direction, e2);
+        const float det = glm::dot(e1, pv);
+        if (std::fabs(det) < 1e-20f)
+            continue;
+        const float invDet = 1.f / det;
+        const glm::vec3 s = ray.origin - p[0];
+        const float u = glm::dot(s, pv) * invDet;
+        if (u < 0.f || u > 1.f)
+            continue;
+        const glm::vec3 q = glm::cross(s, e1);
+        const float v = glm::dot(ray.direction, q) * invDet;
+        if (v < 0.f || u + v > 1.f)
+            continue;
+        const float t = glm::dot(e2, q) * invDet;
+        if (t < 0.f || (hit.triangle >= 0 && t >= hit.distance))
+            continue;
+        hit.triangle = int(i);
+        hit.distance = t;
+    }
+    return hit;
+}
+
+/// Same closest hit: same triangle, or another one at the same distance
+static bool sameHit(const RayHit& a, const RayHit& b)
+{
+    if (a.triangle < 0 || b.triangle < 0)
+        return a.triangle == b.triangle;
+    return a.triangle == b.triangle ? Tests::near(a.distance, b.distance)
+                                    : Tests::near(a.distance, b.distance, 1e-6f);
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    srand(3);
+    std::vector<float> buffer;
+    std::vector<int> triangles;
+    Mesh mesh = makeSoup(3000, buffer, triangles);
+    TriangleBvh bvh(mesh);
+    CHECK(bvh.nbNodes() > 1);
+
+    // Rays from outside aimed in the cube, some away from it, some starting
+    // inside (the triangles behind the origin don't count)
+    std::vector<Ray> rays;
+    for (int i = 0; i < 1000; ++i) {
+        glm::vec3 origin = glm::normalize(randomPoint(-1.f, 1.f)) * 3.f;
+        if (i % 10 == 0)
+            origin = randomPoint(-1.f, 1.f);
+        glm::vec3 target = randomPoint(-1.f, 1.f);
+        glm::vec3 direction = i % 7 == 0 ? origin - target : target - origin;
+        rays.push_back(Ray(origin, glm::normalize(direction)));
+    }
+
+    int nbHits = 0;
+    std::vector<RayHit> single(rays.size());
+    for (std::size_t i = 0; i < rays.size(); ++i) {
+        bool hit = bvh.intersect(rays[i], single[i]);
+        RayHit reference = bruteForce(buffer, triangles, rays[i]);
+        CHECK(hit == (single[i].triangle >= 0));
+        if (!CHECK(sameHit(single[i], reference)))
+            std::fprintf(stderr, "  ray %d: tree %d (%g), brute force %d (%g)\n", int(i),
+                         single[i].triangle, single[i].distance, reference.triangle, reference.distance);
+        nbHits += hit ? 1 : 0;
+    }
+    // Both cases are covered
+    CHECK(nbHits > 100 && nbHits < int(rays.size()) - 100);
+
+    // Packets (several, the last one partial) find the same hits
+    std::vector<RayHit> packets(rays.size());
+    bvh.intersect(&rays[0], int(rays.size()), &packets[0]);
+    for (std::size_t i = 0; i < rays.size(); ++i)
+        CHECK(sameHit(packets[i], single[i]));
+
+    return Tests::testFailures();
+}
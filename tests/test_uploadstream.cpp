@@ -0,0 +1,77 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "gl_utils/glupload_stream.h"
+
+#include <vector>
+
+// Checks a GlUpload_stream whose thread could not run fails its uploads, so
+// that their data can be uploaded another way. No OpenGL call is involved:
+// run() is never called.
+
+// -----------------------------------------------------------------------------
+
+static void test_fail_queued()
+{
+    std::vector<float> data(64, 1.f);
+    GlUpload_stream stream(256);
+    GlUpload vertices(&data[0], data.size() * sizeof(float));
+    GlUpload indices(&data[0], 32 * sizeof(float));
+    stream.push(&vertices);
+    stream.push(&indices);
+    CHECK(stream.nb_pending() == 2);
+    CHECK(!stream.has_failed());
+    CHECK(!vertices.has_failed() && !indices.has_failed());
+
+    stream.fail();
+    CHECK(stream.has_failed());
+    CHECK(vertices.has_failed() && indices.has_failed());
+    // Nothing is left for run() nor for the destructors to release
+    CHECK(stream.nb_pending() == 0);
+    CHECK(vertices.get_buffer() == 0 && indices.get_buffer() == 0);
+}
+
+// -----------------------------------------------------------------------------
+
+static void test_push_after_fail()
+{
+    std::vector<float> data(16, 2.f);
+    GlUpload_stream stream;
+    stream.fail();
+    GlUpload u(&data[0], data.size() * sizeof(float));
+    stream.push(&u);
+    CHECK(u.has_failed());
+    CHECK(stream.nb_pending() == 0);
+
+    // A plain stop() leaves the uploads queued untouched
+    GlUpload_stream stopped;
+    GlUpload v(&data[0], data.size() * sizeof(float));
+    stopped.push(&v);
+    stopped.stop();
+    CHECK(!stopped.has_failed() && !v.has_failed());
+    CHECK(stopped.nb_pending() == 1);
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    test_fail_queued();
+    test_push_after_fail();
+    return Tests::testFailures();
+}
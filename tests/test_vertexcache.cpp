@@ -0,0 +1,153 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "fileloaders/vertexcache.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+// Checks the FIFO cache statistics on hand computed cases and that the
+// optimization keeps the triangles while lowering the ACMR.
+
+using namespace Loaders;
+
+// -----------------------------------------------------------------------------
+
+static VertexCache::Stats analyze(const std::vector<unsigned int>& indices, std::size_t nbVertices, int cacheSize)
+{
+    return VertexCache::analyze(&indices[0], indices.size(), nbVertices, cacheSize);
+}
+
+// -----------------------------------------------------------------------------
+
+static void testStats()
+{
+    // one triangle: 3 misses, every vertex transformed once
+    unsigned int one[] = { 0, 1, 2 };
+    VertexCache::Stats s = analyze(std::vector<unsigned int>(one, one + 3), 3, 16);
+    CHECK(Tests::near(s.acmr, 3.f) && Tests::near(s.atvr, 1.f));
+
+    // two triangles sharing an edge: 4 misses
+    unsigned int quad[] = { 0, 1, 2, 2, 1, 3 };
+    s = analyze(std::vector<unsigned int>(quad, quad + 6), 4, 16);
+    CHECK(Tests::near(s.acmr, 2.f) && Tests::near(s.atvr, 1.f));
+
+    // a triangle drawn again after 3 new vertices: hit with 16 entries,
+    // evicted with 3
+    unsigned int again[] = { 0, 1, 2, 3, 4, 5, 0, 1, 2 };
+    std::vector<unsigned int> v(again, again + 9);
+    s = analyze(v, 6, 16);
+    CHECK(Tests::near(s.acmr, 2.f) && Tests::near(s.atvr, 1.f));
+    s = analyze(v, 6, 3);
+    CHECK(Tests::near(s.acmr, 3.f) && Tests::near(s.atvr, 1.5f));
+
+    // FIFO: a hit doesn't refresh the entry. With 4 entries "0" is
+    // inserted first and evicted by "4" although it was just used
+    unsigned int fifo[] = { 0, 1, 2, 0, 2, 3, 0, 3, 4, 0, 4, 1 };
+    s = analyze(std::vector<unsigned int>(fifo, fifo + 12), 5, 4);
+    // misses: 0 1 2, 3, 4 (evicts 0), 0 (evicts 1), 1 (evicts 2)
+    CHECK(Tests::near(s.acmr, 7.f / 4.f) && Tests::near(s.atvr, 7.f / 5.f));
+}
+
+// -----------------------------------------------------------------------------
+
+/// Grid of n x n quads with its triangles shuffled
+static std::vector<unsigned int> shuffledGrid(int n)
+{
+    std::vector<unsigned int> triangles;
+    for (int j = 0; j < n; ++j) {
+        for (int i = 0; i < n; ++i) {
+            unsigned int a = j * (n + 1) + i, b = a + 1, c = a + n + 2, d = a + n + 1;
+            unsigned int quad[6] = { a, b, c, a, c, d };
+            triangles.insert(triangles.end(), quad, quad + 6);
+        }
+    }
+    std::srand(5);
+    for (std::size_t t = triangles.size() / 3 - 1; t > 0; --t)
+        for (int k = 0, r = std::rand() % int(t + 1); k < 3; ++k)
+            std::swap(triangles[3 * t + k], triangles[3 * r + k]);
+    return triangles;
+}
+
+/// Triangles as sorted triples, to compare index buffers as sets
+static std::vector<std::vector<unsigned int> > triangleSet(const std::vector<unsigned int>& indices)
+{
+    std::vector<std::vector<unsigned int> > set;
+    for (std::size_t i = 0; i < indices.size(); i += 3) {
+        std::vector<unsigned int> t(indices.begin() + i, indices.begin() + i + 3);
+        std::sort(t.begin(), t.end());
+        set.push_back(t);
+    }
+    std::sort(set.begin(), set.end());
+    return set;
+}
+
+// -----------------------------------------------------------------------------
+
+static void testOptimize()
+{
+    const int n = 100;
+    const std::size_t nbVertices = (n + 1) * (n + 1);
+    std::vector<unsigned int> indices = shuffledGrid(n);
+    const std::vector<unsigned int> original = indices;
+
+    VertexCache::Stats before = analyze(indices, nbVertices, VertexCache::FIFO_SIZE);
+    VertexCache::optimizeTriangles(&indices[0], indices.size(), nbVertices);
+    VertexCache::Stats after = analyze(indices, nbVertices, VertexCache::FIFO_SIZE);
+
+    CHECK(triangleSet(indices) == triangleSet(original));
+    // a shuffled grid misses nearly every vertex, an optimized one shares
+    // most of them (1 vertex per 2 triangles is the lower bound)
+    CHECK(before.acmr > 2.f);
+    CHECK(after.acmr < 0.8f);
+    CHECK(after.atvr < 1.6f);
+
+    // vertex fetch: same triangles renamed in order of first use
+    std::vector<unsigned int> remap;
+    std::vector<unsigned int> fetched = indices;
+    VertexCache::optimizeVertexFetch(&fetched[0], fetched.size(), nbVertices, remap);
+    CHECK(remap.size() == nbVertices);
+    std::vector<unsigned int> sorted = remap;
+    std::sort(sorted.begin(), sorted.end());
+    bool permutation = true;
+    for (std::size_t v = 0; v < sorted.size(); ++v)
+        permutation = permutation && sorted[v] == v;
+    CHECK(permutation);
+    unsigned int next = 0;
+    bool firstUseOrder = true;
+    for (std::size_t i = 0; i < fetched.size(); ++i) {
+        CHECK(fetched[i] == remap[indices[i]]);
+        if (fetched[i] == next)
+            ++next;
+        else
+            firstUseOrder = firstUseOrder && fetched[i] < next;
+    }
+    CHECK(firstUseOrder);
+    VertexCache::Stats renamed = analyze(fetched, nbVertices, VertexCache::FIFO_SIZE);
+    CHECK(renamed.acmr == after.acmr && renamed.atvr == after.atvr);
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    testStats();
+    testOptimize();
+    return Tests::testFailures();
+}
@@ -0,0 +1,133 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "fileloaders/mesh.h"
+
+#include <cstdlib>
+#include <vector>
+#include "glm/glm.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+// Checks the structure of arrays layout of Loaders::Mesh gives the same
+// results as the interleaved one.
+
+using namespace Loaders;
+
+// -----------------------------------------------------------------------------
+
+/// Random triangles, 8 floats per vertex; "nbVertices" is not a multiple of
+/// the SIMD width so that the streams padding is exercised
+static Mesh makeMesh(int nbVertices, int nbTriangles, bool hasTextureCoords)
+{
+    std::vector<float> vertices;
+    std::vector<int> triangles;
+    for (int i = 0; i < nbVertices; ++i) {
+        for (int k = 0; k < 8; ++k)
+            vertices.push_back(float(std::rand() % 2000) / 100.f - 10.f);
+        if (!hasTextureCoords)
+            vertices.resize(vertices.size() - 2);
+    }
+    for (int i = 0; i < 3 * nbTriangles; ++i)
+        triangles.push_back(std::rand() % nbVertices);
+    return Mesh(vertices, triangles, std::vector<int>(), true, hasTextureCoords);
+}
+
+// -----------------------------------------------------------------------------
+
+static void checkSame(Mesh& a, Mesh& b)
+{
+    std::vector<float> va, vb;
+    std::vector<int> ta, tb;
+    bool pa, pb;
+    a.getData(va, ta, pa);
+    b.getData(vb, tb, pb);
+    CHECK(a.nbVertices() == b.nbVertices());
+    CHECK(a.nbTriangles() == b.nbTriangles());
+    CHECK(ta == tb);
+    if (!CHECK(va.size() == vb.size()))
+        return;
+    int mismatches = 0;
+    for (std::size_t i = 0; i < va.size(); ++i)
+        mismatches += Tests::near(va[i], vb[i], 1e-4f) ? 0 : 1;
+    CHECK(mismatches == 0);
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    std::srand(11);
+    for (int t = 0; t < 2; ++t) {
+        const bool hasTextureCoords = (t == 0);
+        Mesh interleaved = makeMesh(1001, 3000, hasTextureCoords);
+        Mesh streams = interleaved;
+        streams.setVertexLayout(Mesh::SEPARATE_STREAMS);
+        CHECK(streams.vertexLayout() == Mesh::SEPARATE_STREAMS);
+        checkSame(interleaved, streams);
+
+        glm::vec3 min0, max0, min1, max1, c0, c1;
+        float r0, r1;
+        interleaved.boundingBox(min0, max0);
+        streams.boundingBox(min1, max1);
+        CHECK(min0 == min1 && max0 == max1);
+        interleaved.boundingSphere(c0, r0);
+        streams.boundingSphere(c1, r1);
+        CHECK(c0 == c1 && r0 == r1);
+
+        interleaved.computeNormals(Mesh::ANGLE_WEIGHTS);
+        streams.computeNormals(Mesh::ANGLE_WEIGHTS);
+        checkSame(interleaved, streams);
+
+        glm::mat4 m = glm::rotate(glm::translate(glm::mat4(1.f), glm::vec3(1.f, 2.f, 3.f)), 0.5f, glm::vec3(0.f, 1.f, 0.f));
+        m = glm::scale(m, glm::vec3(2.f, 1.f, 0.5f));
+        interleaved.transform(m);
+        streams.transform(m);
+        checkSame(interleaved, streams);
+
+        Ray ray;
+        ray.origin = c0 + glm::vec3(0.f, 0.f, 50.f);
+        ray.direction = glm::vec3(0.f, 0.f, -1.f);
+        RayHit h0, h1;
+        CHECK(interleaved.intersect(ray, h0) == streams.intersect(ray, h1));
+        CHECK(h0.triangle >= 0 && h0.triangle == h1.triangle);
+
+        // concatenation of both layouts, then back to interleaved
+        Mesh other = makeMesh(37, 50, hasTextureCoords);
+        Mesh otherStreams = other;
+        otherStreams.setVertexLayout(Mesh::SEPARATE_STREAMS);
+        interleaved += otherStreams;
+        streams += other;
+        checkSame(interleaved, streams);
+        streams.setVertexLayout(Mesh::INTERLEAVED);
+        checkSame(interleaved, streams);
+    }
+
+    // an empty mesh appends nothing to non empty buffers, in both layouts
+    for (int t = 0; t < 2; ++t) {
+        Mesh empty(std::vector<float>(), std::vector<int>(), std::vector<int>(),
+                   true, true);
+        if (t == 1)
+            empty.setVertexLayout(Mesh::SEPARATE_STREAMS);
+        std::vector<float> vertices(8, 1.f);
+        std::vector<int> triangles(3, 0);
+        bool parametrized;
+        empty.getData(vertices, triangles, parametrized);
+        CHECK(vertices.size() == 8 && triangles.size() == 3);
+    }
+    return Tests::testFailures();
+}
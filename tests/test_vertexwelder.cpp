@@ -0,0 +1,167 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#include "testing.h"
+
+#include "fileloaders/mesh.h"
+#include "fileloaders/objloader.h"
+#include "fileloaders/vertexwelder.h"
+
+#include <QString>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <tuple>
+#include <vector>
+
+// Checks the index triple welding of the OBJ loader: smoothing groups are
+// welded, "s off" faces are added as is, both must describe the same
+// triangles corner by corner.
+
+using namespace Loaders;
+
+// -----------------------------------------------------------------------------
+
+/// VertexWelder numbers triples like a std::map in order of first insertion
+static void testWelderNumbering()
+{
+    Obj_mtl::VertexWelder welder(4); // small hint: the table has to grow
+    std::map<std::tuple<int, int, int>, int> reference;
+    std::srand(7);
+    for (int i = 0; i < 20000; ++i) {
+        int v = std::rand() % 3000, t = std::rand() % 3 - 1, n = std::rand() % 2;
+        bool inserted;
+        int index = welder.weld(v, t, n, inserted);
+        std::tuple<int, int, int> key(v, t, n);
+        std::map<std::tuple<int, int, int>, int>::iterator it = reference.find(key);
+        if (it == reference.end()) {
+            CHECK(inserted);
+            CHECK(index == int(reference.size()));
+            reference[key] = index;
+        }
+        else {
+            CHECK(!inserted);
+            CHECK(index == it->second);
+        }
+    }
+    CHECK(welder.size() == int(reference.size()));
+}
+
+// -----------------------------------------------------------------------------
+
+/// Grid of quads sharing their corners, "format" is "vtn", "vn" or "v"
+static std::string makeObj(int n, const std::string& format, const char* smoothing)
+{
+    std::ostringstream obj;
+    for (int j = 0; j <= n; ++j) {
+        for (int i = 0; i <= n; ++i) {
+            obj << "v " << i << " " << j << " " << (i + j) % 3 << "\n";
+            obj << "vt " << float(i) / n << " " << float(j) / n << "\n";
+            obj << "vn 0 " << float(i) / n << " 1\n";
+        }
+    }
+    obj << "g grid\ns " << smoothing << "\n";
+    for (int j = 0; j < n; ++j) {
+        for (int i = 0; i < n; ++i) {
+            int c[4] = { j * (n + 1) + i + 1, j * (n + 1) + i + 2, (j + 1) * (n + 1) + i + 2, (j + 1) * (n + 1) + i + 1 };
+            // one triangle out of two cells to mix both buffers
+            int nbCorners = ((i + j) % 2) ? 3 : 4;
+            obj << "f";
+            for (int k = 0; k < nbCorners; ++k) {
+                if (format == "vtn")
+                    obj << " " << c[k] << "/" << c[k] << "/" << c[k];
+                else if (format == "vn")
+                    obj << " " << c[k] << "//" << c[k];
+                else
+                    obj << " " << c[k];
+            }
+            obj << "\n";
+        }
+    }
+    return obj.str();
+}
+
+// -----------------------------------------------------------------------------
+
+static Mesh* load(const std::string& content, const char* name)
+{
+    std::string path = Tests::writeTestFile(name, content);
+    Obj_mtl::ObjLoader loader;
+    loader.setUseMeshCache(false);
+    QString reason;
+    if (!CHECK(loader.load(QString(path.c_str()), reason)))
+        return 0;
+    std::vector<Mesh*> meshes;
+    loader.getObjects(meshes);
+    if (!CHECK(meshes.size() == 1))
+        return 0;
+    return meshes[0];
+}
+
+// -----------------------------------------------------------------------------
+
+/// Compare the corners of each triangle, on the first "nbFloats" attributes
+static void checkSameCorners(Mesh* welded, Mesh* raw, int nbFloats)
+{
+    std::vector<float> v0, v1;
+    std::vector<int> t0, t1;
+    bool p0, p1;
+    welded->getData(v0, t0, p0);
+    raw->getData(v1, t1, p1);
+    CHECK(p0 == p1);
+    if (!CHECK(t0.size() == t1.size()))
+        return;
+    int mismatches = 0;
+    for (std::size_t i = 0; i < t0.size(); ++i)
+        for (int k = 0; k < nbFloats; ++k)
+            mismatches += (v0[8 * t0[i] + k] != v1[8 * t1[i] + k]) ? 1 : 0;
+    CHECK(mismatches == 0);
+}
+
+// -----------------------------------------------------------------------------
+
+static void testWeldedMatchesRaw()
+{
+    const int n = 40;
+    const int nbTriangles = (n * n + 1) / 2;   // odd cells
+    const int nbQuads = n * n / 2;             // even cells
+    const char* formats[] = { "vtn", "vn", "v" };
+    for (int f = 0; f < 3; ++f) {
+        Mesh* welded = load(makeObj(n, formats[f], "1"), "test_welder_smooth.obj");
+        Mesh* raw = load(makeObj(n, formats[f], "off"), "test_welder_raw.obj");
+        if (welded && raw) {
+            // one vertex per grid point used against one per face corner.
+            // Only the corner (0, n) is left out, by the triangle of its cell
+            CHECK(welded->nbVertices() == (n + 1) * (n + 1) - 1);
+            CHECK(raw->nbVertices() == 3 * nbTriangles + 4 * nbQuads);
+            CHECK(welded->nbTriangles() == raw->nbTriangles());
+            // without normals in the file, they are computed: smooth when
+            // welded and flat otherwise, only positions and uvs compare
+            checkSameCorners(welded, raw, formats[f] == std::string("v") ? 3 : 8);
+        }
+        delete welded;
+        delete raw;
+    }
+}
+
+// -----------------------------------------------------------------------------
+
+int main()
+{
+    testWelderNumbering();
+    testWeldedMatchesRaw();
+    return Tests::testFailures();
+}
@@ -0,0 +1,75 @@
+/***************************************************************************
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.             *
+ ***************************************************************************/
+#ifndef TESTING_H
+#define TESTING_H
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+
+/**
+ * @defgroup Tests Tests
+ * CPU only test executables, run by ctest.
+ * Each test is a main() calling #CHECK and returning #testFailures():
+ * a failed check prints its file, line and expression and the test goes on.
+ */
+
+namespace Tests {
+
+/// @ingroup Tests
+/// Number of failed #CHECK so far
+inline int& testFailures()
+{
+    static int failures = 0;
+    return failures;
+}
+
+/// @ingroup Tests
+inline bool check(bool ok, const char* expression, const char* file, int line)
+{
+    if (!ok) {
+        std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", file, line, expression);
+        ++testFailures();
+    }
+    return ok;
+}
+
+/// @ingroup Tests
+/// @return true when |a - b| <= eps
+inline bool near(float a, float b, float eps = 1e-5f)
+{
+    return std::fabs(a - b) <= eps;
+}
+
+/// @ingroup Tests
+/// Write "content" in a file of the test directory and return its path.
+inline std::string writeTestFile(const std::string& name, const std::string& content)
+{
+    std::string path = name;
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (file) {
+        std::fwrite(content.data(), 1, content.size(), file);
+        std::fclose(file);
+    }
+    return path;
+}
+
+} // END namespace tests =======================================================
+
+#define CHECK(expression) Tests::check((expression), #expression, __FILE__, __LINE__)
+
+#endif // TESTING_H